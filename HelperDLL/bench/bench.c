@@ -0,0 +1,700 @@
+/**
+* A command line benchmark for the helper DLL, so render times can be measured (and compared between builds) without Unreal.
+* It builds the DLL's sources straight in, see the Makefile next to this.
+*
+* For every document it times:
+*   - `Pdf_create`
+*   - every page (or pair of pages) through each of the exports asked for, at each of the sizes asked for
+*   - the same pages taken apart into MuPDF's phases: loading the page, running it into a display list, drawing it,
+*     converting RGB to BGRA and copying it into a texture sized buffer, to see where the time actually goes
+* and prints it all as JSON, with pages per second, p50/p99 latencies and the peak resident memory.
+*
+* Usage:
+*   bench [options] file...
+*     --size WxH      render at this size (can be given more than once, default 1024x1024)
+*     --layout NAME   single, spread, rgb, gray or bands (can be given more than once, default single and spread)
+*     --budget MS     how long each `Pdf_continueRender` call of the bands layout may take (default 2), the calls that
+*                     draw rows are timed as well, to see how well they keep to it
+*     --repeat N      go through every document N times per size and layout (default 1)
+*     --max-pages N   only do the first N pages of each document
+*     --warm          leave the page and display list caches on, by default they're off so every render is a full one
+*     --workers N     number of background render threads (default: one less than the number of cores)
+*     --no-phases     skip the phase breakdown
+*     --encode FORMAT bc1 or bc7, also time compressing every single page or spread with `Pdf_encodeBlocks`, and say
+*                     how far the result is from the original (as PSNR, in dB)
+*     --atlas WxH     also time rendering every page as a WxH thumbnail into one atlas with a single `Pdf_renderAtlasBGRA`
+*     --out FILE      write the JSON here instead of to stdout
+*/
+
+#include "mupdf2rgb.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+#ifdef _WIN32
+    #include <psapi.h>
+    #ifdef _MSC_VER
+        #pragma comment( lib, "psapi" )
+    #endif
+#else
+    #include <sys/resource.h>
+#endif
+
+#define MAX_SIZES   16
+#define MAX_LAYOUTS 5
+
+// the exports, the DLL doesn't have a public header of its own
+int Pdf_create(Pdf **newPdf, const char *filePath);
+int Pdf_destroy(Pdf *pdf);
+int Pdf_getPageRGB(Pdf *pdf, int pageNumber, int *width, int *height, unsigned char *outBuffer);
+int Pdf_getPageFittedBGRA(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer);
+int Pdf_get2PagesFittedBGRA(Pdf *pdf, int startPageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer);
+int Pdf_getPageFittedPixels(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride);
+int Pdf_setCacheBudget(Pdf *pdf, size_t budgetBytes);
+int Pdf_setDisplayListCacheSize(Pdf *pdf, int pages);
+int Pdf_setWorkerCount(int count);
+int Pdf_encodeBlocks(int format, const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride);
+int Pdf_renderAtlasBGRA(Pdf *pdf, PdfAtlasPage *pages, int pageCount, unsigned char *atlas, int atlasStride, int atlasHeight);
+int Pdf_beginRender(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, unsigned char *outBuffer, int outStride, PdfRenderJob **newJob);
+int Pdf_continueRender(PdfRenderJob *job, int budgetMicroseconds, PdfRenderProgress *progress);
+int Pdf_endRender(PdfRenderJob *job);
+
+typedef enum Layout
+{
+    LAYOUT_SINGLE,  // Pdf_getPageFittedBGRA
+    LAYOUT_SPREAD,  // Pdf_get2PagesFittedBGRA
+    LAYOUT_RGB,     // Pdf_getPageRGB, which ignores the size
+    LAYOUT_GRAY,    // Pdf_getPageFittedPixels as gray, a byte per pixel
+    LAYOUT_BANDS,   // Pdf_beginRender, then Pdf_continueRender until it's done, like a frame loop would
+} Layout;
+
+static const char *layoutNames[MAX_LAYOUTS] = { "single", "spread", "rgb", "gray", "bands" };
+static const char *encodeNames[2]           = { "bc1", "bc7" };
+
+typedef struct Options
+{
+    int         widths[MAX_SIZES];
+    int         heights[MAX_SIZES];
+    int         sizeCount;
+    Layout      layouts[MAX_LAYOUTS];
+    int         layoutCount;
+    int         repeat;
+    int         maxPages;
+    int         workers;
+    int         encode;  // a BlockFormat, or -1 for none
+    int         budget;  // microseconds per Pdf_continueRender
+    int         atlasWidth;  // thumbnail size for the atlas run, 0 for none
+    int         atlasHeight;
+    bool        warm;
+    bool        phases;
+    const char *outPath;
+} Options;
+
+/**
+* A growing list of durations, in milliseconds.
+*/
+typedef struct Samples
+{
+    double *values;
+    int     count;
+    int     capacity;
+    double  total;
+} Samples;
+
+static double now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return counter.QuadPart * 1000.0 / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+#endif
+}
+
+// gives up the rest of a millisecond or so, like a frame loop would until its next frame
+static void waitABit(void)
+{
+#ifdef _WIN32
+    Sleep(1);
+#else
+    struct timespec time = { 0, 1000000 };
+    nanosleep(&time, NULL);
+#endif
+}
+
+static long peakResidentKilobytes(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss;  // already in KB on Linux
+#endif
+}
+
+static void Samples_add(Samples *samples, double value)
+{
+    if (samples->count == samples->capacity)
+    {
+        int     capacity = samples->capacity ? samples->capacity * 2 : 256;
+        double *values   = (double*)realloc(samples->values, capacity * sizeof(double));
+        if (!values)
+            return;
+        samples->values   = values;
+        samples->capacity = capacity;
+    }
+    samples->values[samples->count++] = value;
+    samples->total += value;
+}
+
+static void Samples_free(Samples *samples)
+{
+    free(samples->values);
+    memset(samples, 0, sizeof(Samples));
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double left  = *(const double*)a;
+    double right = *(const double*)b;
+    return (left > right) - (left < right);
+}
+
+// nearest rank, on a sorted list
+static double percentile(const Samples *samples, double fraction)
+{
+    int rank;
+    if (samples->count == 0)
+        return 0;
+    rank = (int)(fraction * samples->count + 0.999999) - 1;
+    return samples->values[max(0, min(samples->count - 1, rank))];
+}
+
+static void printSamples(FILE *out, const char *name, Samples *samples)
+{
+    qsort(samples->values, samples->count, sizeof(double), compareDoubles);
+    fprintf(out, "\"%s\": {\"count\": %d, \"total_ms\": %.3f, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+            name, samples->count, samples->total, samples->count ? samples->total / samples->count : 0.0,
+            percentile(samples, 0.50), percentile(samples, 0.99), samples->count ? samples->values[samples->count - 1] : 0.0);
+}
+
+static void printString(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for (; *text; text++)
+    {
+        if (*text == '"' || *text == '\\')
+            fprintf(out, "\\%c", *text);
+        else if ((unsigned char)*text < 0x20)
+            fprintf(out, "\\u%04x", *text);
+        else
+            fputc(*text, out);
+    }
+    fputc('"', out);
+}
+
+/**
+* Compresses the top left `width x height` of a rendered page, and adds how long it took and how far off it came out.
+*/
+static void encodePage(BlockFormat format, const unsigned char *pixels, int width, int height, int stride, Samples *timing, double *squaredError, long long *channels)
+{
+    size_t         blockRowBytes = (size_t)(width + 3) / 4 * BlockFormat_bytes(format);
+    unsigned char *blocks        = (unsigned char*)malloc(blockRowBytes * ((height + 3) / 4));
+    unsigned char *decoded       = (unsigned char*)malloc((size_t)width * height * 4);
+    double         before;
+    int            x, y, channel;
+
+    if (blocks && decoded && width > 0 && height > 0)
+    {
+        before = now();
+        Pdf_encodeBlocks(format, pixels, width, height, stride, blocks, (int)blockRowBytes);
+        Samples_add(timing, now() - before);
+
+        Encode_decode(format, blocks, (int)blockRowBytes, decoded, width, height, width * 4);
+        for (y = 0; y < height; y++)
+        {
+            for (x = 0; x < width; x++)
+            {
+                for (channel = 0; channel < 3; channel++)
+                {
+                    double difference = pixels[(size_t)y * stride + x * 4 + channel] - decoded[((size_t)y * width + x) * 4 + channel];
+                    *squaredError += difference * difference;
+                }
+            }
+        }
+        *channels += (long long)width * height * 3;
+    }
+
+    free(blocks);
+    free(decoded);
+}
+
+/**
+* Renders every page (or pair) of an already open document through one of the exports, timing each call.
+*/
+static void benchmarkLayout(FILE *out, Pdf *pdf, int pageCount, const Options *options, Layout layout, int width, int height, unsigned char *buffer)
+{
+    Samples   latency      = { 0 };
+    Samples   encoding     = { 0 };
+    Samples   calls        = { 0 };
+    double    squaredError = 0;
+    long long channels     = 0;
+    int       step         = (layout == LAYOUT_SPREAD) ? 2 : 1;
+    int       rendered     = 0;
+    int       failed       = 0;
+    double    started      = now();
+    int       pass, page;
+
+    for (pass = 0; pass < options->repeat; pass++)
+    {
+        for (page = 0; page + step <= pageCount; page += step)
+        {
+            double before = now();
+            int    ok;
+            int    resultingWidth, resultingHeight;
+
+            if (layout == LAYOUT_SINGLE)
+            {
+                ok = Pdf_getPageFittedBGRA(pdf, page, width, height, &resultingWidth, &resultingHeight, buffer);
+            }
+            else if (layout == LAYOUT_SPREAD)
+            {
+                ok = Pdf_get2PagesFittedBGRA(pdf, page, width, height, &resultingWidth, &resultingHeight, buffer);
+            }
+            else if (layout == LAYOUT_GRAY)
+            {
+                ok = Pdf_getPageFittedPixels(pdf, page, 1, PIXEL_FORMAT_GRAY, width, height, &resultingWidth, &resultingHeight, buffer, width);
+            }
+            else if (layout == LAYOUT_BANDS)
+            {
+                PdfRenderJob     *job = NULL;
+                PdfRenderProgress progress;
+
+                memset(&progress, 0, sizeof(progress));
+                ok = Pdf_beginRender(pdf, page, 1, PIXEL_FORMAT_BGRA, width, height, buffer, width * 4, &job);
+                while (ok && !progress.done)
+                {
+                    double call = now();
+                    ok = Pdf_continueRender(job, options->budget, &progress);
+                    // only the calls that drew something say how well it keeps to the budget, the ones before the
+                    // page is loaded (on a worker) return straight away, and spinning on them would slow the worker down
+                    if (progress.rowsDone > progress.firstRow)
+                        Samples_add(&calls, now() - call);
+                    else if (ok && !progress.done)
+                        waitABit();
+                }
+                Pdf_endRender(job);
+                resultingWidth  = progress.resultingWidth;
+                resultingHeight = progress.resultingHeight;
+            }
+            else
+            {
+                // asks for the size first, then for the pixels, just like a caller has to
+                unsigned char *pixels = NULL;
+                ok = Pdf_getPageRGB(pdf, page, &resultingWidth, &resultingHeight, NULL);
+                if (ok)
+                {
+                    pixels = (unsigned char*)malloc((size_t)resultingWidth * resultingHeight * 3);
+                    ok     = pixels && Pdf_getPageRGB(pdf, page, NULL, NULL, pixels);
+                }
+                free(pixels);
+            }
+
+            Samples_add(&latency, now() - before);
+            if (ok && options->encode >= 0 && layout != LAYOUT_RGB && layout != LAYOUT_GRAY)
+                encodePage((BlockFormat)options->encode, buffer, resultingWidth, resultingHeight, width * 4, &encoding, &squaredError, &channels);
+            if (ok) rendered += step;
+            else    failed++;
+        }
+    }
+
+    {
+        double seconds = (now() - started) / 1000.0;
+        fprintf(out, "        {\"layout\": \"%s\", \"width\": %d, \"height\": %d, \"pages\": %d, \"failed\": %d, \"seconds\": %.3f, \"pages_per_sec\": %.2f, ",
+                layoutNames[layout], width, height, rendered, failed, seconds, seconds > 0 ? rendered / seconds : 0.0);
+        printSamples(out, "latency", &latency);
+        if (calls.count > 0)
+        {
+            fprintf(out, ", \"budget_ms\": %.3f, ", options->budget / 1000.0);
+            printSamples(out, "calls", &calls);
+        }
+        if (encoding.count > 0)
+        {
+            double meanError = squaredError / max(1, channels);
+            fprintf(out, ", \"encoding\": \"%s\", ", encodeNames[options->encode]);
+            printSamples(out, "encode", &encoding);
+            fprintf(out, ", \"psnr_db\": %.2f", meanError > 0 ? 10 * log10(255.0 * 255.0 / meanError) : 99.0);
+        }
+        fprintf(out, "}");
+    }
+
+    Samples_free(&latency);
+    Samples_free(&encoding);
+    Samples_free(&calls);
+}
+
+/**
+* Renders all the pages as thumbnails into one roughly square atlas, in a single call, `repeat` times.
+*/
+static void benchmarkAtlas(FILE *out, Pdf *pdf, int pageCount, const Options *options)
+{
+    Samples        latency = { 0 };
+    PdfAtlasPage  *pages   = (PdfAtlasPage*)calloc(max(1, pageCount), sizeof(PdfAtlasPage));
+    int            columns = max(1, (int)ceil(sqrt((double)pageCount)));
+    int            rows    = (pageCount + columns - 1) / columns;
+    int            stride  = columns * options->atlasWidth * 4;
+    unsigned char *atlas   = (unsigned char*)malloc((size_t)stride * max(1, rows) * options->atlasHeight);
+    int            failed  = 0;
+    int            pass, page;
+
+    for (pass = 0; pages && atlas && pageCount > 0 && pass < options->repeat; pass++)
+    {
+        double before;
+
+        for (page = 0; page < pageCount; page++)
+        {
+            pages[page].pageNumber = page;
+            pages[page].x          = (page % columns) * options->atlasWidth;
+            pages[page].y          = (page / columns) * options->atlasHeight;
+            pages[page].width      = options->atlasWidth;
+            pages[page].height     = options->atlasHeight;
+        }
+
+        before = now();
+        Pdf_renderAtlasBGRA(pdf, pages, pageCount, atlas, stride, rows * options->atlasHeight);
+        Samples_add(&latency, now() - before);
+
+        for (page = 0; page < pageCount; page++)
+            if (!pages[page].success)
+                failed++;
+    }
+
+    {
+        double seconds = latency.total / 1000.0;
+        int    rendered = pageCount * latency.count - failed;
+        fprintf(out, "        {\"layout\": \"atlas\", \"width\": %d, \"height\": %d, \"pages\": %d, \"failed\": %d, \"seconds\": %.3f, \"pages_per_sec\": %.2f, ",
+                options->atlasWidth, options->atlasHeight, rendered, failed, seconds, seconds > 0 ? rendered / seconds : 0.0);
+        printSamples(out, "latency", &latency);
+        fprintf(out, "}");
+    }
+
+    Samples_free(&latency);
+    free(pages);
+    free(atlas);
+}
+
+/**
+* Does by hand what the DLL does for one page, with a timer around each step.
+* This goes through an RGB pixmap and a conversion like the DLL used to, so `convert` and `copy` show what drawing straight
+* into the caller's buffer saves.
+*/
+static void benchmarkPhases(FILE *out, fz_context *ctx, fz_document *document, int pageCount, const Options *options, int width, int height, unsigned char *buffer)
+{
+    Samples        load = { 0 }, run = { 0 }, draw = { 0 }, convert = { 0 }, copy = { 0 };
+    unsigned char *bgra = (unsigned char*)malloc((size_t)width * height * 4);
+    int            pass, page;
+
+    for (pass = 0; bgra && pass < options->repeat; pass++)
+    {
+        for (page = 0; page < pageCount; page++)
+        {
+            fz_page         *fzPage = NULL;
+            fz_display_list *list   = NULL;
+            fz_pixmap       *pixmap = NULL;
+            double           before;
+
+            fz_var(fzPage);
+            fz_var(list);
+            fz_var(pixmap);
+
+            fz_try(ctx)
+            {
+                fz_rect   bbox;
+                fz_matrix viewMatrix;
+                float     zoom;
+                int       w, h, y;
+
+                before = now();
+                fzPage = fz_load_page(ctx, document, page);
+                Samples_add(&load, now() - before);
+
+                before = now();
+                list = fz_new_display_list_from_page(ctx, fzPage);
+                Samples_add(&run, now() - before);
+
+                // same fitting as the DLL's `fitPage`
+                bbox = fz_bound_display_list(ctx, list);
+                zoom = width / (bbox.x1 - bbox.x0);
+                if ((bbox.y1 - bbox.y0) * zoom > height)
+                    zoom = height / (bbox.y1 - bbox.y0);
+                viewMatrix = fz_scale(zoom, zoom);
+
+                before = now();
+                pixmap = fz_new_pixmap_from_display_list(ctx, list, viewMatrix, fz_device_rgb(ctx), 0);
+                Samples_add(&draw, now() - before);
+
+                w = min(pixmap->w, width);
+                h = min(pixmap->h, height);
+
+                before = now();
+                Convert_pixels(PIXEL_FORMAT_RGB, pixmap->samples, (int)pixmap->stride, PIXEL_FORMAT_BGRA, bgra, w * 4, w, h);
+                Samples_add(&convert, now() - before);
+
+                before = now();
+                for (y = 0; y < h; y++)
+                    memcpy(buffer + (size_t)y * width * 4, bgra + (size_t)y * w * 4, (size_t)w * 4);
+                Samples_add(&copy, now() - before);
+            }
+            fz_always(ctx)
+            {
+                fz_drop_pixmap(ctx, pixmap);
+                fz_drop_display_list(ctx, list);
+                fz_drop_page(ctx, fzPage);
+            }
+            fz_catch(ctx)
+            {
+                // a broken page just doesn't count
+            }
+        }
+    }
+
+    fprintf(out, "        {\"width\": %d, \"height\": %d, ", width, height);
+    printSamples(out, "load_page", &load);    fprintf(out, ", ");
+    printSamples(out, "run_page", &run);      fprintf(out, ", ");
+    printSamples(out, "draw", &draw);         fprintf(out, ", ");
+    printSamples(out, "convert", &convert);   fprintf(out, ", ");
+    printSamples(out, "copy", &copy);
+    fprintf(out, "}");
+
+    Samples_free(&load); Samples_free(&run); Samples_free(&draw); Samples_free(&convert); Samples_free(&copy);
+    free(bgra);
+}
+
+static void benchmarkDocument(FILE *out, const char *path, const Options *options, unsigned char *buffer)
+{
+    Pdf    *pdf = NULL;
+    double  before;
+    double  openTime;
+    int     pageCount;
+    int     sizeIndex, layoutIndex;
+    bool    first = true;
+
+    before = now();
+    if (!Pdf_create(&pdf, path))
+    {
+        fprintf(out, "    {\"file\": ");
+        printString(out, path);
+        fprintf(out, ", \"error\": \"could not open\"}");
+        return;
+    }
+    openTime = now() - before;
+
+    if (!options->warm)
+    {
+        Pdf_setCacheBudget(pdf, 0);
+        Pdf_setDisplayListCacheSize(pdf, 0);
+    }
+
+    pageCount = pdf->pageCount;
+    if (options->maxPages > 0)
+        pageCount = min(pageCount, options->maxPages);
+
+    fprintf(out, "    {\"file\": ");
+    printString(out, path);
+    fprintf(out, ", \"pages\": %d, \"open_ms\": %.3f,\n      \"runs\": [\n", pdf->pageCount, openTime);
+
+    for (sizeIndex = 0; sizeIndex < options->sizeCount; sizeIndex++)
+    {
+        for (layoutIndex = 0; layoutIndex < options->layoutCount; layoutIndex++)
+        {
+            // the RGB export doesn't care about the size, so only do it once
+            if (options->layouts[layoutIndex] == LAYOUT_RGB && sizeIndex > 0)
+                continue;
+
+            if (!first) fprintf(out, ",\n");
+            first = false;
+            benchmarkLayout(out, pdf, pageCount, options, options->layouts[layoutIndex], options->widths[sizeIndex], options->heights[sizeIndex], buffer);
+        }
+    }
+    if (options->atlasWidth > 0)
+    {
+        if (!first) fprintf(out, ",\n");
+        benchmarkAtlas(out, pdf, pageCount, options);
+    }
+    fprintf(out, "\n      ]");
+
+    Pdf_destroy(pdf);
+
+    if (options->phases)
+    {
+        fz_context  *ctx      = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+        fz_document *document = NULL;
+
+        fz_var(document);
+
+        if (ctx)
+        {
+            fz_try(ctx)
+            {
+                fz_register_document_handlers(ctx);
+                document = fz_open_document(ctx, path);
+
+                fprintf(out, ",\n      \"phases\": [\n");
+                for (sizeIndex = 0; sizeIndex < options->sizeCount; sizeIndex++)
+                {
+                    if (sizeIndex > 0) fprintf(out, ",\n");
+                    benchmarkPhases(out, ctx, document, pageCount, options, options->widths[sizeIndex], options->heights[sizeIndex], buffer);
+                }
+                fprintf(out, "\n      ]");
+            }
+            fz_always(ctx)
+            {
+                fz_drop_document(ctx, document);
+            }
+            fz_catch(ctx)
+            {
+            }
+            fz_drop_context(ctx);
+        }
+    }
+
+    fprintf(out, "}");
+}
+
+static bool parseOptions(int argc, char **argv, Options *options, int *firstFile)
+{
+    int index;
+
+    memset(options, 0, sizeof(Options));
+    options->repeat = 1;
+    options->phases = true;
+    options->encode = -1;
+    options->budget = 2000;
+
+    for (index = 1; index < argc && argv[index][0] == '-'; index++)
+    {
+        const char *option = argv[index];
+        const char *value  = (index + 1 < argc) ? argv[index + 1] : NULL;
+
+        if (!strcmp(option, "--warm"))      { options->warm = true; continue; }
+        if (!strcmp(option, "--no-phases")) { options->phases = false; continue; }
+        if (!value)
+            return false;
+        index++;
+
+        if (!strcmp(option, "--size"))
+        {
+            if (options->sizeCount == MAX_SIZES || sscanf(value, "%dx%d", &options->widths[options->sizeCount], &options->heights[options->sizeCount]) != 2)
+                return false;
+            if (options->widths[options->sizeCount] <= 0 || options->heights[options->sizeCount] <= 0)
+                return false;
+            options->sizeCount++;
+        }
+        else if (!strcmp(option, "--layout"))
+        {
+            int layout;
+            for (layout = 0; layout < MAX_LAYOUTS; layout++)
+                if (!strcmp(value, layoutNames[layout]))
+                    break;
+            if (layout == MAX_LAYOUTS || options->layoutCount == MAX_LAYOUTS)
+                return false;
+            options->layouts[options->layoutCount++] = (Layout)layout;
+        }
+        else if (!strcmp(option, "--repeat"))    options->repeat   = max(1, atoi(value));
+        else if (!strcmp(option, "--max-pages")) options->maxPages = atoi(value);
+        else if (!strcmp(option, "--workers"))   options->workers  = atoi(value);
+        else if (!strcmp(option, "--out"))       options->outPath  = value;
+        else if (!strcmp(option, "--budget"))    options->budget   = max(0, (int)(atof(value) * 1000));
+        else if (!strcmp(option, "--atlas"))
+        {
+            if (sscanf(value, "%dx%d", &options->atlasWidth, &options->atlasHeight) != 2 || options->atlasWidth <= 0 || options->atlasHeight <= 0)
+                return false;
+        }
+        else if (!strcmp(option, "--encode"))
+        {
+            if      (!strcmp(value, encodeNames[BLOCK_FORMAT_BC1])) options->encode = BLOCK_FORMAT_BC1;
+            else if (!strcmp(value, encodeNames[BLOCK_FORMAT_BC7])) options->encode = BLOCK_FORMAT_BC7;
+            else return false;
+        }
+        else return false;
+    }
+
+    if (options->sizeCount == 0)
+    {
+        options->widths[0]  = 1024;
+        options->heights[0] = 1024;
+        options->sizeCount  = 1;
+    }
+    if (options->layoutCount == 0)
+    {
+        options->layouts[0]  = LAYOUT_SINGLE;
+        options->layouts[1]  = LAYOUT_SPREAD;
+        options->layoutCount = 2;
+    }
+
+    *firstFile = index;
+    return index < argc;
+}
+
+int main(int argc, char **argv)
+{
+    Options        options;
+    FILE          *out    = stdout;
+    unsigned char *buffer = NULL;
+    int            firstFile;
+    int            maxWidth  = 0;
+    int            maxHeight = 0;
+    int            index;
+
+    if (!parseOptions(argc, argv, &options, &firstFile))
+    {
+        fprintf(stderr, "usage: %s [--size WxH]... [--layout single|spread|rgb|gray|bands]... [--budget MS] [--repeat N] [--max-pages N] [--warm] [--workers N] [--no-phases] [--encode bc1|bc7] [--atlas WxH] [--out FILE] file...\n", argv[0]);
+        return 1;
+    }
+
+    if (options.outPath && !(out = fopen(options.outPath, "w")))
+    {
+        fprintf(stderr, "could not write to %s\n", options.outPath);
+        return 1;
+    }
+
+    if (options.workers > 0)
+        Pdf_setWorkerCount(options.workers);
+
+    for (index = 0; index < options.sizeCount; index++)
+    {
+        maxWidth  = max(maxWidth, options.widths[index]);
+        maxHeight = max(maxHeight, options.heights[index]);
+    }
+    buffer = (unsigned char*)malloc((size_t)maxWidth * maxHeight * 4);
+    if (!buffer)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"mupdf\": \"%s\", \"convert\": \"%s\", \"cache\": \"%s\", \"repeat\": %d,\n  \"documents\": [\n",
+            FZ_VERSION, Convert_best()->name, options.warm ? "warm" : "cold", options.repeat);
+    for (index = firstFile; index < argc; index++)
+    {
+        if (index > firstFile) fprintf(out, ",\n");
+        benchmarkDocument(out, argv[index], &options, buffer);
+    }
+    fprintf(out, "\n  ],\n  \"peak_rss_kb\": %ld\n}\n", peakResidentKilobytes());
+
+    free(buffer);
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
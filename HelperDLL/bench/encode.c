@@ -0,0 +1,178 @@
+/**
+* Checks that pages survive the trip through `Encode_blocks` and back out of `Encode_decode`, for BC1 and BC7, so the
+* encoder can be tested on the CPU alone. It builds the DLL's sources straight in, see the Makefile next to this.
+*
+* Every image is one of:
+*   - flat: one colour all over, which has to come back exactly when it's white or black, and close otherwise
+*   - text: black on white, which has to come back exactly, it's what most pages are
+*   - gradient: colours along a line, which only has to come back roughly
+* at widths and heights that aren't multiples of 4 (and a few that are), with and without padding at the end of each
+* row of pixels and of blocks. The padding after each row of blocks, and guard bytes after the last one, mustn't change.
+* The whole lot is done twice, on the calling thread only, and again with the background threads running, to cover the
+* rows of blocks being shared out.
+*
+* Usage:
+*   encode
+*
+* Exits with 1 if anything failed, so it can go in a script.
+*/
+
+#include "mupdf2rgb.h"
+
+#include <stdio.h>
+
+#define GUARD_BYTES 32
+#define GUARD_BYTE  0xA5
+
+typedef enum Kind
+{
+    KIND_WHITE,
+    KIND_BLACK,
+    KIND_FLAT,
+    KIND_TEXT,
+    KIND_GRADIENT,
+    KIND_COUNT
+} Kind;
+
+static const char *kindNames[KIND_COUNT]   = { "white", "black", "flat", "text", "gradient" };
+static const char *formatNames[2]          = { "bc1", "bc7" };
+
+// how far off each channel may come back, by kind, for BC1 and BC7
+static const int tolerances[KIND_COUNT][2] = { { 0, 0 }, { 0, 0 }, { 8, 4 }, { 0, 0 }, { 48, 16 } };
+
+static const int widths[]  = { 1, 2, 3, 4, 5, 7, 8, 13, 33, 203 };
+static const int heights[] = { 1, 3, 4, 6, 17, 141 };
+
+// the BGRA of pixel `x,y` of a `width x height` image of `kind`
+static void makePixel(Kind kind, int x, int y, int width, int height, unsigned char *out)
+{
+    int value;
+
+    switch (kind)
+    {
+    case KIND_WHITE: out[0] = out[1] = out[2] = 255; break;
+    case KIND_BLACK: out[0] = out[1] = out[2] = 0;   break;
+    case KIND_FLAT:  out[0] = 40; out[1] = 120; out[2] = 200; break;
+    case KIND_TEXT:
+        out[0] = out[1] = out[2] = ((x * 7 + y * 3) % 5 < 2) ? 0 : 255;
+        break;
+    default:
+        value  = (width + height > 2) ? (x + y) * 255 / (width + height - 2) : 0;
+        out[0] = (unsigned char)value;
+        out[1] = (unsigned char)(value / 2 + 64);
+        out[2] = (unsigned char)(255 - value);
+        break;
+    }
+    out[3] = 255;
+}
+
+/**
+* Encodes one image and decodes it again, returns whether it came back the way it should.
+*/
+static bool checkImage(BlockFormat format, Kind kind, int width, int height, int srcPadding, int dstPadding)
+{
+    int            blockBytes = BlockFormat_bytes(format);
+    int            srcStride  = width * 4 + srcPadding;
+    int            dstStride  = (width + 3) / 4 * blockBytes + dstPadding;
+    int            blockRows  = (height + 3) / 4;
+    size_t         blocksSize = (size_t)dstStride * (blockRows - 1) + (size_t)(width + 3) / 4 * blockBytes;
+    unsigned char *image      = (unsigned char*)calloc((size_t)srcStride * height, 1);
+    unsigned char *blocks     = (unsigned char*)malloc(blocksSize + GUARD_BYTES);
+    unsigned char *decoded    = (unsigned char*)calloc((size_t)width * height, 4);
+    const char    *problem    = NULL;
+    int            x, y, channel;
+    size_t         index;
+
+    if (!image || !blocks || !decoded)
+    {
+        free(image);
+        free(blocks);
+        free(decoded);
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+            makePixel(kind, x, y, width, height, image + (size_t)y * srcStride + (size_t)x * 4);
+    memset(blocks, GUARD_BYTE, blocksSize + GUARD_BYTES);
+
+    if (!Encode_blocks(format, image, width, height, srcStride, blocks, dstStride))
+        problem = "Encode_blocks failed";
+    else if (!Encode_decode(format, blocks, dstStride, decoded, width, height, width * 4))
+        problem = "Encode_decode failed";
+
+    for (index = blocksSize; !problem && index < blocksSize + GUARD_BYTES; index++)
+        if (blocks[index] != GUARD_BYTE)
+            problem = "wrote past the last block";
+    for (y = 0; !problem && y < blockRows - 1; y++)
+        for (x = 0; !problem && x < dstPadding; x++)
+            if (blocks[(size_t)y * dstStride + (size_t)(width + 3) / 4 * blockBytes + x] != GUARD_BYTE)
+                problem = "wrote past the end of a row of blocks";
+
+    for (y = 0; !problem && y < height; y++)
+    {
+        for (x = 0; !problem && x < width; x++)
+        {
+            const unsigned char *expected = image + (size_t)y * srcStride + (size_t)x * 4;
+            const unsigned char *actual   = decoded + ((size_t)y * width + x) * 4;
+
+            // BC7's mode 6 shares each end colour's low bit between colour and alpha, so black can only be 254 opaque
+            if (actual[3] < ((format == BLOCK_FORMAT_BC7) ? 254 : 255))
+                problem = "came back not opaque";
+            for (channel = 0; channel < 3; channel++)
+                if (abs(actual[channel] - expected[channel]) > tolerances[kind][format])
+                    problem = "came back too different";
+            if (problem)
+                fprintf(stderr, "  pixel %d,%d: BGRA %d %d %d %d, should be %d %d %d %d\n", x, y,
+                        actual[0], actual[1], actual[2], actual[3], expected[0], expected[1], expected[2], expected[3]);
+        }
+    }
+
+    if (problem)
+        fprintf(stderr, "FAIL %s %s %dx%d, %d bytes padding per row, %d per row of blocks: %s\n",
+                formatNames[format], kindNames[kind], width, height, srcPadding, dstPadding, problem);
+
+    free(image);
+    free(blocks);
+    free(decoded);
+    return problem == NULL;
+}
+
+// every format, kind, size and padding, returns how many failed
+static int checkAll(void)
+{
+    int failures = 0;
+    int format, kind, width, height, padding;
+
+    for (format = BLOCK_FORMAT_BC1; format <= BLOCK_FORMAT_BC7; format++)
+        for (kind = 0; kind < KIND_COUNT; kind++)
+            for (width = 0; width < (int)(sizeof(widths) / sizeof(widths[0])); width++)
+                for (height = 0; height < (int)(sizeof(heights) / sizeof(heights[0])); height++)
+                    for (padding = 0; padding < 2; padding++)
+                        if (!checkImage((BlockFormat)format, (Kind)kind, widths[width], heights[height], padding * 12, padding * 5))
+                            failures++;
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    int failures;
+    int threaded;
+
+    if (argc > 1)
+    {
+        fprintf(stderr, "usage: %s\n", argv[0]);
+        return 1;
+    }
+
+    failures = checkAll();
+    printf("on the calling thread: %d failures\n", failures);
+
+    Workers_retain();
+    threaded = checkAll();
+    printf("with %d background threads: %d failures\n", Workers_count(), threaded);
+    Workers_release();
+
+    return (failures || threaded) ? 1 : 0;
+}
@@ -0,0 +1,578 @@
+/**
+* Throws random sizes, strides and formats at the exports that draw into the caller's buffer (`Pdf_getPageFittedPixels`,
+* `Pdf_getSpreadPixels`, `Pdf_renderTile`, and the ones without a stride, `Pdf_getPageFittedBGRA`,
+* `Pdf_get2PagesFittedBGRA`, `Pdf_getPageFittedRGB` and `Pdf_getPageRGB`), to check that they never write anywhere they
+* shouldn't, and that they turn down whatever doesn't add up instead of overflowing on it.
+* It builds the DLL's sources straight in, like the benchmark, see the Makefile next to this.
+*
+* Every buffer gets guard bytes before and after it, and is filled with a pattern first, so after each call it checks:
+*   - the guard bytes, and the bytes between the end of each row and the stride, are untouched
+*   - anything `checkBuffer` would turn down (no format, a width or height <= 0, a stride too small for the width, a
+*     width in bytes that doesn't fit in an int, a tile whose far edge doesn't) failed, and everything else worked
+*   - the resulting size fits in the available space, and a spread showed 1 or 2 pages
+* The sizes that don't add up are given a buffer that's far too small for what they claim, so getting one wrong crashes
+* rather than passing quietly.
+*
+* With no files, it makes up a PDF with pages of random sizes (from 1x1 up, very wide and very tall ones included) from
+* the seed, and uses that.
+*
+* Usage:
+*   fuzz [options] [file...]
+*     --seed N        start from this seed (default 1), a failure prints the seed and iteration to go back to it with
+*     --iterations N  calls per export per document (default 2000)
+*     --pages N       pages in the made up PDF (default 8)
+*
+* Exits with 1 if anything failed, so it can go in a script.
+*/
+
+#include "mupdf2rgb.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+
+#define GUARD_BYTES 64
+#define GUARD_BYTE  0xA5
+#define MAX_PAGES   64
+
+// the exports, the DLL doesn't have a public header of its own
+int Pdf_create(Pdf **newPdf, const char *filePath);
+int Pdf_createFromMemory(Pdf **newPdf, const char *name, const void *data, size_t size, StreamRelease release, void *user);
+int Pdf_destroy(Pdf *pdf);
+int Pdf_getPageCount(Pdf *pdf, int *pageCount);
+int Pdf_getPageRGB(Pdf *pdf, int pageNumber, int *width, int *height, unsigned char *outBuffer);
+int Pdf_getPageFittedRGB(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer);
+int Pdf_get2PagesFittedBGRA(Pdf *pdf, int startPageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer);
+int Pdf_getPageFittedBGRA(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer);
+int Pdf_getPageFittedPixels(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride);
+int Pdf_getSpreadPixels(Pdf *pdf, int startPageNumber, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *shownPages);
+int Pdf_renderTile(Pdf *pdf, int pageNumber, float zoom, int tileX, int tileY, int tileWidth, int tileHeight, unsigned char *outBuffer, int outStride);
+
+typedef struct Options
+{
+    unsigned int seed;
+    int          iterations;
+    int          pages;
+} Options;
+
+/**
+* A buffer as the caller would hand it over, `width x height` pixels of `bytes` each with rows `stride` bytes apart,
+* with the guard bytes around it.
+*/
+typedef struct Buffer
+{
+    unsigned char *memory;
+    size_t         size;   // not counting the guard bytes
+    int            width;
+    int            height;
+    int            bytes;
+    int            stride;
+    bool           valid;  // whether it's what `checkBuffer` lets through
+} Buffer;
+
+static unsigned int rngState;
+static int          failures;
+static unsigned int currentSeed;
+static int          currentIteration;
+
+// xorshift, so a seed gives the same run everywhere
+static unsigned int nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// from `low` to `high`, both included
+static int randomBetween(int low, int high)
+{
+    return low + (int)(nextRandom() % (unsigned int)(high - low + 1));
+}
+
+static void fail(const char *what, const char *format, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "FAIL %s (seed %u, iteration %d): ", what, currentSeed, currentIteration);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    failures++;
+}
+
+/**
+* Mostly sensible sizes, with the odd one that's 0, negative, or too big for its width in bytes to fit in an int.
+*/
+static int randomSize(int bytes, int largest)
+{
+    switch (randomBetween(0, 15))
+    {
+    case 0:  return randomBetween(-2, 0);
+    case 1:  return (bytes > 1) ? INT_MAX / bytes + randomBetween(1, 2) : INT_MAX;
+    case 2:  return INT_MAX - randomBetween(0, 1);
+    case 3:  return randomBetween(1, 4);
+    default: return randomBetween(1, largest);
+    }
+}
+
+/**
+* Makes a buffer for `width x height` of `format` with rows `stride` bytes apart. One that doesn't add up just gets the
+* guard bytes and a little room.
+*/
+static bool Buffer_makeWithStride(Buffer *buffer, int format, int width, int height, long long stride)
+{
+    long long rowBytes;
+
+    memset(buffer, 0, sizeof(Buffer));
+    buffer->width  = width;
+    buffer->height = height;
+    buffer->bytes  = PixelFormat_bytes((PixelFormat)format);
+    buffer->stride = (int)max(-1, min(INT_MAX, stride));
+
+    rowBytes      = (long long)width * buffer->bytes;
+    buffer->valid = buffer->bytes > 0 && width > 0 && height > 0 && rowBytes <= INT_MAX && buffer->stride >= rowBytes;
+    buffer->size  = buffer->valid ? (size_t)buffer->stride * (height - 1) + (size_t)rowBytes : 16;
+    if (buffer->size > 64 * 1024 * 1024)
+        return false;
+
+    buffer->memory = (unsigned char*)malloc(buffer->size + 2 * GUARD_BYTES);
+    if (!buffer->memory)
+        return false;
+    memset(buffer->memory, GUARD_BYTE, buffer->size + 2 * GUARD_BYTES);
+    return true;
+}
+
+/**
+* `Buffer_makeWithStride`, with a random amount of padding at the end of each row, or now and again a stride that's too
+* small (or nonsense).
+*/
+static bool Buffer_make(Buffer *buffer, int format, int width, int height)
+{
+    long long rowBytes = (long long)width * PixelFormat_bytes((PixelFormat)format);
+    long long stride;
+
+    // min and max are macros, so the random amounts are picked before they go in
+    switch (randomBetween(0, 9))
+    {
+    case 0:  stride = rowBytes - randomBetween(1, 3); break;
+    case 1:  stride = randomBetween(-1, 0); break;
+    case 2:  stride = INT_MAX; break;
+    default: stride = rowBytes + randomBetween(0, 2) * randomBetween(0, 32); break;
+    }
+    return Buffer_makeWithStride(buffer, format, width, height, stride);
+}
+
+static unsigned char *Buffer_pixels(const Buffer *buffer)
+{
+    return buffer->memory + GUARD_BYTES;
+}
+
+/**
+* Checks nothing was written outside the rows, i.e., to the guard bytes, or between the end of a row and the stride.
+*/
+static void Buffer_check(const Buffer *buffer, const char *what)
+{
+    const unsigned char *pixels = Buffer_pixels(buffer);
+    size_t               index;
+    int                  row;
+
+    for (index = 0; index < GUARD_BYTES; index++)
+    {
+        if (buffer->memory[index] != GUARD_BYTE)
+            { fail(what, "wrote %d bytes before the buffer", (int)(GUARD_BYTES - index)); break; }
+    }
+    for (index = 0; index < GUARD_BYTES; index++)
+    {
+        if (pixels[buffer->size + index] != GUARD_BYTE)
+            { fail(what, "wrote %d bytes past the end of the buffer (%dx%d, stride %d)", (int)index + 1, buffer->width, buffer->height, buffer->stride); break; }
+    }
+    if (!buffer->valid)
+        return;
+
+    for (row = 0; row < buffer->height - 1; row++)
+    {
+        const unsigned char *padding = pixels + (size_t)row * buffer->stride + (size_t)buffer->width * buffer->bytes;
+        for (index = 0; index < (size_t)(buffer->stride - buffer->width * buffer->bytes); index++)
+        {
+            if (padding[index] != GUARD_BYTE)
+                { fail(what, "wrote past the width into the stride of row %d (%dx%d, stride %d)", row, buffer->width, buffer->height, buffer->stride); return; }
+        }
+    }
+}
+
+static void Buffer_free(Buffer *buffer)
+{
+    free(buffer->memory);
+    memset(buffer, 0, sizeof(Buffer));
+}
+
+/**
+* What's expected of a call: it should have worked if the buffer's fine and the page(s) are there, and failed if either
+* isn't. It's allowed to fail with a fine buffer on pages that aren't, but not to work with a buffer that isn't fine.
+*/
+static void checkResult(const char *what, const Buffer *buffer, bool pagesThere, int result, int resultingWidth, int resultingHeight)
+{
+    if (result && !buffer->valid)
+        fail(what, "took a buffer it should have turned down (%dx%d, %d bytes per pixel, stride %d)", buffer->width, buffer->height, buffer->bytes, buffer->stride);
+    else if (!result && buffer->valid && pagesThere)
+        fail(what, "failed on a fine buffer (%dx%d, %d bytes per pixel, stride %d)", buffer->width, buffer->height, buffer->bytes, buffer->stride);
+    else if (result && (resultingWidth < 0 || resultingWidth > buffer->width || resultingHeight < 0 || resultingHeight > buffer->height))
+        fail(what, "resulting size %dx%d doesn't fit in %dx%d", resultingWidth, resultingHeight, buffer->width, buffer->height);
+}
+
+static void fuzzFitted(Pdf *pdf, int pageCount)
+{
+    Buffer buffer;
+    int    format         = randomBetween(-1, 4);
+    int    pages          = randomBetween(0, 7) ? randomBetween(1, 2) : randomBetween(-1, 3);
+    int    page           = randomBetween(-1, pageCount);
+    int    bytes          = PixelFormat_bytes((PixelFormat)format);
+    int    resultingWidth  = 0;
+    int    resultingHeight = 0;
+    int    result;
+
+    if (!Buffer_make(&buffer, format, randomSize(bytes, 700), randomSize(bytes, 700)))
+        return;
+
+    result = Pdf_getPageFittedPixels(pdf, page, pages, format, buffer.width, buffer.height, &resultingWidth, &resultingHeight, Buffer_pixels(&buffer), buffer.stride);
+    if (pages != 1 && pages != 2)
+    {
+        if (result) fail("Pdf_getPageFittedPixels", "took a page count of %d", pages);
+    }
+    else checkResult("Pdf_getPageFittedPixels", &buffer, page >= 0 && page + pages <= pageCount, result, resultingWidth, resultingHeight);
+    Buffer_check(&buffer, "Pdf_getPageFittedPixels");
+
+    Buffer_free(&buffer);
+}
+
+static void fuzzSpread(Pdf *pdf, int pageCount)
+{
+    Buffer buffer;
+    int    format          = randomBetween(-1, 4);
+    int    page            = randomBetween(-1, pageCount);
+    int    bytes           = PixelFormat_bytes((PixelFormat)format);
+    int    resultingWidth  = 0;
+    int    resultingHeight = 0;
+    int    shownPages      = -1;
+    int    result;
+
+    if (!Buffer_make(&buffer, format, randomSize(bytes, 1400), randomSize(bytes, 700)))
+        return;
+
+    result = Pdf_getSpreadPixels(pdf, page, format, buffer.width, buffer.height, &resultingWidth, &resultingHeight, Buffer_pixels(&buffer), buffer.stride, &shownPages);
+    checkResult("Pdf_getSpreadPixels", &buffer, page >= 0 && page < pageCount, result, resultingWidth, resultingHeight);
+    if (result && shownPages != 1 && shownPages != 2)
+        fail("Pdf_getSpreadPixels", "showed %d pages", shownPages);
+    if (!result && shownPages != 0)
+        fail("Pdf_getSpreadPixels", "failed but said it showed %d pages", shownPages);
+    Buffer_check(&buffer, "Pdf_getSpreadPixels");
+
+    Buffer_free(&buffer);
+}
+
+static void fuzzTile(Pdf *pdf, int pageCount)
+{
+    static const float oddZooms[4] = { 0.0f, -1.0f, 1e-6f, 64.0f };
+
+    Buffer buffer;
+    int    page = randomBetween(-1, pageCount);
+    int    tileX, tileY;
+    float  zoom;
+    bool   valid;
+    int    result;
+
+    zoom = randomBetween(0, 7) ? randomBetween(1, 400) / 100.0f : (randomBetween(0, 4) ? oddZooms[randomBetween(0, 3)] : NAN);
+    switch (randomBetween(0, 5))
+    {
+    case 0:  tileX = INT_MAX - randomBetween(0, 600); tileY = randomBetween(-100, 100); break;
+    case 1:  tileX = randomBetween(-100, 100); tileY = INT_MAX - randomBetween(0, 600); break;
+    case 2:  tileX = INT_MIN + randomBetween(0, 600); tileY = randomBetween(-2000, 2000); break;
+    default: tileX = randomBetween(-2000, 4000); tileY = randomBetween(-2000, 4000); break;
+    }
+
+    if (!Buffer_make(&buffer, PIXEL_FORMAT_BGRA, randomSize(4, 300), randomSize(4, 300)))
+        return;
+
+    // the buffer, as well as a zoom that's a number > 0, and a tile whose far edge is still an int
+    valid  = buffer.valid && zoom > 0 && tileX <= INT_MAX - buffer.width && tileY <= INT_MAX - buffer.height;
+    result = Pdf_renderTile(pdf, page, zoom, tileX, tileY, buffer.width, buffer.height, Buffer_pixels(&buffer), buffer.stride);
+    if (result && !valid)
+        fail("Pdf_renderTile", "took a %dx%d tile at %d,%d, zoom %g, stride %d it should have turned down", buffer.width, buffer.height, tileX, tileY, zoom, buffer.stride);
+    else if (!result && valid && page >= 0 && page < pageCount)
+        fail("Pdf_renderTile", "failed on a %dx%d tile at %d,%d, zoom %g, stride %d", buffer.width, buffer.height, tileX, tileY, zoom, buffer.stride);
+    Buffer_check(&buffer, "Pdf_renderTile");
+
+    Buffer_free(&buffer);
+}
+
+/**
+* The exports that don't take a stride, `Pdf_getPageFittedBGRA`, `Pdf_get2PagesFittedBGRA` and `Pdf_getPageFittedRGB`, have
+* rows exactly as wide as the available space, and mustn't overflow working that out.
+*/
+static void fuzzPacked(Pdf *pdf, int pageCount)
+{
+    static const char *names[3] = { "Pdf_getPageFittedBGRA", "Pdf_get2PagesFittedBGRA", "Pdf_getPageFittedRGB" };
+
+    Buffer buffer;
+    int    which           = randomBetween(0, 2);
+    int    format          = (which == 2) ? PIXEL_FORMAT_RGB : PIXEL_FORMAT_BGRA;
+    int    pages           = (which == 1) ? 2 : 1;
+    int    page            = randomBetween(-1, pageCount);
+    int    bytes           = PixelFormat_bytes((PixelFormat)format);
+    int    width           = randomSize(bytes, 700);
+    int    resultingWidth  = 0;
+    int    resultingHeight = 0;
+    int    result;
+
+    if (!Buffer_makeWithStride(&buffer, format, width, randomSize(bytes, 700), (long long)width * bytes))
+        return;
+
+    if (which == 0)      result = Pdf_getPageFittedBGRA(pdf, page, buffer.width, buffer.height, &resultingWidth, &resultingHeight, Buffer_pixels(&buffer));
+    else if (which == 1) result = Pdf_get2PagesFittedBGRA(pdf, page, buffer.width, buffer.height, &resultingWidth, &resultingHeight, Buffer_pixels(&buffer));
+    else                 result = Pdf_getPageFittedRGB(pdf, page, buffer.width, buffer.height, &resultingWidth, &resultingHeight, Buffer_pixels(&buffer));
+    checkResult(names[which], &buffer, page >= 0 && page + pages <= pageCount, result, resultingWidth, resultingHeight);
+    Buffer_check(&buffer, names[which]);
+
+    Buffer_free(&buffer);
+}
+
+/**
+* `Pdf_getPageRGB` the way a caller has to use it: once without a buffer for the size, then again with a buffer of exactly
+* that size, which it has to fill without going past the end.
+*/
+static void fuzzPageRGB(Pdf *pdf, int pageCount)
+{
+    Buffer buffer;
+    int    page   = randomBetween(-1, pageCount);
+    int    width  = -1;
+    int    height = -1;
+    int    result;
+
+    result = Pdf_getPageRGB(pdf, page, &width, &height, NULL);
+    if (!result)
+    {
+        if (page >= 0 && page < pageCount)
+            fail("Pdf_getPageRGB", "couldn't size page %d", page);
+        return;
+    }
+    if (page < 0 || page >= pageCount)
+    {
+        fail("Pdf_getPageRGB", "sized page %d, which isn't there", page);
+        return;
+    }
+    if (width <= 0 || height <= 0)
+    {
+        fail("Pdf_getPageRGB", "page %d is %dx%d", page, width, height);
+        return;
+    }
+
+    if (!Buffer_makeWithStride(&buffer, PIXEL_FORMAT_RGB, width, height, (long long)width * 3))
+        return;
+
+    if (!Pdf_getPageRGB(pdf, page, NULL, NULL, Buffer_pixels(&buffer)))
+        fail("Pdf_getPageRGB", "couldn't draw page %d into the %dx%d it asked for", page, width, height);
+    Buffer_check(&buffer, "Pdf_getPageRGB");
+
+    Buffer_free(&buffer);
+}
+
+/**
+* The exports without a stride work it out from the width, which mustn't overflow on the way to being checked.
+*/
+static void checkPackedStrides(Pdf *pdf)
+{
+    static const int widths[3] = { INT_MAX / 4 + 1, INT_MAX / 2, INT_MAX };
+
+    Buffer buffer;
+    int    index;
+
+    for (index = 0; index < 3; index++)
+    {
+        if (!Buffer_make(&buffer, -1, 0, 0))
+            return;
+        if (Pdf_getPageFittedBGRA(pdf, 0, widths[index], 16, NULL, NULL, Buffer_pixels(&buffer)))
+            fail("Pdf_getPageFittedBGRA", "took a width of %d, whose stride doesn't fit in an int", widths[index]);
+        Buffer_check(&buffer, "Pdf_getPageFittedBGRA");
+        Buffer_free(&buffer);
+    }
+}
+
+typedef struct Text
+{
+    char   data[256 * MAX_PAGES + 256];  // plenty for a page, its contents and their xref entries
+    size_t length;
+} Text;
+
+static void Text_add(Text *text, const char *format, ...)
+{
+    va_list args;
+    int     written;
+
+    va_start(args, format);
+    written = vsnprintf(text->data + text->length, sizeof(text->data) - text->length, format, args);
+    va_end(args);
+    if (written > 0)
+        text->length = min(sizeof(text->data) - 1, text->length + written);
+}
+
+/**
+* A PDF with `pageCount` pages of random sizes (some of them very wide, or very tall, or tiny), each with a coloured
+* rectangle on, so there's something to draw. Objects 3 and 4 are the first page and its contents, 5 and 6 the second...
+*/
+static void makeDocument(Text *text, int pageCount)
+{
+    size_t offsets[2 * MAX_PAGES + 3];
+    size_t xref;
+    int    objects = 2 * pageCount + 3;
+    int    index;
+
+    text->length = 0;
+    Text_add(text, "%%PDF-1.4\n");
+    offsets[1] = text->length;
+    Text_add(text, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+    offsets[2] = text->length;
+    Text_add(text, "2 0 obj\n<</Type/Pages/Count %d/Kids[", pageCount);
+    for (index = 0; index < pageCount; index++)
+        Text_add(text, "%d 0 R ", 3 + 2 * index);
+    Text_add(text, "]>>\nendobj\n");
+
+    for (index = 0; index < pageCount; index++)
+    {
+        char content[128];
+        int  width, height;
+
+        switch (randomBetween(0, 7))
+        {
+        case 0:  width = 1;                         height = 1;                        break;
+        case 1:  width = randomBetween(2000, 5000); height = randomBetween(10, 200);   break;
+        case 2:  width = randomBetween(10, 200);    height = randomBetween(2000, 5000); break;
+        case 3:  width = 1224;                      height = 792;                      break;  // a double page spread
+        default: width = randomBetween(100, 1500);  height = randomBetween(100, 1500); break;
+        }
+        snprintf(content, sizeof(content), "%.2f %.2f %.2f rg %d %d %d %d re f",
+                 randomBetween(0, 100) / 100.0, randomBetween(0, 100) / 100.0, randomBetween(0, 100) / 100.0,
+                 width / 4, height / 4, max(1, width / 2), max(1, height / 2));
+
+        offsets[3 + 2 * index] = text->length;
+        Text_add(text, "%d 0 obj\n<</Type/Page/Parent 2 0 R/MediaBox[0 0 %d %d]/Contents %d 0 R>>\nendobj\n", 3 + 2 * index, width, height, 4 + 2 * index);
+        offsets[4 + 2 * index] = text->length;
+        Text_add(text, "%d 0 obj\n<</Length %d>>\nstream\n%s\nendstream\nendobj\n", 4 + 2 * index, (int)strlen(content), content);
+    }
+
+    xref = text->length;
+    Text_add(text, "xref\n0 %d\n0000000000 65535 f \n", objects);
+    for (index = 1; index < objects; index++)
+        Text_add(text, "%010d 00000 n \n", (int)offsets[index]);
+    Text_add(text, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%d\n%%%%EOF\n", objects, (int)xref);
+}
+
+static void fuzzDocument(Pdf *pdf, const char *name, const Options *options)
+{
+    int pageCount = 0;
+    int before    = failures;
+
+    if (!Pdf_getPageCount(pdf, &pageCount) || pageCount <= 0)
+    {
+        fprintf(stderr, "FAIL %s: no pages\n", name);
+        failures++;
+        return;
+    }
+
+    checkPackedStrides(pdf);
+    for (currentIteration = 0; currentIteration < options->iterations; currentIteration++)
+    {
+        fuzzFitted(pdf, pageCount);
+        fuzzSpread(pdf, pageCount);
+        fuzzTile(pdf, pageCount);
+        fuzzPacked(pdf, pageCount);
+        // a whole page at 72dpi is a lot more than the others draw
+        if (currentIteration % 16 == 0)
+            fuzzPageRGB(pdf, pageCount);
+    }
+    printf("%s: %d pages, %d iterations, %d failures\n", name, pageCount, options->iterations, failures - before);
+}
+
+static bool parseOptions(int argc, char **argv, Options *options, int *firstFile)
+{
+    int index;
+
+    memset(options, 0, sizeof(Options));
+    options->seed       = 1;
+    options->iterations = 2000;
+    options->pages      = 8;
+
+    for (index = 1; index < argc && argv[index][0] == '-'; index++)
+    {
+        const char *option = argv[index];
+        const char *value  = (index + 1 < argc) ? argv[index + 1] : NULL;
+
+        if (!value)
+            return false;
+        index++;
+
+        if      (!strcmp(option, "--seed"))       options->seed       = (unsigned int)strtoul(value, NULL, 10);
+        else if (!strcmp(option, "--iterations")) options->iterations = max(1, atoi(value));
+        else if (!strcmp(option, "--pages"))      options->pages      = max(1, min(MAX_PAGES, atoi(value)));
+        else return false;
+    }
+
+    // xorshift never gets out of 0
+    if (options->seed == 0)
+        options->seed = 1;
+
+    *firstFile = index;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    Pdf    *pdf;
+    int     firstFile;
+    int     index;
+
+    if (!parseOptions(argc, argv, &options, &firstFile))
+    {
+        fprintf(stderr, "usage: %s [--seed N] [--iterations N] [--pages N] [file...]\n", argv[0]);
+        return 1;
+    }
+
+    currentSeed = options.seed;
+    rngState    = options.seed;
+
+    if (firstFile == argc)
+    {
+        Text *text = (Text*)malloc(sizeof(Text));
+        if (!text)
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        makeDocument(text, options.pages);
+        if (!Pdf_createFromMemory(&pdf, "fuzz.pdf", text->data, text->length, NULL, NULL))
+        {
+            fprintf(stderr, "FAIL could not open the made up PDF (seed %u)\n", options.seed);
+            free(text);
+            return 1;
+        }
+        free(text);
+        fuzzDocument(pdf, "fuzz.pdf", &options);
+        Pdf_destroy(pdf);
+    }
+
+    for (index = firstFile; index < argc; index++)
+    {
+        if (!Pdf_create(&pdf, argv[index]))
+        {
+            fprintf(stderr, "FAIL could not open %s\n", argv[index]);
+            failures++;
+            continue;
+        }
+        fuzzDocument(pdf, argv[index], &options);
+        Pdf_destroy(pdf);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+/**
+* Checks every pixel conversion kernel this machine can run (see convert.c) against the plain C ones, since the fast ones
+* are only worth having if they give exactly the same results.
+* It builds the DLL's sources straight in, like the benchmark, see the Makefile next to this.
+*
+* Each kernel converts random rows of every width up to a few of its blocks (so the leftovers handed on to the slower
+* kernels get covered too), with the source and destination starting at every offset up to 32 bytes out of line.
+* The destination rows have guard bytes after them, which mustn't change.
+* Kernels the CPU (or the build) can't do are listed as skipped, so run it on every kind of machine that matters.
+*
+* Usage:
+*   kernels [--seed N] [--rounds N]
+*     --seed N    start from this seed (default 1)
+*     --rounds N  how many times to go through every width and offset with new random rows (default 4)
+*
+* Exits with 1 if anything failed, so it can go in a script.
+*/
+
+#include "mupdf2rgb.h"
+
+#include <stdio.h>
+
+#define MAX_WIDTH   200  // a few blocks of the widest kernel, AVX2's 32 pixels
+#define MAX_OFFSET  32
+#define GUARD_BYTES 16
+#define GUARD_BYTE  0xCD
+
+static const char *levelNames[CONVERT_LEVEL_COUNT] = { "scalar", "ssse3", "avx2", "neon" };
+static const char *rowNames[3]                     = { "rgbToBGRA", "rgbToRGBA", "grayToBGRA" };
+
+static unsigned int rngState;
+
+// xorshift, so a seed gives the same run everywhere
+static unsigned int nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+/**
+* Runs one kernel against the plain C one it stands in for, returns how many rows came out different.
+*/
+static int checkRow(const char *name, ConvertRow plain, ConvertRow fast, int rounds)
+{
+    unsigned char source[MAX_OFFSET + MAX_WIDTH * 3];
+    unsigned char expected[MAX_WIDTH * 4 + GUARD_BYTES];
+    unsigned char actual[MAX_OFFSET + MAX_WIDTH * 4 + GUARD_BYTES];
+    int           failures = 0;
+    int           round, width, offset, index;
+
+    for (round = 0; round < rounds; round++)
+    {
+        for (index = 0; index < (int)sizeof(source); index++)
+            source[index] = (unsigned char)nextRandom();
+
+        for (width = 0; width <= MAX_WIDTH; width++)
+        {
+            for (offset = 0; offset < MAX_OFFSET; offset++)
+            {
+                // the source and destination move out of line by different amounts, so all sorts of pairings come up
+                const unsigned char *src       = source + offset;
+                int                  dstOffset = (offset * 7) % MAX_OFFSET;
+
+                memset(expected, GUARD_BYTE, sizeof(expected));
+                memset(actual, GUARD_BYTE, sizeof(actual));
+                plain(src, expected, width);
+                fast(src, actual + dstOffset, width);
+
+                for (index = 0; index < dstOffset && actual[index] == GUARD_BYTE; index++)
+                    ;
+                if (index < dstOffset || memcmp(expected, actual + dstOffset, (size_t)width * 4 + GUARD_BYTES) != 0)
+                {
+                    fprintf(stderr, "FAIL %s: width %d, source offset %d, destination offset %d, different from the plain C one\n", name, width, offset, dstOffset);
+                    failures++;
+                    break;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    const ConvertKernels *plain    = Convert_kernels(CONVERT_SCALAR);
+    unsigned int          seed     = 1;
+    int                   rounds   = 4;
+    int                   failures = 0;
+    int                   index;
+    ConvertLevel          level;
+
+    for (index = 1; index < argc; index += 2)
+    {
+        const char *option = argv[index];
+        const char *value  = (index + 1 < argc) ? argv[index + 1] : NULL;
+
+        if      (value && !strcmp(option, "--seed"))   seed   = (unsigned int)strtoul(value, NULL, 10);
+        else if (value && !strcmp(option, "--rounds")) rounds = max(1, atoi(value));
+        else
+        {
+            fprintf(stderr, "usage: %s [--seed N] [--rounds N]\n", argv[0]);
+            return 1;
+        }
+    }
+    // xorshift never gets out of 0
+    rngState = seed ? seed : 1;
+
+    for (level = CONVERT_SCALAR + 1; level < CONVERT_LEVEL_COUNT; level++)
+    {
+        const ConvertKernels *kernels = Convert_kernels(level);
+        int                   before  = failures;
+
+        if (!kernels)
+        {
+            printf("%s: skipped, not on this machine\n", levelNames[level]);
+            continue;
+        }
+
+        {
+            const ConvertRow plainRows[3] = { plain->rgbToBGRA, plain->rgbToRGBA, plain->grayToBGRA };
+            const ConvertRow fastRows[3]  = { kernels->rgbToBGRA, kernels->rgbToRGBA, kernels->grayToBGRA };
+            for (index = 0; index < 3; index++)
+            {
+                char name[64];
+                snprintf(name, sizeof(name), "%s %s", kernels->name, rowNames[index]);
+                failures += checkRow(name, plainRows[index], fastRows[index], rounds);
+            }
+        }
+        printf("%s: %s\n", kernels->name, (failures == before) ? "same as scalar" : "FAILED");
+    }
+    printf("best: %s\n", Convert_best()->name);
+
+    return failures ? 1 : 0;
+}
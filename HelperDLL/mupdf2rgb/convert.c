@@ -0,0 +1,397 @@
+/**
+* Pixel format conversions, for wherever MuPDF can't draw the format we want directly.
+*
+* Every conversion has a plain C version, and faster SSSE3/AVX2 (x86) or NEON (ARM) versions that are picked at runtime
+* depending on what the CPU can do. The fast versions only do the bulk of a row, and hand the leftovers to the next
+* slower one, so they all give exactly the same results.
+* bench/kernels.c (`make check` there) checks every one the machine can run against the plain ones.
+*/
+
+#include "mupdf2rgb.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define HAVE_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define TARGET_SSSE3
+        #define TARGET_AVX2
+    #else
+        #include <cpuid.h>
+        #define TARGET_SSSE3 __attribute__((target("ssse3")))
+        #define TARGET_AVX2  __attribute__((target("avx2")))
+    #endif
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__ARM_NEON)
+    #define HAVE_NEON 1
+    #include <arm_neon.h>
+#endif
+
+//
+// plain C
+//
+
+static void rgbToBGRA_scalar(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x;
+    for (x = 0; x < width; x++)
+    {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = 255;
+        src += 3;
+        dst += 4;
+    }
+}
+
+static void rgbToRGBA_scalar(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x;
+    for (x = 0; x < width; x++)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 255;
+        src += 3;
+        dst += 4;
+    }
+}
+
+static void grayToBGRA_scalar(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x;
+    for (x = 0; x < width; x++)
+    {
+        dst[0] = dst[1] = dst[2] = src[x];
+        dst[3] = 255;
+        dst += 4;
+    }
+}
+
+static const ConvertKernels scalarKernels = { "scalar", rgbToBGRA_scalar, rgbToRGBA_scalar, grayToBGRA_scalar };
+
+#ifdef HAVE_X86
+
+//
+// SSSE3, 16 pixels at a time
+// The 48 bytes of RGB are loaded as 3 registers, and `palignr` lines up each group of 4 pixels (12 bytes) at the
+// start of a register, so `pshufb` can spread them out to 16 bytes. Alpha is OR'd in afterwards.
+//
+
+#define RGB_SHUFFLE_SSSE3(shuffle, alpha, a, b, c, dst)                                                    \
+    _mm_storeu_si128((__m128i*)(dst) + 0, _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alpha));               \
+    _mm_storeu_si128((__m128i*)(dst) + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), shuffle), alpha)); \
+    _mm_storeu_si128((__m128i*)(dst) + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), shuffle), alpha));  \
+    _mm_storeu_si128((__m128i*)(dst) + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), shuffle), alpha));
+
+TARGET_SSSE3 static void rgbToBGRA_ssse3(const unsigned char *src, unsigned char *dst, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha   = _mm_set1_epi32((int)0xFF000000);
+    int           x       = 0;
+
+    for (; x + 16 <= width; x += 16, src += 48, dst += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)src + 0);
+        __m128i b = _mm_loadu_si128((const __m128i*)src + 1);
+        __m128i c = _mm_loadu_si128((const __m128i*)src + 2);
+        RGB_SHUFFLE_SSSE3(shuffle, alpha, a, b, c, dst);
+    }
+    rgbToBGRA_scalar(src, dst, width - x);
+}
+
+TARGET_SSSE3 static void rgbToRGBA_ssse3(const unsigned char *src, unsigned char *dst, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha   = _mm_set1_epi32((int)0xFF000000);
+    int           x       = 0;
+
+    for (; x + 16 <= width; x += 16, src += 48, dst += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)src + 0);
+        __m128i b = _mm_loadu_si128((const __m128i*)src + 1);
+        __m128i c = _mm_loadu_si128((const __m128i*)src + 2);
+        RGB_SHUFFLE_SSSE3(shuffle, alpha, a, b, c, dst);
+    }
+    rgbToRGBA_scalar(src, dst, width - x);
+}
+
+TARGET_SSSE3 static void grayToBGRA_ssse3(const unsigned char *src, unsigned char *dst, int width)
+{
+    const __m128i shuffle0 = _mm_setr_epi8( 0,  0,  0, -1,  1,  1,  1, -1,  2,  2,  2, -1,  3,  3,  3, -1);
+    const __m128i shuffle1 = _mm_setr_epi8( 4,  4,  4, -1,  5,  5,  5, -1,  6,  6,  6, -1,  7,  7,  7, -1);
+    const __m128i shuffle2 = _mm_setr_epi8( 8,  8,  8, -1,  9,  9,  9, -1, 10, 10, 10, -1, 11, 11, 11, -1);
+    const __m128i shuffle3 = _mm_setr_epi8(12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1);
+    const __m128i alpha    = _mm_set1_epi32((int)0xFF000000);
+    int           x        = 0;
+
+    for (; x + 16 <= width; x += 16, src += 16, dst += 64)
+    {
+        __m128i gray = _mm_loadu_si128((const __m128i*)src);
+        _mm_storeu_si128((__m128i*)dst + 0, _mm_or_si128(_mm_shuffle_epi8(gray, shuffle0), alpha));
+        _mm_storeu_si128((__m128i*)dst + 1, _mm_or_si128(_mm_shuffle_epi8(gray, shuffle1), alpha));
+        _mm_storeu_si128((__m128i*)dst + 2, _mm_or_si128(_mm_shuffle_epi8(gray, shuffle2), alpha));
+        _mm_storeu_si128((__m128i*)dst + 3, _mm_or_si128(_mm_shuffle_epi8(gray, shuffle3), alpha));
+    }
+    grayToBGRA_scalar(src, dst, width - x);
+}
+
+static const ConvertKernels ssse3Kernels = { "ssse3", rgbToBGRA_ssse3, rgbToRGBA_ssse3, grayToBGRA_ssse3 };
+
+//
+// AVX2, 32 pixels at a time
+// `vpshufb` only shuffles within each 128 bit half, so each half gets loaded with its own 4 pixels (12 bytes).
+// Every load reads 16 bytes though, so the last one reaches 4 bytes past the 96 we're converting, which is why
+// the loop stops while there are still at least 2 more pixels, and the SSSE3 version does the rest.
+//
+
+TARGET_AVX2 static void rgbShuffle_avx2(const unsigned char *src, unsigned char *dst, int width, __m256i shuffle, void (*rest)(const unsigned char*, unsigned char*, int))
+{
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    int           x     = 0;
+
+    for (; x + 34 <= width; x += 32, src += 96, dst += 128)
+    {
+        int block;
+        for (block = 0; block < 4; block++)
+        {
+            const unsigned char *in  = src + block * 24;
+            __m256i              rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)in)), _mm_loadu_si128((const __m128i*)(in + 12)), 1);
+            _mm256_storeu_si256((__m256i*)dst + block, _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), alpha));
+        }
+    }
+    rest(src, dst, width - x);
+}
+
+TARGET_AVX2 static void rgbToBGRA_avx2(const unsigned char *src, unsigned char *dst, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                                             2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    rgbShuffle_avx2(src, dst, width, shuffle, rgbToBGRA_ssse3);
+}
+
+TARGET_AVX2 static void rgbToRGBA_avx2(const unsigned char *src, unsigned char *dst, int width)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                             0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    rgbShuffle_avx2(src, dst, width, shuffle, rgbToRGBA_ssse3);
+}
+
+TARGET_AVX2 static void grayToBGRA_avx2(const unsigned char *src, unsigned char *dst, int width)
+{
+    // both halves get the same 16 gray pixels, the masks pick pixels 0-7 and 8-15 respectively
+    const __m256i shuffle0 = _mm256_setr_epi8( 0,  0,  0, -1,  1,  1,  1, -1,  2,  2,  2, -1,  3,  3,  3, -1,
+                                               4,  4,  4, -1,  5,  5,  5, -1,  6,  6,  6, -1,  7,  7,  7, -1);
+    const __m256i shuffle1 = _mm256_setr_epi8( 8,  8,  8, -1,  9,  9,  9, -1, 10, 10, 10, -1, 11, 11, 11, -1,
+                                              12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1);
+    const __m256i alpha    = _mm256_set1_epi32((int)0xFF000000);
+    int           x        = 0;
+
+    for (; x + 16 <= width; x += 16, src += 16, dst += 64)
+    {
+        __m256i gray = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)src));
+        _mm256_storeu_si256((__m256i*)dst + 0, _mm256_or_si256(_mm256_shuffle_epi8(gray, shuffle0), alpha));
+        _mm256_storeu_si256((__m256i*)dst + 1, _mm256_or_si256(_mm256_shuffle_epi8(gray, shuffle1), alpha));
+    }
+    grayToBGRA_scalar(src, dst, width - x);
+}
+
+static const ConvertKernels avx2Kernels = { "avx2", rgbToBGRA_avx2, rgbToRGBA_avx2, grayToBGRA_avx2 };
+
+static void cpuid(int leaf, int subleaf, int registers[4])
+{
+#ifdef _MSC_VER
+    __cpuidex(registers, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+static bool hasSSSE3(void)
+{
+    int registers[4];
+    cpuid(1, 0, registers);
+    return (registers[2] & (1 << 9)) != 0;
+}
+
+static bool hasAVX2(void)
+{
+    int                registers[4];
+    unsigned long long enabled;
+
+    // the CPU has to support it, and the OS has to save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2)
+    cpuid(1, 0, registers);
+    if (!(registers[2] & (1 << 27)) || !(registers[2] & (1 << 28)))
+        return false;
+#ifdef _MSC_VER
+    enabled = _xgetbv(0);
+#else
+    {
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        enabled = ((unsigned long long)edx << 32) | eax;
+    }
+#endif
+    if ((enabled & 6) != 6)
+        return false;
+
+    cpuid(7, 0, registers);
+    return (registers[1] & (1 << 5)) != 0;
+}
+
+#endif // HAVE_X86
+
+#ifdef HAVE_NEON
+
+//
+// NEON, 16 pixels at a time, the (de)interleaving loads and stores do all the work
+//
+
+static void rgbToBGRA_neon(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16, src += 48, dst += 64)
+    {
+        uint8x16x3_t rgb = vld3q_u8(src);
+        uint8x16x4_t bgra;
+        bgra.val[0] = rgb.val[2];
+        bgra.val[1] = rgb.val[1];
+        bgra.val[2] = rgb.val[0];
+        bgra.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst, bgra);
+    }
+    rgbToBGRA_scalar(src, dst, width - x);
+}
+
+static void rgbToRGBA_neon(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16, src += 48, dst += 64)
+    {
+        uint8x16x3_t rgb = vld3q_u8(src);
+        uint8x16x4_t rgba;
+        rgba.val[0] = rgb.val[0];
+        rgba.val[1] = rgb.val[1];
+        rgba.val[2] = rgb.val[2];
+        rgba.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst, rgba);
+    }
+    rgbToRGBA_scalar(src, dst, width - x);
+}
+
+static void grayToBGRA_neon(const unsigned char *src, unsigned char *dst, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16, src += 16, dst += 64)
+    {
+        uint8x16_t   gray = vld1q_u8(src);
+        uint8x16x4_t bgra;
+        bgra.val[0] = gray;
+        bgra.val[1] = gray;
+        bgra.val[2] = gray;
+        bgra.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst, bgra);
+    }
+    grayToBGRA_scalar(src, dst, width - x);
+}
+
+static const ConvertKernels neonKernels = { "neon", rgbToBGRA_neon, rgbToRGBA_neon, grayToBGRA_neon };
+
+#endif // HAVE_NEON
+
+
+/**
+* Returns the kernels for a specific level, or `NULL` if this CPU (or build) can't do them.
+*/
+const ConvertKernels *Convert_kernels(ConvertLevel level)
+{
+    switch (level)
+    {
+    case CONVERT_SCALAR:
+        return &scalarKernels;
+#ifdef HAVE_X86
+    case CONVERT_SSSE3:
+        return hasSSSE3() ? &ssse3Kernels : NULL;
+    case CONVERT_AVX2:
+        return (hasSSSE3() && hasAVX2()) ? &avx2Kernels : NULL;
+#endif
+#ifdef HAVE_NEON
+    case CONVERT_NEON:
+        return &neonKernels;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+/**
+* Returns the fastest kernels this CPU can run, working it out the first time round.
+*/
+const ConvertKernels *Convert_best(void)
+{
+    static const ConvertKernels *best = NULL;
+    const ConvertKernels        *found;
+
+    if (best)
+        return best;
+
+    if (!(found = Convert_kernels(CONVERT_AVX2)) &&
+        !(found = Convert_kernels(CONVERT_NEON)) &&
+        !(found = Convert_kernels(CONVERT_SSSE3)))
+        found = &scalarKernels;
+
+    // racing threads would all come up with the same answer anyway
+    best = found;
+    return best;
+}
+
+/**
+* Converts a `width x height` block of pixels from one format to another, rows are `srcStride`/`dstStride` bytes apart.
+* Returns false if that's not a conversion we know how to do.
+*/
+bool Convert_pixels(PixelFormat srcFormat, const unsigned char *src, int srcStride, PixelFormat dstFormat, unsigned char *dst, int dstStride, int width, int height)
+{
+    const ConvertKernels *kernels = Convert_best();
+    ConvertRow            convert = NULL;
+    int                   y;
+
+    if (srcFormat == dstFormat)
+    {
+        size_t rowSize = (size_t)width * PixelFormat_bytes(srcFormat);
+        if (srcStride == dstStride && (size_t)srcStride == rowSize)
+        {
+            memcpy(dst, src, rowSize * height);
+            return true;
+        }
+        for (y = 0; y < height; y++)
+            memcpy(dst + (size_t)y * dstStride, src + (size_t)y * srcStride, rowSize);
+        return true;
+    }
+
+    if (srcFormat == PIXEL_FORMAT_RGB && dstFormat == PIXEL_FORMAT_BGRA)
+        convert = kernels->rgbToBGRA;
+    else if (srcFormat == PIXEL_FORMAT_RGB && dstFormat == PIXEL_FORMAT_RGBA)
+        convert = kernels->rgbToRGBA;
+    else if (srcFormat == PIXEL_FORMAT_GRAY && (dstFormat == PIXEL_FORMAT_BGRA || dstFormat == PIXEL_FORMAT_RGBA))
+        convert = kernels->grayToBGRA; // gray looks the same either way round
+    if (!convert)
+        return false;
+
+    for (y = 0; y < height; y++)
+        convert(src + (size_t)y * srcStride, dst + (size_t)y * dstStride, width);
+
+    return true;
+}
+
+int PixelFormat_bytes(PixelFormat format)
+{
+    switch (format)
+    {
+    case PIXEL_FORMAT_BGRA:
+    case PIXEL_FORMAT_RGBA: return 4;
+    case PIXEL_FORMAT_RGB:  return 3;
+    case PIXEL_FORMAT_GRAY: return 1;
+    default:                return 0;
+    }
+}
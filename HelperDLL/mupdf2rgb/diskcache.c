@@ -0,0 +1,577 @@
+/**
+* Rendered pages kept on disk between sessions, so a book that gets opened again (every morning, on a kiosk showing the
+* same few manuals all day) shows the pages it showed before without MuPDF having to draw them again.
+*
+* Everything lives in one pack file that's mapped into memory: a header, a fixed table of slots saying what's where, and
+* the pages themselves, LZ4 compressed, one after the other in a ring. Rendered pages are mostly paper, so they shrink a
+* lot, and decompressing one is much quicker than drawing it. Once the ring is full the oldest pages get written over,
+* so the file never grows past the size it was asked to be.
+*
+* A page is recognised by its document (the file's path and when it was last modified, see `DiskCache_document`), its
+* `PageKey` and pixel format. A slot only counts if its page hasn't been written over since, and its checksum still
+* matches, so a file left half written by a crash just loses those pages. A file written by another version of this
+* (or of MuPDF, which might draw things differently) is started afresh, see `DISKCACHE_VERSION`.
+*
+* Only one process can have the file at a time, a second one just goes without.
+* The lock is only held while copying in and out of the mapping, compressing and decompressing happen outside of it.
+*/
+
+#include "mupdf2rgb.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/file.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#define DISKCACHE_MAGIC    0x4B434450  // "PDCK"
+// bump this whenever what gets drawn changes, so pages drawn the old way aren't shown any more
+#define DISKCACHE_VERSION  2
+#define DISKCACHE_SLOTS    8192
+// how many slots a page may end up in, starting at the one its hash picks
+#define DISKCACHE_PROBES   8
+// the smallest ring worth having, anything less and a single page wouldn't fit
+#define DISKCACHE_MIN_RING (4 * 1024 * 1024)
+
+// LZ4's block format: matches are at least 4 bytes, the last 5 bytes are always literals, and the last match starts
+// at least 12 bytes before the end
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT   12
+#define LZ4_HASH_BITS     16
+#define LZ4_MAX_OFFSET    65535
+
+typedef struct DiskHeader
+{
+    unsigned int       magic;
+    unsigned int       version;
+    unsigned long long renderer;  // which MuPDF drew the pages
+    unsigned long long ring;      // how many bytes the ring holds
+    unsigned long long head;      // where the next page goes, counting every byte ever written, so it never wraps
+} DiskHeader;
+
+typedef struct DiskSlot
+{
+    unsigned long long document;
+    PageKey            key;
+    int                format;
+    int                width;
+    int                height;
+    unsigned int       size;      // compressed, 0 for an empty slot
+    unsigned int       checksum;  // of the compressed bytes
+    unsigned int       unused;
+    unsigned long long position;  // counting like `DiskHeader.head`
+} DiskSlot;
+
+static SRWLOCK        diskLock = SRWLOCK_INIT;
+static unsigned char *mapped   = NULL;
+static size_t         mappedSize;
+static char          *mappedPath = NULL;
+static DiskHeader    *header;
+static DiskSlot      *slots;
+static unsigned char *ring;
+#ifdef _WIN32
+static HANDLE         mapping;
+#else
+static int            file = -1;
+#endif
+
+static unsigned long long hashBytes(unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    size_t               index;
+
+    // FNV-1a
+    for (index = 0; index < size; index++)
+        hash = (hash ^ bytes[index]) * 0x100000001B3ULL;
+    return hash;
+}
+
+#define HASH_START 0xCBF29CE484222325ULL
+
+static unsigned long long rendererId(void)
+{
+    unsigned int version = DISKCACHE_VERSION;
+    return hashBytes(hashBytes(HASH_START, FZ_VERSION, strlen(FZ_VERSION)), &version, sizeof(version));
+}
+
+static unsigned int checksum(const unsigned char *data, size_t size)
+{
+    unsigned long long hash = hashBytes(HASH_START, data, size);
+    return (unsigned int)(hash ^ (hash >> 32));
+}
+
+//
+// LZ4
+//
+
+static size_t lz4Bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+static unsigned int read32(const unsigned char *p)
+{
+    unsigned int value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned char *writeLength(unsigned char *op, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+// one token, its literals, and (if `matchLength` isn't 0) its match
+static unsigned char *writeSequence(unsigned char *op, const unsigned char *literals, size_t literalCount, size_t offset, size_t matchLength)
+{
+    unsigned char *token = op++;
+    size_t         extra = matchLength ? matchLength - LZ4_MIN_MATCH : 0;
+
+    *token = (unsigned char)((min(literalCount, 15) << 4) | min(extra, 15));
+    if (literalCount >= 15)
+        op = writeLength(op, literalCount - 15);
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+
+    if (matchLength)
+    {
+        *op++ = (unsigned char)offset;
+        *op++ = (unsigned char)(offset >> 8);
+        if (extra >= 15)
+            op = writeLength(op, extra - 15);
+    }
+    return op;
+}
+
+/**
+* Compresses `size` bytes into `dst`, which needs room for `lz4Bound(size)`, and returns how many it took, 0 if it failed.
+* Greedy, with one candidate per hash, which is all it takes for pages: long runs of paper, and repeating glyphs.
+*/
+static size_t lz4Compress(const unsigned char *src, size_t size, unsigned char *dst)
+{
+    unsigned int        *table;
+    const unsigned char *ip     = src;
+    const unsigned char *anchor = src;
+    const unsigned char *end    = src + size;
+    unsigned char       *op     = dst;
+    unsigned int         misses = 0;
+
+    table = (unsigned int*)calloc((size_t)1 << LZ4_HASH_BITS, sizeof(unsigned int));
+    if (!table)
+        return 0;
+
+    if (size > LZ4_MATCH_LIMIT)
+    {
+        const unsigned char *matchStop = end - LZ4_LAST_LITERALS;
+        const unsigned char *searchEnd = end - LZ4_MATCH_LIMIT;
+
+        while (ip < searchEnd)
+        {
+            unsigned int         sequence = read32(ip);
+            unsigned int         hash     = (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+            const unsigned char *match    = src + table[hash];
+            size_t               length;
+
+            table[hash] = (unsigned int)(ip - src);
+            if (match >= ip || ip - match > LZ4_MAX_OFFSET || read32(match) != sequence)
+            {
+                // the longer nothing matches, the further it skips ahead, so pictures don't take forever
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && match > src && ip[-1] == match[-1])
+            {
+                ip--;
+                match--;
+            }
+            length = LZ4_MIN_MATCH;
+            while (ip + length < matchStop && ip[length] == match[length])
+                length++;
+
+            op     = writeSequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - match), length);
+            ip    += length;
+            anchor = ip;
+        }
+    }
+
+    op = writeSequence(op, anchor, (size_t)(end - anchor), 0, 0);
+    free(table);
+    return (size_t)(op - dst);
+}
+
+static bool readLength(const unsigned char **ip, const unsigned char *end, size_t *length)
+{
+    unsigned char byte;
+    do
+    {
+        if (*ip >= end)
+            return false;
+        byte     = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/**
+* Decompresses into exactly `expected` bytes, and fails on anything that doesn't add up, rather than trusting the file.
+*/
+static bool lz4Decompress(const unsigned char *src, size_t size, unsigned char *dst, size_t expected)
+{
+    const unsigned char *ip   = src;
+    const unsigned char *iend = src + size;
+    unsigned char       *op   = dst;
+    unsigned char       *oend = dst + expected;
+
+    while (ip < iend)
+    {
+        unsigned char        token   = *ip++;
+        size_t               literals = token >> 4;
+        size_t               length   = token & 15;
+        size_t               offset;
+        const unsigned char *match;
+
+        if (literals == 15 && !readLength(&ip, iend, &literals))
+            return false;
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+            return false;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence is only literals
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return false;
+
+        if (length == 15 && !readLength(&ip, iend, &length))
+            return false;
+        length += LZ4_MIN_MATCH;
+        if (length > (size_t)(oend - op))
+            return false;
+
+        // the match can overlap what it's making (a run of white is one pixel repeated), so copy what's there already,
+        // which doubles each time around
+        match = op - offset;
+        while (length > 0)
+        {
+            size_t chunk = min(length, (size_t)(op - match));
+            memcpy(op, match, chunk);
+            op     += chunk;
+            length -= chunk;
+        }
+    }
+
+    return op == oend;
+}
+
+//
+// the pack file
+//
+
+// must be called with the lock held
+static void unmap(void)
+{
+    if (!mapped)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(mapped);
+    CloseHandle(mapping);
+    mapping = NULL;
+#else
+    munmap(mapped, mappedSize);
+    close(file);
+    file = -1;
+#endif
+    free(mappedPath);
+    mappedPath = NULL;
+    mapped     = NULL;
+    header     = NULL;
+    slots      = NULL;
+    ring       = NULL;
+}
+
+// must be called with the lock held, the file gets exactly `size` bytes
+static bool map(const char *path, size_t size)
+{
+#ifdef _WIN32
+    HANDLE        handle;
+    LARGE_INTEGER end;
+
+    // nobody else gets to write (or read) it while it's ours
+    handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    end.QuadPart = (LONGLONG)size;
+    if (!SetFilePointerEx(handle, end, NULL, FILE_BEGIN) || !SetEndOfFile(handle))
+    {
+        CloseHandle(handle);
+        return false;
+    }
+
+    mapping = CreateFileMappingA(handle, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, NULL);
+    CloseHandle(handle);
+    if (!mapping)
+        return false;
+
+    mapped = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!mapped)
+    {
+        CloseHandle(mapping);
+        mapping = NULL;
+        return false;
+    }
+#else
+    void *view;
+
+    file = open(path, O_RDWR | O_CREAT, 0644);
+    if (file < 0)
+        return false;
+    if (flock(file, LOCK_EX | LOCK_NB) != 0 || ftruncate(file, (off_t)size) != 0)
+    {
+        close(file);
+        file = -1;
+        return false;
+    }
+
+    view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (view == MAP_FAILED)
+    {
+        close(file);
+        file = -1;
+        return false;
+    }
+    mapped = (unsigned char*)view;
+#endif
+
+    mappedSize = size;
+    mappedPath = (char*)malloc(strlen(path) + 1);
+    if (mappedPath) strcpy(mappedPath, path);
+    header     = (DiskHeader*)mapped;
+    slots      = (DiskSlot*)(mapped + sizeof(DiskHeader));
+    ring       = mapped + sizeof(DiskHeader) + sizeof(DiskSlot) * DISKCACHE_SLOTS;
+    return true;
+}
+
+/**
+* Opens (or creates) the pack file at `path`, which takes up `bytes` on disk, and uses it from here on.
+* Whatever is in it already is kept if it was written by the same version with the same size, otherwise it starts
+* out empty. Whatever was open before is closed first, unless it's the same file at the same size, which is left as it is.
+*/
+bool DiskCache_open(const char *path, size_t bytes)
+{
+    size_t ringSize = bytes - min(bytes, sizeof(DiskHeader) + sizeof(DiskSlot) * DISKCACHE_SLOTS);
+    bool   result   = false;
+
+    AcquireSRWLockExclusive(&diskLock);
+    if (mapped && path && mappedPath && mappedSize == bytes && strcmp(mappedPath, path) == 0)
+    {
+        ReleaseSRWLockExclusive(&diskLock);
+        return true;
+    }
+    unmap();
+
+    if (path && *path && ringSize >= DISKCACHE_MIN_RING && map(path, bytes))
+    {
+        if (header->magic != DISKCACHE_MAGIC || header->version != DISKCACHE_VERSION || header->renderer != rendererId() || header->ring != ringSize)
+        {
+            // the header goes last, so if this gets cut short it's simply started afresh next time as well
+            header->magic = 0;
+            memset(slots, 0, sizeof(DiskSlot) * DISKCACHE_SLOTS);
+            header->version  = DISKCACHE_VERSION;
+            header->renderer = rendererId();
+            header->ring     = ringSize;
+            header->head     = 0;
+            header->magic    = DISKCACHE_MAGIC;
+        }
+        result = true;
+    }
+
+    ReleaseSRWLockExclusive(&diskLock);
+    return result;
+}
+
+void DiskCache_close(void)
+{
+    AcquireSRWLockExclusive(&diskLock);
+    unmap();
+    ReleaseSRWLockExclusive(&diskLock);
+}
+
+/**
+* What identifies a document opened from a file, across sessions, 0 for one that wasn't (those aren't cached).
+*/
+unsigned long long DiskCache_document(const char *path, LONGLONG modified)
+{
+    unsigned long long hash;
+
+    if (!path)
+        return 0;
+
+    hash = hashBytes(hashBytes(HASH_START, path, strlen(path)), &modified, sizeof(modified));
+    return hash ? hash : 1;
+}
+
+static unsigned int firstSlot(unsigned long long document, const PageKey *key, int format)
+{
+    unsigned long long hash = hashBytes(hashBytes(document, key, sizeof(PageKey)), &format, sizeof(format));
+    return (unsigned int)(hash % DISKCACHE_SLOTS);
+}
+
+// must be called with the lock held, whether the slot's page is still all there, i.e., hasn't been written over since
+static bool isIntact(const DiskSlot *slot)
+{
+    return slot->size > 0 && slot->position + header->ring >= header->head && slot->position + slot->size <= header->head;
+}
+
+// must be called with the lock held
+static DiskSlot *findSlot(unsigned long long document, const PageKey *key, int format)
+{
+    unsigned int first = firstSlot(document, key, format);
+    int          probe;
+
+    for (probe = 0; probe < DISKCACHE_PROBES; probe++)
+    {
+        DiskSlot *slot = &slots[(first + probe) % DISKCACHE_SLOTS];
+        if (slot->size && slot->document == document && slot->format == format && !memcmp(&slot->key, key, sizeof(PageKey)))
+            return isIntact(slot) ? slot : NULL;
+    }
+    return NULL;
+}
+
+/**
+* Copies the page `key` of `document` (as `format`) out of the disk cache into `outBuffer`, whose rows are `outStride`
+* bytes apart, and returns true, or returns false if it isn't there (or has gone bad).
+*/
+bool DiskCache_get(unsigned long long document, const PageKey *key, PixelFormat format, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride)
+{
+    unsigned char *compressed = NULL;
+    unsigned char *pixels     = NULL;
+    DiskSlot       found;
+    DiskSlot      *slot;
+    size_t         rowSize;
+    bool           result = false;
+
+    if (!document || !mapped)
+        return false;
+
+    // copy it out while it can't be written over, the rest can happen without holding everybody else up
+    AcquireSRWLockExclusive(&diskLock);
+    slot = mapped ? findSlot(document, key, format) : NULL;
+    if (slot)
+    {
+        found      = *slot;
+        compressed = (unsigned char*)malloc(found.size);
+        if (compressed)
+            memcpy(compressed, ring + found.position % header->ring, found.size);
+    }
+    ReleaseSRWLockExclusive(&diskLock);
+
+    if (!compressed)
+        return false;
+    if (checksum(compressed, found.size) != found.checksum || found.width <= 0 || found.height <= 0 ||
+        found.width > key->availableWidth || found.height > key->availableHeight)
+        goto done;
+
+    // straight into the caller's buffer if the rows line up, otherwise through one that does
+    rowSize = (size_t)found.width * PixelFormat_bytes(format);
+    pixels  = ((size_t)outStride == rowSize) ? outBuffer : (unsigned char*)malloc(rowSize * found.height);
+    if (!pixels || !lz4Decompress(compressed, found.size, pixels, rowSize * found.height))
+        goto done;
+    if (pixels != outBuffer)
+        Convert_pixels(format, pixels, (int)rowSize, format, outBuffer, outStride, found.width, found.height);
+
+    if (resultingWidth)  *resultingWidth  = found.width;
+    if (resultingHeight) *resultingHeight = found.height;
+    result = true;
+
+done:
+    if (pixels != outBuffer) free(pixels);
+    free(compressed);
+    return result;
+}
+
+/**
+* Keeps `width x height` pixels of `format` (rows `stride` bytes apart) on disk as the page `key` of `document`,
+* writing over the oldest pages if there's no room left.
+*/
+void DiskCache_put(unsigned long long document, const PageKey *key, PixelFormat format, int width, int height, const unsigned char *pixels, int stride)
+{
+    unsigned char *packed     = NULL;
+    unsigned char *compressed = NULL;
+    size_t         rowSize    = (size_t)width * PixelFormat_bytes(format);
+    size_t         size;
+
+    if (!document || !mapped || width <= 0 || height <= 0)
+        return;
+
+    // the rows go in one after the other
+    if ((size_t)stride != rowSize)
+    {
+        packed = (unsigned char*)malloc(rowSize * height);
+        if (!packed)
+            return;
+        Convert_pixels(format, pixels, stride, format, packed, (int)rowSize, width, height);
+        pixels = packed;
+    }
+
+    compressed = (unsigned char*)malloc(lz4Bound(rowSize * height));
+    size       = compressed ? lz4Compress(pixels, rowSize * height, compressed) : 0;
+
+    AcquireSRWLockExclusive(&diskLock);
+    // a page taking up more than a quarter of the ring would push everything else out
+    if (mapped && size > 0 && size <= header->ring / 4)
+    {
+        unsigned int first  = firstSlot(document, key, format);
+        DiskSlot    *slot   = NULL;
+        DiskSlot    *oldest = NULL;
+        int          probe;
+
+        // the same page again, an empty slot, or one whose page is gone, otherwise the one with the oldest page
+        for (probe = 0; probe < DISKCACHE_PROBES && !slot; probe++)
+        {
+            DiskSlot *candidate = &slots[(first + probe) % DISKCACHE_SLOTS];
+            if (!isIntact(candidate) || (candidate->document == document && candidate->format == (int)format && !memcmp(&candidate->key, key, sizeof(PageKey))))
+                slot = candidate;
+            else if (!oldest || candidate->position < oldest->position)
+                oldest = candidate;
+        }
+        if (!slot)
+            slot = oldest;
+
+        // pages don't wrap around the end of the ring, they start over at the beginning
+        if (header->head % header->ring + size > header->ring)
+            header->head += header->ring - header->head % header->ring;
+
+        // the slot is only filled in once the page is there, so a crash halfway doesn't leave it pointing at garbage
+        slot->size = 0;
+        memcpy(ring + header->head % header->ring, compressed, size);
+        slot->document = document;
+        slot->key      = *key;
+        slot->format   = format;
+        slot->width    = width;
+        slot->height   = height;
+        slot->position = header->head;
+        slot->checksum = checksum(compressed, size);
+        slot->size     = (unsigned int)size;
+        header->head  += size;
+    }
+    ReleaseSRWLockExclusive(&diskLock);
+
+    free(compressed);
+    free(packed);
+}
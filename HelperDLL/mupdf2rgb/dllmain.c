@@ -2,389 +2,2700 @@
 * This is a lightweight wrapper around libmupdf (hey Robin!) to make it easier to just get a page, or 2 pages together, into an existing framebuffer.
 * See https://github.com/ArtifexSoftware/mupdf and https://www.mupdf.com/
 * As such, this is under APL3: https://www.gnu.org/licenses/agpl-3.0.en.html
+*
+* Everything here can be called from any number of threads at the same time, even for the same `Pdf`,
+* the only exception being `Pdf_destroy`, which nobody else may be busy with that `Pdf` for.
+*
+* Opening a file that's already open hands out the same `Pdf` again (see registry.c), so anything set on it, like
+* `Pdf_setCacheBudget`, applies to everybody who opened it.
 */
 
-#include <Windows.h>
-#include <stdbool.h>
+#include "mupdf2rgb.h"
+#ifdef _MSC_VER
+    #pragma comment( lib, "libmupdf" )
+#endif
+
+#define DEFAULT_CACHE_BUDGET (64 * 1024 * 1024)
+// display lists are usually a few hundred KB for text, but can be much bigger for vector heavy pages
+#define DEFAULT_LIST_CACHE   32
+// how much MuPDF may keep around for each document (decoded images, fonts, ...) before throwing the oldest out
+#define DEFAULT_STORE_BUDGET (64 * 1024 * 1024)
+// previews are rendered at this fraction of the size, a quarter means a sixteenth of the pixels
+#define PREVIEW_DIVISOR      4
+// how far from gray (0-1, in any of red, green or blue) a colour may be and still count as gray, see `Pdf_isPageGray`
+#define GRAY_THRESHOLD       0.02f
+
+// only read when a document is created, see `Pdf_setStoreBudget`
+static volatile size_t storeBudget = DEFAULT_STORE_BUDGET;
+// see `Pdf_setFileMapping`
+static volatile LONG mapFiles = true;
+
+static void lockMutex(void *user, int lock)
+{
+    AcquireSRWLockExclusive(&((SRWLOCK*)user)[lock]);
+}
+
+static void unlockMutex(void *user, int lock)
+{
+    ReleaseSRWLockExclusive(&((SRWLOCK*)user)[lock]);
+}
+
+
+static bool openDocument(Pdf *pdf, fz_context *ctx);
+
+/**
+* Loads a page and records everything on it into a display list, which can then be drawn at any size without going
+* near the document again. Only this part needs `pdf->documentLock`, so several pages can be drawn at the same time.
+* Recently used pages come straight out of `pdf->lists`, so drawing the same page again at another size skips the parsing.
+* Returns `NULL` if the page couldn't be loaded, otherwise drop it with `fz_drop_display_list` when done.
+* With `keep` false a newly loaded page isn't put in `pdf->lists`, for when lots of pages are only needed once (like
+* thumbnails), which would otherwise push out the ones that are actually being read.
+*/
+static fz_display_list *loadPageList(Pdf *pdf, fz_context *ctx, int pageNumber, bool keep)
+{
+    fz_page         *page = NULL;
+    fz_display_list *list = NULL;
+
+    fz_var(page);
+    fz_var(list);
+
+    list = ListCache_get(&pdf->lists, ctx, pageNumber);
+    if (list)
+    {
+        Stats_count(&pdf->stats, STAT_LISTCACHE_HIT);
+        return list;
+    }
+
+    AcquireSRWLockExclusive(&pdf->documentLock);
+    fz_try(ctx)
+    {
+        // a lazily opened document gets opened by whoever needs it first
+        if (!openDocument(pdf, ctx))
+            fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open document");
+
+        // somebody else might have loaded it while we were waiting for the lock
+        list = ListCache_get(&pdf->lists, ctx, pageNumber);
+        if (list)
+        {
+            Stats_count(&pdf->stats, STAT_LISTCACHE_HIT);
+        }
+        else
+        {
+            LONGLONG started;
+
+            Stats_count(&pdf->stats, STAT_LISTCACHE_MISS);
+            started = Stats_begin(&pdf->stats);
+            page = fz_load_page(ctx, pdf->document, pageNumber);
+            Stats_end(&pdf->stats, STAT_LOAD_PAGE, started);
+
+            started = Stats_begin(&pdf->stats);
+            list = fz_new_display_list_from_page(ctx, page);
+            Stats_end(&pdf->stats, STAT_RUN_PAGE, started);
+
+            if (keep)
+                ListCache_put(&pdf->lists, ctx, pageNumber, list);
+        }
+    }
+    fz_always(ctx)
+    {
+        fz_drop_page(ctx, page);
+        ReleaseSRWLockExclusive(&pdf->documentLock);
+    }
+    fz_catch(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+        return NULL;
+    }
+
+    return list;
+}
+
+static fz_display_list *loadDisplayList(Pdf *pdf, fz_context *ctx, int pageNumber)
+{
+    return loadPageList(pdf, ctx, pageNumber, true);
+}
+
+
+/**
+* Works out how to scale a page with the bounds `bbox` so it fits into the available space, keeping its aspect ratio.
+*/
+static fz_matrix fitPage(fz_rect bbox, int availableWidth, int availableHeight)
+{
+    float bboxWidth  = bbox.x1 - bbox.x0;
+    float bboxHeight = bbox.y1 - bbox.y0;
+    float zoomFactor = availableWidth / bboxWidth;
+
+    if (bboxHeight * zoomFactor > availableHeight)
+        zoomFactor = availableHeight / bboxHeight;
+
+    return fz_scale(zoomFactor, zoomFactor);
+}
+
+
+/**
+* Checks that `outBuffer` can take `availableWidth x availableHeight` pixels of `format` with rows `outStride` bytes apart,
+* which is what every export that fills the caller's buffer expects.
+*/
+static bool checkBuffer(PixelFormat format, int availableWidth, int availableHeight, const unsigned char *outBuffer, int outStride)
+{
+    int bytes = PixelFormat_bytes(format);
+
+    if (!outBuffer || !bytes || availableWidth <= 0 || availableHeight <= 0)
+        return false;
+    // the width in bytes has to fit in an int, like the stride does
+    if (availableWidth > INT_MAX / bytes || outStride < availableWidth * bytes)
+        return false;
+    return true;
+}
+
+/**
+* The stride of a buffer with nothing between the rows, for the exports that don't take one. It's 0 (which `checkBuffer`
+* turns down) when the width in bytes doesn't fit in an int, rather than overflowing on the way to being checked.
+*/
+static int packedStride(PixelFormat format, int width)
+{
+    int bytes = PixelFormat_bytes(format);
+
+    if (!bytes || width <= 0 || width > INT_MAX / bytes)
+        return 0;
+    return width * bytes;
+}
+
+/**
+* Draws a display list straight into the caller's buffer (rows `outStride` bytes apart), instead of into a pixmap of
+* our own that then has to be converted and copied over.
+* `area` is the part of the page (in device space, after `ctm`) to draw, its top left ends up at the start of `outBuffer`.
+*
+* The draw device is quite happy to draw any of our pixel formats: BGR with alpha is exactly the B8G8R8A8 layout the
+* texture wants, RGB with alpha is RGBA, and RGB and gray without alpha are just that.
+* Because everything is cleared to opaque white first, alpha ends up as 255 everywhere.
+* The time it takes goes into `stats`. With a `cookie` it can be stopped part way through (see `Pdf_abortRender`), and
+* anything on the page that fails to draw is counted there and left out, rather than failing the lot.
+*/
+static void drawListInto(fz_context *ctx, Stats *stats, fz_display_list *list, fz_matrix ctm, fz_irect area, PixelFormat format, unsigned char *outBuffer, int outStride, fz_cookie *cookie)
+{
+    fz_pixmap     *pix = NULL;
+    fz_device     *dev = NULL;
+    fz_colorspace *colorspace;
+    int            alpha;
+    const fz_matrix fz_identity = {1, 0, 0, 1, 0, 0};
+    LONGLONG started;
+
+    fz_var(pix);
+    fz_var(dev);
+
+    if (area.x1 <= area.x0 || area.y1 <= area.y0)
+        return;
+
+    switch (format)
+    {
+    case PIXEL_FORMAT_BGRA: colorspace = fz_device_bgr(ctx);  alpha = 1; break;
+    case PIXEL_FORMAT_RGBA: colorspace = fz_device_rgb(ctx);  alpha = 1; break;
+    case PIXEL_FORMAT_RGB:  colorspace = fz_device_rgb(ctx);  alpha = 0; break;
+    case PIXEL_FORMAT_GRAY: colorspace = fz_device_gray(ctx); alpha = 0; break;
+    default:                fz_throw(ctx, FZ_ERROR_GENERIC, "unknown pixel format");
+    }
+
+    started = Stats_begin(stats);
+    fz_try(ctx)
+    {
+        pix = fz_new_pixmap_with_data(ctx, colorspace, area.x1 - area.x0, area.y1 - area.y0, NULL, alpha, outStride, outBuffer);
+        pix->x = area.x0;
+        pix->y = area.y0;
+        fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+
+        dev = fz_new_draw_device(ctx, ctm, pix);
+        fz_run_display_list(ctx, list, dev, fz_identity, fz_rect_from_irect(area), cookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        // this only frees the pixmap itself, the samples still belong to the caller
+        fz_drop_pixmap(ctx, pix);
+        Stats_end(stats, STAT_DRAW, started);
+    }
+    fz_catch(ctx)
+    {
+        fz_rethrow(ctx);
+    }
+}
+
+
+/**
+* Draws an already loaded page, scaled to fit, as `format` into `outBuffer` whose rows are `outStride` bytes apart.
+* Drops `list` either way.
+*/
+static int drawListFitted(Pdf *pdf, fz_context *ctx, fz_display_list *list, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, PixelFormat format, unsigned char *outBuffer, int outStride)
+{
+    bool             result = true;
+    fz_matrix        viewMatrix;
+    fz_rect          bbox;
+    fz_irect         area;
+
+    fz_try(ctx)
+    {
+        bbox       = fz_bound_display_list(ctx, list);
+        viewMatrix = fitPage(bbox, availableWidth, availableHeight);
+        area       = fz_round_rect(fz_transform_rect(bbox, viewMatrix));
+
+        // rounding outwards can make it a pixel bigger than there's room for, so what's reported is what's drawn
+        area.x1 = min(area.x1, area.x0 + availableWidth);
+        area.y1 = min(area.y1, area.y0 + availableHeight);
+
+        if (resultingWidth)  *resultingWidth  = max(0, area.x1 - area.x0);
+        if (resultingHeight) *resultingHeight = max(0, area.y1 - area.y0);
+        drawListInto(ctx, &pdf->stats, list, viewMatrix, area, format, outBuffer, outStride, NULL);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx)
+    {
+        result = false;
+    }
+
+    return result;
+}
+
+/**
+* Renders a single page, scaled to fit, as `format` into `outBuffer` whose rows are `outStride` bytes apart.
+*/
+static int renderPageFitted(Pdf *pdf, fz_context *ctx, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, PixelFormat format, unsigned char *outBuffer, int outStride)
+{
+    fz_display_list *list = loadDisplayList(pdf, ctx, pageNumber);
+    if (!list)
+        return false;
+    return drawListFitted(pdf, ctx, list, availableWidth, availableHeight, resultingWidth, resultingHeight, format, outBuffer, outStride);
+}
+
+
+// a page counts as two pages already stuck together when it's this much wider (for its height) than the page next to it
+#define MERGED_SPREAD_RATIO 1.5f
+
+/**
+* One of the two pages of a spread, as it gets drawn by `drawSpreadPages`.
+*/
+typedef struct SpreadPage
+{
+    fz_display_list *list;
+    fz_matrix        ctm;
+    fz_irect         area;
+    unsigned char   *out;   // where the top row of `area` goes
+    int              top;   // which row of the spread that is
+    bool             drawn;
+} SpreadPage;
+
+typedef struct SpreadJob
+{
+    Pdf           *pdf;
+    SpreadPage     pages[2];
+    PixelFormat    format;
+    int            outStride;
+    volatile LONG  next;
+} SpreadJob;
+
+// draws whichever of the pages nobody has taken yet, until there are none left
+static void drawSpreadPages(SpreadJob *job, fz_context *ctx)
+{
+    int index;
+    while ((index = (int)InterlockedIncrement(&job->next) - 1) < 2)
+    {
+        SpreadPage *page = &job->pages[index];
+        fz_try(ctx)
+        {
+            drawListInto(ctx, &job->pdf->stats, page->list, page->ctm, page->area, job->format, page->out, job->outStride, NULL);
+            page->drawn = true;
+        }
+        fz_catch(ctx)
+        {
+            page->drawn = false;
+        }
+    }
+}
+
+static void runSpreadPage(void *userData)
+{
+    SpreadJob  *job = (SpreadJob*)userData;
+    fz_context *ctx = fz_clone_context(job->pdf->context);
+
+    // without a context of its own it leaves both to the calling thread
+    if (!ctx)
+        return;
+    drawSpreadPages(job, ctx);
+    fz_drop_context(ctx);
+}
+
+static float aspectRatio(fz_rect bounds)
+{
+    return (bounds.x1 - bounds.x0) / (bounds.y1 - bounds.y0);
+}
+
+/**
+* Gets the bounds of both pages of the spread starting at `startPageNumber`, along with their display lists (which the
+* caller has to drop, if `lists` isn't `NULL`). Fails if either can't be loaded, or is empty.
+*/
+static bool boundSpread(Pdf *pdf, fz_context *ctx, int startPageNumber, fz_rect bounds[2], fz_display_list *lists[2])
+{
+    fz_display_list *loaded[2] = { NULL, NULL };
+    bool             result    = true;
+    int              index;
+
+    for (index = 0; index < 2 && result; index++)
+    {
+        loaded[index] = loadDisplayList(pdf, ctx, startPageNumber + index);
+        if (!loaded[index])
+        {
+            result = false;
+            break;
+        }
+
+        fz_try(ctx)
+            bounds[index] = fz_bound_display_list(ctx, loaded[index]);
+        fz_catch(ctx)
+            result = false;
+        if (result && fz_is_empty_rect(bounds[index]))
+            result = false;
+    }
+
+    for (index = 0; index < 2; index++)
+    {
+        if (result && lists)
+            lists[index] = loaded[index];
+        else if (loaded[index])
+            fz_drop_display_list(ctx, loaded[index]);
+    }
+    return result;
+}
+
+/**
+* Works out where both pages of a spread go in `outBuffer`: scaled to the same height, as tall as the two of them fit next
+* to each other however different their shapes are. Rounding can make one a pixel shorter than the other, so they're
+* lined up along the middle, and the rows above and below are cleared to nothing.
+* Fills in everything of `pages` but `list` and `drawn`.
+*/
+static void layoutSpread(const fz_rect bounds[2], int availableWidth, int availableHeight, PixelFormat format, unsigned char *outBuffer, int outStride, SpreadPage pages[2], int *spreadWidth, int *spreadHeight)
+{
+    int   bytes  = PixelFormat_bytes(format);
+    float height = min((float)availableHeight, availableWidth / (aspectRatio(bounds[0]) + aspectRatio(bounds[1])));
+    int   width  = 0;
+    int   rows   = 0;
+    int   index, y;
+
+    for (index = 0; index < 2; index++)
+    {
+        SpreadPage *page = &pages[index];
+        float       zoom = height / (bounds[index].y1 - bounds[index].y0);
+
+        page->ctm  = fz_scale(zoom, zoom);
+        page->area = fz_round_rect(fz_transform_rect(bounds[index], page->ctm));
+        page->area.x1 = min(page->area.x1, page->area.x0 + availableWidth - width);
+        page->area.y1 = min(page->area.y1, page->area.y0 + availableHeight);
+        page->out  = outBuffer + (size_t)width * bytes;
+
+        width += max(0, page->area.x1 - page->area.x0);
+        rows   = max(rows, page->area.y1 - page->area.y0);
+    }
+
+    for (index = 0; index < 2; index++)
+    {
+        SpreadPage *page      = &pages[index];
+        int         pageWidth = max(0, page->area.x1 - page->area.x0);
+        int         pageRows  = max(0, page->area.y1 - page->area.y0);
+
+        page->top = (rows - pageRows) / 2;
+        for (y = 0; y < rows; y++)
+            if (y < page->top || y >= page->top + pageRows)
+                memset(page->out + (size_t)y * outStride, 0, (size_t)pageWidth * bytes);
+        page->out += (size_t)page->top * outStride;
+    }
+
+    *spreadWidth  = width;
+    *spreadHeight = rows;
+}
+
+/**
+* Renders 2 pages side by side, see `Pdf_get2PagesFittedBGRA` for the details.
+*
+* Both pages are bounded first, so they can be laid out next to each other (see `layoutSpread`). Then they're drawn at
+* the same time, one by a worker and one by the calling thread (or both by the calling thread, if the workers are all busy).
+*/
+static int render2PagesFitted(Pdf *pdf, fz_context *ctx, int startPageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, PixelFormat format, unsigned char *outBuffer, int outStride)
+{
+    fz_display_list *lists[2] = { NULL, NULL };
+    fz_rect          bounds[2];
+    SpreadJob        job;
+    int              spreadWidth  = 0;
+    int              spreadHeight = 0;
+    int              index;
+
+    if (!boundSpread(pdf, ctx, startPageNumber, bounds, lists))
+        return false;
+
+    memset(&job, 0, sizeof(job));
+    job.pdf       = pdf;
+    job.format    = format;
+    job.outStride = outStride;
+
+    layoutSpread(bounds, availableWidth, availableHeight, format, outBuffer, outStride, job.pages, &spreadWidth, &spreadHeight);
+    job.pages[0].list = lists[0];
+    job.pages[1].list = lists[1];
+
+    Workers_submit(&job, runSpreadPage, NULL, &job);
+    drawSpreadPages(&job, ctx);
+    // the job lives on this thread's stack, so the worker has to be done with it (or never start it) before returning
+    Workers_cancel(&job);
+    Workers_wait(&job);
+
+    for (index = 0; index < 2; index++)
+        fz_drop_display_list(ctx, lists[index]);
+
+    if (!job.pages[0].drawn || !job.pages[1].drawn)
+        return false;
+
+    if (resultingWidth)  *resultingWidth  = spreadWidth;
+    if (resultingHeight) *resultingHeight = spreadHeight;
+    return true;
+}
+
+
+/**
+* Works out whether the spread starting at `startPageNumber` really is 2 pages (returns 2), or whether the first page
+* has to be shown on its own (returns 1): because there is no second page, or because either of them is a double page
+* spread already, which would leave the other one squashed next to it.
+*/
+static int spreadPageCount(Pdf *pdf, fz_context *ctx, int startPageNumber)
+{
+    fz_rect bounds[2];
+    float   ratios[2];
+
+    if (pdf->pageCount >= 0 && startPageNumber + 1 >= pdf->pageCount)
+        return 1;
+    if (!boundSpread(pdf, ctx, startPageNumber, bounds, NULL))
+        return 1;
+
+    ratios[0] = aspectRatio(bounds[0]);
+    ratios[1] = aspectRatio(bounds[1]);
+    if (ratios[0] > ratios[1] * MERGED_SPREAD_RATIO || ratios[1] > ratios[0] * MERGED_SPREAD_RATIO)
+        return 1;
+    return 2;
+}
+
+
+// what pages get shown as, BGRA, or gray for books without any colour in them. these go through the caches and steer
+// prefetching, anything else is a one off, e.g., for saving a page to a file
+static bool isShownFormat(PixelFormat format)
+{
+    return format == PIXEL_FORMAT_BGRA || format == PIXEL_FORMAT_GRAY;
+}
+
+
+/**
+* Renders whatever `key` describes as `format` into `outBuffer`, with rows `outStride` bytes apart, using the context `ctx`
+* which must be a clone of `pdf->context` belonging to the calling thread.
+* The resulting dimensions are clamped to the available space.
+* Pages that get shown (see `isShownFormat`) of documents opened from a file are looked for in the disk cache first, and
+* kept there once rendered.
+*/
+int renderFitted(Pdf *pdf, fz_context *ctx, const PageKey *key, PixelFormat format, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride)
+{
+    int  result;
+    int  width  = 0;
+    int  height = 0;
+    bool onDisk = (isShownFormat(format) && pdf->diskId != 0);
+
+    if (onDisk && DiskCache_get(pdf->diskId, key, format, &width, &height, outBuffer, outStride))
+    {
+        Stats_count(&pdf->stats, STAT_DISKCACHE_HIT);
+        if (resultingWidth)  *resultingWidth  = width;
+        if (resultingHeight) *resultingHeight = height;
+        return true;
+    }
+    if (onDisk)
+        Stats_count(&pdf->stats, STAT_DISKCACHE_MISS);
+
+    if (key->pageCount == 1)
+        result = renderPageFitted(pdf, ctx, key->pageNumber, key->availableWidth, key->availableHeight, &width, &height, format, outBuffer, outStride);
+    else
+        result = render2PagesFitted(pdf, ctx, key->pageNumber, key->availableWidth, key->availableHeight, &width, &height, format, outBuffer, outStride);
+
+    width  = min(width, key->availableWidth);
+    height = min(height, key->availableHeight);
+    if (result && onDisk)
+        DiskCache_put(pdf->diskId, key, format, width, height, outBuffer, outStride);
+
+    if (resultingWidth)  *resultingWidth  = width;
+    if (resultingHeight) *resultingHeight = height;
+
+    return result;
+}
+
+
+/**
+* What all of the fitted exports boil down to: one page (or two side by side) scaled to fit, as `format`, into the caller's
+* buffer with rows `outStride` bytes apart.
+* BGRA and gray are what get shown, so they go through the cache: look there first, and only render if the page isn't there.
+* Whatever gets rendered is also put in the cache, so flipping back to it later is cheap, and it's what prefetching works
+* from (in the same format). Any other format is simply rendered.
+*/
+static int getFitted(Pdf *pdf, int pageNumber, int pageCount, PixelFormat format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride)
+{
+    PageKey         key    = { pageNumber, pageCount, availableWidth, availableHeight, format };
+    int             width  = 0;
+    int             height = 0;
+    PageCacheResult cached = PAGECACHE_MISS;
+
+    if (!pdf || (pageCount != 1 && pageCount != 2) || !checkBuffer(format, availableWidth, availableHeight, outBuffer, outStride))
+        return false;
+
+    if (isShownFormat(format))
+    {
+        AcquireSRWLockExclusive(&pdf->requestLock);
+        pdf->lastRequest = key;
+        pdf->lastSpreads = false;
+        ReleaseSRWLockExclusive(&pdf->requestLock);
+
+        cached = PageCache_acquire(&pdf->cache, &key, &width, &height, outBuffer, outStride);
+        Stats_count(&pdf->stats, (cached == PAGECACHE_HIT) ? STAT_PAGECACHE_HIT : STAT_PAGECACHE_MISS);
+    }
+    if (cached != PAGECACHE_HIT)
+    {
+        fz_context *ctx    = fz_clone_context(pdf->context);
+        int         result = ctx && renderFitted(pdf, ctx, &key, format, &width, &height, outBuffer, outStride);
+
+        if (ctx) fz_drop_context(ctx);
+        if (!result)
+        {
+            if (cached == PAGECACHE_CLAIMED) PageCache_abandon(&pdf->cache, &key);
+            return false;
+        }
+        if (cached == PAGECACHE_CLAIMED) PageCache_fill(&pdf->cache, &key, width, height, outBuffer, outStride);
+    }
+
+    if (resultingWidth)  *resultingWidth  = width;
+    if (resultingHeight) *resultingHeight = height;
+
+    return true;
+}
+
+
+/**
+* This will scale a page to fit the available space specified and return it as BGRA (where alpha will always be 255).
+* It keeps the original aspect ratio of the page, so the resulting buffer might end up with space to the right, or bottom.
+* If `resultingWidth` and `resultingHeight` are non `NULL`, then they will be set to the actual dimensions of the contents within the buffer.
+* If you like, you can then e.g., zero out the unused contents
+* 
+* If the page was prefetched (see `Pdf_prefetch`) at the same size, this is just a copy out of the cache.
+* 
+* NOTE! do NOT use the same width and height variables for specifying the available space and the resulting space, things will go wrong.
+*/
+__declspec(dllexport) int __cdecl Pdf_getPageFittedBGRA(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer)
+{
+    return getFitted(pdf, pageNumber, 1, PIXEL_FORMAT_BGRA, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, packedStride(PIXEL_FORMAT_BGRA, availableWidth));
+}
+
+
+/**
+* This will scale 2 pages to fit the available space specified and return it as BGRA (where alpha will always be 255).
+* It keeps the original aspect ratio of the pages, so the resulting buffer might end up with space to the right, or bottom.
+* If `resultingWidth` and `resultingHeight` are non `NULL`, then they will be set to the actual dimensions of the contents within the buffer.
+* If you like, you can then e.g., zero out the unused contents
+* 
+* Both pages are scaled to the same height, so a page that's a different shape from the other (e.g., two pages stuck together as a
+* single page in a comic book) gets the width it needs rather than half, and they're drawn at the same time on 2 threads.
+* To show a page that's already a double page spread on its own instead, see `Pdf_getSpreadBGRA`.
+* 
+* NOTE! do NOT use the same width and height variables for specifying the available space and the resulting space, things will go wrong.
+*/
+__declspec(dllexport) int __cdecl Pdf_get2PagesFittedBGRA(Pdf *pdf, int startPageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer)
+{
+    return getFitted(pdf, startPageNumber, 2, PIXEL_FORMAT_BGRA, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, packedStride(PIXEL_FORMAT_BGRA, availableWidth));
+}
+
+
+// `getFitted` for a spread, see `Pdf_getSpreadBGRA`
+static int getSpread(Pdf *pdf, int startPageNumber, PixelFormat format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *shownPages)
+{
+    fz_context *ctx;
+    int         pageCount;
+    int         result;
+
+    if (shownPages) *shownPages = 0;
+    if (!pdf || !checkBuffer(format, availableWidth, availableHeight, outBuffer, outStride))
+        return false;
+
+    ctx = fz_clone_context(pdf->context);
+    if (!ctx)
+        return false;
+    pageCount = spreadPageCount(pdf, ctx, startPageNumber);
+    fz_drop_context(ctx);
+
+    result = getFitted(pdf, startPageNumber, pageCount, format, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, outStride);
+
+    if (isShownFormat(format))
+    {
+        AcquireSRWLockExclusive(&pdf->requestLock);
+        pdf->lastRequest.pageCount = 2;
+        pdf->lastSpreads = true;
+        ReleaseSRWLockExclusive(&pdf->requestLock);
+    }
+
+    if (result && shownPages) *shownPages = pageCount;
+    return result;
+}
+
+
+/**
+* For flipping through a book 2 pages at a time, where some of the pages might be double page spreads already (which is common
+* in comic books). It's `Pdf_get2PagesFittedBGRA`, unless either page is much wider than the other, or `startPageNumber` is
+* the last page, in which case it's `Pdf_getPageFittedBGRA` for `startPageNumber` on its own.
+* `shownPages` is set to how many pages it showed, 1 or 2, so the next spread starts at `startPageNumber + *shownPages`.
+*
+* Prefetching goes from spread to spread the same way, so it renders whatever the next few spreads really are.
+*/
+__declspec(dllexport) int __cdecl Pdf_getSpreadBGRA(Pdf *pdf, int startPageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int *shownPages)
+{
+    return getSpread(pdf, startPageNumber, PIXEL_FORMAT_BGRA, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, packedStride(PIXEL_FORMAT_BGRA, availableWidth), shownPages);
+}
+
+
+/**
+* `Pdf_getSpreadBGRA` as `format`, with rows `outStride` bytes apart, like `Pdf_getPageFittedPixels`.
+*/
+__declspec(dllexport) int __cdecl Pdf_getSpreadPixels(Pdf *pdf, int startPageNumber, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *shownPages)
+{
+    return getSpread(pdf, startPageNumber, (PixelFormat)format, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, outStride, shownPages);
+}
+
+
+/**
+* The one the others are made of: `pageCount` pages (1, or 2 side by side like `Pdf_get2PagesFittedBGRA`) scaled to fit the
+* available space, as `format` (0: BGRA, 1: RGBA, 2: RGB, 3: gray, like `Pdf_convertPixels`), into `outBuffer` whose rows
+* are `outStride` bytes apart, which has to be at least `availableWidth` pixels' worth. That's what lets it draw straight
+* into memory that isn't laid out the way we'd like, e.g., part of a bigger image, or mapped GPU staging memory.
+* Only the top left `resultingWidth x resultingHeight` gets written to, the rest of the buffer is left alone.
+* 
+* BGRA and gray go through the page cache (and steer prefetching, which then renders gray as well) like
+* `Pdf_getPageFittedBGRA` does, the other formats don't. Gray is a quarter of the memory (and of the copying and uploading)
+* of BGRA, which makes it the one to use for books that are only black and white, see `Pdf_isPageGray`.
+* 
+* NOTE! do NOT use the same width and height variables for specifying the available space and the resulting space, things will go wrong.
+*/
+__declspec(dllexport) int __cdecl Pdf_getPageFittedPixels(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride)
+{
+    return getFitted(pdf, pageNumber, pageCount, (PixelFormat)format, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, outStride);
+}
+
+
+/**
+* This will scale a page to fit the available space specified and return it as RGB, rows `availableWidth * 3` bytes apart.
+* It keeps the original aspect ratio of the page, so the resulting buffer might end up with space to the right, or bottom.
+* If `resultingWidth` and `resultingHeight` are non `NULL`, then they will be set to the actual dimensions of the contents within the buffer.
+* If you like, you can then e.g., zero out the unused contents
+* 
+* NOTE! do NOT use the same width and height variables for specifying the available space and the resulting space, things will go wrong.
+*/
+__declspec(dllexport) int __cdecl Pdf_getPageFittedRGB(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer)
+{
+    return getFitted(pdf, pageNumber, 1, PIXEL_FORMAT_RGB, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, packedStride(PIXEL_FORMAT_RGB, availableWidth));
+}
+
+
+/**
+* This gets a page from the PDF at 72dpi
+* 
+* Usage:
+*   call the function with `outBuffer` set to `NULL`
+*   `width` and `height` will be set to the required width and height of the document
+*   allocate a buffer of size `width * height * 3` and call the function again to have it populated with the contents of the page
+*/
+__declspec(dllexport) int __cdecl Pdf_getPageRGB(Pdf *pdf, int pageNumber, int *width, int *height, unsigned char *outBuffer)
+{
+    int              result = true;
+    fz_context      *ctx;
+    fz_display_list *list;
+
+    if (!pdf)
+        return false;
+
+    ctx = fz_clone_context(pdf->context);
+    if (!ctx)
+        return false;
+
+    list = loadDisplayList(pdf, ctx, pageNumber);
+    if (!list)
+    {
+        fz_drop_context(ctx);
+        return false;
+    }
+
+    fz_try(ctx)
+    {
+        const fz_matrix fz_identity = {1, 0, 0, 1, 0, 0};
+        fz_irect        area        = fz_round_rect(fz_bound_display_list(ctx, list));
+        int             pageWidth   = area.x1 - area.x0;
+        int             pageHeight  = area.y1 - area.y0;
+
+        if (!outBuffer)
+        {
+            if (width)  *width  = pageWidth;
+            if (height) *height = pageHeight;
+        }
+        else if (!checkBuffer(PIXEL_FORMAT_RGB, pageWidth, pageHeight, outBuffer, pageWidth * 3))
+        {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "page has no size");
+        }
+        else
+        {
+            // rows are exactly as wide as the page, as the size handed out by the first call says
+            drawListInto(ctx, &pdf->stats, list, fz_identity, area, PIXEL_FORMAT_RGB, outBuffer, pageWidth * 3, NULL);
+        }
+    }
+    fz_always(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx)
+    {
+        result = false;
+    }
+
+    fz_drop_context(ctx);
+    return result;
+}
+
+
+// the core of `Pdf_getPreviewBGRA`, in any format
+static int getPreview(Pdf *pdf, int pageNumber, int pageCount, PixelFormat format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *isFinal)
+{
+    PageKey        key         = { pageNumber, pageCount, availableWidth, availableHeight, format };
+    PageKey        previewKey  = key;
+    int            bytes       = PixelFormat_bytes(format);
+    int            width       = 0;
+    int            height      = 0;
+    int            result      = false;
+    fz_context    *ctx         = NULL;
+    unsigned char *preview     = NULL;
+
+    if (isFinal) *isFinal = false;
+    if (!pdf || (pageCount != 1 && pageCount != 2) || !checkBuffer(format, availableWidth, availableHeight, outBuffer, outStride))
+        return false;
+
+    if (PageCache_peek(&pdf->cache, &key, &width, &height, outBuffer, outStride))
+    {
+        if (resultingWidth)  *resultingWidth  = width;
+        if (resultingHeight) *resultingHeight = height;
+        if (isFinal)         *isFinal         = true;
+        return true;
+    }
+
+    previewKey.availableWidth  = max(1, availableWidth / PREVIEW_DIVISOR);
+    previewKey.availableHeight = max(1, availableHeight / PREVIEW_DIVISOR);
+
+    ctx     = fz_clone_context(pdf->context);
+    preview = (unsigned char*)malloc((size_t)previewKey.availableWidth * previewKey.availableHeight * bytes);
+
+    if (ctx && preview && renderFitted(pdf, ctx, &previewKey, format, &width, &height, preview, previewKey.availableWidth * bytes))
+    {
+        int stretchedWidth  = min(availableWidth, width * PREVIEW_DIVISOR);
+        int stretchedHeight = min(availableHeight, height * PREVIEW_DIVISOR);
+
+        result = Scale_bilinear(bytes, preview, width, height, previewKey.availableWidth * bytes, outBuffer, stretchedWidth, stretchedHeight, outStride);
+
+        if (resultingWidth)  *resultingWidth  = stretchedWidth;
+        if (resultingHeight) *resultingHeight = stretchedHeight;
+    }
+
+    free(preview);
+    if (ctx) fz_drop_context(ctx);
+
+    return result;
+}
+
+
+/**
+* This gives a quick, blurry version of what `Pdf_getPageFittedBGRA` (`pageCount` 1) or `Pdf_get2PagesFittedBGRA` (`pageCount` 2)
+* would give, to show while the real thing renders, e.g., when jumping to a page far away.
+* It's rendered at a quarter of the size and then stretched up to cover (roughly) the same area the full render will.
+* 
+* If the page is already in the cache at full resolution then you get that instead, and `isFinal` is set to 1,
+* meaning there's no need to render it again.
+* 
+* Usage:
+*   call this, show the result
+*   if `isFinal` is 0, call the `Fitted` function for the real thing (on another thread, if you don't want to wait) and show that
+*/
+__declspec(dllexport) int __cdecl Pdf_getPreviewBGRA(Pdf *pdf, int pageNumber, int pageCount, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int *isFinal)
+{
+    return getPreview(pdf, pageNumber, pageCount, PIXEL_FORMAT_BGRA, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, packedStride(PIXEL_FORMAT_BGRA, availableWidth), isFinal);
+}
+
+
+/**
+* `Pdf_getPreviewBGRA` as `format`, with rows `outStride` bytes apart, for previews of what `Pdf_getPageFittedPixels` gives.
+*/
+__declspec(dllexport) int __cdecl Pdf_getPreviewPixels(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *isFinal)
+{
+    return getPreview(pdf, pageNumber, pageCount, (PixelFormat)format, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, outStride, isFinal);
+}
+
+
+/**
+* The preview for `Pdf_getSpreadPixels`: works out first whether the spread really is 2 pages, the same way, so a double
+* page spread isn't previewed squashed next to the page after it. `shownPages` is set to how many pages it previewed.
+*/
+__declspec(dllexport) int __cdecl Pdf_getSpreadPreviewPixels(Pdf *pdf, int startPageNumber, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *isFinal, int *shownPages)
+{
+    fz_context *ctx;
+    int         pageCount;
+
+    if (isFinal)    *isFinal    = false;
+    if (shownPages) *shownPages = 0;
+    if (!pdf)
+        return false;
+
+    ctx = fz_clone_context(pdf->context);
+    if (!ctx)
+        return false;
+    pageCount = spreadPageCount(pdf, ctx, startPageNumber);
+    fz_drop_context(ctx);
+
+    if (!getPreview(pdf, startPageNumber, pageCount, (PixelFormat)format, availableWidth, availableHeight, resultingWidth, resultingHeight, outBuffer, outStride, isFinal))
+        return false;
+    if (shownPages) *shownPages = pageCount;
+    return true;
+}
+
+
+/**
+* Gets the size of a page in points (1/72 of an inch), i.e., its size in pixels when rendered at a zoom of 1.
+* Handy for working out how many tiles `Pdf_renderTile` needs to cover a page.
+*/
+__declspec(dllexport) int __cdecl Pdf_getPageSize(Pdf *pdf, int pageNumber, float *width, float *height)
+{
+    fz_context      *ctx;
+    fz_display_list *list;
+    fz_rect          bbox;
+
+    if (!pdf)
+        return false;
+
+    ctx = fz_clone_context(pdf->context);
+    if (!ctx)
+        return false;
+
+    list = loadDisplayList(pdf, ctx, pageNumber);
+    if (!list)
+    {
+        fz_drop_context(ctx);
+        return false;
+    }
+
+    bbox = fz_bound_display_list(ctx, list);
+    if (width)  *width  = bbox.x1 - bbox.x0;
+    if (height) *height = bbox.y1 - bbox.y0;
+
+    fz_drop_display_list(ctx, list);
+    fz_drop_context(ctx);
+    return true;
+}
+
+
+/**
+* Finds out whether a page has any colour on it, setting `isGray` to 1 if it doesn't, in which case rendering it gray
+* (see `Pdf_getPageFittedPixels`) looks exactly the same as BGRA, for a quarter of the memory. Text, lines, fills,
+* images and shadings all count, anything within a hair (`GRAY_THRESHOLD`) of gray is gray, since scans are never
+* perfectly neutral. It stops at the first bit of colour, so a colourful page is quick to rule out.
+* 
+* The page gets loaded the same way rendering it does (and cached like that), so checking a page that's about to be
+* shown costs very little on top.
+* 
+* Usage: check a few pages spread through the book, and only show it gray if none of them have colour.
+*/
+__declspec(dllexport) int __cdecl Pdf_isPageGray(Pdf *pdf, int pageNumber, int *isGray)
+{
+    const fz_matrix  fz_identity = {1, 0, 0, 1, 0, 0};
+    int              result      = true;
+    int              isColor     = 0;
+    fz_context      *ctx;
+    fz_display_list *list;
+    fz_device       *dev         = NULL;
+
+    if (!pdf || !isGray)
+        return false;
+
+    ctx = fz_clone_context(pdf->context);
+    if (!ctx)
+        return false;
+
+    list = loadDisplayList(pdf, ctx, pageNumber);
+    if (!list)
+    {
+        fz_drop_context(ctx);
+        return false;
+    }
+
+    fz_var(dev);
+    fz_try(ctx)
+    {
+        dev = fz_new_test_device(ctx, &isColor, GRAY_THRESHOLD, FZ_TEST_OPT_IMAGES | FZ_TEST_OPT_SHADINGS, NULL);
+        fz_run_display_list(ctx, list, dev, fz_identity, fz_bound_display_list(ctx, list), NULL);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_device(ctx, dev);
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx)
+    {
+        // the test device stops everything by throwing as soon as it sees colour
+        result = (isColor != 0);
+    }
+
+    fz_drop_context(ctx);
+    if (result)
+        *isGray = !isColor;
+    return result;
+}
+
+
+/**
+* Renders one rectangle of a page as BGRA, for when the page is too big (or zoomed in too far) to render all of it.
+* Think of the whole page drawn at `zoom` (1 is 72dpi, so the page is `Pdf_getPageSize` pixels big), with its top left
+* corner at 0,0: this draws the `tileWidth x tileHeight` pixels starting at `tileX,tileY` of that into `outBuffer`,
+* whose rows are `outStride` bytes apart. Anything past the edge of the page is white.
+* 
+* Only the tile gets rasterised, so the cost depends on the size of the tile, not on the size of the page times the zoom.
+* The page itself only gets parsed once (see `loadDisplayList`), no matter how many tiles are drawn from it.
+* Tiles can be rendered on several threads at the same time.
+*/
+__declspec(dllexport) int __cdecl Pdf_renderTile(Pdf *pdf, int pageNumber, float zoom, int tileX, int tileY, int tileWidth, int tileHeight, unsigned char *outBuffer, int outStride)
+{
+    int              result = true;
+    fz_context      *ctx;
+    fz_display_list *list;
+    fz_irect         area;
+
+    if (!pdf || !(zoom > 0) || !checkBuffer(PIXEL_FORMAT_BGRA, tileWidth, tileHeight, outBuffer, outStride))
+        return false;
+    // the far edge of the tile has to be a pixel too
+    if (tileX > INT_MAX - tileWidth || tileY > INT_MAX - tileHeight)
+        return false;
+
+    ctx = fz_clone_context(pdf->context);
+    if (!ctx)
+        return false;
+
+    list = loadDisplayList(pdf, ctx, pageNumber);
+    if (!list)
+    {
+        fz_drop_context(ctx);
+        return false;
+    }
+
+    area.x0 = tileX;
+    area.y0 = tileY;
+    area.x1 = tileX + tileWidth;
+    area.y1 = tileY + tileHeight;
+
+    fz_try(ctx)
+    {
+        fz_rect   bbox       = fz_bound_display_list(ctx, list);
+        fz_matrix viewMatrix = fz_concat(fz_translate(-bbox.x0, -bbox.y0), fz_scale(zoom, zoom));
+
+        drawListInto(ctx, &pdf->stats, list, viewMatrix, area, PIXEL_FORMAT_BGRA, outBuffer, outStride, NULL);
+    }
+    fz_always(ctx)
+    {
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx)
+    {
+        result = false;
+    }
+
+    fz_drop_context(ctx);
+    return result;
+}
+
+
+typedef struct AtlasJob
+{
+    Pdf            *pdf;
+    PdfAtlasPage   *pages;
+    int             pageCount;
+    unsigned char  *atlas;
+    int             atlasStride;
+    volatile LONG   next;
+    volatile LONG   failed;
+} AtlasJob;
+
+// renders whichever of the pages nobody has taken yet, until there are none left
+static void renderAtlasPages(AtlasJob *job, fz_context *ctx)
+{
+    Pdf *pdf = job->pdf;
+    int  index;
+
+    while ((index = (int)InterlockedIncrement(&job->next) - 1) < job->pageCount)
+    {
+        PdfAtlasPage    *page   = &job->pages[index];
+        PageKey          key    = { page->pageNumber, 1, page->width, page->height };
+        unsigned char   *out    = job->atlas + (size_t)page->y * job->atlasStride + (size_t)page->x * 4;
+        fz_display_list *list;
+
+        page->success = false;
+
+        // shown (or prefetched) at exactly this size already
+        if (PageCache_peek(&pdf->cache, &key, &page->resultingWidth, &page->resultingHeight, out, job->atlasStride))
+        {
+            page->success = true;
+            continue;
+        }
+
+        list = loadPageList(pdf, ctx, page->pageNumber, false);
+        if (list)
+            page->success = drawListFitted(pdf, ctx, list, page->width, page->height, &page->resultingWidth, &page->resultingHeight, PIXEL_FORMAT_BGRA, out, job->atlasStride);
+        if (!page->success)
+            InterlockedIncrement(&job->failed);
+    }
+}
+
+static void runAtlasPages(void *userData)
+{
+    AtlasJob   *job = (AtlasJob*)userData;
+    fz_context *ctx = fz_clone_context(job->pdf->context);
+
+    // the others (or the calling thread) get to do its share
+    if (!ctx)
+        return;
+    renderAtlasPages(job, ctx);
+    fz_drop_context(ctx);
+}
+
+/**
+* Renders lots of pages in one go, each scaled to fit its own rectangle of one big BGRA buffer (`atlasHeight` rows,
+* `atlasStride` bytes apart), e.g., all the thumbnails of a book for an overview, or a strip of them for a carousel.
+* Each entry of `pages` says which page goes where: its top left at `x,y` in the atlas, fitted into `width x height`.
+* Like `Pdf_getPageFittedBGRA` the page is drawn at the top left of its rectangle, and the rest of the rectangle is left
+* alone. The rectangles must not overlap, and must lie inside the atlas, if any of them doesn't nothing is drawn.
+* For every entry, `success` is set, and if it worked, `resultingWidth` and `resultingHeight` as well.
+* Returns true if every page rendered.
+*
+* The pages are spread over the worker threads (see `Pdf_setWorkerCount`) and the calling thread, which does its share
+* too, and the call only returns once they're all done. Loading the pages still happens one at a time, but everything
+* else happens in parallel. Thumbnails don't go into the caches, so they don't push out the pages being read, but any
+* page that's already in the page cache at exactly that size is just copied.
+*
+* Usage:
+*   PdfAtlasPage pages[COLUMNS * ROWS];
+*   for (index = 0; index < COLUMNS * ROWS; index++)
+*   {
+*       pages[index].pageNumber = index;
+*       pages[index].x          = (index % COLUMNS) * THUMB_WIDTH;
+*       pages[index].y          = (index / COLUMNS) * THUMB_HEIGHT;
+*       pages[index].width      = THUMB_WIDTH;
+*       pages[index].height     = THUMB_HEIGHT;
+*   }
+*   Pdf_renderAtlasBGRA(pdf, pages, COLUMNS * ROWS, atlas, COLUMNS * THUMB_WIDTH * 4, ROWS * THUMB_HEIGHT);
+*/
+__declspec(dllexport) int __cdecl Pdf_renderAtlasBGRA(Pdf *pdf, PdfAtlasPage *pages, int pageCount, unsigned char *atlas, int atlasStride, int atlasHeight)
+{
+    AtlasJob    job;
+    fz_context *ctx;
+    int         helpers;
+    int         index;
+
+    if (!pdf || !pages || pageCount <= 0 || !atlas || atlasStride <= 0 || atlasHeight <= 0)
+        return false;
+
+    for (index = 0; index < pageCount; index++)
+    {
+        PdfAtlasPage *page = &pages[index];
+        // (x + width) * 4 has to fit in the stride, and y + height in the rows, worked out without overflowing
+        if (page->x < 0 || page->y < 0 || page->width <= 0 || page->height <= 0 || page->width > atlasStride / 4 || page->x > atlasStride / 4 - page->width)
+            return false;
+        if (page->height > atlasHeight || page->y > atlasHeight - page->height)
+            return false;
+    }
+
+    ctx = fz_clone_context(pdf->context);
+    if (!ctx)
+        return false;
+
+    memset(&job, 0, sizeof(job));
+    job.pdf         = pdf;
+    job.pages       = pages;
+    job.pageCount   = pageCount;
+    job.atlas       = atlas;
+    job.atlasStride = atlasStride;
+
+    // no point asking for more help than there are pages left over for
+    helpers = min(Workers_count(), pageCount - 1);
+    for (index = 0; index < helpers; index++)
+        Workers_submit(&job, runAtlasPages, NULL, &job);
+
+    renderAtlasPages(&job, ctx);
+    // the job lives on this thread's stack, so the workers have to be done with it (or never start it) before returning
+    Workers_cancel(&job);
+    Workers_wait(&job);
+
+    fz_drop_context(ctx);
+    return job.failed == 0;
+}
+
+
+// the first band of a job is this many rows, after that they're sized to fit what's left of the budget
+#define FIRST_BAND_ROWS 16
+// but never thinner than this, every band goes through the whole display list to find what's in it
+#define MIN_BAND_ROWS   4
+
+typedef enum RenderStage
+{
+    STAGE_LOADING = 0,  // the page(s) are being loaded into display lists
+    STAGE_LOADED,
+    STAGE_FAILED,
+} RenderStage;
+
+struct PdfRenderJob
+{
+    Pdf           *pdf;
+    fz_context    *ctx;
+    PageKey        key;        // only once a spread is loaded is it known how many pages it is
+    bool           spread;
+    PixelFormat    format;
+    unsigned char *out;
+    int            outStride;
+
+    // the caller's, and the worker's while it's loading it, whoever lets go last frees it
+    volatile LONG  references;
+    volatile LONG  stage;
+    bool           queued;     // the loading went to a worker, otherwise `Pdf_continueRender` does it
+    fz_rect        bounds[2];
+    SpreadPage     pages[2];
+    int            parts;
+
+    bool           placed;     // where the page(s) go in `out` is worked out
+    bool           cached;     // it was in the page cache, so it's all there already
+    int            width;
+    int            height;
+    int            rowsDone;
+    bool           finished;
+    LONGLONG       ticksPerSecond;
+    LONGLONG       ticksPerRow;  // how long a row took so far, 0 until the first band is done
+    fz_cookie      cookie;
+};
+
+static void releaseRender(PdfRenderJob *job)
+{
+    int index;
+
+    if (InterlockedDecrement(&job->references) > 0)
+        return;
+
+    for (index = 0; index < job->parts; index++)
+        fz_drop_display_list(job->ctx, job->pages[index].list);
+    fz_drop_context(job->ctx);
+    free(job);
+}
+
+/**
+* The part of a job that can't be done a band at a time: loading the page(s), which is all of the parsing.
+* This doesn't touch the caller's buffer, so the caller can end the job (and reuse the buffer) while a worker's at it.
+*/
+static bool loadRender(PdfRenderJob *job, fz_context *ctx)
+{
+    Pdf     *pdf = job->pdf;
+    PageKey *key = &job->key;
+
+    if (job->spread)
+        key->pageCount = spreadPageCount(pdf, ctx, key->pageNumber);
+
+    if (key->pageCount == 2)
+    {
+        fz_display_list *lists[2];
+
+        if (!boundSpread(pdf, ctx, key->pageNumber, job->bounds, lists))
+            return false;
+        job->pages[0].list = lists[0];
+        job->pages[1].list = lists[1];
+        job->parts = 2;
+        return true;
+    }
+
+    job->pages[0].list = loadDisplayList(pdf, ctx, key->pageNumber);
+    if (!job->pages[0].list)
+        return false;
+    job->parts = 1;
+
+    fz_try(ctx)
+        job->bounds[0] = fz_bound_display_list(ctx, job->pages[0].list);
+    fz_catch(ctx)
+        return false;
+    return true;
+}
+
+static void runRenderLoad(void *userData)
+{
+    PdfRenderJob *job    = (PdfRenderJob*)userData;
+    fz_context   *ctx    = job->cookie.abort ? NULL : fz_clone_context(job->pdf->context);
+    bool          loaded = ctx && loadRender(job, ctx);
+
+    if (ctx) fz_drop_context(ctx);
+    InterlockedExchange(&job->stage, loaded ? STAGE_LOADED : STAGE_FAILED);
+    releaseRender(job);
+}
+
+static void discardRenderLoad(void *userData)
+{
+    PdfRenderJob *job = (PdfRenderJob*)userData;
+
+    InterlockedExchange(&job->stage, STAGE_FAILED);
+    releaseRender(job);
+}
+
+/**
+* Looks for what the job is after in the page cache, and if it's there, copies it into the caller's buffer and that's it.
+*/
+static bool peekRender(PdfRenderJob *job)
+{
+    if (!isShownFormat(job->format))
+        return false;
+
+    job->cached = PageCache_peek(&job->pdf->cache, &job->key, &job->width, &job->height, job->out, job->outStride);
+    Stats_count(&job->pdf->stats, job->cached ? STAT_PAGECACHE_HIT : STAT_PAGECACHE_MISS);
+    if (job->cached)
+    {
+        job->placed   = true;
+        job->rowsDone = job->height;
+    }
+    return job->cached;
+}
+
+/**
+* Works out where the loaded page(s) go in the caller's buffer. A single page was already looked for in the page cache
+* by `Pdf_beginRender`, a spread can only be looked for now that it's known how many pages it is.
+*/
+static void placeRender(PdfRenderJob *job)
+{
+    PageKey *key = &job->key;
+
+    if (job->spread && peekRender(job))
+        return;
+
+    job->placed = true;
+    if (job->parts == 2)
+    {
+        layoutSpread(job->bounds, key->availableWidth, key->availableHeight, job->format, job->out, job->outStride, job->pages, &job->width, &job->height);
+    }
+    else
+    {
+        SpreadPage *page = &job->pages[0];
+
+        page->ctm  = fitPage(job->bounds[0], key->availableWidth, key->availableHeight);
+        page->area = fz_round_rect(fz_transform_rect(job->bounds[0], page->ctm));
+        page->area.x1 = min(page->area.x1, page->area.x0 + key->availableWidth);
+        page->area.y1 = min(page->area.y1, page->area.y0 + key->availableHeight);
+        page->out  = job->out;
+        page->top  = 0;
+
+        job->width  = max(0, page->area.x1 - page->area.x0);
+        job->height = max(0, page->area.y1 - page->area.y0);
+    }
+}
+
+/**
+* Draws rows `firstRow` up to `lastRow` of whatever the job covers, each page only where it overlaps them.
+*/
+static void drawBand(PdfRenderJob *job, int firstRow, int lastRow)
+{
+    int index;
+
+    for (index = 0; index < job->parts; index++)
+    {
+        SpreadPage *page = &job->pages[index];
+        int         from = max(firstRow, page->top);
+        int         to   = min(lastRow, page->top + (page->area.y1 - page->area.y0));
+        fz_irect    band = page->area;
+
+        if (from >= to)
+            continue;
+        band.y0 = page->area.y0 + (from - page->top);
+        band.y1 = page->area.y0 + (to - page->top);
+        drawListInto(job->ctx, &job->pdf->stats, page->list, page->ctm, band, job->format, page->out + (size_t)(from - page->top) * job->outStride, job->outStride, &job->cookie);
+    }
+}
+
+/**
+* Starts drawing `pageCount` pages (1, or 2 for a spread like `Pdf_getSpreadPixels`) scaled to fit, as `format`, into
+* `outBuffer` (rows `outStride` bytes apart), a band of rows at a time, for hosts that can't afford to wait for a whole
+* page on the thread that draws their frames. It's `Pdf_getPageFittedPixels` (or `Pdf_getSpreadPixels`) split up:
+* `Pdf_continueRender` draws as many rows as fit in the time it's given, and says which ones are done so they can be
+* shown (or uploaded) straight away.
+*
+* Loading the page(s) can't be split up like that, it's all of the parsing (which for a heavy vector page can be most of
+* the work), so that's handed to a worker as soon as the job is made. A page that's in the page cache is simply copied.
+* Once it's all drawn it goes into the page cache like any other, but unlike `Pdf_getPageFittedPixels` it never touches
+* the disk cache, compressing a page can't be split up either.
+*
+* The job belongs to the caller, only one thread may call `Pdf_continueRender` on it at a time, `outBuffer` has to stay
+* put until `Pdf_endRender`, and every job of a `Pdf` has to be ended before the `Pdf` is destroyed.
+*
+* Usage:
+*   Pdf_beginRender(pdf, page, 1, 0, width, height, pixels, width * 4, &job);
+*   then, once a frame:
+*       if (!Pdf_continueRender(job, 2000, &progress))  ->  failed (or aborted), Pdf_endRender(job)
+*       upload rows progress.firstRow up to progress.rowsDone
+*       if (progress.done)                              ->  Pdf_endRender(job)
+*   and if the page isn't wanted any more, Pdf_endRender(job) right away
+*/
+__declspec(dllexport) int __cdecl Pdf_beginRender(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, unsigned char *outBuffer, int outStride, PdfRenderJob **newJob)
+{
+    PdfRenderJob  *job;
+    PageKey        key = { pageNumber, pageCount, availableWidth, availableHeight, format };
+    LARGE_INTEGER  frequency;
+
+    if (newJob)
+        *newJob = NULL;
+    if (!pdf || !newJob || (pageCount != 1 && pageCount != 2) || !checkBuffer((PixelFormat)format, availableWidth, availableHeight, outBuffer, outStride))
+        return false;
+
+    job = (PdfRenderJob*)calloc(1, sizeof(PdfRenderJob));
+    if (!job)
+        return false;
+    job->ctx = fz_clone_context(pdf->context);
+    if (!job->ctx)
+    {
+        free(job);
+        return false;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    job->pdf            = pdf;
+    job->key            = key;
+    job->spread         = (pageCount == 2);
+    job->format         = (PixelFormat)format;
+    job->out            = outBuffer;
+    job->outStride      = outStride;
+    job->references     = 1;
+    job->ticksPerSecond = frequency.QuadPart;
+
+    // prefetching goes on from here, like it does for the other ways of getting a page
+    if (isShownFormat(job->format))
+    {
+        AcquireSRWLockExclusive(&pdf->requestLock);
+        pdf->lastRequest = key;
+        pdf->lastSpreads = job->spread;
+        ReleaseSRWLockExclusive(&pdf->requestLock);
+    }
+
+    // a single page that's in the cache doesn't need loading, a spread has to be loaded to know how many pages it is
+    if (pageCount == 1 && peekRender(job))
+    {
+        job->stage = STAGE_LOADED;
+        *newJob = job;
+        return true;
+    }
+
+    // it's the document's, so destroying the document waits for it, and the caller doesn't have to. not under `pdf`
+    // itself though, the book might be shared, and another caller's `Pdf_prefetch` would cancel it
+    job->queued = Workers_count() > 0;
+    if (job->queued)
+    {
+        InterlockedIncrement(&job->references);
+        Workers_submit(&pdf->renderLoads, runRenderLoad, discardRenderLoad, job);
+    }
+
+    *newJob = job;
+    return true;
+}
+
+/**
+* Draws the next few bands of `job`, for about `budgetMicroseconds`, and fills in `progress`.
+* Every call gets somewhere (at least one band, however thin), and bands are sized by how long the ones before them
+* took, so a call stays within its budget unless a single band doesn't fit in it.
+* Until the page(s) are loaded (see `Pdf_beginRender`) there's nothing to draw, and `progress` says 0 rows, without
+* waiting for it. Without any workers the first call loads them itself, and draws nothing else.
+* Returns false if the job failed, or was aborted, after which it can only be ended.
+*/
+__declspec(dllexport) int __cdecl Pdf_continueRender(PdfRenderJob *job, int budgetMicroseconds, PdfRenderProgress *progress)
+{
+    LARGE_INTEGER now;
+    LONGLONG      deadline;
+    int           firstRow;
+    bool          drawn = false;
+
+    if (progress)
+        memset(progress, 0, sizeof(PdfRenderProgress));
+    if (!job || !progress || job->cookie.abort)
+        return false;
+
+    if (job->stage == STAGE_LOADING && !job->queued)
+    {
+        InterlockedExchange(&job->stage, loadRender(job, job->ctx) ? STAGE_LOADED : STAGE_FAILED);
+        drawn = true;
+    }
+    if (job->stage == STAGE_FAILED)
+        return false;
+    if (job->stage == STAGE_LOADING)
+        return true;
+
+    firstRow = job->rowsDone;
+    if (!job->placed)
+        placeRender(job);
+
+    QueryPerformanceCounter(&now);
+    deadline = now.QuadPart + (LONGLONG)budgetMicroseconds * job->ticksPerSecond / 1000000;
+    while (job->rowsDone < job->height)
+    {
+        LONGLONG started = now.QuadPart;
+        LONGLONG perRow;
+        int      rows    = FIRST_BAND_ROWS;
+
+        if (job->ticksPerRow > 0)
+        {
+            LONGLONG left = deadline - now.QuadPart;
+            rows = (left > 0) ? (int)min(left / job->ticksPerRow, (LONGLONG)job->height) : 0;
+        }
+        else if (drawn)
+        {
+            rows = 0;
+        }
+        if (rows < MIN_BAND_ROWS)
+        {
+            if (drawn)
+                break;
+            rows = MIN_BAND_ROWS;
+        }
+        rows = min(rows, job->height - job->rowsDone);
+
+        fz_try(job->ctx)
+            drawBand(job, job->rowsDone, job->rowsDone + rows);
+        fz_catch(job->ctx)
+        {
+            InterlockedExchange(&job->stage, STAGE_FAILED);
+            return false;
+        }
+        // the band was left half drawn
+        if (job->cookie.abort)
+            return false;
+
+        QueryPerformanceCounter(&now);
+        perRow = max(1, (now.QuadPart - started) / rows);
+        // weighted towards the latest band, pages are rarely as busy at the bottom as at the top
+        job->ticksPerRow = job->ticksPerRow ? (job->ticksPerRow + perRow) / 2 : perRow;
+        job->rowsDone += rows;
+        drawn = true;
+    }
+
+    if (job->rowsDone >= job->height && !job->finished)
+    {
+        job->finished = true;
+        // nobody else is rendering it, or has, so it can go straight in
+        if (!job->cached && isShownFormat(job->format) && PageCache_queue(&job->pdf->cache, &job->key) && PageCache_start(&job->pdf->cache, &job->key))
+            PageCache_fill(&job->pdf->cache, &job->key, job->width, job->height, job->out, job->outStride);
+    }
+
+    progress->resultingWidth  = job->width;
+    progress->resultingHeight = job->height;
+    progress->shownPages      = job->key.pageCount;
+    progress->firstRow        = firstRow;
+    progress->rowsDone        = job->rowsDone;
+    progress->errors          = job->cookie.errors;
+    progress->done            = job->finished;
+    return true;
+}
+
+/**
+* Stops `job` as soon as it can, and can be called from any thread: a band that's being drawn stops part way through
+* (through the `fz_cookie` it's drawn with), and if no worker got to loading the page(s) yet, none will.
+* A worker that's already loading them can't be stopped, but `Pdf_endRender` doesn't wait for it.
+* The job still has to be ended.
+*/
+__declspec(dllexport) int __cdecl Pdf_abortRender(PdfRenderJob *job)
+{
+    if (!job)
+        return false;
+
+    job->cookie.abort = 1;
+    return true;
+}
+
+/**
+* Lets go of `job`, finished or not, without waiting for anything: from here on nothing touches the caller's buffer.
+* Nothing else may be busy with it.
+*/
+__declspec(dllexport) int __cdecl Pdf_endRender(PdfRenderJob *job)
+{
+    if (!job)
+        return false;
+
+    Pdf_abortRender(job);
+    releaseRender(job);
+    return true;
+}
+
+
+typedef struct PrefetchJob
+{
+    Pdf     *pdf;
+    PageKey  key;
+} PrefetchJob;
+
+static void discardPrefetch(void *userData)
+{
+    PrefetchJob *job = (PrefetchJob*)userData;
+    PageCache_unqueue(&job->pdf->cache, &job->key);
+    free(job);
+}
+
+static void runPrefetch(void *userData)
+{
+    PrefetchJob   *job    = (PrefetchJob*)userData;
+    Pdf           *pdf    = job->pdf;
+    PixelFormat    format = (PixelFormat)job->key.format;
+    int            bytes  = PixelFormat_bytes(format);
+    int            stride = job->key.availableWidth * bytes;
+    int            width  = 0;
+    int            height = 0;
+    fz_context    *ctx    = NULL;
+    unsigned char *pixels = NULL;
+
+    // the foreground might have gotten to it first
+    if (!PageCache_start(&pdf->cache, &job->key))
+    {
+        free(job);
+        return;
+    }
+
+    ctx    = fz_clone_context(pdf->context);
+    pixels = (unsigned char*)calloc((size_t)stride * job->key.availableHeight, 1);
+
+    if (ctx && pixels && renderFitted(pdf, ctx, &job->key, format, &width, &height, pixels, stride) && width > 0 && height > 0)
+    {
+        // squash the rows together, the cache only wants the part that was drawn on
+        unsigned char *shrunk;
+        int            y;
+        for (y = 1; y < height; y++)
+            memmove(pixels + (size_t)y * width * bytes, pixels + (size_t)y * stride, (size_t)width * bytes);
+        shrunk = (unsigned char*)realloc(pixels, (size_t)width * height * bytes);
+        if (shrunk) pixels = shrunk;
+
+        PageCache_fillOwned(&pdf->cache, &job->key, width, height, pixels);
+        pixels = NULL;
+    }
+    else
+    {
+        PageCache_abandon(&pdf->cache, &job->key);
+    }
+
+    free(pixels);
+    if (ctx) fz_drop_context(ctx);
+    free(job);
+}
+
+static void queuePrefetch(Pdf *pdf, void *owner, const PageKey *layout, int pageNumber)
+{
+    PrefetchJob *job;
+    PageKey      key = *layout;
+
+    // while a lazily opened document is still being counted, pages past the end simply fail to render
+    if (pageNumber < 0 || (pdf->pageCount >= 0 && pageNumber + layout->pageCount > pdf->pageCount))
+        return;
+
+    key.pageNumber = pageNumber;
+    if (!PageCache_queue(&pdf->cache, &key))
+        return;
+
+    job = (PrefetchJob*)malloc(sizeof(PrefetchJob));
+    if (!job)
+    {
+        PageCache_unqueue(&pdf->cache, &key);
+        return;
+    }
+    job->pdf = pdf;
+    job->key = key;
+    Workers_submit(owner, runPrefetch, discardPrefetch, job);
+}
+
+
+// for spreads, where the pages around the current one are depends on how wide each of them is, which needs them loaded.
+// that's done on a worker too, which then queues the spreads it finds, closest ones first
+typedef struct PrefetchPlan
+{
+    Pdf     *pdf;
+    void    *owner;
+    PageKey  layout;
+    int      pageNumber;
+    int      radius;
+} PrefetchPlan;
+
+static void discardPrefetchPlan(void *userData)
+{
+    free(userData);
+}
+
+static void runPrefetchPlan(void *userData)
+{
+    PrefetchPlan *plan     = (PrefetchPlan*)userData;
+    Pdf          *pdf      = plan->pdf;
+    PageKey       layout   = plan->layout;
+    int           forward  = plan->pageNumber;
+    int           backward = plan->pageNumber;
+    int           distance;
+    fz_context   *ctx      = fz_clone_context(pdf->context);
+
+    if (!ctx)
+    {
+        free(plan);
+        return;
+    }
+
+    for (distance = 1; distance <= plan->radius; distance++)
+    {
+        // the next one starts right after however many pages this one shows
+        forward += spreadPageCount(pdf, ctx, forward);
+        layout.pageCount = spreadPageCount(pdf, ctx, forward);
+        queuePrefetch(pdf, plan->owner, &layout, forward);
+
+        // the one before is 2 pages back, unless those don't make a spread, then the page right before starts it
+        if (backward <= 0)
+            continue;
+        if (backward >= 2 && spreadPageCount(pdf, ctx, backward - 2) == 2)
+        {
+            backward -= 2;
+            layout.pageCount = 2;
+        }
+        else
+        {
+            backward -= 1;
+            layout.pageCount = 1;
+        }
+        queuePrefetch(pdf, plan->owner, &layout, backward);
+    }
+
+    fz_drop_context(ctx);
+    free(plan);
+}
+
+static void planPrefetch(Pdf *pdf, void *owner, const PageKey *layout, int pageNumber, int radius)
+{
+    PrefetchPlan *plan = (PrefetchPlan*)malloc(sizeof(PrefetchPlan));
+    if (!plan)
+        return;
+
+    plan->pdf        = pdf;
+    plan->owner      = owner;
+    plan->layout     = *layout;
+    plan->pageNumber = pageNumber;
+    plan->radius     = radius;
+    Workers_submit(owner, runPrefetchPlan, discardPrefetchPlan, plan);
+}
+
+// what both ways of prefetching come down to, everything is queued under `owner`, which is also what gets cancelled
+static void prefetchAround(Pdf *pdf, void *owner, const PageKey *layout, bool spreads, int pageNumber, int radius)
+{
+    int distance;
+
+    // whatever is still waiting was for a page we're no longer near
+    Workers_cancel(owner);
+
+    if (spreads)
+    {
+        if (radius > 0)
+            planPrefetch(pdf, owner, layout, pageNumber, radius);
+        return;
+    }
+
+    for (distance = 1; distance <= radius; distance++)
+    {
+        queuePrefetch(pdf, owner, layout, pageNumber + distance * layout->pageCount);
+        queuePrefetch(pdf, owner, layout, pageNumber - distance * layout->pageCount);
+    }
+}
+
+
+/**
+* Renders the pages around `pageNumber` in the background, so that flipping to them later is just a copy.
+* It uses the size, layout (1 or 2 pages) and format of the last `Pdf_getPageFittedBGRA`/`Pdf_get2PagesFittedBGRA` call
+* (or `Pdf_getPageFittedPixels` in BGRA or gray), and renders up to `radius` steps in either direction (a step being 2 pages
+* in 2 page mode, or a spread after `Pdf_getSpreadBGRA`), closest ones first, starting with the next page.
+* 
+* Anything still waiting from a previous call is thrown away, so just call it every time the page changes.
+* 
+* Usage:
+*   show a page with one of the `Fitted` functions as usual
+*   call this with the page you just showed
+*/
+__declspec(dllexport) int __cdecl Pdf_prefetch(Pdf *pdf, int pageNumber, int radius)
+{
+    PageKey layout;
+    bool    spreads;
+
+    if (!pdf || radius < 0)
+        return false;
+
+    AcquireSRWLockExclusive(&pdf->requestLock);
+    layout  = pdf->lastRequest;
+    spreads = pdf->lastSpreads;
+    ReleaseSRWLockExclusive(&pdf->requestLock);
+    if (layout.availableWidth <= 0 || layout.availableHeight <= 0)
+        return false;
+
+    prefetchAround(pdf, pdf, &layout, spreads, pageNumber, radius);
+    return true;
+}
+
+
+/**
+* A document shared by several callers (see `Pdf_create`) has one `Pdf_prefetch`, which goes by whatever any of them
+* asked for last, and cancels whatever the others queued. A prefetcher is one caller's own: `Pdf_prefetchLayout` takes
+* the layout from the caller, and only cancels what the same prefetcher queued before. The pages still go into the
+* document's page cache, which all of them share.
+* It has to be destroyed (see `Pdf_destroyPrefetcher`) before the caller destroys its `Pdf`.
+*
+* Usage:
+*   Pdf_createPrefetcher(pdf, &prefetcher);
+*   show a page with one of the `Fitted` functions as usual
+*   Pdf_prefetchLayout(prefetcher, page, 1, 0, 0, width, height, 2);
+*   ...
+*   Pdf_destroyPrefetcher(prefetcher);
+*   Pdf_destroy(pdf);
+*/
+__declspec(dllexport) int __cdecl Pdf_createPrefetcher(Pdf *pdf, PdfPrefetcher **newPrefetcher)
+{
+    PdfPrefetcher *prefetcher;
+
+    if (newPrefetcher)
+        *newPrefetcher = NULL;
+    if (!pdf || !newPrefetcher)
+        return false;
+
+    prefetcher = (PdfPrefetcher*)calloc(1, sizeof(PdfPrefetcher));
+    if (!prefetcher)
+        return false;
+    prefetcher->pdf = pdf;
+    *newPrefetcher = prefetcher;
+    return true;
+}
+
+
+/**
+* `Pdf_prefetch` for one caller, with the layout it shows pages in: `pageCount` pages (1, or 2 side by side), as spreads
+* like `Pdf_getSpreadPixels` if `spreads` is set, in `format` (BGRA or gray), fitted to `availableWidth x availableHeight`.
+*/
+__declspec(dllexport) int __cdecl Pdf_prefetchLayout(PdfPrefetcher *prefetcher, int pageNumber, int pageCount, int spreads, int format, int availableWidth, int availableHeight, int radius)
+{
+    PageKey layout = { pageNumber, pageCount, availableWidth, availableHeight, format };
+
+    if (!prefetcher || radius < 0 || (pageCount != 1 && pageCount != 2) || !isShownFormat((PixelFormat)format))
+        return false;
+    if (availableWidth <= 0 || availableHeight <= 0 || availableWidth > INT_MAX / PixelFormat_bytes((PixelFormat)format))
+        return false;
+
+    prefetchAround(prefetcher->pdf, prefetcher, &layout, spreads && pageCount == 2, pageNumber, radius);
+    return true;
+}
+
+
+/**
+* Throws away whatever `prefetcher` still has queued, waits for what's already rendering, and frees it.
+*/
+__declspec(dllexport) int __cdecl Pdf_destroyPrefetcher(PdfPrefetcher *prefetcher)
+{
+    if (!prefetcher)
+        return false;
+
+    Workers_cancel(prefetcher);
+    Workers_wait(prefetcher);
+    // a prefetch plan that was running queued its spreads after the cancel, and those never started
+    Workers_cancel(prefetcher);
+    free(prefetcher);
+    return true;
+}
+
+
+/**
+* Sets how many bytes of already rendered pages to keep around for this document, 0 turns the cache (and prefetching) off.
+* The default is 64MB, which is 16 pages at 1024x1024.
+*/
+__declspec(dllexport) int __cdecl Pdf_setCacheBudget(Pdf *pdf, size_t budgetBytes)
+{
+    if (!pdf)
+        return false;
+
+    PageCache_setBudget(&pdf->cache, budgetBytes);
+    return true;
+}
+
+
+/**
+* Sets how many pages to keep loaded (as display lists) for this document, 0 turns it off. The default is 32.
+* This is separate from `Pdf_setCacheBudget`, which keeps finished pixels around: a loaded page can be drawn again at
+* any size, or as part of a different layout, without parsing it again, but it still has to be drawn.
+*/
+__declspec(dllexport) int __cdecl Pdf_setDisplayListCacheSize(Pdf *pdf, int pages)
+{
+    if (!pdf || pages < 0)
+        return false;
+
+    ListCache_setCapacity(&pdf->lists, pdf->context, pages);
+    return true;
+}
+
+
+/**
+* Turns timing (see `Pdf_getStats`) on or off for a document, it's off to begin with.
+* Memory and cache counters don't cost anything worth mentioning, so they're always on.
+*/
+__declspec(dllexport) int __cdecl Pdf_enableStats(Pdf *pdf, int enabled)
+{
+    if (!pdf)
+        return false;
+
+    Stats_enable(&pdf->stats, !!enabled);
+    return true;
+}
+
+
+/**
+* Gets what a document has been up to: how often, and for how long in total (in microseconds), each step ran,
+* how often the page and display list caches had what was asked for, and how much memory MuPDF is using for it.
+* See `PdfStats` in mupdf2rgb.h for the layout, and `StatPhase` and `StatCounter` for what's in which slot.
+* 
+* Usage:
+*   call `Pdf_enableStats` once, after `Pdf_create`
+*   call this once a frame with `reset` set to 1, to get what happened since the last frame
+*/
+__declspec(dllexport) int __cdecl Pdf_getStats(Pdf *pdf, PdfStats *outStats, int reset)
+{
+    if (!pdf || !outStats)
+        return false;
+
+    Stats_read(&pdf->stats, outStats, !!reset);
+    return true;
+}
+
+
+/**
+* Sets how much MuPDF may keep cached (decoded images, fonts, parsed objects) for each document opened after this,
+* 0 means no limit. The default is 64MB, MuPDF can't change it for documents that are already open.
+*/
+__declspec(dllexport) int __cdecl Pdf_setStoreBudget(size_t bytes)
+{
+    storeBudget = bytes;
+    return true;
+}
+
+
+/**
+* Turns reading files (for documents opened with `Pdf_create` after this) through a memory mapping on or off, it's on by
+* default. A mapped file is read straight out of the system's file cache instead of being copied into MuPDF's buffers a
+* bit at a time, which makes opening and seeking around in big scans and archives a lot quicker. The catch is that
+* outside of Windows (which doesn't let anybody shrink a mapped file) something truncating the file while it's open
+* pulls the memory out from under MuPDF, which crashes, so turn it off if that could happen.
+*/
+__declspec(dllexport) int __cdecl Pdf_setFileMapping(int enabled)
+{
+    InterlockedExchange(&mapFiles, enabled ? 1 : 0);
+    return true;
+}
+
+
+/**
+* Sets a limit on how much memory MuPDF may use for all open documents together, 0 (the default) means no limit.
+* When a document gets to the limit, MuPDF throws whatever it can out of that document's caches, and only if that isn't
+* enough does the render fail. This doesn't include the rendered page cache, see `Pdf_setCacheBudget` for that.
+*/
+__declspec(dllexport) int __cdecl Pdf_setMemoryLimit(size_t bytes)
+{
+    Stats_setMemoryLimit(bytes);
+    return true;
+}
+
+
+/**
+* Keeps rendered pages (of documents opened from a file) in the file at `path`, which takes up `bytes` on disk, so the
+* next session that opens the same book shows them without rendering them again. Once it's full the oldest pages get
+* written over. Only one process at a time can use the same file, for any other this fails.
+* `NULL` or 0 turns it off (the default), changing the path or size starts over with the new file.
+* 
+* Usage: call it once at startup, pointing at somewhere like the user's local app data, 256MB or so is plenty.
+*/
+__declspec(dllexport) int __cdecl Pdf_setDiskCache(const char *path, size_t bytes)
+{
+    if (!path || !bytes)
+    {
+        DiskCache_close();
+        return true;
+    }
+    return DiskCache_open(path, bytes);
+}
+
+
+/**
+* Converts a block of pixels from one format to another, using SSE/AVX2/NEON when the CPU has it.
+* Formats are 0: BGRA, 1: RGBA, 2: RGB, 3: gray, and the supported conversions are RGB to BGRA or RGBA, gray to BGRA or RGBA,
+* and anything to itself. `srcStride` and `dstStride` are the number of bytes from the start of one row to the next.
+* 
+* Handy for turning `Pdf_getPageRGB` or `Pdf_getPageFittedRGB` output into something a texture can use.
+*/
+__declspec(dllexport) int __cdecl Pdf_convertPixels(int srcFormat, const unsigned char *src, int srcStride, int dstFormat, unsigned char *dst, int dstStride, int width, int height)
+{
+    if (!src || !dst || width < 0 || height < 0)
+        return false;
+    if (!PixelFormat_bytes((PixelFormat)srcFormat) || !PixelFormat_bytes((PixelFormat)dstFormat))
+        return false;
+    // nothing to convert is fine, otherwise both strides have to hold a row
+    if (width > 0 && height > 0 && (!checkBuffer((PixelFormat)srcFormat, width, height, src, srcStride) || !checkBuffer((PixelFormat)dstFormat, width, height, dst, dstStride)))
+        return false;
+
+    return Convert_pixels((PixelFormat)srcFormat, src, srcStride, (PixelFormat)dstFormat, dst, dstStride, width, height);
+}
+
+
+/**
+* Makes the next mip level of a BGRA image: `dst` gets `max(1, width / 2) x max(1, height / 2)` pixels, each one the
+* average of a 2x2 block of `src`. Call it again on its own output to get the level after that, and so on.
+* `srcStride` and `dstStride` are the number of bytes from the start of one row to the next, `src` and `dst` may not overlap.
+*/
+__declspec(dllexport) int __cdecl Pdf_halveBGRA(const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride)
+{
+    if (!checkBuffer(PIXEL_FORMAT_BGRA, width, height, src, srcStride) || !checkBuffer(PIXEL_FORMAT_BGRA, max(1, width / 2), max(1, height / 2), dst, dstStride))
+        return false;
+
+    Scale_halveBGRA(src, width, height, srcStride, dst, dstStride);
+    return true;
+}
+
+
+/**
+* `Pdf_halveBGRA` for gray images, one byte per pixel.
+*/
+__declspec(dllexport) int __cdecl Pdf_halveGray(const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride)
+{
+    if (!checkBuffer(PIXEL_FORMAT_GRAY, width, height, src, srcStride) || !checkBuffer(PIXEL_FORMAT_GRAY, max(1, width / 2), max(1, height / 2), dst, dstStride))
+        return false;
+
+    Scale_halveGray(src, width, height, srcStride, dst, dstStride);
+    return true;
+}
+
+
+/**
+* Compresses a BGRA image into GPU blocks, for a texture that takes a lot less video memory (and time to upload):
+* `format` 0 is BC1 (aka DXT1, 8 bytes per 4x4 block, no alpha) and 1 is BC7 (16 bytes per block, keeps alpha, and looks
+* a good deal better on anything that isn't black and white, but takes about twice as long to make).
+* It's shared out between the background threads and the calling one, see encode.c for what it does and doesn't try.
+*
+* `dst` gets `(width + 3) / 4` blocks per row of blocks and `(height + 3) / 4` rows of them, `dstStride` bytes apart.
+* Where `width` or `height` isn't a multiple of 4 the last column or row of pixels is repeated to fill the blocks.
+* `srcStride` is the number of bytes from the start of one row of pixels to the next.
+*/
+__declspec(dllexport) int __cdecl Pdf_encodeBlocks(int format, const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride)
+{
+    int bytes = BlockFormat_bytes((BlockFormat)format);
+
+    if (!bytes || !checkBuffer(PIXEL_FORMAT_BGRA, width, height, src, srcStride) || !dst)
+        return false;
+    // a BC7 row of blocks can be a few bytes more than the row of pixels it's made from, so that's checked the same way
+    if ((width + 3) / 4 > INT_MAX / bytes || dstStride < (width + 3) / 4 * bytes)
+        return false;
+
+    return Encode_blocks((BlockFormat)format, src, width, height, srcStride, dst, dstStride);
+}
+
+
+/**
+* `Pdf_getPageFittedBGRA` (`pageCount` 1) or `Pdf_get2PagesFittedBGRA` (`pageCount` 2), compressed by `Pdf_encodeBlocks`.
+* The whole available area is compressed, so `outBuffer` needs room for `(availableWidth + 3) / 4 * ((availableHeight + 3) / 4)`
+* blocks, one row of blocks after the other, and whatever the page(s) don't cover is black: transparent with BC7, but
+* opaque with BC1, which has no alpha in the blocks `Encode_blocks` makes.
+*
+* The page cache keeps the BGRA version, so asking for a prefetched page only costs the compression.
+*/
+__declspec(dllexport) int __cdecl Pdf_getPageFittedBlocks(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer)
+{
+    unsigned char *pixels;
+    int            stride = packedStride(PIXEL_FORMAT_BGRA, availableWidth);
+    int            bytes  = BlockFormat_bytes((BlockFormat)format);
+    int            result;
+
+    if (!pdf || !outBuffer || !stride || availableHeight <= 0 || (pageCount != 1 && pageCount != 2) || !bytes)
+        return false;
+    // like `Pdf_encodeBlocks`, a BC7 row of blocks can be just too many bytes for an int when the pixels aren't
+    if ((availableWidth + 3) / 4 > INT_MAX / bytes)
+        return false;
+
+    pixels = (unsigned char*)calloc((size_t)availableWidth * availableHeight, 4);
+    if (!pixels)
+        return false;
+
+    result = getFitted(pdf, pageNumber, pageCount, PIXEL_FORMAT_BGRA, availableWidth, availableHeight, resultingWidth, resultingHeight, pixels, stride) &&
+             Encode_blocks((BlockFormat)format, pixels, availableWidth, availableHeight, stride, outBuffer, (availableWidth + 3) / 4 * bytes);
+
+    free(pixels);
+    return result;
+}
+
+
+/**
+* Sets how many background threads render pages (shared by all open documents), 0 means one less than the number of cores,
+* which is also the default.
+*/
+__declspec(dllexport) int __cdecl Pdf_setWorkerCount(int count)
+{
+    if (count < 0)
+        return false;
+
+    Workers_setCount(count);
+    return true;
+}
+
+
+static int freePdf(Pdf *pdf)
+{
+    int index;
+
+    if (!pdf)
+        return false;
 
-#include "mupdf/fitz.h"
-#pragma comment( lib, "libmupdf" )
+    for (index = 0; index < pdf->outlineCount; index++)
+        fz_free(pdf->context, pdf->outline[index].title);
+    if (pdf->outline) fz_free(pdf->context, pdf->outline);
 
-typedef struct Pdf
-{
-	fz_context  *context;
-	fz_document *document;
-    int          pageCount;
-} Pdf;
+    if (pdf->context)  ListCache_destroy(&pdf->lists, pdf->context);
+	if (pdf->document) fz_drop_document(pdf->context, pdf->document);
+	if (pdf->context)  fz_drop_context(pdf->context);
+    PageCache_destroy(&pdf->cache);
+    free(pdf->path);
+    free(pdf);
+	return false;
+}
 
-// yoinked from `utils.c` so I didn't have to include another library
-fz_pixmap *
-_fz_new_pixmap_from_page_with_separations(fz_context *ctx, fz_page *page, fz_matrix ctm, fz_colorspace *cs, fz_separations *seps, int alpha)
+/**
+* Lets go of a document, it's only actually closed once everybody who opened it has let go of it.
+*/
+__declspec(dllexport) int __cdecl Pdf_destroy(Pdf *pdf)
 {
-	fz_rect rect;
-	fz_irect bbox;
-	fz_pixmap *pix;
-	fz_device *dev = NULL;
-    const fz_matrix fz_identity = {1, 0, 0, 1, 0, 0};
+    if (!pdf)
+        return false;
+
+    if (!Registry_release(pdf))
+        return false;
 
-	fz_var(dev);
+    // make sure no worker is still busy with this document before pulling it out from under them
+    Workers_cancel(pdf);
+    Workers_cancel(&pdf->openState);
+    Workers_cancel(&pdf->renderLoads);
+    Workers_wait(pdf);
+    Workers_wait(&pdf->openState);
+    Workers_wait(&pdf->renderLoads);
+    // a prefetch plan that was running queued its spreads after the cancel, and those never started
+    Workers_cancel(pdf);
+    Workers_release();
+
+    freePdf(pdf);
+    // whatever it had lying around in the pool isn't likely to be the right size for the next one
+    Pool_trim();
+    return false;
+}
 
-	rect = fz_bound_page(ctx, page);
-	rect = fz_transform_rect(rect, ctm);
-	bbox = fz_round_rect(rect);
+typedef enum SourceKind
+{
+    SOURCE_FILE = 0,
+    SOURCE_MEMORY,
+    SOURCE_CALLBACKS,
+} SourceKind;
+
+// where the bytes of a document that's being opened come from. memory and callbacks belong to the document once it's
+// opened (or to its stream, once there is one), until then whoever gives up on opening it has to hand them back
+typedef struct Source
+{
+    SourceKind           kind;
+    bool                 taken;
+    const unsigned char *data;
+    size_t               size;
+    StreamRelease        release;
+    StreamRead           read;
+    StreamSeek           seek;
+    StreamClose          close;
+    void                *user;
+} Source;
+
+static void dropSource(Source *source)
+{
+    if (source->taken)
+        return;
+    source->taken = true;
+
+    if (source->kind == SOURCE_MEMORY && source->release)
+        source->release(source->user, source->data, source->size);
+    if (source->kind == SOURCE_CALLBACKS && source->close)
+        source->close(source->user);
+}
 
-	pix = fz_new_pixmap_with_bbox(ctx, cs, bbox, seps, alpha);
+// `magic` is the file name (or just the extension, or a mime type), which is how MuPDF tells what kind of document it is
+static fz_document *openSource(fz_context *ctx, Source *source, const char *magic)
+{
+    fz_stream   *stream = NULL;
+    fz_document *document = NULL;
 
-	fz_try(ctx)
-	{
-		if (alpha)
-			fz_clear_pixmap(ctx, pix);
-		else
-			fz_clear_pixmap_with_value(ctx, pix, 0xFF);
+    source->taken = true;
+    switch (source->kind)
+    {
+    case SOURCE_MEMORY:
+        stream = Stream_openMemory(ctx, source->data, source->size, source->release, source->user);
+        break;
+    case SOURCE_CALLBACKS:
+        stream = Stream_openCallbacks(ctx, source->read, source->seek, source->close, source->user);
+        break;
+    default:
+        if (mapFiles)
+            stream = Stream_openMapped(ctx, magic);
+        // not mappable, let MuPDF read it the usual way
+        if (!stream)
+            return fz_open_document(ctx, magic);
+        break;
+    }
 
-		dev = fz_new_draw_device(ctx, ctm, pix);
-		fz_run_page(ctx, page, dev, fz_identity, NULL);
-		fz_close_device(ctx, dev);
-	}
-	fz_always(ctx)
-	{
-		fz_drop_device(ctx, dev);
-	}
-	fz_catch(ctx)
-	{
-		fz_drop_pixmap(ctx, pix);
-		fz_rethrow(ctx);
-	}
+    // the document keeps its own reference to the stream
+    fz_try(ctx)
+        document = fz_open_document_with_stream(ctx, magic, stream);
+    fz_always(ctx)
+        fz_drop_stream(ctx, stream);
+    fz_catch(ctx)
+        fz_rethrow(ctx);
 
-	return pix;
+    return document;
 }
-fz_pixmap *
-_fz_new_pixmap_from_page_number_with_separations(fz_context *ctx, fz_document *doc, int number, fz_matrix ctm, fz_colorspace *cs, fz_separations *seps, int alpha)
+
+typedef struct OpenWaiter
+{
+    PdfOpened          callback;
+    void              *user;
+    struct OpenWaiter *next;
+} OpenWaiter;
+
+// opens the document of a `Pdf_createLazy` if nobody has yet, the caller has to hold `pdf->documentLock`.
+// returns whether there's a document to work with
+static bool openDocument(Pdf *pdf, fz_context *ctx)
 {
-	fz_page *page;
-	fz_pixmap *pix = NULL;
+    Source source = { SOURCE_FILE };
+
+    if (pdf->openState == OPEN_PENDING)
+    {
+        fz_try(ctx)
+        {
+            pdf->document  = openSource(ctx, &source, pdf->path);
+            pdf->openState = OPEN_DONE;
+        }
+        fz_catch(ctx)
+        {
+            pdf->openState = OPEN_FAILED;
+        }
+    }
 
-	page = fz_load_page(ctx, doc, number);
-	fz_try(ctx)
-		pix = _fz_new_pixmap_from_page_with_separations(ctx, page, ctm, cs, seps, alpha);
-	fz_always(ctx)
-		fz_drop_page(ctx, page);
-	fz_catch(ctx)
-		fz_rethrow(ctx);
-	return pix;
+    return pdf->openState == OPEN_DONE;
 }
 
+static int outlinePage(fz_context *ctx, fz_document *document, fz_outline *item)
+{
+#if FZ_VERSION_MAJOR > 1 || FZ_VERSION_MINOR >= 19
+    return fz_page_number_from_location(ctx, document, item->page);
+#else
+    return item->page;
+#endif
+}
 
-/**
-* This gets a page from the PDF at 72dpi
-* 
-* Usage:
-*   call the function with `outBuffer` set to `NULL`
-*   `width` and `height` will be set to the required width and height of the document
-*   allocate a buffer of size `width * height * 3` and call the function again to have it populated with the contents of the page
-*/
-__declspec(dllexport) int __cdecl Pdf_getPageRGB(Pdf *pdf, int pageNumber, int *width, int *height, unsigned char *outBuffer)
+static void flattenOutline(Pdf *pdf, fz_context *ctx, fz_outline *item, int depth, int *capacity)
 {
-    fz_pixmap *pixmap     = NULL;
-    fz_matrix  viewMatrix = fz_scale(1.0, 1.0);
+    for (; item; item = item->next)
+    {
+        OutlineEntry *entry;
 
-    if (!pdf)
-        return false;
+        if (pdf->outlineCount == *capacity)
+        {
+            *capacity    = *capacity ? *capacity * 2 : 32;
+            pdf->outline = (OutlineEntry*)fz_realloc(ctx, pdf->outline, *capacity * sizeof(OutlineEntry));
+        }
 
-    fz_try(pdf->context)
-        pixmap = _fz_new_pixmap_from_page_number_with_separations(pdf->context, pdf->document, pageNumber, viewMatrix, fz_device_rgb(pdf->context), NULL, 0);
-    fz_catch(pdf->context)
-        return false;
+        entry = &pdf->outline[pdf->outlineCount++];
+        entry->title      = NULL;
+        entry->depth      = depth;
+        entry->pageNumber = outlinePage(ctx, pdf->document, item);
+        entry->title      = fz_strdup(ctx, item->title ? item->title : "");
+
+        flattenOutline(pdf, ctx, item->down, depth + 1, capacity);
+    }
+}
+
+// whatever made it in before something went wrong is kept, a broken outline doesn't make for a broken document
+static void loadOutline(Pdf *pdf, fz_context *ctx)
+{
+    fz_outline *outline  = NULL;
+    int         capacity = 0;
+
+    fz_var(outline);
 
-    if (!outBuffer)
+    fz_try(ctx)
     {
-        if (width)  *width  = pixmap->w;
-        if (height) *height = pixmap->h;
+        outline = fz_load_outline(ctx, pdf->document);
+        flattenOutline(pdf, ctx, outline, 0, &capacity);
     }
-    else
+    fz_always(ctx)
+    {
+        fz_drop_outline(ctx, outline);
+    }
+    fz_catch(ctx)
     {
-        int y;
-        // could this just be one single memcpy? can `->stride` ever NOT be just `->w`?
-        // I'm not going to find out, so just be safe
-        for (y = 0; y < pixmap->h; y++)
-        {
-            unsigned char *srcLine = &pixmap->samples[y * pixmap->stride];
-            unsigned char *dstLine = &outBuffer[y * pixmap->w];
-            memcpy(dstLine, srcLine, pixmap->w);
-        }
     }
+}
 
-    if (pixmap) fz_drop_pixmap(pdf->context, pixmap);
+// opens the document (if it isn't yet), counts its pages and loads its outline. returns the page count, or -1 if it
+// couldn't be opened or counted. the document lock is let go of in between, so pages that are waiting can get in
+static int countDocument(Pdf *pdf, fz_context *ctx)
+{
+    int pageCount = -1;
 
-    return true;
-}
+    AcquireSRWLockExclusive(&pdf->documentLock);
+    if (openDocument(pdf, ctx))
+    {
+        fz_try(ctx)
+            pageCount = fz_count_pages(ctx, pdf->document);
+        fz_catch(ctx)
+            pageCount = -1;
+    }
+    ReleaseSRWLockExclusive(&pdf->documentLock);
+
+    if (pageCount < 0)
+        return -1;
 
+    // prefetching can go by it from here on
+    pdf->pageCount = pageCount;
 
-static int getPagePixmap(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, fz_pixmap **outPixmap)
+    AcquireSRWLockExclusive(&pdf->documentLock);
+    loadOutline(pdf, ctx);
+    ReleaseSRWLockExclusive(&pdf->documentLock);
+
+    return pageCount;
+}
+
+// lets everybody who's waiting for the pages to be counted know how it went
+static void finishCounting(Pdf *pdf, int pageCount)
 {
-    bool       result = true;
-    fz_pixmap *pixmap = NULL;
-    fz_page   *page   = NULL;
-    fz_rect    bbox;
+    OpenWaiter *waiters;
 
-    if (!pdf || !outPixmap)
-        return false;
+    // so the next one to open the file tries again, rather than getting this one
+    if (pageCount < 0)
+        Registry_forget(pdf);
 
-    *outPixmap = NULL;
-    page = fz_load_page(pdf->context, pdf->document, pageNumber);
-    bbox = fz_bound_page(pdf->context, page);
+    AcquireSRWLockExclusive(&pdf->requestLock);
+    pdf->pageCount = pageCount;
+    pdf->counting  = false;
+    waiters        = pdf->waiters;
+    pdf->waiters   = NULL;
+    WakeAllConditionVariable(&pdf->counted);
+    ReleaseSRWLockExclusive(&pdf->requestLock);
+
+    while (waiters)
     {
-        fz_matrix viewMatrix;
-        float     bboxWidth   = bbox.x1 - bbox.x0;
-        float     bboxHeight  = bbox.y1 - bbox.y0;
-        float     aspectRatio = bboxWidth / bboxHeight;
-        float     zoomFactor  = availableWidth / bboxWidth;
+        OpenWaiter *next = waiters->next;
+        waiters->callback(waiters->user, pdf, pageCount);
+        free(waiters);
+        waiters = next;
+    }
+}
+
+// calls `callback` once the pages are counted, which might be right now
+static bool addWaiter(Pdf *pdf, PdfOpened callback, void *user)
+{
+    OpenWaiter *waiter;
+    int         pageCount = -1;
+    bool        counting;
 
-        if (bboxHeight * zoomFactor > availableHeight)
-            zoomFactor = availableHeight / bboxHeight;
+    if (!callback)
+        return true;
 
-        viewMatrix = fz_scale(zoomFactor, zoomFactor);
+    waiter = (OpenWaiter*)malloc(sizeof(OpenWaiter));
+    if (!waiter)
+        return false;
+    waiter->callback = callback;
+    waiter->user     = user;
 
-	    fz_try(pdf->context)
-		    pixmap = _fz_new_pixmap_from_page_with_separations(pdf->context, page, viewMatrix, fz_device_rgb(pdf->context), NULL, 0);
-	    fz_catch(pdf->context)
-		    result = false;
+    AcquireSRWLockExclusive(&pdf->requestLock);
+    counting = pdf->counting;
+    if (counting)
+    {
+        waiter->next = pdf->waiters;
+        pdf->waiters = waiter;
+    }
+    else
+    {
+        pageCount = pdf->pageCount;
     }
+    ReleaseSRWLockExclusive(&pdf->requestLock);
 
-    if (result)
+    if (!counting)
     {
-        if (resultingWidth)  *resultingWidth  = pixmap->w;
-        if (resultingHeight) *resultingHeight = pixmap->h;
-        *outPixmap = pixmap;
+        callback(user, pdf, pageCount);
+        free(waiter);
     }
+    return true;
+}
 
-    if (page) fz_drop_page(pdf->context, page);
-    return result;
+static int waitForCount(Pdf *pdf)
+{
+    int pageCount;
+
+    AcquireSRWLockExclusive(&pdf->requestLock);
+    while (pdf->counting)
+        SleepConditionVariableSRW(&pdf->counted, &pdf->requestLock, INFINITE, 0);
+    pageCount = pdf->pageCount;
+    ReleaseSRWLockExclusive(&pdf->requestLock);
+
+    return pageCount;
 }
 
+static void runOpen(void *userData)
+{
+    Pdf        *pdf = (Pdf*)userData;
+    fz_context *ctx = fz_clone_context(pdf->context);
+    int         pageCount = -1;
 
-/**
-* This will scale a page to fit the available space specified and return it as RGB.
-* It keeps the original aspect ratio of the page, so the resulting buffer might end up with space to the right, or bottom.
-* If `resultingWidth` and `resultingHeight` are non `NULL`, then they will be set to the actual dimensions of the contents within the buffer.
-* If you like, you can then e.g., zero out the unused contents
-* 
-* NOTE! do NOT use the same width and height variables for specifying the available space and the resulting space, things will go wrong.
-*/
-__declspec(dllexport) int __cdecl Pdf_getPageFittedRGB(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer)
+    if (ctx)
+    {
+        pageCount = countDocument(pdf, ctx);
+        fz_drop_context(ctx);
+    }
+    finishCounting(pdf, pageCount);
+}
+
+// only happens when the last reference goes before the job got to run, but the callbacks still have to be called
+static void discardOpen(void *userData)
 {
-    fz_pixmap *pixmap = NULL;
+    finishCounting((Pdf*)userData, -1);
+}
 
-    if (!pdf || !outBuffer)
+// hands out a document that somebody else opened, and which might not be counted yet
+static int useShared(Pdf **newPdf, Pdf *pdf, bool lazy, PdfOpened callback, void *user)
+{
+    if (lazy)
+    {
+        if (!addWaiter(pdf, callback, user))
+        {
+            Pdf_destroy(pdf);
+            return false;
+        }
+    }
+    // everybody else expects it to be ready to go
+    else if (waitForCount(pdf) < 0)
+    {
+        Pdf_destroy(pdf);
         return false;
+    }
 
-    if (!getPagePixmap(pdf, pageNumber, availableWidth, availableHeight, resultingWidth, resultingHeight, &pixmap))
-        return false;
+    *newPdf = pdf;
+    return true;
+}
+
+// opens a document, or returns the one registered under `path` (if it isn't NULL) if that's already open.
+// takes ownership of `path` and `source`, whether it works or not.
+// with `lazy` the document isn't opened here, but by whoever needs it first, either a page being drawn or the background
+// job that counts its pages, which calls `callback` when it's done. only files can be opened lazily
+static int openPdf(Pdf **newPdf, char *path, LONGLONG modified, const char *magic, Source *source, bool lazy, PdfOpened callback, void *user)
+{
+    Pdf *pdf = NULL;
+    Pdf *shared = NULL;
+    int  index;
+
+    *newPdf = NULL;
+
+    // the cheap way, somebody already has it open
+    if (path)
+        shared = Registry_acquire(path, modified);
+    if (shared)
+    {
+        free(path);
+        dropSource(source);
+        return useShared(newPdf, shared, lazy, callback, user);
+    }
+
+    pdf = (Pdf*)calloc(sizeof(Pdf), 1);
+    if (!pdf)
+    {
+        free(path);
+        goto error;
+    }
+    pdf->path      = path;
+    pdf->modified  = modified;
+    pdf->diskId    = (source->kind == SOURCE_FILE) ? DiskCache_document(path, modified) : 0;
+    pdf->pageCount = -1;
+    pdf->counting  = true;
+
+    for (index = 0; index < FZ_LOCK_MAX; index++)
+        InitializeSRWLock(&pdf->mutexes[index]);
+    InitializeSRWLock(&pdf->documentLock);
+    InitializeSRWLock(&pdf->requestLock);
+    InitializeConditionVariable(&pdf->counted);
+    pdf->locks.user   = pdf->mutexes;
+    pdf->locks.lock   = lockMutex;
+    pdf->locks.unlock = unlockMutex;
+    Stats_init(&pdf->stats);
+    pdf->allocator = Stats_allocator(&pdf->stats);
+    PageCache_init(&pdf->cache, DEFAULT_CACHE_BUDGET, &pdf->stats);
+    ListCache_init(&pdf->lists, DEFAULT_LIST_CACHE);
+
+	// Create a context to hold the exception stack and various caches.
+	pdf->context = fz_new_context(&pdf->allocator, &pdf->locks, storeBudget);
+    if (!pdf->context)
+        goto error;
+
+	// Register document handlers for the default file types we support.
+    fz_try(pdf->context)
+	    fz_register_document_handlers(pdf->context);
+    fz_catch(pdf->context)
+        goto error;
+
+    if (!lazy)
+    {
+        // Open the PDF, XPS or CBZ document.
+        fz_try(pdf->context)
+            pdf->document = openSource(pdf->context, source, magic);
+        fz_catch(pdf->context)
+            goto error;
+        pdf->openState = OPEN_DONE;
+
+        // Retrieve the number of pages.
+        if (countDocument(pdf, pdf->context) < 0)
+            goto error;
+        pdf->counting = false;
+    }
 
-    // write the RGB pixmap to the BGRA outBuffer in the slowest way possible
+    // somebody else might have opened the same file while this one was busy, in which case theirs wins
+    shared = path ? Registry_add(pdf) : pdf;
+    if (shared != pdf)
     {
-        int y;
-        int maxWidth = min(availableWidth, pixmap->w);
-        int maxHeight = min(availableHeight, pixmap->h);
+        freePdf(pdf);
+        return useShared(newPdf, shared, lazy, callback, user);
+    }
+    if (!path)
+        pdf->references = 1;
+
+    Workers_retain();
 
-        // could this just be one single memcpy? can `->stride` ever NOT be just `->w`?
-        // I'm not going to find out, so just be safe
-        for (y = 0; y < maxHeight; y++)
+    // the job is its own owner, so `Pdf_prefetch` cancelling what's queued for the document leaves it alone
+    if (lazy)
+    {
+        Workers_submit(&pdf->openState, runOpen, discardOpen, pdf);
+        if (!addWaiter(pdf, callback, user))
         {
-            unsigned char *srcLine = &pixmap->samples[y * pixmap->stride];
-            unsigned char* dstLine = &outBuffer[y * pixmap->w * 3];
-            memcpy(dstLine, srcLine, maxWidth * 3);
+            Pdf_destroy(pdf);
+            return false;
         }
     }
 
-    if (pixmap) fz_drop_pixmap(pdf->context, pixmap);
+    *newPdf = pdf;
+	return true;
 
-    return true;
+error:
+    dropSource(source);
+    return freePdf(pdf);
 }
 
-
 /**
-* This will scale a page to fit the available space specified and return it as BGRA (where alpha will always be 255).
-* It keeps the original aspect ratio of the page, so the resulting buffer might end up with space to the right, or bottom.
-* If `resultingWidth` and `resultingHeight` are non `NULL`, then they will be set to the actual dimensions of the contents within the buffer.
-* If you like, you can then e.g., zero out the unused contents
-* 
-* NOTE! do NOT use the same width and height variables for specifying the available space and the resulting space, things will go wrong.
+* Opens a PDF, XPS, CBZ, EPUB, ..., or hands out the one that's already open if the same file (that hasn't been changed
+* since) was opened before, and hasn't been destroyed as often as it was created yet.
+* Every successful call needs a `Pdf_destroy`.
 */
-__declspec(dllexport) int __cdecl Pdf_getPageFittedBGRA(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer)
+__declspec(dllexport) int __cdecl Pdf_create(Pdf **newPdf, const char *filePath)
 {
-    fz_pixmap *pixmap = NULL;
+    Source   source = { SOURCE_FILE };
+    char    *path;
+    LONGLONG modified;
 
-    if (!pdf || !outBuffer)
+    if (!newPdf || !filePath)
         return false;
 
-    if (!getPagePixmap(pdf, pageNumber, availableWidth, availableHeight, resultingWidth, resultingHeight, &pixmap))
+    *newPdf = NULL;
+
+    if (!Registry_identify(filePath, &path, &modified))
         return false;
 
-    // write the RGB pixmap to the BGRA outBuffer in the slowest way possible
-    {
-        int x, y;
-        int maxWidth = min(availableWidth, pixmap->w);
-        int maxHeight = min(availableHeight, pixmap->h);
-        for (y = 0; y < maxHeight; y++)
-        {
-            unsigned char *src = &pixmap->samples[y * pixmap->stride];
-            unsigned char *dst = &outBuffer[y * availableWidth * 4];
-            for (x = 0; x < maxWidth; x++)
-            {
-                *(dst + 2) = *(src + 0);
-                *(dst + 1) = *(src + 1);
-                *(dst + 0) = *(src + 2);
-                *(dst + 3) = 255;
-
-                src += 3;
-                dst += 4;
-            }
-        }
-    }
+    return openPdf(newPdf, path, modified, path, &source, false, NULL, NULL);
+}
 
-    if (pixmap) fz_drop_pixmap(pdf->context, pixmap);
+/**
+* Like `Pdf_create`, but returns straight away, without even opening the file: the first page asked for opens it (on
+* whichever thread that happens on, so use the async functions or do it on a thread of your own), and gets drawn as
+* soon as it's loaded, while counting the pages and loading the outline happens on a background thread afterwards.
+* That's where the time goes for reflowed documents (EPUB has to lay out the whole book to count its pages) and for
+* PDFs with a big page tree. A PDF with a broken cross reference table still has to be repaired when it's opened.
+*
+* `callback(user, pdf, pageCount)` is called from the background thread once the pages are counted, with -1 if the
+* document couldn't be opened, or was destroyed first. If the file was already open and counted, it's called before this
+* returns. It's only called when this returns true, and then always exactly once.
+* Don't `Pdf_destroy` from inside it, that waits for the very job that's calling it.
+*
+* Until then `Pdf_getPageCount` fails, and `Pdf_prefetch` doesn't know where the book ends, everything else works as usual.
+*/
+__declspec(dllexport) int __cdecl Pdf_createLazy(Pdf **newPdf, const char *filePath, PdfOpened callback, void *user)
+{
+    Source   source = { SOURCE_FILE };
+    char    *path;
+    LONGLONG modified;
 
-    return true;
-}
+    if (!newPdf || !filePath)
+        return false;
+
+    *newPdf = NULL;
 
+    // this much has to happen now, to be able to tell whether the file is already open
+    if (!Registry_identify(filePath, &path, &modified))
+        return false;
+
+    return openPdf(newPdf, path, modified, path, &source, true, callback, user);
+}
 
 /**
-* This will scale 2 pages to fit the available space specified and return it as BGRA (where alpha will always be 255).
-* It keeps the original aspect ratio of the pages, so the resulting buffer might end up with space to the right, or bottom.
-* If `resultingWidth` and `resultingHeight` are non `NULL`, then they will be set to the actual dimensions of the contents within the buffer.
-* If you like, you can then e.g., zero out the unused contents
-* 
-* It rather naively first allocates half the width to the first page, which works for most books, but sometimes comic books have
-* two pages stuck together as a single page already, meaning that the left page will have a lot of wasted space below it, and look out of place.
-* Feel free to rework and get the bounding boxes of both pages and do something more sensible in that case.
-* 
-* NOTE! do NOT use the same width and height variables for specifying the available space and the resulting space, things will go wrong.
+* Gets how many pages a document has, fails while a `Pdf_createLazy` is still counting them (or couldn't).
 */
-__declspec(dllexport) int __cdecl Pdf_get2PagesFittedBGRA(Pdf *pdf, int startPageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer)
+__declspec(dllexport) int __cdecl Pdf_getPageCount(Pdf *pdf, int *pageCount)
 {
-    int index;
-    int assignedWidth = availableWidth / 2;
-    int leftOffset    = 0;
-    int bottomOffset  = 0;
+    bool known;
 
-    if (!pdf || !outBuffer)
+    if (!pdf || !pageCount)
         return false;
 
-    for (index = 0; index < 2; index++)
-    {
-        fz_matrix viewMatrix; // don't affect the context one
-        fz_page  *page         = fz_load_page(pdf->context, pdf->document, startPageNumber + index);
-        fz_rect   bbox         = fz_bound_page(pdf->context, page);
-        float     bboxWidth    = bbox.x1 - bbox.x0;
-        float     bboxHeight   = bbox.y1 - bbox.y0;
-        float     aspectRatio  = bboxWidth / bboxHeight;
-        float     zoomFactor   = assignedWidth / bboxWidth;
+    AcquireSRWLockExclusive(&pdf->requestLock);
+    known      = !pdf->counting && pdf->pageCount >= 0;
+    *pageCount = pdf->pageCount;
+    ReleaseSRWLockExclusive(&pdf->requestLock);
 
-        if (bboxHeight * zoomFactor > availableHeight)
-            zoomFactor = availableHeight / bboxHeight;
-
-        viewMatrix = fz_scale(zoomFactor, zoomFactor);
+    return known;
+}
 
-	    fz_try(pdf->context)
-        {
-		    fz_pixmap *pagePixmap = _fz_new_pixmap_from_page_with_separations(pdf->context, page, viewMatrix, fz_device_rgb(pdf->context), NULL, 0);
-            {
-                int x, y;
-                int maxWidth = min(assignedWidth, pagePixmap->w);
-                int maxHeight = min(availableHeight, pagePixmap->h);
-                for (y = 0; y < maxHeight; y++)
-                {
-                    unsigned char *src = (pagePixmap->samples + y * pagePixmap->w * 3);
-                    unsigned char *dst = (outBuffer + y * availableWidth * 4) + (leftOffset * 4);
-                    for (x = 0; x < maxWidth; x++)
-                    {
-                        *(dst + 2) = *(src + 0);
-                        *(dst + 1) = *(src + 1);
-                        *(dst + 0) = *(src + 2);
-                        *(dst + 3) = 255;
-
-                        src += 3;
-                        dst += 4;
-                    }
-                }
-            }
-            leftOffset += pagePixmap->w;
-            assignedWidth = availableWidth - leftOffset;
-            if (pagePixmap->h > bottomOffset)
-                bottomOffset = pagePixmap->h;
-            fz_drop_pixmap(pdf->context, pagePixmap);
-        }
-	    fz_catch(pdf->context)
-        {
-            if (page) fz_drop_page(pdf->context, page);
-            return false;
-        }
+/**
+* Gets one entry of the document's table of contents, flattened: the entries come in reading order, and each one's
+* `depth` says how far down the tree it is (0 for the top level, the entries after it with a bigger depth are inside it).
+* `pageNumber` is where it points, or -1 if it points outside of the document, and `title` is filled with up to
+* `titleSize - 1` bytes of UTF-8 and a 0. Any of them can be NULL.
+*
+* Fails once `index` is past the last entry, and while a `Pdf_createLazy` is still counting pages.
+*
+* Usage:
+*   call it with `index` 0, 1, 2, ... until it fails
+*/
+__declspec(dllexport) int __cdecl Pdf_getOutlineEntry(Pdf *pdf, int index, int *depth, int *pageNumber, char *title, int titleSize)
+{
+    OutlineEntry *entry;
+    bool          counting;
 
-        if (page) fz_drop_page(pdf->context, page);
-    }
+    if (!pdf || index < 0)
+        return false;
 
-    if (resultingWidth)  *resultingWidth  = leftOffset;
-    if (resultingHeight) *resultingHeight = bottomOffset;
+    // the outline is done with once `counting` is false, and never touched again
+    AcquireSRWLockExclusive(&pdf->requestLock);
+    counting = pdf->counting;
+    ReleaseSRWLockExclusive(&pdf->requestLock);
+    if (counting || index >= pdf->outlineCount)
+        return false;
 
+    entry = &pdf->outline[index];
+    if (depth)      *depth      = entry->depth;
+    if (pageNumber) *pageNumber = entry->pageNumber;
+    if (title && titleSize > 0)
+    {
+        strncpy(title, entry->title ? entry->title : "", titleSize - 1);
+        title[titleSize - 1] = 0;
+    }
     return true;
 }
 
-__declspec(dllexport) int __cdecl Pdf_destroy(Pdf *pdf)
+static void __cdecl freeCopy(void *user, const unsigned char *data, size_t size)
 {
-    if (!pdf)
-        return false;
+    free((void*)data);
+}
 
-	if (pdf->document) fz_drop_document(pdf->context, pdf->document);
-	if (pdf->context)  fz_drop_context(pdf->context);
-    free(pdf);
-	return false;
+// documents that didn't come from a file get registered under this, so they can't be mistaken for one that did
+static char *memoryKey(const char *name)
+{
+    char *key = (char*)malloc(strlen(name) + sizeof("memory:"));
+    if (key)
+    {
+        strcpy(key, "memory:");
+        strcat(key, name);
+    }
+    return key;
 }
 
-__declspec(dllexport) int __cdecl Pdf_create(Pdf **newPdf, const char *filePath)
+/**
+* Opens a document that's already in memory, e.g., read out of an archive, without it going anywhere near the disk.
+* `name` is how MuPDF tells what kind of document it is, from its extension ("book.cbz", or just "cbz", or a mime type),
+* and also what it's shared by: another `Pdf_createFromMemory` or `Pdf_createFromStream` with the same name gets the
+* same `Pdf` while it's open (and its data is released straight away), so give different documents different names.
+*
+* With a `release` function the data is used where it is, and has to stay there until `release(user, data, size)` is
+* called, which happens when the document is closed (from whichever thread calls the last `Pdf_destroy`), or straight
+* away if this fails, or it was already open. Without one, the data is copied first, and can go as soon as this returns.
+*/
+__declspec(dllexport) int __cdecl Pdf_createFromMemory(Pdf **newPdf, const char *name, const void *data, size_t size, StreamRelease release, void *user)
 {
-    Pdf *pdf = NULL;
+    Source source = { SOURCE_MEMORY };
 
-    if (!newPdf || !filePath)
+    if (!newPdf || !name || !data)
         return false;
 
     *newPdf = NULL;
 
-    pdf = (Pdf*)calloc(sizeof(Pdf), 1);
-    if (!pdf)
-        goto error;
+    source.data    = (const unsigned char*)data;
+    source.size    = size;
+    source.release = release;
+    source.user    = user;
 
-	// Create a context to hold the exception stack and various caches.
-	pdf->context = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
-    if (!pdf->context)
-        goto error;
+    if (!release)
+    {
+        unsigned char *copy = (unsigned char*)malloc(size ? size : 1);
+        if (!copy)
+            return false;
+        memcpy(copy, data, size);
+        source.data    = copy;
+        source.release = freeCopy;
+    }
 
-	// Register document handlers for the default file types we support.
-    fz_try(pdf->context)
-	    fz_register_document_handlers(pdf->context);
-    fz_catch(pdf->context)
-        goto error;
+    return openPdf(newPdf, memoryKey(name), 0, name, &source, false, NULL, NULL);
+}
 
-	// Open the PDF, XPS or CBZ document.
-    fz_try(pdf->context)
-    	pdf->document = fz_open_document(pdf->context, filePath);
-    fz_catch(pdf->context)
-        goto error;
+/**
+* Opens a document that MuPDF reads through callbacks as it goes, e.g., straight out of a compressed archive, so it never
+* has to all be in memory at once. `name` is like for `Pdf_createFromMemory`.
+*
+*   `read(user, buffer, size)` reads up to `size` bytes, returns how many it read, 0 at the end, or -1 when it fails
+*   `seek(user, offset, whence)` goes to `offset` from the start (`whence` 0) or the end (`whence` 2, `offset` is <= 0),
+*                                returns where it ended up, or -1 when it fails
+*   `close(user)` is called when the document is closed, or straight away if this fails, or it was already open
+*
+* The callbacks are only ever called by one thread at a time, but not always the same one.
+*/
+__declspec(dllexport) int __cdecl Pdf_createFromStream(Pdf **newPdf, const char *name, StreamRead read, StreamSeek seek, StreamClose close, void *user)
+{
+    Source source = { SOURCE_CALLBACKS };
 
-	// Retrieve the number of pages.
-    fz_try(pdf->context)
-    	pdf->pageCount = fz_count_pages(pdf->context, pdf->document);
-    fz_catch(pdf->context)
-        goto error;
+    if (!newPdf || !name || !read || !seek)
+        return false;
 
-    *newPdf = pdf;
+    *newPdf = NULL;
 
-	return true;
+    source.read  = read;
+    source.seek  = seek;
+    source.close = close;
+    source.user  = user;
 
-error:
-    return Pdf_destroy(pdf);
+    return openPdf(newPdf, memoryKey(name), 0, name, &source, false, NULL, NULL);
 }
 
+#ifdef _WIN32
 BOOL APIENTRY DllMain( HMODULE hModule,
                        DWORD  ul_reason_for_call,
                        LPVOID lpReserved
@@ -400,4 +2711,4 @@ BOOL APIENTRY DllMain( HMODULE hModule,
     }
     return TRUE;
 }
-
+#endif
@@ -0,0 +1,644 @@
+/**
+* Compressing BGRA pages into GPU blocks, BC1 (aka DXT1) or BC7, so a page takes 8 (BC1) or 4 (BC7) times less video
+* memory than it does as BGRA, and that much less time to upload.
+*
+* Both are the plain "pick two end colours, then the closest point between them for every pixel" kind of encoder, which
+* is all a page of text or a scan needs. They're nowhere near what a texture tool squeezes out of a photo, but they're fast:
+*   - the end colours start off as the two pixels furthest apart along the line that fits the block's colours best
+*     (their principal axis), every pixel gets the closest step between them, and then the end colours are fitted to
+*     those steps by least squares, once, which is kept if it came out better
+*   - BC1 has no alpha (pages are opaque anyway), and only ever uses its 4 colour mode
+*   - BC7 only ever uses mode 6: one pair of RGBA end colours of 7 bits (plus a shared low bit each), with 16 steps
+*     between them. No partitions, so blocks with two very different colours that aren't black and white (or along the
+*     same line) come out worse than a proper encoder would make them
+*
+* Rows of blocks are shared out between the background threads and the calling one, see `Encode_blocks`.
+* bench/encode.c (`make check` there) checks that pages survive the trip through both formats.
+*/
+
+#include "mupdf2rgb.h"
+#include <math.h>
+
+// not worth waking a worker for fewer rows of blocks than this
+#define ROWS_PER_THREAD 4
+
+// how far along (out of 64) each of BC7's 16 steps is
+static const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static const float bc7Steps[16] = { 0 / 64.0f,  4 / 64.0f,  9 / 64.0f, 13 / 64.0f, 17 / 64.0f, 21 / 64.0f, 26 / 64.0f, 30 / 64.0f,
+                                   34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f, 51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f };
+
+// how far along (out of 1) each of BC1's 4 steps is, the end colours come first
+static const float bc1Steps[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+int BlockFormat_bytes(BlockFormat format)
+{
+    switch (format)
+    {
+    case BLOCK_FORMAT_BC1: return 8;
+    case BLOCK_FORMAT_BC7: return 16;
+    default:               return 0;
+    }
+}
+
+static float clampColor(float value)
+{
+    return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+// copies a 4x4 block out of a BGRA image as RGBA, repeating the last row and column where the image stops short of it
+static void fetchBlock(const unsigned char *src, int srcStride, int width, int height, int blockX, int blockY, int pixels[16][4])
+{
+    int x, y;
+    for (y = 0; y < 4; y++)
+    {
+        const unsigned char *row = src + (size_t)min(blockY * 4 + y, height - 1) * srcStride;
+        for (x = 0; x < 4; x++)
+        {
+            const unsigned char *pixel = row + (size_t)min(blockX * 4 + x, width - 1) * 4;
+            int                 *out   = pixels[y * 4 + x];
+            out[0] = pixel[2];
+            out[1] = pixel[1];
+            out[2] = pixel[0];
+            out[3] = pixel[3];
+        }
+    }
+}
+
+/**
+* Picks the two pixels furthest apart along the block's principal axis (over the first `channels` channels) as the
+* starting end colours. A block that's all one colour gets it as both.
+*/
+static void pickEnds(int pixels[16][4], int channels, float ends[2][4])
+{
+    float mean[4]          = { 0 };
+    float covariance[4][4] = { { 0 } };
+    float axis[4];
+    float lowest           = 0;
+    float highest          = 0;
+    int   low              = 0;
+    int   high             = 0;
+    int   widest           = 0;
+    int   index, i, j, iteration;
+
+    // most of a page is margin, so don't bother with the maths for a block that's all one colour
+    for (index = 1; index < 16; index++)
+        if (memcmp(pixels[index], pixels[0], sizeof(pixels[0])) != 0)
+            break;
+    if (index == 16)
+    {
+        for (i = 0; i < 4; i++)
+            ends[0][i] = ends[1][i] = (float)pixels[0][i];
+        return;
+    }
+
+    for (index = 0; index < 16; index++)
+        for (i = 0; i < channels; i++)
+            mean[i] += pixels[index][i];
+    for (i = 0; i < channels; i++)
+        mean[i] /= 16;
+
+    for (index = 0; index < 16; index++)
+        for (i = 0; i < channels; i++)
+            for (j = i; j < channels; j++)
+                covariance[i][j] += (pixels[index][i] - mean[i]) * (pixels[index][j] - mean[j]);
+    for (i = 0; i < channels; i++)
+    {
+        for (j = 0; j < i; j++)
+            covariance[i][j] = covariance[j][i];
+        if (covariance[i][i] > covariance[widest][widest])
+            widest = i;
+    }
+
+    // a few rounds of power iteration, starting off from the channel that varies the most, is plenty for 16 pixels
+    for (i = 0; i < channels; i++)
+        axis[i] = covariance[widest][i];
+    for (iteration = 0; iteration < 4; iteration++)
+    {
+        float next[4] = { 0 };
+        float largest = 0;
+        for (i = 0; i < channels; i++)
+        {
+            for (j = 0; j < channels; j++)
+                next[i] += covariance[i][j] * axis[j];
+            largest = max(largest, fabsf(next[i]));
+        }
+        if (largest <= 0)
+            break;
+        for (i = 0; i < channels; i++)
+            axis[i] = next[i] / largest;
+    }
+
+    for (index = 0; index < 16; index++)
+    {
+        float along = 0;
+        for (i = 0; i < channels; i++)
+            along += (pixels[index][i] - mean[i]) * axis[i];
+        if (index == 0 || along < lowest)  { lowest  = along; low  = index; }
+        if (index == 0 || along > highest) { highest = along; high = index; }
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        ends[0][i] = (float)pixels[low][i];
+        ends[1][i] = (float)pixels[high][i];
+    }
+}
+
+/**
+* The end colours that best fit the pixels, given how far along between them (`steps[indices[n]]`, 0 to 1) each one is.
+* Returns false if there's no telling, e.g., when every pixel picked the same step.
+*/
+static bool fitEnds(int pixels[16][4], int channels, const unsigned char indices[16], const float *steps, float ends[2][4])
+{
+    float a = 0, b = 0, c = 0;
+    float determinant;
+    int   index, i;
+
+    for (index = 0; index < 16; index++)
+    {
+        float t = steps[indices[index]];
+        a += (1 - t) * (1 - t);
+        b += (1 - t) * t;
+        c += t * t;
+    }
+    determinant = a * c - b * b;
+    if (fabsf(determinant) < 1e-4f)
+        return false;
+
+    for (i = 0; i < channels; i++)
+    {
+        float x = 0, y = 0;
+        for (index = 0; index < 16; index++)
+        {
+            float t = steps[indices[index]];
+            x += (1 - t) * pixels[index][i];
+            y += t * pixels[index][i];
+        }
+        ends[0][i] = clampColor((c * x - b * y) / determinant);
+        ends[1][i] = clampColor((a * y - b * x) / determinant);
+    }
+    return true;
+}
+
+static void writeBits(unsigned char *out, int *position, unsigned int value, int count)
+{
+    int bit;
+    for (bit = 0; bit < count; bit++, (*position)++)
+        if (value & (1u << bit))
+            out[*position >> 3] |= (unsigned char)(1 << (*position & 7));
+}
+
+//
+// BC1
+//
+
+static unsigned short pack565(const float color[4])
+{
+    int red   = (int)(clampColor(color[0]) * 31 / 255 + 0.5f);
+    int green = (int)(clampColor(color[1]) * 63 / 255 + 0.5f);
+    int blue  = (int)(clampColor(color[2]) * 31 / 255 + 0.5f);
+    return (unsigned short)((red << 11) | (green << 5) | blue);
+}
+
+static void unpack565(unsigned short packed, int color[4])
+{
+    int red   = (packed >> 11) & 31;
+    int green = (packed >> 5) & 63;
+    int blue  = packed & 31;
+    color[0] = (red << 3) | (red >> 2);
+    color[1] = (green << 2) | (green >> 4);
+    color[2] = (blue << 3) | (blue >> 2);
+    color[3] = 255;
+}
+
+// the 4 colours a BC1 block with end colours `first` and `second` can have, in the 4 colour mode (first > second)
+static void bc1Palette(unsigned short first, unsigned short second, int palette[4][4])
+{
+    int i;
+    unpack565(first, palette[0]);
+    unpack565(second, palette[1]);
+    for (i = 0; i < 4; i++)
+    {
+        palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+        palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+    }
+}
+
+/**
+* Quantizes `ends` into a BC1 block's end colours and picks the closest step for every pixel.
+* Returns the total squared error.
+*/
+static int bc1Try(int pixels[16][4], const float ends[2][4], unsigned short *first, unsigned short *second, unsigned char indices[16])
+{
+    int palette[4][4];
+    int total = 0;
+    int index, step, i;
+
+    *first  = pack565(ends[0]);
+    *second = pack565(ends[1]);
+    // the 4 colour mode needs the first to be bigger, the same end colour twice just uses step 0 everywhere
+    if (*first < *second)
+    {
+        unsigned short swap = *first;
+        *first  = *second;
+        *second = swap;
+    }
+    bc1Palette(*first, *second, palette);
+
+    for (index = 0; index < 16; index++)
+    {
+        int best      = 0;
+        int bestError = 0;
+        for (step = 0; step < ((*first == *second) ? 1 : 4); step++)
+        {
+            int error = 0;
+            for (i = 0; i < 3; i++)
+                error += (pixels[index][i] - palette[step][i]) * (pixels[index][i] - palette[step][i]);
+            if (step == 0 || error < bestError)
+            {
+                best      = step;
+                bestError = error;
+            }
+        }
+        indices[index] = (unsigned char)best;
+        total += bestError;
+    }
+    return total;
+}
+
+static void bc1Block(int pixels[16][4], unsigned char *out)
+{
+    float          ends[2][4];
+    unsigned short first, second;
+    unsigned char  indices[16];
+    int            error;
+    int            index;
+
+    pickEnds(pixels, 3, ends);
+    error = bc1Try(pixels, ends, &first, &second, indices);
+
+    // the indices go with the end colours as `bc1Try` ordered them, so that's what gets fitted
+    if (error > 0 && first != second && fitEnds(pixels, 3, indices, bc1Steps, ends))
+    {
+        unsigned short fittedFirst, fittedSecond;
+        unsigned char  fittedIndices[16];
+        if (bc1Try(pixels, ends, &fittedFirst, &fittedSecond, fittedIndices) < error)
+        {
+            first  = fittedFirst;
+            second = fittedSecond;
+            memcpy(indices, fittedIndices, sizeof(indices));
+        }
+    }
+
+    out[0] = (unsigned char)(first & 0xFF);
+    out[1] = (unsigned char)(first >> 8);
+    out[2] = (unsigned char)(second & 0xFF);
+    out[3] = (unsigned char)(second >> 8);
+    out[4] = out[5] = out[6] = out[7] = 0;
+    for (index = 0; index < 16; index++)
+        out[4 + index / 4] |= (unsigned char)(indices[index] << ((index % 4) * 2));
+}
+
+static void bc1Decode(const unsigned char *block, unsigned char pixels[16][4])
+{
+    unsigned short first  = (unsigned short)(block[0] | (block[1] << 8));
+    unsigned short second = (unsigned short)(block[2] | (block[3] << 8));
+    int            palette[4][4];
+    int            index, i;
+
+    unpack565(first, palette[0]);
+    unpack565(second, palette[1]);
+    for (i = 0; i < 4; i++)
+    {
+        if (first > second)
+        {
+            palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+            palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+        }
+        else
+        {
+            // the 3 colour mode, with transparent black as the 4th
+            palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+            palette[3][i] = 0;
+        }
+    }
+
+    for (index = 0; index < 16; index++)
+    {
+        int step = (block[4 + index / 4] >> ((index % 4) * 2)) & 3;
+        for (i = 0; i < 4; i++)
+            pixels[index][i] = (unsigned char)palette[step][i];
+    }
+}
+
+//
+// BC7, mode 6 only
+//
+
+// the 7 bit value per channel, and the shared low bit, that come closest to `color` as 8 bits
+static void quantize7(const float color[4], int quantized[4], int *lowBit)
+{
+    float bestError = 0;
+    int   bit, i;
+
+    for (bit = 0; bit < 2; bit++)
+    {
+        int   candidate[4];
+        float error = 0;
+        for (i = 0; i < 4; i++)
+        {
+            int value = (int)((clampColor(color[i]) - bit) / 2 + 0.5f);
+            candidate[i] = max(0, min(127, value));
+            error += (candidate[i] * 2 + bit - color[i]) * (candidate[i] * 2 + bit - color[i]);
+        }
+        if (bit == 0 || error < bestError)
+        {
+            bestError = error;
+            *lowBit   = bit;
+            memcpy(quantized, candidate, sizeof(candidate));
+        }
+    }
+}
+
+/**
+* Quantizes `ends` into a mode 6 block's end colours (as 7 bits and a low bit each) and picks the closest step for every
+* pixel. Rather than trying all 16 steps, it works out how far along each pixel is and only tries the steps either side.
+* Returns the total squared error.
+*/
+static int bc7Try(int pixels[16][4], const float ends[2][4], int quantized[2][4], int lowBits[2], unsigned char indices[16])
+{
+    int       decoded[2][4];
+    int       palette[16][4];
+    int       span[4];
+    long long spanLength = 0;
+    int       total      = 0;
+    int       index, step, i;
+
+    for (index = 0; index < 2; index++)
+    {
+        quantize7(ends[index], quantized[index], &lowBits[index]);
+        for (i = 0; i < 4; i++)
+            decoded[index][i] = quantized[index][i] * 2 + lowBits[index];
+    }
+    for (step = 0; step < 16; step++)
+        for (i = 0; i < 4; i++)
+            palette[step][i] = ((64 - bc7Weights[step]) * decoded[0][i] + bc7Weights[step] * decoded[1][i] + 32) >> 6;
+    for (i = 0; i < 4; i++)
+    {
+        span[i]     = decoded[1][i] - decoded[0][i];
+        spanLength += span[i] * span[i];
+    }
+
+    for (index = 0; index < 16; index++)
+    {
+        int guess     = 0;
+        int best      = 0;
+        int bestError = -1;
+
+        if (spanLength > 0)
+        {
+            long long along = 0;
+            int       weight;
+            for (i = 0; i < 4; i++)
+                along += (long long)(pixels[index][i] - decoded[0][i]) * span[i];
+            weight = (int)max(0, min(64, (along * 64 + spanLength / 2) / spanLength));
+            while (guess < 15 && bc7Weights[guess + 1] <= weight)
+                guess++;
+        }
+
+        for (step = max(0, guess - 1); step <= min(15, guess + 1); step++)
+        {
+            int error = 0;
+            for (i = 0; i < 4; i++)
+                error += (pixels[index][i] - palette[step][i]) * (pixels[index][i] - palette[step][i]);
+            if (bestError < 0 || error < bestError)
+            {
+                best      = step;
+                bestError = error;
+            }
+        }
+        indices[index] = (unsigned char)best;
+        total += bestError;
+    }
+    return total;
+}
+
+static void bc7Block(int pixels[16][4], unsigned char *out)
+{
+    float          ends[2][4];
+    int            quantized[2][4];
+    int            lowBits[2];
+    unsigned char  indices[16];
+    int            error;
+    int            position = 0;
+    int            index, i;
+
+    pickEnds(pixels, 4, ends);
+    error = bc7Try(pixels, ends, quantized, lowBits, indices);
+
+    if (error > 0 && fitEnds(pixels, 4, indices, bc7Steps, ends))
+    {
+        int           fittedQuantized[2][4];
+        int           fittedLowBits[2];
+        unsigned char fittedIndices[16];
+        if (bc7Try(pixels, ends, fittedQuantized, fittedLowBits, fittedIndices) < error)
+        {
+            memcpy(quantized, fittedQuantized, sizeof(quantized));
+            memcpy(lowBits, fittedLowBits, sizeof(lowBits));
+            memcpy(indices, fittedIndices, sizeof(indices));
+        }
+    }
+
+    // the first pixel's index only gets 3 bits, so it has to be in the first half, swapping the ends flips them all
+    if (indices[0] >= 8)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            int swap        = quantized[0][i];
+            quantized[0][i] = quantized[1][i];
+            quantized[1][i] = swap;
+        }
+        i          = lowBits[0];
+        lowBits[0] = lowBits[1];
+        lowBits[1] = i;
+        for (index = 0; index < 16; index++)
+            indices[index] = (unsigned char)(15 - indices[index]);
+    }
+
+    memset(out, 0, 16);
+    writeBits(out, &position, 1 << 6, 7);  // mode 6
+    for (i = 0; i < 4; i++)
+    {
+        writeBits(out, &position, quantized[0][i], 7);
+        writeBits(out, &position, quantized[1][i], 7);
+    }
+    writeBits(out, &position, lowBits[0], 1);
+    writeBits(out, &position, lowBits[1], 1);
+    writeBits(out, &position, indices[0], 3);
+    for (index = 1; index < 16; index++)
+        writeBits(out, &position, indices[index], 4);
+}
+
+static unsigned int readBits(const unsigned char *block, int *position, int count)
+{
+    unsigned int value = 0;
+    int          bit;
+    for (bit = 0; bit < count; bit++, (*position)++)
+        if (block[*position >> 3] & (1 << (*position & 7)))
+            value |= 1u << bit;
+    return value;
+}
+
+// only knows mode 6, which is all `bc7Block` makes
+static bool bc7Decode(const unsigned char *block, unsigned char pixels[16][4])
+{
+    int decoded[2][4];
+    int lowBits[2];
+    int position = 0;
+    int index, i;
+
+    if (readBits(block, &position, 7) != (1 << 6))
+        return false;
+
+    for (i = 0; i < 4; i++)
+    {
+        decoded[0][i] = (int)readBits(block, &position, 7) << 1;
+        decoded[1][i] = (int)readBits(block, &position, 7) << 1;
+    }
+    lowBits[0] = (int)readBits(block, &position, 1);
+    lowBits[1] = (int)readBits(block, &position, 1);
+
+    for (index = 0; index < 16; index++)
+    {
+        int weight = bc7Weights[readBits(block, &position, index == 0 ? 3 : 4)];
+        for (i = 0; i < 4; i++)
+            pixels[index][i] = (unsigned char)(((64 - weight) * (decoded[0][i] | lowBits[0]) + weight * (decoded[1][i] | lowBits[1]) + 32) >> 6);
+    }
+    return true;
+}
+
+//
+// whole images
+//
+
+typedef struct EncodeJob
+{
+    BlockFormat          format;
+    const unsigned char *src;
+    int                  width;
+    int                  height;
+    int                  srcStride;
+    unsigned char       *dst;
+    int                  dstStride;
+    int                  blockRows;
+    volatile LONG        nextRow;
+} EncodeJob;
+
+// keeps taking the next row of blocks nobody has done yet, until there are none left
+static void encodeRows(void *userData)
+{
+    EncodeJob *job        = (EncodeJob*)userData;
+    int        blockBytes = BlockFormat_bytes(job->format);
+    int        blocksWide = (job->width + 3) / 4;
+    int        pixels[16][4];
+    int        row, column;
+
+    while ((row = (int)InterlockedIncrement(&job->nextRow) - 1) < job->blockRows)
+    {
+        unsigned char *out = job->dst + (size_t)row * job->dstStride;
+        for (column = 0; column < blocksWide; column++, out += blockBytes)
+        {
+            fetchBlock(job->src, job->srcStride, job->width, job->height, column, row, pixels);
+            if (job->format == BLOCK_FORMAT_BC1)
+                bc1Block(pixels, out);
+            else
+                bc7Block(pixels, out);
+        }
+    }
+}
+
+/**
+* Compresses a `width x height` BGRA image into `(width + 3) / 4` blocks per row, `(height + 3) / 4` rows of them,
+* `dstStride` bytes apart. `srcStride` is the number of bytes from one row of pixels to the next.
+*
+* Big enough images are split up by rows of blocks between the background threads (whichever aren't busy) and the
+* calling thread, which does its share rather than wait, so this is fine to call from a worker as well.
+* That's only when some open document is already keeping the threads going, otherwise it's all done on the calling
+* thread, as starting them up (and stopping them again) for every image would cost more than it saves.
+*/
+bool Encode_blocks(BlockFormat format, const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride)
+{
+    EncodeJob job;
+    int       helpers;
+    int       index;
+
+    if (!BlockFormat_bytes(format) || width <= 0 || height <= 0)
+        return false;
+
+    job.format    = format;
+    job.src       = src;
+    job.width     = width;
+    job.height    = height;
+    job.srcStride = srcStride;
+    job.dst       = dst;
+    job.dstStride = dstStride;
+    job.blockRows = (height + 3) / 4;
+    job.nextRow   = 0;
+
+    helpers = min(Workers_count(), job.blockRows / ROWS_PER_THREAD - 1);
+    if (helpers <= 0)
+    {
+        encodeRows(&job);
+        return true;
+    }
+
+    // the job lives on this thread's stack, so every helper is either cancelled or waited for before returning. If the
+    // threads are stopped meanwhile, whatever they didn't get to is still cancelled here, and this thread does it
+    for (index = 0; index < helpers; index++)
+        Workers_submit(&job, encodeRows, NULL, &job);
+    encodeRows(&job);
+    Workers_cancel(&job);
+    Workers_wait(&job);
+
+    return true;
+}
+
+/**
+* Turns blocks made by `Encode_blocks` back into BGRA, for checking what the compression did to a page.
+* Only knows what `Encode_blocks` makes, so it fails on BC7 blocks that aren't mode 6.
+*/
+bool Encode_decode(BlockFormat format, const unsigned char *src, int srcStride, unsigned char *dst, int width, int height, int dstStride)
+{
+    unsigned char pixels[16][4];
+    int           blockBytes = BlockFormat_bytes(format);
+    int           row, column, x, y;
+
+    if (!blockBytes || width <= 0 || height <= 0)
+        return false;
+
+    for (row = 0; row < (height + 3) / 4; row++)
+    {
+        for (column = 0; column < (width + 3) / 4; column++)
+        {
+            const unsigned char *block = src + (size_t)row * srcStride + (size_t)column * blockBytes;
+            if (format == BLOCK_FORMAT_BC1)
+                bc1Decode(block, pixels);
+            else if (!bc7Decode(block, pixels))
+                return false;
+
+            for (y = 0; y < 4 && row * 4 + y < height; y++)
+            {
+                for (x = 0; x < 4 && column * 4 + x < width; x++)
+                {
+                    unsigned char *out = dst + (size_t)(row * 4 + y) * dstStride + (size_t)(column * 4 + x) * 4;
+                    out[0] = pixels[y * 4 + x][2];
+                    out[1] = pixels[y * 4 + x][1];
+                    out[2] = pixels[y * 4 + x][0];
+                    out[3] = pixels[y * 4 + x][3];
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,131 @@
+/**
+* A cache of pages that have already been loaded into display lists.
+*
+* Loading a page means parsing its whole content stream, which is most of the work for simple pages, and has to happen
+* under the document lock, one page at a time. A display list can be replayed at any size, by any number of threads at once,
+* so keeping the lists of recently used pages around means switching between one and two page layouts, resizing the
+* texture, previews and tiles only pay for the drawing.
+*
+* MuPDF doesn't say how much memory a list takes, so the cache holds a number of pages rather than a number of bytes.
+* Lists are reference counted, so evicting one that somebody is still drawing is fine, it goes away once they drop it.
+*/
+
+#include "mupdf2rgb.h"
+
+struct ListCacheEntry
+{
+    int              pageNumber;
+    fz_display_list *list;
+    ListCacheEntry  *newer;
+    ListCacheEntry  *older;
+};
+
+static ListCacheEntry *findEntry(ListCache *cache, int pageNumber)
+{
+    ListCacheEntry *entry;
+    for (entry = cache->newest; entry; entry = entry->older)
+        if (entry->pageNumber == pageNumber)
+            return entry;
+    return NULL;
+}
+
+static void unlinkEntry(ListCache *cache, ListCacheEntry *entry)
+{
+    if (entry->newer) entry->newer->older = entry->older;
+    else              cache->newest       = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else              cache->oldest       = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void linkNewest(ListCache *cache, ListCacheEntry *entry)
+{
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest) cache->newest->newer = entry;
+    cache->newest = entry;
+    if (!cache->oldest) cache->oldest = entry;
+}
+
+static void freeEntry(ListCache *cache, fz_context *ctx, ListCacheEntry *entry)
+{
+    unlinkEntry(cache, entry);
+    cache->count--;
+    fz_drop_display_list(ctx, entry->list);
+    free(entry);
+}
+
+// must be called with the lock held
+static void evict(ListCache *cache, fz_context *ctx)
+{
+    while (cache->oldest && cache->count > cache->capacity)
+        freeEntry(cache, ctx, cache->oldest);
+}
+
+void ListCache_init(ListCache *cache, int capacity)
+{
+    memset(cache, 0, sizeof(ListCache));
+    InitializeSRWLock(&cache->lock);
+    cache->capacity = capacity;
+}
+
+/**
+* Drops every list, nobody may be using the cache anymore when this is called.
+*/
+void ListCache_destroy(ListCache *cache, fz_context *ctx)
+{
+    while (cache->newest)
+        freeEntry(cache, ctx, cache->newest);
+}
+
+void ListCache_setCapacity(ListCache *cache, fz_context *ctx, int capacity)
+{
+    AcquireSRWLockExclusive(&cache->lock);
+    cache->capacity = max(0, capacity);
+    evict(cache, ctx);
+    ReleaseSRWLockExclusive(&cache->lock);
+}
+
+/**
+* Returns the list for a page (which the caller has to drop when done), or `NULL` if it's not in the cache.
+*/
+fz_display_list *ListCache_get(ListCache *cache, fz_context *ctx, int pageNumber)
+{
+    fz_display_list *list = NULL;
+    ListCacheEntry  *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    entry = findEntry(cache, pageNumber);
+    if (entry)
+    {
+        list = fz_keep_display_list(ctx, entry->list);
+        unlinkEntry(cache, entry);
+        linkNewest(cache, entry);
+    }
+    ReleaseSRWLockExclusive(&cache->lock);
+
+    return list;
+}
+
+/**
+* Adds a freshly loaded list, the cache keeps its own reference so the caller still has to drop theirs.
+*/
+void ListCache_put(ListCache *cache, fz_context *ctx, int pageNumber, fz_display_list *list)
+{
+    ListCacheEntry *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    if (cache->capacity > 0 && !findEntry(cache, pageNumber))
+    {
+        entry = (ListCacheEntry*)calloc(1, sizeof(ListCacheEntry));
+        if (entry)
+        {
+            entry->pageNumber = pageNumber;
+            entry->list       = fz_keep_display_list(ctx, list);
+            linkNewest(cache, entry);
+            cache->count++;
+            evict(cache, ctx);
+        }
+    }
+    ReleaseSRWLockExclusive(&cache->lock);
+}
@@ -0,0 +1,360 @@
+/**
+* Internal bits shared between the files of the helper DLL, nothing in here is exported.
+* See dllmain.c for the actual API.
+*/
+
+#pragma once
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include "posix.h"
+#endif
+#include <stdbool.h>
+#include <limits.h>
+
+#include "mupdf/fitz.h"
+
+/**
+* Identifies one rendered result: which page(s), how many of them side-by-side, the space they were fitted into,
+* and what pixels they were rendered as.
+*/
+typedef struct PageKey
+{
+    int pageNumber;
+    int pageCount;
+    int availableWidth;
+    int availableHeight;
+    int format;  // a `PixelFormat`, left out (0) it's BGRA
+} PageKey;
+
+typedef struct PageCacheEntry PageCacheEntry;
+
+typedef struct ListCacheEntry ListCacheEntry;
+
+/**
+* A least-recently-used cache of the display lists of recently loaded pages, holding at most `capacity` of them.
+* See listcache.c
+*/
+typedef struct ListCache
+{
+    SRWLOCK         lock;
+    int             capacity;
+    int             count;
+    ListCacheEntry *newest;
+    ListCacheEntry *oldest;
+} ListCache;
+
+void             ListCache_init(ListCache *cache, int capacity);
+void             ListCache_destroy(ListCache *cache, fz_context *ctx);
+void             ListCache_setCapacity(ListCache *cache, fz_context *ctx, int capacity);
+fz_display_list *ListCache_get(ListCache *cache, fz_context *ctx, int pageNumber);
+void             ListCache_put(ListCache *cache, fz_context *ctx, int pageNumber, fz_display_list *list);
+
+/**
+* A byte-budgeted, least-recently-used cache of already converted BGRA pages.
+* Entries are either queued (a worker will get to it), rendering (someone is busy with it) or ready.
+* See pagecache.c
+*/
+typedef struct PageCache
+{
+    SRWLOCK             lock;
+    CONDITION_VARIABLE  changed;  // signalled whenever an entry finishes, or gets abandoned
+    size_t              budget;
+    size_t              used;
+    PageCacheEntry     *newest;
+    PageCacheEntry     *oldest;
+    struct Stats       *stats;    // copying in and out is timed in here
+} PageCache;
+
+typedef enum PageCacheResult
+{
+    PAGECACHE_MISS = 0,  // nothing there, the caller has to render it
+    PAGECACHE_CLAIMED,   // nothing there, but the caller now owns a placeholder and must `fill` or `abandon` it
+    PAGECACHE_HIT,       // copied into the caller's buffer
+} PageCacheResult;
+
+void            PageCache_init(PageCache *cache, size_t budget, struct Stats *stats);
+void            PageCache_destroy(PageCache *cache);
+void            PageCache_setBudget(PageCache *cache, size_t budget);
+PageCacheResult PageCache_acquire(PageCache *cache, const PageKey *key, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride);
+bool            PageCache_peek(PageCache *cache, const PageKey *key, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride);
+bool            PageCache_queue(PageCache *cache, const PageKey *key);
+bool            PageCache_start(PageCache *cache, const PageKey *key);
+void            PageCache_fill(PageCache *cache, const PageKey *key, int width, int height, const unsigned char *pixels, int stride);
+void            PageCache_fillOwned(PageCache *cache, const PageKey *key, int width, int height, unsigned char *pixels);
+void            PageCache_abandon(PageCache *cache, const PageKey *key);
+void            PageCache_unqueue(PageCache *cache, const PageKey *key);
+
+/**
+* The pixel layouts we know about, the numbers are part of the exported API so don't shuffle them around.
+*/
+typedef enum PixelFormat
+{
+    PIXEL_FORMAT_BGRA = 0,
+    PIXEL_FORMAT_RGBA = 1,
+    PIXEL_FORMAT_RGB  = 2,
+    PIXEL_FORMAT_GRAY = 3,
+} PixelFormat;
+
+/**
+* Converts one row of `width` pixels, see convert.c
+*/
+typedef void (*ConvertRow)(const unsigned char *src, unsigned char *dst, int width);
+
+typedef struct ConvertKernels
+{
+    const char *name;
+    ConvertRow  rgbToBGRA;
+    ConvertRow  rgbToRGBA;
+    ConvertRow  grayToBGRA;
+} ConvertKernels;
+
+typedef enum ConvertLevel
+{
+    CONVERT_SCALAR = 0,
+    CONVERT_SSSE3,
+    CONVERT_AVX2,
+    CONVERT_NEON,
+    CONVERT_LEVEL_COUNT
+} ConvertLevel;
+
+const ConvertKernels *Convert_kernels(ConvertLevel level);
+const ConvertKernels *Convert_best(void);
+bool                  Convert_pixels(PixelFormat srcFormat, const unsigned char *src, int srcStride, PixelFormat dstFormat, unsigned char *dst, int dstStride, int width, int height);
+int                   PixelFormat_bytes(PixelFormat format);
+
+/**
+* GPU block compressed formats, see encode.c. The numbers are part of the exported API.
+*/
+typedef enum BlockFormat
+{
+    BLOCK_FORMAT_BC1 = 0,  // 8 bytes per 4x4 block, no alpha
+    BLOCK_FORMAT_BC7 = 1,  // 16 bytes per 4x4 block
+} BlockFormat;
+
+int  BlockFormat_bytes(BlockFormat format);
+bool Encode_blocks(BlockFormat format, const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride);
+bool Encode_decode(BlockFormat format, const unsigned char *src, int srcStride, unsigned char *dst, int width, int height, int dstStride);
+
+bool Scale_bilinear(int channels, const unsigned char *src, int srcWidth, int srcHeight, int srcStride, unsigned char *dst, int dstWidth, int dstHeight, int dstStride);
+void Scale_halveBGRA(const unsigned char *src, int srcWidth, int srcHeight, int srcStride, unsigned char *dst, int dstStride);
+void Scale_halveGray(const unsigned char *src, int srcWidth, int srcHeight, int srcStride, unsigned char *dst, int dstStride);
+
+/**
+* What gets timed, and counted. The numbers (and the layout of `PdfStats`) are part of the exported API, see `Pdf_getStats`.
+*/
+typedef enum StatPhase
+{
+    STAT_LOAD_PAGE = 0,  // fz_load_page
+    STAT_RUN_PAGE,       // running the page into a display list
+    STAT_DRAW,           // drawing a display list into pixels
+    STAT_CONVERT,        // converting pixels from one format to another
+    STAT_COPY,           // copying pixels in and out of the page cache, or out of MuPDF's pixmaps
+    STAT_PHASE_COUNT
+} StatPhase;
+
+typedef enum StatCounter
+{
+    STAT_PAGECACHE_HIT = 0,
+    STAT_PAGECACHE_MISS,
+    STAT_LISTCACHE_HIT,
+    STAT_LISTCACHE_MISS,
+    STAT_DISKCACHE_HIT,
+    STAT_DISKCACHE_MISS,
+    STAT_COUNTER_COUNT
+} StatCounter;
+
+typedef struct PdfStats
+{
+    struct
+    {
+        long long count;
+        long long microseconds;
+    }         phases[STAT_PHASE_COUNT];
+    long long counters[STAT_COUNTER_COUNT];
+    long long bytesAllocated;      // what MuPDF is holding on to for this document right now
+    long long peakBytesAllocated;
+    long long allocations;
+} PdfStats;
+
+/**
+* The live counters behind `PdfStats`, see stats.c
+*/
+typedef struct Stats
+{
+    volatile LONG     enabled;
+    volatile LONGLONG phaseCounts[STAT_PHASE_COUNT];
+    volatile LONGLONG phaseTicks[STAT_PHASE_COUNT];
+    volatile LONGLONG counters[STAT_COUNTER_COUNT];
+    volatile LONGLONG bytes;
+    volatile LONGLONG peakBytes;
+    volatile LONGLONG allocations;
+} Stats;
+
+void             Stats_init(Stats *stats);
+void             Stats_enable(Stats *stats, bool enabled);
+LONGLONG         Stats_begin(Stats *stats);
+void             Stats_end(Stats *stats, StatPhase phase, LONGLONG started);
+void             Stats_count(Stats *stats, StatCounter counter);
+fz_alloc_context Stats_allocator(Stats *stats);
+void             Stats_read(Stats *stats, PdfStats *out, bool reset);
+void             Stats_setMemoryLimit(size_t bytes);
+
+/**
+* Recycles big allocations instead of giving them back to the system straight away, see pool.c
+*/
+void  *Pool_malloc(size_t size);
+void  *Pool_realloc(void *pointer, size_t size);
+void   Pool_free(void *pointer);
+size_t Pool_size(void *pointer);
+void   Pool_trim(void);
+
+/**
+* Streams for documents that MuPDF doesn't read from a file itself, see stream.c
+* The callbacks are part of the exported API (see `Pdf_createFromMemory` and `Pdf_createFromStream`).
+*/
+typedef void      (__cdecl *StreamRelease)(void *user, const unsigned char *data, size_t size);
+typedef long long (__cdecl *StreamRead)(void *user, unsigned char *buffer, size_t size);
+typedef long long (__cdecl *StreamSeek)(void *user, long long offset, int whence);
+typedef void      (__cdecl *StreamClose)(void *user);
+
+fz_stream *Stream_openMemory(fz_context *ctx, const unsigned char *data, size_t size, StreamRelease release, void *user);
+fz_stream *Stream_openMapped(fz_context *ctx, const char *path);
+fz_stream *Stream_openCallbacks(fz_context *ctx, StreamRead read, StreamSeek seek, StreamClose close, void *user);
+
+typedef enum OpenState
+{
+    OPEN_PENDING = 0,  // nobody needed the document yet, see `Pdf_createLazy`
+    OPEN_DONE,
+    OPEN_FAILED,
+} OpenState;
+
+typedef struct OutlineEntry
+{
+    char *title;
+    int   depth;
+    int   pageNumber;
+} OutlineEntry;
+
+typedef struct Pdf
+{
+	fz_context       *context;
+	fz_document      *document;
+    int               pageCount;
+
+    // MuPDF needs these to be able to clone the context for other threads
+    fz_locks_context  locks;
+    SRWLOCK           mutexes[FZ_LOCK_MAX];
+    // fz_document is not thread safe, only one context may poke at it at a time
+    SRWLOCK           documentLock;
+
+    PageCache         cache;
+    ListCache         lists;
+    SRWLOCK           requestLock;
+    PageKey           lastRequest;  // so that prefetching knows what size and layout to render
+    bool              lastSpreads;  // and whether its 2 pages were a spread, which prefetching has to step through the same way
+
+    Stats             stats;
+    fz_alloc_context  allocator;  // counts into `stats`
+
+    // a lazily opened document is only opened when something first needs it, and its pages are counted in the background.
+    // `document` is only there once `openState` (which only changes under `documentLock`) says so, and `pageCount` is -1
+    // until it's counted. `counting`, `waiters` (the callbacks to call once it's counted) go under `requestLock`
+    LONG                 openState;
+    bool                 counting;
+    CONDITION_VARIABLE   counted;
+    struct OpenWaiter   *waiters;
+    // never read, its address is what the band jobs' loads are queued under (see Pdf_beginRender), so that
+    // `Pdf_prefetch` cancelling the document's work leaves them alone
+    char                 renderLoads;
+    // the table of contents, flattened, loaded along with the page count and not touched after that
+    OutlineEntry        *outline;
+    int                  outlineCount;
+
+    // everybody who opened the same file shares this, see registry.c
+    char             *path;
+    LONGLONG          modified;
+    // what the disk cache knows the document as, 0 for documents that didn't come from a file, which aren't kept there
+    unsigned long long diskId;
+    LONG              references;  // only touched under the registry's lock
+    struct Pdf       *nextShared;
+} Pdf;
+
+bool Registry_identify(const char *filePath, char **outPath, LONGLONG *outModified);
+Pdf *Registry_acquire(const char *path, LONGLONG modified);
+Pdf *Registry_add(Pdf *pdf);
+bool Registry_release(Pdf *pdf);
+void Registry_forget(Pdf *pdf);
+
+/**
+* Rendered pages kept on disk between sessions, see diskcache.c
+*/
+bool               DiskCache_open(const char *path, size_t bytes);
+void               DiskCache_close(void);
+unsigned long long DiskCache_document(const char *path, LONGLONG modified);
+bool               DiskCache_get(unsigned long long document, const PageKey *key, PixelFormat format, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride);
+void               DiskCache_put(unsigned long long document, const PageKey *key, PixelFormat format, int width, int height, const unsigned char *pixels, int stride);
+
+/**
+* What `Pdf_createLazy` calls once the pages are counted, part of the exported API.
+*/
+typedef void (__cdecl *PdfOpened)(void *user, Pdf *pdf, int pageCount);
+
+/**
+* One page of `Pdf_renderAtlasBGRA`, part of the exported API: where it goes in the atlas, and how it went.
+*/
+typedef struct PdfAtlasPage
+{
+    int pageNumber;
+    int x;
+    int y;
+    int width;              // the space it's fitted into
+    int height;
+    int resultingWidth;     // what it actually covers, set by Pdf_renderAtlasBGRA
+    int resultingHeight;
+    int success;
+} PdfAtlasPage;
+
+/**
+* A page being drawn a band at a time, see `Pdf_beginRender`.
+*/
+typedef struct PdfRenderJob PdfRenderJob;
+
+/**
+* One caller's prefetching of a shared document, see `Pdf_createPrefetcher`. Its address is what its jobs are queued under.
+*/
+typedef struct PdfPrefetcher
+{
+    Pdf *pdf;
+} PdfPrefetcher;
+
+/**
+* How far `Pdf_continueRender` got, part of the exported API.
+*/
+typedef struct PdfRenderProgress
+{
+    int resultingWidth;     // what the page(s) cover, 0 until they're laid out
+    int resultingHeight;
+    int shownPages;         // 1 or 2, like Pdf_getSpreadPixels
+    int firstRow;           // the rows finished by this call are firstRow up to (not including) rowsDone
+    int rowsDone;           // rows are done top to bottom, these are all finished
+    int errors;             // things on the page that failed to draw and were left out (fz_cookie's errors)
+    int done;
+} PdfRenderProgress;
+
+int renderFitted(Pdf *pdf, fz_context *ctx, const PageKey *key, PixelFormat format, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride);
+
+/**
+* A pool of background threads shared by all open documents, see workers.c
+* Jobs belong to an `owner` (the Pdf) so they can all be cancelled when it goes away.
+*/
+typedef void (*WorkerFunction)(void *userData);
+
+void Workers_retain(void);
+void Workers_release(void);
+void Workers_submit(void *owner, WorkerFunction run, WorkerFunction discard, void *userData);
+void Workers_cancel(void *owner);
+void Workers_wait(void *owner);
+void Workers_setCount(int count);
+int  Workers_count(void);
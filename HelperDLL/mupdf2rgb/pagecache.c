@@ -0,0 +1,311 @@
+/**
+* A cache of pages that have already been rendered, as BGRA (or gray, for books that are shown that way), so that
+* flipping back and forth, or flipping to a page that was prefetched, is just a copy instead of a full trip through MuPDF.
+*
+* Pixels are stored tightly packed (`width` pixels per row, in the key's format), only the area the page(s) actually
+* covered is kept. The same page in two formats is two entries.
+* The list is kept in least-recently-used order, and the oldest ready entries get thrown out once over budget.
+* Entries that are queued or busy rendering don't count towards the budget, and are never evicted.
+*/
+
+#include "mupdf2rgb.h"
+
+typedef enum PageCacheState
+{
+    ENTRY_QUEUED,
+    ENTRY_RENDERING,
+    ENTRY_READY,
+} PageCacheState;
+
+struct PageCacheEntry
+{
+    PageKey         key;
+    PageCacheState  state;
+    int             width;
+    int             height;
+    unsigned char  *pixels;
+    size_t          size;
+    PageCacheEntry *newer;
+    PageCacheEntry *older;
+};
+
+static bool sameKey(const PageKey *a, const PageKey *b)
+{
+    return a->pageNumber      == b->pageNumber &&
+           a->pageCount       == b->pageCount &&
+           a->availableWidth  == b->availableWidth &&
+           a->availableHeight == b->availableHeight &&
+           a->format          == b->format;
+}
+
+static PageCacheEntry *findEntry(PageCache *cache, const PageKey *key)
+{
+    PageCacheEntry *entry;
+    for (entry = cache->newest; entry; entry = entry->older)
+        if (sameKey(&entry->key, key))
+            return entry;
+    return NULL;
+}
+
+static void unlinkEntry(PageCache *cache, PageCacheEntry *entry)
+{
+    if (entry->newer) entry->newer->older = entry->older;
+    else              cache->newest       = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else              cache->oldest       = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void linkNewest(PageCache *cache, PageCacheEntry *entry)
+{
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest) cache->newest->newer = entry;
+    cache->newest = entry;
+    if (!cache->oldest) cache->oldest = entry;
+}
+
+static void freeEntry(PageCache *cache, PageCacheEntry *entry)
+{
+    unlinkEntry(cache, entry);
+    if (entry->state == ENTRY_READY)
+        cache->used -= entry->size;
+    free(entry->pixels);
+    free(entry);
+}
+
+static PageCacheEntry *newEntry(PageCache *cache, const PageKey *key, PageCacheState state)
+{
+    PageCacheEntry *entry = (PageCacheEntry*)calloc(1, sizeof(PageCacheEntry));
+    if (!entry)
+        return NULL;
+    entry->key   = *key;
+    entry->state = state;
+    linkNewest(cache, entry);
+    return entry;
+}
+
+// must be called with the lock held, also makes it the most recently used
+static void copyOut(PageCache *cache, PageCacheEntry *entry, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride)
+{
+    PixelFormat format  = (PixelFormat)entry->key.format;
+    LONGLONG    started = Stats_begin(cache->stats);
+    Convert_pixels(format, entry->pixels, entry->width * PixelFormat_bytes(format), format, outBuffer, outStride, entry->width, entry->height);
+    Stats_end(cache->stats, STAT_COPY, started);
+
+    if (resultingWidth)  *resultingWidth  = entry->width;
+    if (resultingHeight) *resultingHeight = entry->height;
+
+    unlinkEntry(cache, entry);
+    linkNewest(cache, entry);
+}
+
+// must be called with the lock held
+static void evict(PageCache *cache)
+{
+    PageCacheEntry *entry = cache->oldest;
+    while (entry && cache->used > cache->budget)
+    {
+        PageCacheEntry *newer = entry->newer;
+        if (entry->state == ENTRY_READY)
+            freeEntry(cache, entry);
+        entry = newer;
+    }
+}
+
+void PageCache_init(PageCache *cache, size_t budget, Stats *stats)
+{
+    memset(cache, 0, sizeof(PageCache));
+    InitializeSRWLock(&cache->lock);
+    InitializeConditionVariable(&cache->changed);
+    cache->budget = budget;
+    cache->stats  = stats;
+}
+
+/**
+* Nobody may be using the cache anymore when this is called, i.e., all workers for the owning Pdf have to be done.
+*/
+void PageCache_destroy(PageCache *cache)
+{
+    while (cache->newest)
+        freeEntry(cache, cache->newest);
+}
+
+void PageCache_setBudget(PageCache *cache, size_t budget)
+{
+    AcquireSRWLockExclusive(&cache->lock);
+    cache->budget = budget;
+    evict(cache);
+    ReleaseSRWLockExclusive(&cache->lock);
+}
+
+/**
+* Looks for a page, and if it's ready copies it into `outBuffer` (rows `outStride` bytes apart).
+* If a worker is busy rendering it right now, this waits for it rather than doing the work twice.
+* If it's only queued, the caller steals it from the worker and gets PAGECACHE_CLAIMED back.
+* The same goes for a page that isn't in the cache at all, as long as there is a budget to put it in once done.
+*/
+PageCacheResult PageCache_acquire(PageCache *cache, const PageKey *key, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride)
+{
+    PageCacheResult result = PAGECACHE_MISS;
+    PageCacheEntry *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+
+    while ((entry = findEntry(cache, key)) != NULL && entry->state == ENTRY_RENDERING)
+        SleepConditionVariableSRW(&cache->changed, &cache->lock, INFINITE, 0);
+
+    if (entry && entry->state == ENTRY_READY)
+    {
+        copyOut(cache, entry, resultingWidth, resultingHeight, outBuffer, outStride);
+        result = PAGECACHE_HIT;
+    }
+    else if (entry) // queued, so take it over
+    {
+        entry->state = ENTRY_RENDERING;
+        result = PAGECACHE_CLAIMED;
+    }
+    else if (cache->budget > 0 && newEntry(cache, key, ENTRY_RENDERING))
+    {
+        result = PAGECACHE_CLAIMED;
+    }
+
+    ReleaseSRWLockExclusive(&cache->lock);
+    return result;
+}
+
+/**
+* Copies a page into `outBuffer` if it's ready, but unlike `PageCache_acquire` never waits and never claims anything.
+*/
+bool PageCache_peek(PageCache *cache, const PageKey *key, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride)
+{
+    bool            found = false;
+    PageCacheEntry *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    entry = findEntry(cache, key);
+    if (entry && entry->state == ENTRY_READY)
+    {
+        copyOut(cache, entry, resultingWidth, resultingHeight, outBuffer, outStride);
+        found = true;
+    }
+    ReleaseSRWLockExclusive(&cache->lock);
+
+    return found;
+}
+
+/**
+* Adds a placeholder for a page a worker is going to render, returns false if it's already there (or can't be).
+*/
+bool PageCache_queue(PageCache *cache, const PageKey *key)
+{
+    bool queued = false;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    if (cache->budget > 0 && !findEntry(cache, key))
+        queued = newEntry(cache, key, ENTRY_QUEUED) != NULL;
+    ReleaseSRWLockExclusive(&cache->lock);
+
+    return queued;
+}
+
+/**
+* Called by the worker when it gets around to a queued page, returns false if somebody else got to it first.
+*/
+bool PageCache_start(PageCache *cache, const PageKey *key)
+{
+    bool started = false;
+    PageCacheEntry *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    entry = findEntry(cache, key);
+    if (entry && entry->state == ENTRY_QUEUED)
+    {
+        entry->state = ENTRY_RENDERING;
+        started = true;
+    }
+    ReleaseSRWLockExclusive(&cache->lock);
+
+    return started;
+}
+
+/**
+* Hands a tightly packed buffer (in the key's format, allocated with `malloc`) over to the cache, which frees it when it's done with it.
+*/
+void PageCache_fillOwned(PageCache *cache, const PageKey *key, int width, int height, unsigned char *pixels)
+{
+    PageCacheEntry *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    entry = findEntry(cache, key);
+    if (entry && entry->state == ENTRY_RENDERING)
+    {
+        entry->pixels = pixels;
+        entry->width  = width;
+        entry->height = height;
+        entry->size   = (size_t)width * height * PixelFormat_bytes((PixelFormat)key->format);
+        entry->state  = ENTRY_READY;
+        cache->used  += entry->size;
+
+        unlinkEntry(cache, entry);
+        linkNewest(cache, entry);
+        evict(cache);
+        pixels = NULL;
+    }
+    WakeAllConditionVariable(&cache->changed);
+    ReleaseSRWLockExclusive(&cache->lock);
+
+    free(pixels);
+}
+
+/**
+* Same as `PageCache_fillOwned`, but copies `width * height` pixels out of a buffer with rows `stride` bytes apart.
+*/
+void PageCache_fill(PageCache *cache, const PageKey *key, int width, int height, const unsigned char *pixels, int stride)
+{
+    PixelFormat    format = (PixelFormat)key->format;
+    unsigned char *copy   = (unsigned char*)malloc((size_t)width * height * PixelFormat_bytes(format));
+    LONGLONG       started;
+
+    if (!copy)
+    {
+        PageCache_abandon(cache, key);
+        return;
+    }
+
+    started = Stats_begin(cache->stats);
+    Convert_pixels(format, pixels, stride, format, copy, width * PixelFormat_bytes(format), width, height);
+    Stats_end(cache->stats, STAT_COPY, started);
+
+    PageCache_fillOwned(cache, key, width, height, copy);
+}
+
+/**
+* Removes a placeholder that will never be filled, e.g., rendering failed or the prefetch was cancelled.
+*/
+void PageCache_abandon(PageCache *cache, const PageKey *key)
+{
+    PageCacheEntry *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    entry = findEntry(cache, key);
+    if (entry && entry->state != ENTRY_READY)
+        freeEntry(cache, entry);
+    WakeAllConditionVariable(&cache->changed);
+    ReleaseSRWLockExclusive(&cache->lock);
+}
+
+/**
+* Removes a placeholder that is still only queued, i.e., the prefetch got cancelled before a worker got to it.
+* If somebody already started rendering it, it's left alone.
+*/
+void PageCache_unqueue(PageCache *cache, const PageKey *key)
+{
+    PageCacheEntry *entry;
+
+    AcquireSRWLockExclusive(&cache->lock);
+    entry = findEntry(cache, key);
+    if (entry && entry->state == ENTRY_QUEUED)
+        freeEntry(cache, entry);
+    ReleaseSRWLockExclusive(&cache->lock);
+}
@@ -0,0 +1,185 @@
+/**
+* Where MuPDF's memory comes from (through the allocator in stats.c).
+*
+* Small allocations go straight to malloc. Big ones (scratch pixmaps, decoded images, the draw device's buffers) tend to
+* be the same few sizes page after page, so instead of handing them back to malloc, which then has to find room for the
+* same thing again a moment later and fragments the heap while doing so, they're kept on a free list (up to a limit)
+* and handed out again to the next request of the same size.
+*
+* Every block remembers the size asked for and the size actually allocated in front of it.
+*/
+
+#include "mupdf2rgb.h"
+
+#define HEADER_SIZE   16                  // keeps the rest 16 byte aligned, like malloc does
+#define BIG_BLOCK     (256 * 1024)        // anything from this size up gets pooled
+#define BIG_ROUNDING  (64 * 1024)         // and is rounded up to this, so near enough sizes can share
+#define POOL_LIMIT    (64 * 1024 * 1024)  // how much may sit around unused
+
+typedef struct BlockHeader
+{
+    size_t size;      // what was asked for
+    size_t capacity;  // what's actually there, after the header
+} BlockHeader;
+
+typedef struct FreeBlock
+{
+    struct FreeBlock *next;
+} FreeBlock;
+
+static SRWLOCK    poolLock   = SRWLOCK_INIT;
+static FreeBlock *freeBlocks = NULL;
+static size_t     pooled     = 0;
+
+static size_t capacityFor(size_t size)
+{
+    if (size < BIG_BLOCK)
+        return size;
+    return (size + BIG_ROUNDING - 1) / BIG_ROUNDING * BIG_ROUNDING;
+}
+
+static BlockHeader *headerOf(void *pointer)
+{
+    return (BlockHeader*)((unsigned char*)pointer - HEADER_SIZE);
+}
+
+// takes a block of exactly `capacity` off the free list, if there is one
+static void *takePooled(size_t capacity)
+{
+    FreeBlock **link;
+    void       *found = NULL;
+
+    AcquireSRWLockExclusive(&poolLock);
+    for (link = &freeBlocks; *link; link = &(*link)->next)
+    {
+        if (headerOf(*link)->capacity == capacity)
+        {
+            found   = *link;
+            *link   = (*link)->next;
+            pooled -= capacity;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&poolLock);
+
+    return found;
+}
+
+void *Pool_malloc(size_t size)
+{
+    size_t         capacity = capacityFor(size);
+    unsigned char *block;
+
+    if (capacity >= BIG_BLOCK)
+    {
+        void *reused = takePooled(capacity);
+        if (reused)
+        {
+            headerOf(reused)->size = size;
+            return reused;
+        }
+    }
+
+    block = (unsigned char*)malloc(capacity + HEADER_SIZE);
+    if (!block)
+        return NULL;
+
+    ((BlockHeader*)block)->size     = size;
+    ((BlockHeader*)block)->capacity = capacity;
+    return block + HEADER_SIZE;
+}
+
+void Pool_free(void *pointer)
+{
+    BlockHeader *header;
+
+    if (!pointer)
+        return;
+
+    header = headerOf(pointer);
+    if (header->capacity >= BIG_BLOCK)
+    {
+        bool kept = false;
+
+        AcquireSRWLockExclusive(&poolLock);
+        if (pooled + header->capacity <= POOL_LIMIT)
+        {
+            FreeBlock *block = (FreeBlock*)pointer;
+            block->next = freeBlocks;
+            freeBlocks  = block;
+            pooled     += header->capacity;
+            kept        = true;
+        }
+        ReleaseSRWLockExclusive(&poolLock);
+
+        if (kept)
+            return;
+    }
+
+    free(header);
+}
+
+void *Pool_realloc(void *pointer, size_t size)
+{
+    BlockHeader *header;
+    void        *moved;
+
+    if (!pointer)
+        return Pool_malloc(size);
+
+    // still fits, and isn't wasting a pooled sized block on something small
+    header = headerOf(pointer);
+    if (size <= header->capacity && capacityFor(size) == header->capacity)
+    {
+        header->size = size;
+        return pointer;
+    }
+
+    // pooled blocks can't go through realloc, the pool might want to keep the old one
+    if (header->capacity >= BIG_BLOCK || capacityFor(size) >= BIG_BLOCK)
+    {
+        moved = Pool_malloc(size);
+        if (!moved)
+            return NULL;
+        memcpy(moved, pointer, min(size, header->size));
+        Pool_free(pointer);
+        return moved;
+    }
+
+    header = (BlockHeader*)realloc(header, size + HEADER_SIZE);
+    if (!header)
+        return NULL;
+
+    header->size     = size;
+    header->capacity = size;
+    return (unsigned char*)header + HEADER_SIZE;
+}
+
+/**
+* How big the block was asked to be, not counting any rounding.
+*/
+size_t Pool_size(void *pointer)
+{
+    return pointer ? headerOf(pointer)->size : 0;
+}
+
+/**
+* Hands everything sitting in the pool back to the system, e.g., when a document is closed.
+*/
+void Pool_trim(void)
+{
+    FreeBlock *blocks;
+
+    AcquireSRWLockExclusive(&poolLock);
+    blocks     = freeBlocks;
+    freeBlocks = NULL;
+    pooled     = 0;
+    ReleaseSRWLockExclusive(&poolLock);
+
+    while (blocks)
+    {
+        FreeBlock *next = blocks->next;
+        free(headerOf(blocks));
+        blocks = next;
+    }
+}
@@ -0,0 +1,158 @@
+/**
+* Just enough of the Win32 API, on top of pthreads, for the helper DLL to build on Linux (and friends),
+* so the benchmark in ../bench can run it without Unreal or Windows.
+*
+* Only what the DLL actually uses is here, and only the way it uses it: locks are only ever taken exclusively,
+* and condition variables are only ever waited on forever.
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define __declspec(x)
+#define __cdecl
+
+#ifndef min
+    #define min(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+    #define max(a,b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef uint32_t DWORD;
+typedef int32_t  LONG;
+typedef int64_t  LONGLONG;
+typedef void    *LPVOID;
+#define WINAPI
+#define INFINITE 0xFFFFFFFF
+
+//
+// locks and condition variables
+//
+
+typedef pthread_mutex_t SRWLOCK;
+typedef pthread_cond_t  CONDITION_VARIABLE;
+
+#define SRWLOCK_INIT            PTHREAD_MUTEX_INITIALIZER
+#define CONDITION_VARIABLE_INIT PTHREAD_COND_INITIALIZER
+
+static inline void InitializeSRWLock(SRWLOCK *lock)       { pthread_mutex_init(lock, NULL); }
+static inline void AcquireSRWLockExclusive(SRWLOCK *lock) { pthread_mutex_lock(lock); }
+static inline void ReleaseSRWLockExclusive(SRWLOCK *lock) { pthread_mutex_unlock(lock); }
+
+static inline void InitializeConditionVariable(CONDITION_VARIABLE *condition) { pthread_cond_init(condition, NULL); }
+static inline void WakeConditionVariable(CONDITION_VARIABLE *condition)       { pthread_cond_signal(condition); }
+static inline void WakeAllConditionVariable(CONDITION_VARIABLE *condition)    { pthread_cond_broadcast(condition); }
+
+static inline int SleepConditionVariableSRW(CONDITION_VARIABLE *condition, SRWLOCK *lock, DWORD milliseconds, unsigned long flags)
+{
+    (void)milliseconds; (void)flags;
+    return pthread_cond_wait(condition, lock) == 0;
+}
+
+//
+// atomics
+//
+
+static inline LONG     InterlockedExchange(volatile LONG *target, LONG value)                                 { return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST); }
+static inline LONG     InterlockedIncrement(volatile LONG *target)                                            { return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST); }
+static inline LONG     InterlockedDecrement(volatile LONG *target)                                            { return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST); }
+static inline LONGLONG InterlockedExchange64(volatile LONGLONG *target, LONGLONG value)                       { return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST); }
+static inline LONGLONG InterlockedIncrement64(volatile LONGLONG *target)                                      { return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST); }
+static inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG *target, LONGLONG value)                    { return __atomic_fetch_add(target, value, __ATOMIC_SEQ_CST); }
+static inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG *target, LONGLONG value, LONGLONG compare)
+{
+    __atomic_compare_exchange_n(target, &compare, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return compare;
+}
+
+//
+// threads
+//
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+typedef struct PosixThread
+{
+    pthread_t              thread;
+    LPTHREAD_START_ROUTINE start;
+    LPVOID                 parameter;
+} PosixThread, *HANDLE;
+
+static void *posixThreadMain(void *parameter)
+{
+    PosixThread *thread = (PosixThread*)parameter;
+    thread->start(thread->parameter);
+    return NULL;
+}
+
+static inline HANDLE CreateThread(void *attributes, size_t stackSize, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD flags, DWORD *threadId)
+{
+    PosixThread *thread = (PosixThread*)calloc(1, sizeof(PosixThread));
+    (void)attributes; (void)stackSize; (void)flags; (void)threadId;
+
+    if (!thread)
+        return NULL;
+
+    thread->start     = start;
+    thread->parameter = parameter;
+    if (pthread_create(&thread->thread, NULL, posixThreadMain, thread) != 0)
+    {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+static inline DWORD WaitForSingleObject(HANDLE thread, DWORD milliseconds)
+{
+    (void)milliseconds;
+    pthread_join(thread->thread, NULL);
+    return 0;
+}
+
+static inline int CloseHandle(HANDLE thread)
+{
+    free(thread);
+    return 1;
+}
+
+//
+// system
+//
+
+typedef union LARGE_INTEGER
+{
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+static inline int QueryPerformanceCounter(LARGE_INTEGER *counter)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    counter->QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+    return 1;
+}
+
+static inline int QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000;
+    return 1;
+}
+
+typedef struct SYSTEM_INFO
+{
+    DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+static inline void GetSystemInfo(SYSTEM_INFO *info)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    info->dwNumberOfProcessors = (DWORD)(count > 0 ? count : 1);
+}
@@ -0,0 +1,163 @@
+/**
+* The documents that are currently open, so opening the same file again hands out the same `Pdf` instead of parsing it
+* all over again, with its own context, fonts, decoded images and page caches.
+*
+* A file is recognised by its full path (made absolute, and on Windows lower cased with backslashes, since the file system
+* doesn't care) together with when it was last modified, so a file that was changed on disk gets opened afresh, while
+* whoever still has the old one keeps using that.
+*
+* Every `Pdf_create` that finds (or adds) a document counts as a reference, and only the `Pdf_destroy` that drops the
+* last one actually closes it.
+*/
+
+#include "mupdf2rgb.h"
+#include <ctype.h>
+#include <sys/stat.h>
+
+static SRWLOCK registryLock = SRWLOCK_INIT;
+static Pdf    *registered   = NULL;
+
+/**
+* Works out what a file should be recognised by, `*outPath` must be freed by the caller.
+* Fails if the file doesn't exist, in which case there's nothing to open anyway.
+*/
+bool Registry_identify(const char *filePath, char **outPath, LONGLONG *outModified)
+{
+    char *path;
+
+    *outPath = NULL;
+    *outModified = 0;
+
+#ifdef _WIN32
+    {
+        struct __stat64 info;
+        char           *c;
+
+        path = _fullpath(NULL, filePath, 0);
+        if (!path)
+            return false;
+        for (c = path; *c; c++)
+            *c = (*c == '/') ? '\\' : (char)tolower((unsigned char)*c);
+
+        if (_stat64(path, &info) != 0)
+        {
+            free(path);
+            return false;
+        }
+        *outModified = (LONGLONG)info.st_mtime;
+    }
+#else
+    {
+        struct stat info;
+
+        path = realpath(filePath, NULL);
+        if (!path)
+            return false;
+
+        if (stat(path, &info) != 0)
+        {
+            free(path);
+            return false;
+        }
+        // nanoseconds too where there are any, a file rewritten within the same second is still a different file
+        *outModified = (LONGLONG)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    }
+#endif
+
+    *outPath = path;
+    return true;
+}
+
+static Pdf *findPdf(const char *path, LONGLONG modified)
+{
+    Pdf *pdf;
+    for (pdf = registered; pdf; pdf = pdf->nextShared)
+        if (pdf->modified == modified && strcmp(pdf->path, path) == 0)
+            return pdf;
+    return NULL;
+}
+
+/**
+* Returns the open document for `path` as it was at `modified`, with one more reference to it, or NULL if it isn't open.
+*/
+Pdf *Registry_acquire(const char *path, LONGLONG modified)
+{
+    Pdf *pdf;
+
+    AcquireSRWLockExclusive(&registryLock);
+    pdf = findPdf(path, modified);
+    if (pdf)
+        pdf->references++;
+    ReleaseSRWLockExclusive(&registryLock);
+
+    return pdf;
+}
+
+/**
+* Adds a freshly opened document (with its `path` and `modified` filled in), with one reference.
+* If somebody else opened the same file in the meantime, theirs is returned instead (with one more reference) and the
+* caller should throw its own away, otherwise `pdf` itself comes back.
+*/
+Pdf *Registry_add(Pdf *pdf)
+{
+    Pdf *existing;
+
+    AcquireSRWLockExclusive(&registryLock);
+    existing = findPdf(pdf->path, pdf->modified);
+    if (existing)
+    {
+        existing->references++;
+    }
+    else
+    {
+        pdf->references = 1;
+        pdf->nextShared = registered;
+        registered      = pdf;
+    }
+    ReleaseSRWLockExclusive(&registryLock);
+
+    return existing ? existing : pdf;
+}
+
+// takes it out of the registry, so it doesn't get handed out any more, whoever already has it keeps it
+static void unregister(Pdf *pdf)
+{
+    Pdf **link;
+
+    for (link = &registered; *link; link = &(*link)->nextShared)
+    {
+        if (*link == pdf)
+        {
+            *link = pdf->nextShared;
+            break;
+        }
+    }
+    pdf->nextShared = NULL;
+}
+
+/**
+* Stops a document from being handed out to anybody else who opens the same file, e.g., because it turned out to be broken.
+*/
+void Registry_forget(Pdf *pdf)
+{
+    AcquireSRWLockExclusive(&registryLock);
+    unregister(pdf);
+    ReleaseSRWLockExclusive(&registryLock);
+}
+
+/**
+* Drops a reference, returns true if that was the last one, in which case the document is no longer registered and the
+* caller has to close it.
+*/
+bool Registry_release(Pdf *pdf)
+{
+    bool last;
+
+    AcquireSRWLockExclusive(&registryLock);
+    last = --pdf->references <= 0;
+    if (last)
+        unregister(pdf);
+    ReleaseSRWLockExclusive(&registryLock);
+
+    return last;
+}
@@ -0,0 +1,228 @@
+/**
+* Resizing BGRA (and gray) images, for stretching small previews up to the size of the real thing,
+* and halving pages over and over to make mipmaps.
+*/
+
+#include "mupdf2rgb.h"
+
+// no need to ask the CPU for these, every x64 CPU has SSE2 and every ARM64 one has NEON
+#if defined(_M_X64) || defined(__SSE2__)
+    #define HAVE_SSE2 1
+    #include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+    #define HAVE_NEON 1
+    #include <arm_neon.h>
+#endif
+
+/**
+* Works out, for every destination pixel along one axis, the two source pixels it sits between and how far along
+* (0-255 of the way from the first to the second) it is. Pixel centres line up, like most GPUs do it.
+*/
+static void bilinearSteps(int srcSize, int dstSize, int *first, int *weight)
+{
+    int index;
+    for (index = 0; index < dstSize; index++)
+    {
+        long long position = ((long long)(index * 2 + 1) * srcSize * 256) / ((long long)dstSize * 2) - 128;
+        if (position < 0)
+            position = 0;
+
+        first[index]  = (int)(position >> 8);
+        weight[index] = (int)(position & 255);
+        if (first[index] >= srcSize - 1)
+        {
+            first[index]  = srcSize - 1;
+            weight[index] = 0;
+        }
+    }
+}
+
+/**
+* Bilinear resize of a `srcWidth x srcHeight` image, with `channels` bytes per pixel (4 for BGRA, 1 for gray), into a
+* `dstWidth x dstHeight` area of `dst`. Rows are `srcStride` and `dstStride` bytes apart. Returns false if it ran out of memory.
+*/
+bool Scale_bilinear(int channels, const unsigned char *src, int srcWidth, int srcHeight, int srcStride, unsigned char *dst, int dstWidth, int dstHeight, int dstStride)
+{
+    int *steps;
+    int *xFirst, *xWeight, *yFirst, *yWeight;
+    int  x, y, channel;
+
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+        return true;
+
+    steps = (int*)malloc(sizeof(int) * 2 * (dstWidth + dstHeight));
+    if (!steps)
+        return false;
+
+    xFirst  = steps;
+    xWeight = xFirst + dstWidth;
+    yFirst  = xWeight + dstWidth;
+    yWeight = yFirst + dstHeight;
+    bilinearSteps(srcWidth, dstWidth, xFirst, xWeight);
+    bilinearSteps(srcHeight, dstHeight, yFirst, yWeight);
+
+    for (y = 0; y < dstHeight; y++)
+    {
+        const unsigned char *top    = src + (size_t)yFirst[y] * srcStride;
+        const unsigned char *bottom = (yWeight[y] > 0) ? top + srcStride : top;
+        unsigned char       *out    = dst + (size_t)y * dstStride;
+        int                  wy     = yWeight[y];
+
+        for (x = 0; x < dstWidth; x++)
+        {
+            const unsigned char *topLeft    = top + xFirst[x] * channels;
+            const unsigned char *bottomLeft = bottom + xFirst[x] * channels;
+            int                  right      = (xWeight[x] > 0) ? channels : 0;
+            int                  wx         = xWeight[x];
+
+            for (channel = 0; channel < channels; channel++)
+            {
+                int upper = topLeft[channel] * (256 - wx) + topLeft[channel + right] * wx;
+                int lower = bottomLeft[channel] * (256 - wx) + bottomLeft[channel + right] * wx;
+                *out++ = (unsigned char)((upper * (256 - wy) + lower * wy + 32768) >> 16);
+            }
+        }
+    }
+
+    free(steps);
+    return true;
+}
+
+/**
+* Averages 2x2 blocks of the two source rows into `dst`, from pixel `start` up to `count`.
+* The SIMD versions do the bulk of the row and leave the last few to this one.
+*/
+static void halveRow_scalar(const unsigned char *top, const unsigned char *bottom, unsigned char *dst, int start, int count)
+{
+    int x, channel;
+    for (x = start; x < count; x++)
+    {
+        const unsigned char *a = top + x * 8;
+        const unsigned char *b = bottom + x * 8;
+        for (channel = 0; channel < 4; channel++)
+            dst[x * 4 + channel] = (unsigned char)((a[channel] + a[channel + 4] + b[channel] + b[channel + 4] + 2) >> 2);
+    }
+}
+
+#if defined(HAVE_SSE2)
+// 8 source pixels from each row become 4, returns how many were done
+static int halveRow_simd(const unsigned char *top, const unsigned char *bottom, unsigned char *dst, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two  = _mm_set1_epi16(2);
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        __m128i t0 = _mm_loadu_si128((const __m128i*)(top + x * 8));
+        __m128i t1 = _mm_loadu_si128((const __m128i*)(top + x * 8 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(bottom + x * 8));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(bottom + x * 8 + 16));
+
+        // column sums, two pixels per register
+        __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(t0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(t0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(t1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(t1, zero), _mm_unpackhi_epi8(b1, zero));
+
+        // then add each even pixel to the odd one next to it
+        __m128i d01 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+        __m128i d23 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+        d01 = _mm_srli_epi16(_mm_add_epi16(d01, two), 2);
+        d23 = _mm_srli_epi16(_mm_add_epi16(d23, two), 2);
+
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(d01, d23));
+    }
+    return x;
+}
+#elif defined(HAVE_NEON)
+static int halveRow_simd(const unsigned char *top, const unsigned char *bottom, unsigned char *dst, int count)
+{
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4)
+    {
+        // splits 8 pixels into the 4 even and 4 odd ones
+        uint32x4x2_t t    = vld2q_u32((const uint32_t*)(top + x * 8));
+        uint32x4x2_t b    = vld2q_u32((const uint32_t*)(bottom + x * 8));
+        uint8x16_t   te   = vreinterpretq_u8_u32(t.val[0]);
+        uint8x16_t   to   = vreinterpretq_u8_u32(t.val[1]);
+        uint8x16_t   be   = vreinterpretq_u8_u32(b.val[0]);
+        uint8x16_t   bo   = vreinterpretq_u8_u32(b.val[1]);
+        uint16x8_t   low  = vaddw_u8(vaddw_u8(vaddl_u8(vget_low_u8(te), vget_low_u8(to)), vget_low_u8(be)), vget_low_u8(bo));
+        uint16x8_t   high = vaddw_u8(vaddw_u8(vaddl_u8(vget_high_u8(te), vget_high_u8(to)), vget_high_u8(be)), vget_high_u8(bo));
+
+        // the rounding narrow does the +2 >> 2
+        vst1q_u8(dst + x * 4, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+    }
+    return x;
+}
+#else
+static int halveRow_simd(const unsigned char *top, const unsigned char *bottom, unsigned char *dst, int count)
+{
+    return 0;
+}
+#endif
+
+/**
+* Makes the next mip level down: every 2x2 block of `src` is averaged into one pixel of `dst`, which ends up
+* `max(1, srcWidth / 2) x max(1, srcHeight / 2)`, the same sizes the GPU uses.
+* A leftover odd row or column is dropped, and a side that's already 1 pixel only gets averaged in the other direction.
+*/
+void Scale_halveBGRA(const unsigned char *src, int srcWidth, int srcHeight, int srcStride, unsigned char *dst, int dstStride)
+{
+    int dstWidth  = max(1, srcWidth / 2);
+    int dstHeight = max(1, srcHeight / 2);
+    int y;
+
+    if (srcWidth <= 0 || srcHeight <= 0)
+        return;
+
+    for (y = 0; y < dstHeight; y++)
+    {
+        const unsigned char *top    = src + (size_t)y * (srcHeight > 1 ? 2 : 1) * srcStride;
+        const unsigned char *bottom = (srcHeight > 1) ? top + srcStride : top;
+        unsigned char       *out    = dst + (size_t)y * dstStride;
+
+        if (srcWidth > 1)
+        {
+            halveRow_scalar(top, bottom, out, halveRow_simd(top, bottom, out, dstWidth), dstWidth);
+        }
+        else
+        {
+            int channel;
+            for (channel = 0; channel < 4; channel++)
+                out[channel] = (unsigned char)((top[channel] + bottom[channel] + 1) >> 1);
+        }
+    }
+}
+
+/**
+* `Scale_halveBGRA` for gray pages, one byte per pixel. Simple enough for the compiler to vectorise on its own.
+*/
+void Scale_halveGray(const unsigned char *src, int srcWidth, int srcHeight, int srcStride, unsigned char *dst, int dstStride)
+{
+    int dstWidth  = max(1, srcWidth / 2);
+    int dstHeight = max(1, srcHeight / 2);
+    int x, y;
+
+    if (srcWidth <= 0 || srcHeight <= 0)
+        return;
+
+    for (y = 0; y < dstHeight; y++)
+    {
+        const unsigned char *top    = src + (size_t)y * (srcHeight > 1 ? 2 : 1) * srcStride;
+        const unsigned char *bottom = (srcHeight > 1) ? top + srcStride : top;
+        unsigned char       *out    = dst + (size_t)y * dstStride;
+
+        if (srcWidth > 1)
+        {
+            for (x = 0; x < dstWidth; x++)
+                out[x] = (unsigned char)((top[x * 2] + top[x * 2 + 1] + bottom[x * 2] + bottom[x * 2 + 1] + 2) >> 2);
+        }
+        else
+        {
+            out[0] = (unsigned char)((top[0] + bottom[0] + 1) >> 1);
+        }
+    }
+}
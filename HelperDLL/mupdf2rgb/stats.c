@@ -0,0 +1,188 @@
+/**
+* Counters for where the time (and memory) goes, per document.
+*
+* Timing is off until `Pdf_enableStats` turns it on, and while it's off all it costs is checking a flag.
+* Memory is always counted, since it's done by the allocator MuPDF is given, and that has to be there from the start;
+* that's an atomic add per allocation, next to everything else malloc already does.
+*
+* The same allocator also enforces the memory limit over all documents (see `Pdf_setMemoryLimit`): an allocation that
+* would go over it fails, which makes MuPDF throw things out of its caches and try again, and only if there's nothing
+* left to throw out does it give up.
+*/
+
+#include "mupdf2rgb.h"
+
+// what all documents together are using, and how much they may
+static volatile LONGLONG totalBytes = 0;
+static volatile LONGLONG limitBytes = 0;
+
+static LONGLONG ticksPerSecond(void)
+{
+    static LONGLONG frequency = 0;
+    if (!frequency)
+    {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        frequency = value.QuadPart;
+    }
+    return frequency;
+}
+
+void Stats_init(Stats *stats)
+{
+    memset(stats, 0, sizeof(Stats));
+    ticksPerSecond();
+}
+
+void Stats_enable(Stats *stats, bool enabled)
+{
+    InterlockedExchange(&stats->enabled, enabled ? 1 : 0);
+}
+
+/**
+* Returns the time to hand to `Stats_end`, or 0 when timing is off.
+*/
+LONGLONG Stats_begin(Stats *stats)
+{
+    LARGE_INTEGER now;
+    if (!stats->enabled)
+        return 0;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart ? now.QuadPart : 1;
+}
+
+void Stats_end(Stats *stats, StatPhase phase, LONGLONG started)
+{
+    LARGE_INTEGER now;
+    if (!started)
+        return;
+    QueryPerformanceCounter(&now);
+    InterlockedIncrement64(&stats->phaseCounts[phase]);
+    InterlockedExchangeAdd64(&stats->phaseTicks[phase], now.QuadPart - started);
+}
+
+// always counted, whether timing is on or not, it's one interlocked add
+void Stats_count(Stats *stats, StatCounter counter)
+{
+    InterlockedIncrement64(&stats->counters[counter]);
+}
+
+static void addBytes(Stats *stats, LONGLONG bytes)
+{
+    LONGLONG total = InterlockedExchangeAdd64(&stats->bytes, bytes) + bytes;
+    LONGLONG peak  = stats->peakBytes;
+
+    InterlockedExchangeAdd64(&totalBytes, bytes);
+
+    while (total > peak)
+    {
+        LONGLONG seen = InterlockedCompareExchange64(&stats->peakBytes, total, peak);
+        if (seen == peak)
+            break;
+        peak = seen;
+    }
+}
+
+// racy, but it only has to be roughly right, several threads squeezing in at once go over by at most their sizes
+static bool overLimit(LONGLONG growth)
+{
+    LONGLONG limit = limitBytes;
+    return limit > 0 && growth > 0 && totalBytes + growth > limit;
+}
+
+static void *statsMalloc(void *user, size_t size)
+{
+    Stats *stats = (Stats*)user;
+    void  *block;
+
+    if (overLimit((LONGLONG)size))
+        return NULL;
+
+    block = Pool_malloc(size);
+    if (!block)
+        return NULL;
+
+    addBytes(stats, (LONGLONG)size);
+    InterlockedIncrement64(&stats->allocations);
+    return block;
+}
+
+static void *statsRealloc(void *user, void *old, size_t size)
+{
+    Stats   *stats = (Stats*)user;
+    LONGLONG growth;
+    void    *block;
+
+    if (!old)
+        return statsMalloc(user, size);
+
+    growth = (LONGLONG)size - (LONGLONG)Pool_size(old);
+    if (overLimit(growth))
+        return NULL;
+
+    block = Pool_realloc(old, size);
+    if (!block)
+        return NULL;
+
+    addBytes(stats, growth);
+    InterlockedIncrement64(&stats->allocations);
+    return block;
+}
+
+static void statsFree(void *user, void *pointer)
+{
+    Stats *stats = (Stats*)user;
+
+    if (!pointer)
+        return;
+
+    addBytes(stats, -(LONGLONG)Pool_size(pointer));
+    Pool_free(pointer);
+}
+
+/**
+* Caps what all documents together may have MuPDF allocate, 0 means no limit.
+*/
+void Stats_setMemoryLimit(size_t bytes)
+{
+    InterlockedExchange64(&limitBytes, (LONGLONG)bytes);
+}
+
+/**
+* An allocator for `fz_new_context` that counts what MuPDF is holding on to in `stats`, and gets it from the pool.
+*/
+fz_alloc_context Stats_allocator(Stats *stats)
+{
+    fz_alloc_context allocator;
+    allocator.user    = stats;
+    allocator.malloc  = statsMalloc;
+    allocator.realloc = statsRealloc;
+    allocator.free    = statsFree;
+    return allocator;
+}
+
+/**
+* Copies the counters out, with times in microseconds, and optionally starts them from 0 again
+* (the memory currently in use is left alone, and the peak starts again from there).
+* Counters that change while this is busy may end up in either the old or the new batch, never in neither.
+*/
+void Stats_read(Stats *stats, PdfStats *out, bool reset)
+{
+    LONGLONG frequency = ticksPerSecond();
+    int      index;
+
+    memset(out, 0, sizeof(PdfStats));
+    for (index = 0; index < STAT_PHASE_COUNT; index++)
+    {
+        LONGLONG count = reset ? InterlockedExchange64(&stats->phaseCounts[index], 0) : stats->phaseCounts[index];
+        LONGLONG ticks = reset ? InterlockedExchange64(&stats->phaseTicks[index], 0) : stats->phaseTicks[index];
+        out->phases[index].count        = count;
+        out->phases[index].microseconds = frequency ? ticks * 1000000 / frequency : 0;
+    }
+    for (index = 0; index < STAT_COUNTER_COUNT; index++)
+        out->counters[index] = reset ? InterlockedExchange64(&stats->counters[index], 0) : stats->counters[index];
+
+    out->bytesAllocated     = stats->bytes;
+    out->peakBytesAllocated = reset ? InterlockedExchange64(&stats->peakBytes, stats->bytes) : stats->peakBytes;
+    out->allocations        = reset ? InterlockedExchange64(&stats->allocations, 0) : stats->allocations;
+}
@@ -0,0 +1,266 @@
+/**
+* Ways of getting a document into MuPDF other than it reading the file itself.
+*
+* MuPDF's own file stream reads through stdio, a few KB at a time, so a big scanned PDF or CBZ ends up in memory twice
+* (once in the system's file cache, once in MuPDF's buffers) and every seek is a system call. Mapping the file instead
+* means MuPDF reads straight out of the file cache, and only the parts it actually touches ever get read from disk.
+*
+* The same memory stream also works for documents that are already in memory (e.g., read out of a pak file by Unreal),
+* and there's a stream that reads through callbacks, for when even that is too much and the data should come in as
+* MuPDF asks for it.
+*
+* MuPDF only ever touches a document's stream from the thread holding `documentLock`, so none of this has to be thread safe.
+*/
+
+#include "mupdf2rgb.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+//
+// memory
+//
+
+typedef struct MemoryStream
+{
+    const unsigned char *data;
+    size_t               size;
+    StreamRelease        release;
+    void                *user;
+} MemoryStream;
+
+// everything is in the buffer from the start, there's never any more
+static int nextMemory(fz_context *ctx, fz_stream *stm, size_t max)
+{
+    return EOF;
+}
+
+// the same as MuPDF's own buffer streams: `pos` is the end of the data, and `rp` moves about in it
+static void seekMemory(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+    int64_t current = stm->pos - (stm->wp - stm->rp);
+
+    if (whence == SEEK_CUR)
+        offset += current;
+    else if (whence == SEEK_END)
+        offset += stm->pos;
+
+    if (offset < 0)        offset = 0;
+    if (offset > stm->pos) offset = stm->pos;
+    stm->rp += offset - current;
+}
+
+static void dropMemory(fz_context *ctx, void *state)
+{
+    MemoryStream *memory = (MemoryStream*)state;
+    if (memory->release)
+        memory->release(memory->user, memory->data, memory->size);
+    fz_free(ctx, memory);
+}
+
+/**
+* A stream that reads `size` bytes at `data` in place, `release` (if there is one) gets called once the stream is dropped,
+* which for a document is when the document is. `release` is also called if this throws, so the caller never has to.
+*/
+fz_stream *Stream_openMemory(fz_context *ctx, const unsigned char *data, size_t size, StreamRelease release, void *user)
+{
+    MemoryStream *memory = NULL;
+    fz_stream    *stream;
+
+    fz_var(memory);
+
+    fz_try(ctx)
+    {
+        memory = fz_malloc_struct(ctx, MemoryStream);
+        memory->data    = data;
+        memory->size    = size;
+        memory->release = release;
+        memory->user    = user;
+    }
+    fz_catch(ctx)
+    {
+        fz_free(ctx, memory);
+        if (release)
+            release(user, data, size);
+        fz_rethrow(ctx);
+    }
+
+    // if this throws, it has already dropped `memory`, which calls `release`, so it's not in the try
+    stream = fz_new_stream(ctx, memory, nextMemory, dropMemory);
+
+    stream->rp   = (unsigned char*)data;
+    stream->wp   = (unsigned char*)data + size;
+    stream->pos  = (int64_t)size;
+    stream->seek = seekMemory;
+    return stream;
+}
+
+//
+// mapped files
+//
+
+static void __cdecl unmapFile(void *user, const unsigned char *data, size_t size)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)user);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+/**
+* Maps the whole file at `path` and returns a stream reading it, or NULL if it can't be mapped (in which case the caller
+* should just open it the normal way, it's probably empty or on something that doesn't do mapping).
+*/
+fz_stream *Stream_openMapped(fz_context *ctx, const char *path)
+{
+    const unsigned char *data = NULL;
+    size_t               size = 0;
+    void                *user = NULL;
+
+#ifdef _WIN32
+    HANDLE        file;
+    HANDLE        mapping;
+    LARGE_INTEGER fileSize;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0 || (ULONGLONG)fileSize.QuadPart > (SIZE_T)-1)
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    // the mapping keeps the file open by itself, so it's the only handle that has to be kept
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+
+    data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        CloseHandle(mapping);
+        return NULL;
+    }
+    size = (size_t)fileSize.QuadPart;
+    user = mapping;
+#else
+    struct stat info;
+    int         file;
+    void       *mapped;
+
+    file = open(path, O_RDONLY);
+    if (file < 0)
+        return NULL;
+    if (fstat(file, &info) != 0 || info.st_size <= 0)
+    {
+        close(file);
+        return NULL;
+    }
+
+    mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED)
+        return NULL;
+
+    data = (const unsigned char*)mapped;
+    size = (size_t)info.st_size;
+#endif
+
+    return Stream_openMemory(ctx, data, size, unmapFile, user);
+}
+
+//
+// callbacks
+//
+
+#define CALLBACK_BUFFER (64 * 1024)
+
+typedef struct CallbackStream
+{
+    StreamRead     read;
+    StreamSeek     seek;
+    StreamClose    close;
+    void          *user;
+    unsigned char  buffer[CALLBACK_BUFFER];
+} CallbackStream;
+
+static int nextCallback(fz_context *ctx, fz_stream *stm, size_t max)
+{
+    CallbackStream *callbacks = (CallbackStream*)stm->state;
+    long long       count;
+
+    count = callbacks->read(callbacks->user, callbacks->buffer, min(max, sizeof(callbacks->buffer)));
+    if (count < 0)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "read error");
+
+    stm->rp   = callbacks->buffer;
+    stm->wp   = callbacks->buffer + count;
+    stm->pos += count;
+
+    if (count == 0)
+        return EOF;
+    return *stm->rp++;
+}
+
+// fz_seek already turned SEEK_CUR into SEEK_SET, so the callback only ever sees the other two
+static void seekCallback(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+    CallbackStream *callbacks = (CallbackStream*)stm->state;
+    long long       position;
+
+    position = callbacks->seek(callbacks->user, offset, whence);
+    if (position < 0)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot seek");
+
+    stm->pos = position;
+    stm->rp  = stm->wp = callbacks->buffer;
+}
+
+static void dropCallback(fz_context *ctx, void *state)
+{
+    CallbackStream *callbacks = (CallbackStream*)state;
+    if (callbacks->close)
+        callbacks->close(callbacks->user);
+    fz_free(ctx, callbacks);
+}
+
+/**
+* A stream that gets its data from `read` and `seek`, `close` (if there is one) gets called once the stream is dropped.
+* Like `Stream_openMemory`, `close` is also called if this throws.
+*/
+fz_stream *Stream_openCallbacks(fz_context *ctx, StreamRead read, StreamSeek seek, StreamClose close, void *user)
+{
+    CallbackStream *callbacks = NULL;
+    fz_stream      *stream;
+
+    fz_var(callbacks);
+
+    fz_try(ctx)
+    {
+        callbacks = fz_malloc_struct(ctx, CallbackStream);
+        callbacks->read  = read;
+        callbacks->seek  = seek;
+        callbacks->close = close;
+        callbacks->user  = user;
+    }
+    fz_catch(ctx)
+    {
+        fz_free(ctx, callbacks);
+        if (close)
+            close(user);
+        fz_rethrow(ctx);
+    }
+
+    // same as for `Stream_openMemory`, a throw from here has closed it already
+    stream = fz_new_stream(ctx, callbacks, nextCallback, dropCallback);
+
+    stream->seek = seekCallback;
+    return stream;
+}
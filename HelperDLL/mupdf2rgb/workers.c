@@ -0,0 +1,246 @@
+/**
+* Background threads for rendering pages ahead of time.
+*
+* The threads are started when the first document is opened, and stopped (and waited for) when the last one is destroyed,
+* so that nothing is left running inside the DLL by the time the host unloads it.
+*
+* Each job clones the context of the document it works on, and only holds the document lock while loading a page into
+* a display list, so several workers can draw pages of the same document at the same time.
+*/
+
+#include "mupdf2rgb.h"
+
+#define MAX_WORKERS 64
+
+typedef struct WorkerJob
+{
+    void             *owner;
+    WorkerFunction    run;
+    WorkerFunction    discard;
+    void             *userData;
+    struct WorkerJob *next;
+} WorkerJob;
+
+// only one thread gets to start or stop the workers at a time
+static SRWLOCK            startStopLock  = SRWLOCK_INIT;
+static SRWLOCK            workersLock    = SRWLOCK_INIT;
+static CONDITION_VARIABLE workersChanged = CONDITION_VARIABLE_INIT;
+static HANDLE             workerThreads[MAX_WORKERS];
+static void              *runningOwners[MAX_WORKERS];
+static int                workerCount    = 0;  // 0 means "one less than the number of cores"
+static int                runningCount   = 0;
+static WorkerJob         *firstJob       = NULL;
+static WorkerJob         *lastJob        = NULL;
+static int                users          = 0;
+static bool               quitting       = false;
+
+static DWORD WINAPI workerMain(LPVOID parameter)
+{
+    int index = (int)(intptr_t)parameter;
+
+    AcquireSRWLockExclusive(&workersLock);
+    for (;;)
+    {
+        WorkerJob *job;
+
+        while (!firstJob && !quitting)
+            SleepConditionVariableSRW(&workersChanged, &workersLock, INFINITE, 0);
+        if (quitting)
+            break;
+
+        job = firstJob;
+        firstJob = job->next;
+        if (!firstJob) lastJob = NULL;
+        runningOwners[index] = job->owner;
+        ReleaseSRWLockExclusive(&workersLock);
+
+        job->run(job->userData);
+        free(job);
+
+        AcquireSRWLockExclusive(&workersLock);
+        runningOwners[index] = NULL;
+        WakeAllConditionVariable(&workersChanged);
+    }
+    ReleaseSRWLockExclusive(&workersLock);
+
+    return 0;
+}
+
+static int wantedCount(void)
+{
+    SYSTEM_INFO info;
+
+    if (workerCount > 0)
+        return workerCount;
+
+    // leave a core for whoever is calling us
+    GetSystemInfo(&info);
+    return (int)max(1, min(MAX_WORKERS, (int)info.dwNumberOfProcessors - 1));
+}
+
+// startStopLock must be held
+static void startThreads(void)
+{
+    int index;
+
+    quitting     = false;
+    runningCount = wantedCount();
+    for (index = 0; index < runningCount; index++)
+        workerThreads[index] = CreateThread(NULL, 0, workerMain, (LPVOID)(intptr_t)index, 0, NULL);
+}
+
+// startStopLock must be held, whatever is still queued stays queued
+static void stopThreads(void)
+{
+    int index;
+
+    AcquireSRWLockExclusive(&workersLock);
+    quitting = true;
+    WakeAllConditionVariable(&workersChanged);
+    ReleaseSRWLockExclusive(&workersLock);
+
+    for (index = 0; index < runningCount; index++)
+    {
+        if (!workerThreads[index])
+            continue;
+        WaitForSingleObject(workerThreads[index], INFINITE);
+        CloseHandle(workerThreads[index]);
+        workerThreads[index] = NULL;
+    }
+    runningCount = 0;
+}
+
+void Workers_retain(void)
+{
+    AcquireSRWLockExclusive(&startStopLock);
+    if (users++ == 0)
+        startThreads();
+    ReleaseSRWLockExclusive(&startStopLock);
+}
+
+/**
+* Every owner must have cancelled and waited for its own jobs before releasing.
+*/
+void Workers_release(void)
+{
+    AcquireSRWLockExclusive(&startStopLock);
+    if (--users == 0)
+        stopThreads();
+    ReleaseSRWLockExclusive(&startStopLock);
+}
+
+/**
+* Changes how many threads there are, 0 goes back to the default of one less than the number of cores.
+* If they're already running they're restarted, anything queued is kept, anything running is finished first.
+*/
+void Workers_setCount(int count)
+{
+    AcquireSRWLockExclusive(&startStopLock);
+    workerCount = max(0, min(MAX_WORKERS, count));
+    if (users > 0)
+    {
+        stopThreads();
+        startThreads();
+    }
+    ReleaseSRWLockExclusive(&startStopLock);
+}
+
+/**
+* How many threads there are right now, 0 if nobody retained them.
+*/
+int Workers_count(void)
+{
+    int count;
+
+    AcquireSRWLockExclusive(&startStopLock);
+    count = runningCount;
+    ReleaseSRWLockExclusive(&startStopLock);
+
+    return count;
+}
+
+/**
+* Queues `run(userData)` to be called on a worker thread.
+* If the job gets cancelled before it runs, `discard(userData)` is called instead (if not `NULL`), so it can clean up.
+*/
+void Workers_submit(void *owner, WorkerFunction run, WorkerFunction discard, void *userData)
+{
+    WorkerJob *job = (WorkerJob*)calloc(1, sizeof(WorkerJob));
+    if (!job)
+    {
+        if (discard) discard(userData);
+        return;
+    }
+
+    job->owner    = owner;
+    job->run      = run;
+    job->discard  = discard;
+    job->userData = userData;
+
+    AcquireSRWLockExclusive(&workersLock);
+    if (lastJob) lastJob->next = job;
+    else         firstJob      = job;
+    lastJob = job;
+    WakeConditionVariable(&workersChanged);
+    ReleaseSRWLockExclusive(&workersLock);
+}
+
+/**
+* Throws away all the jobs belonging to `owner` that haven't started yet, anything already running is left to finish.
+*/
+void Workers_cancel(void *owner)
+{
+    WorkerJob *cancelled = NULL;
+    WorkerJob *job;
+    WorkerJob *previous  = NULL;
+
+    AcquireSRWLockExclusive(&workersLock);
+    job = firstJob;
+    while (job)
+    {
+        WorkerJob *next = job->next;
+        if (job->owner == owner)
+        {
+            if (previous) previous->next = next;
+            else          firstJob       = next;
+            if (lastJob == job) lastJob = previous;
+            job->next = cancelled;
+            cancelled = job;
+        }
+        else
+        {
+            previous = job;
+        }
+        job = next;
+    }
+    ReleaseSRWLockExclusive(&workersLock);
+
+    // discard outside the lock, they might want to take other locks
+    while (cancelled)
+    {
+        job = cancelled;
+        cancelled = job->next;
+        if (job->discard) job->discard(job->userData);
+        free(job);
+    }
+}
+
+static bool isRunning(void *owner)
+{
+    int index;
+    for (index = 0; index < MAX_WORKERS; index++)
+        if (runningOwners[index] == owner)
+            return true;
+    return false;
+}
+
+/**
+* Blocks until no worker is running a job belonging to `owner`.
+*/
+void Workers_wait(void *owner)
+{
+    AcquireSRWLockExclusive(&workersLock);
+    while (isRunning(owner))
+        SleepConditionVariableSRW(&workersChanged, &workersLock, INFINITE, 0);
+    ReleaseSRWLockExclusive(&workersLock);
+}
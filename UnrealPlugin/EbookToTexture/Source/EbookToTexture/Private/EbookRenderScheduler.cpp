@@ -0,0 +1,102 @@
+// Copyright 2023 Dirk de la Hunt
+
+#include "EbookRenderScheduler.h"
+#include "EbookToTextureComponent.h"
+#include "Engine/Engine.h"
+#include "Engine/GameViewportClient.h"
+#include "Engine/World.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Components/StaticMeshComponent.h"
+#include "Kismet/GameplayStatics.h"
+
+// a book somebody's reading goes before one that's just bigger on screen
+#define INTERACTION_BOOST 4.0f
+// and one out of view after everything that's in view
+#define HIDDEN_PENALTY 0.01f
+
+bool UEbookRenderScheduler::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+    return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+TStatId UEbookRenderScheduler::GetStatId() const
+{
+    RETURN_QUICK_DECLARE_CYCLE_STAT(UEbookRenderScheduler, STATGROUP_Tickables);
+}
+
+void UEbookRenderScheduler::Register(UEbookToTextureComponent* Book)
+{
+    if (Book && !mBooks.ContainsByPredicate([Book](const FScheduledBook& scheduled) { return scheduled.Book == Book; }))
+        mBooks.Add({ Book, 0 });
+}
+
+void UEbookRenderScheduler::Unregister(UEbookToTextureComponent* Book)
+{
+    mBooks.RemoveAll([Book](const FScheduledBook& scheduled) { return scheduled.Book == Book; });
+}
+
+void UEbookRenderScheduler::Tick(float DeltaTime)
+{
+    mBooks.RemoveAll([](const FScheduledBook& scheduled) { return !scheduled.Book.IsValid(); });
+    if (mBooks.Num() == 0)
+        return;
+
+    // where the player looks from, and how many pixels across the screen is. without a camera (or a viewport), every book
+    // gets its pages drawn as big as its texture allows
+    APlayerCameraManager* camera = UGameplayStatics::GetPlayerCameraManager(GetWorld(), 0);
+    FVector2D viewportSize(0, 0);
+    if (GEngine && GEngine->GameViewport)
+        GEngine->GameViewport->GetViewportSize(viewportSize);
+    FVector viewOrigin = camera ? camera->GetCameraLocation() : FVector::ZeroVector;
+    float tanHalfFov = camera ? FMath::Tan(FMath::DegreesToRadians(FMath::Clamp(camera->GetFOVAngle(), 1.0f, 170.0f) * 0.5f)) : 1.0f;
+    bool canMeasure = camera && viewportSize.X > 0;
+    double now = FPlatformTime::Seconds();
+    int maxDivisor = FMath::RoundUpToPowerOfTwo(FMath::Max(MaxResolutionDivisor, 1));
+
+    for (FScheduledBook& scheduled : mBooks)
+    {
+        UEbookToTextureComponent* book = scheduled.Book.Get();
+        UStaticMeshComponent* mesh = book->GetPageMesh();
+        bool visible = mesh && mesh->WasRecentlyRendered(0.2f);
+        float pixels = book->GetTextureWidth();
+
+        // roughly how many pixels across the screen the book is, from its bounding sphere
+        if (canMeasure && mesh)
+        {
+            const FBoxSphereBounds& bounds = mesh->Bounds;
+            float distance = FMath::Max((float)FVector::Dist(viewOrigin, bounds.Origin), bounds.SphereRadius);
+            pixels = bounds.SphereRadius / (distance * tanHalfFov) * viewportSize.X;
+        }
+
+        // the smallest halving of the texture that's still at least as big as the book is on screen
+        int divisor = maxDivisor;
+        if (visible)
+        {
+            divisor = 1;
+            while (divisor < maxDivisor && book->GetTextureWidth() / (divisor * 2) >= pixels)
+                divisor *= 2;
+        }
+        book->SetRenderDivisor(divisor);
+
+        bool interacted = now - book->GetLastInteractionTime() < InteractionSeconds;
+        scheduled.Priority = FMath::Max(pixels, 1.0f) * (visible ? 1.0f : HIDDEN_PENALTY) * (interacted ? INTERACTION_BOOST : 1.0f);
+    }
+
+    mBooks.Sort([](const FScheduledBook& a, const FScheduledBook& b) { return a.Priority > b.Priority; });
+
+    // best ranked first, for as long as the budgets last
+    double deadline = now + FMath::Max(FrameBudgetMs, 0.0f) / 1000.0;
+    int64 uploadLeft = (int64)FMath::Max(UploadBudgetKilobytes, 0) * 1024;
+    for (int32 rank = 0; rank < mBooks.Num(); rank++)
+    {
+        UEbookToTextureComponent* book = mBooks[rank].Book.Get();
+        book->SetPrefetchAllowed(rank < PrefetchingBooks);
+
+        if (!book->HasPendingBands() || uploadLeft <= 0)
+            continue;
+        int budgetMicroseconds = (int)((deadline - FPlatformTime::Seconds()) * 1000000.0);
+        if (budgetMicroseconds <= 0)
+            continue;
+        uploadLeft -= book->RunBands(budgetMicroseconds);
+    }
+}
@@ -0,0 +1,348 @@
+// Copyright 2023 Dirk de la Hunt
+
+#include "EbookSubsystem.h"
+#include "Engine/Engine.h"
+#include "HAL/PlatformFileManager.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "RenderingThread.h"
+#include "RenderCommandFence.h"
+#include "Rendering/Texture2DResource.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+
+DEFINE_STAT(STAT_EBookUpload);
+CSV_DECLARE_CATEGORY_EXTERN(EBook);
+
+// an upload of more regions than this is split up, a page never needs more than 3
+#define MAX_STAGED_REGIONS 4
+// staging buffers come in powers of two from this up, so pages of about the same size share them
+#define MIN_STAGING_BYTES (64 * 1024)
+// textures handed back beyond this many are left to the garbage collector
+#define MAX_FREE_TEXTURES 8
+
+// one upload's worth of pixels, along with what the render thread needs to know to upload them
+struct UEbookSubsystem::FStagingBuffer
+{
+    uint8* Data = nullptr;
+    int64 Capacity = 0;
+
+    FTexture2DResource* Resource = nullptr;
+    int32 MipIndex = 0;
+    uint32 NumRegions = 0;
+    FUpdateTextureRegion2D Regions[MAX_STAGED_REGIONS];
+    uint32 Pitches[MAX_STAGED_REGIONS];
+    int64 Offsets[MAX_STAGED_REGIONS];
+
+    // passes once the RHI is done with the upload, until then it's not touched
+    FRenderCommandFence Fence;
+};
+
+// reads a book through an IFileHandle, for Pdf_createFromStream. the DLL only calls these from one thread at a time
+static long long __cdecl readFileHandle(void* user, unsigned char* buffer, size_t size)
+{
+    IFileHandle* handle = (IFileHandle*)user;
+    int64 count = FMath::Min((int64)size, handle->Size() - handle->Tell());
+    if (count <= 0)
+        return 0;
+    return handle->Read(buffer, count) ? count : -1;
+}
+
+static long long __cdecl seekFileHandle(void* user, long long offset, int whence)
+{
+    IFileHandle* handle = (IFileHandle*)user;
+    bool moved = (whence == 2) ? handle->SeekFromEnd(offset) : handle->Seek(offset);
+    return moved ? handle->Tell() : -1;
+}
+
+static void __cdecl closeFileHandle(void* user)
+{
+    delete (IFileHandle*)user;
+}
+
+// for Pdf_createLazy, which calls it exactly once
+static void __cdecl bookCounted(void* user, Pdf* book, int pageCount)
+{
+    TFunction<void(int32)>* onCounted = (TFunction<void(int32)>*)user;
+    (*onCounted)(pageCount);
+    delete onCounted;
+}
+
+void UEbookSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+    Super::Initialize(Collection);
+
+    // !!! don't forget to put this DLL (and libmudpdf.dll) into one of the folders that Unreal looks in, if in doubt, try run it as is
+    // and check the output log, it'll have listed all the locations it tried to find it in
+    dllHandle = FPlatformProcess::GetDllHandle(_T("H:\\programming\\mupdf2rgb\\x64\\Release\\mupdf2rgb.dll"));
+    if (dllHandle == nullptr)
+        return;
+
+    pdfCreate = (Pdf_create)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_create"));
+    pdfDestroy = (Pdf_destroy)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_destroy"));
+    pdfCreateFromStream = (Pdf_createFromStream)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_createFromStream"));
+    pdfCreateLazy = (Pdf_createLazy)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_createLazy"));
+    pdfGetPageCount = (Pdf_getPageCount)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getPageCount"));
+}
+
+void UEbookSubsystem::Deinitialize()
+{
+    if (dllHandle)
+    {
+        // whoever forgot to close their book doesn't get to keep it past this point
+        if (pdfDestroy)
+        {
+            for (auto& book : mBooks)
+                for (int32 user = 0; user < book.Value.Users; user++)
+                    pdfDestroy(book.Key);
+        }
+        mBooks.Empty();
+
+        FPlatformProcess::FreeDllHandle(dllHandle);
+        dllHandle = nullptr;
+    }
+
+    freeStaging();
+    mFreeTextures.Empty();
+
+    Super::Deinitialize();
+}
+
+Pdf* UEbookSubsystem::OpenBook(const FString& FilePath, TFunction<void(int32)> OnCounted)
+{
+    Pdf* book = nullptr;
+
+    if (!pdfCreate)
+        return nullptr;
+
+    if (OnCounted && pdfCreateLazy)
+    {
+        // the DLL owns it from here on if this works
+        TFunction<void(int32)>* onCounted = new TFunction<void(int32)>(MoveTemp(OnCounted));
+        if (pdfCreateLazy(&book, TCHAR_TO_ANSI(*FilePath), bookCounted, onCounted) && book)
+        {
+            mBooks.FindOrAdd(book).Users++;
+            return book;
+        }
+        OnCounted = MoveTemp(*onCounted);
+        delete onCounted;
+        book = nullptr;
+    }
+
+    if (!pdfCreate(&book, TCHAR_TO_ANSI(*FilePath)) || !book)
+    {
+        // not on disk as such, but Unreal might know where it is
+        IFileHandle* handle = pdfCreateFromStream ? FPlatformFileManager::Get().GetPlatformFile().OpenRead(*FilePath) : nullptr;
+        if (!handle)
+            return nullptr;
+
+        // the DLL closes the handle, whether it works or not
+        book = nullptr;
+        if (!pdfCreateFromStream(&book, TCHAR_TO_UTF8(*FilePath), readFileHandle, seekFileHandle, closeFileHandle, handle) || !book)
+            return nullptr;
+    }
+
+    mBooks.FindOrAdd(book).Users++;
+
+    // opened the slow way after all, so it's counted already
+    if (OnCounted)
+    {
+        int pageCount = -1;
+        if (!pdfGetPageCount || !pdfGetPageCount(book, &pageCount))
+            pageCount = -1;
+        OnCounted(pageCount);
+    }
+    return book;
+}
+
+int64 UEbookSubsystem::CloseBook(Pdf* Book)
+{
+    FOpenBook* open = Book ? mBooks.Find(Book) : nullptr;
+    if (!open)
+        return 0;
+
+    pdfDestroy(Book);
+
+    if (--open->Users > 0)
+        return 0;
+
+    int64 freed = open->ReportedBytes;
+    mBooks.Remove(Book);
+    return freed;
+}
+
+int64 UEbookSubsystem::ReportBookMemory(Pdf* Book, int64 Bytes)
+{
+    FOpenBook* open = mBooks.Find(Book);
+    if (!open)
+        return 0;
+
+    int64 change = Bytes - open->ReportedBytes;
+    open->ReportedBytes = Bytes;
+    return change;
+}
+
+int32 UEbookSubsystem::GetBookUserCount() const
+{
+    int32 users = 0;
+    for (const auto& book : mBooks)
+        users += book.Value.Users;
+    return users;
+}
+
+void UEbookSubsystem::UploadTextureRegions(UTexture2D* Texture, int32 MipIndex, uint32 NumRegions, const FUpdateTextureRegion2D* Regions, uint32 SrcPitch, const uint8* SrcData)
+{
+    if (!Texture || !Texture->GetResource() || !SrcData)
+        return;
+
+    // a pixel is a 1x1 block, as far as this is concerned
+    const FPixelFormatInfo& format = GPixelFormats[Texture->GetPixelFormat()];
+    uint32 blockWidth = (uint32)format.BlockSizeX;
+    uint32 blockHeight = (uint32)format.BlockSizeY;
+    uint32 blockBytes = (uint32)format.BlockBytes;
+
+    for (uint32 first = 0; first < NumRegions; first += MAX_STAGED_REGIONS)
+    {
+        uint32 count = FMath::Min(NumRegions - first, (uint32)MAX_STAGED_REGIONS);
+
+        // each region goes in as its own tightly packed rows (of blocks)
+        int64 bytes = 0;
+        for (uint32 index = 0; index < count; index++)
+        {
+            const FUpdateTextureRegion2D& region = Regions[first + index];
+            bytes += (int64)FMath::DivideAndRoundUp(region.Width, blockWidth) * blockBytes * FMath::DivideAndRoundUp(region.Height, blockHeight);
+        }
+        if (bytes == 0)
+            continue;
+
+        FStagingBuffer* staging = acquireStaging(bytes);
+        staging->Resource = (FTexture2DResource*)Texture->GetResource();
+        staging->MipIndex = MipIndex;
+        staging->NumRegions = count;
+
+        int64 offset = 0;
+        for (uint32 index = 0; index < count; index++)
+        {
+            const FUpdateTextureRegion2D& region = Regions[first + index];
+            uint32 rowBytes = FMath::DivideAndRoundUp(region.Width, blockWidth) * blockBytes;
+            uint32 rows = FMath::DivideAndRoundUp(region.Height, blockHeight);
+            const uint8* from = SrcData + (region.SrcY / blockHeight) * SrcPitch + (region.SrcX / blockWidth) * blockBytes;
+            for (uint32 row = 0; row < rows; row++)
+                FMemory::Memcpy(staging->Data + offset + (int64)row * rowBytes, from + (int64)row * SrcPitch, rowBytes);
+
+            staging->Regions[index] = region;
+            staging->Pitches[index] = rowBytes;
+            staging->Offsets[index] = offset;
+            offset += (int64)rowBytes * rows;
+        }
+
+        ENQUEUE_RENDER_COMMAND(EbookUploadTextureRegions)(
+            [staging](FRHICommandListImmediate& RHICmdList)
+            {
+                SCOPE_CYCLE_COUNTER(STAT_EBookUpload);
+                CSV_SCOPED_TIMING_STAT(EBook, Upload);
+                int32 currentFirstMip = staging->Resource->GetCurrentFirstMip();
+                if (staging->MipIndex < currentFirstMip)
+                    return;
+                for (uint32 index = 0; index < staging->NumRegions; index++)
+                {
+                    RHIUpdateTexture2D(staging->Resource->GetTexture2DRHI(), staging->MipIndex - currentFirstMip, staging->Regions[index],
+                        staging->Pitches[index], staging->Data + staging->Offsets[index]);
+                }
+            });
+        // the RHI thread might only read it when it gets to the upload, so that's what's waited for, not the render thread
+        staging->Fence.BeginFence(true);
+    }
+}
+
+// the buffers are looked at in turn, starting after the last one handed out, so the one that's been in flight the
+// longest (and is the likeliest to be done) comes up first
+UEbookSubsystem::FStagingBuffer* UEbookSubsystem::acquireStaging(int64 bytes)
+{
+    int64 capacity = FMath::Max((int64)FMath::RoundUpToPowerOfTwo64((uint64)bytes), (int64)MIN_STAGING_BYTES);
+
+    for (int32 tried = 0; tried < mStaging.Num(); tried++)
+    {
+        int32 index = (mStagingCursor + tried) % mStaging.Num();
+        FStagingBuffer* buffer = mStaging[index];
+        if (buffer->Capacity == capacity && buffer->Fence.IsFenceComplete())
+        {
+            mStagingCursor = index + 1;
+            return buffer;
+        }
+    }
+
+    // all of them are still in flight, which only happens until there are enough of them
+    FStagingBuffer* buffer = new FStagingBuffer();
+    buffer->Data = (uint8*)FMemory::Malloc(capacity);
+    buffer->Capacity = capacity;
+    mStaging.Add(buffer);
+    mStagingCursor = 0;
+    return buffer;
+}
+
+void UEbookSubsystem::freeStaging()
+{
+    // the render thread might still be uploading from them
+    if (mStaging.Num() > 0)
+        FlushRenderingCommands();
+    for (FStagingBuffer* buffer : mStaging)
+    {
+        FMemory::Free(buffer->Data);
+        delete buffer;
+    }
+    mStaging.Empty();
+    mStagingCursor = 0;
+}
+
+UTexture2D* UEbookSubsystem::AcquirePageTexture(int32 Width, int32 Height, EPixelFormat Format, int32 MipCount)
+{
+    for (int32 index = mFreeTextures.Num() - 1; index >= 0; index--)
+    {
+        UTexture2D* texture = mFreeTextures[index];
+        if (texture && texture->GetSizeX() == Width && texture->GetSizeY() == Height && texture->GetPixelFormat() == Format && texture->GetNumMips() == MipCount)
+        {
+            mFreeTextures.RemoveAt(index);
+            return texture;
+        }
+    }
+
+    UTexture2D* texture = UTexture2D::CreateTransient(Width, Height, Format);
+    if (!texture)
+        return nullptr;
+    texture->CompressionSettings = (Format == PF_G8) ? TextureCompressionSettings::TC_Grayscale : TextureCompressionSettings::TC_VectorDisplacementmap;
+    texture->SRGB = 0;
+    texture->Filter = (MipCount > 1) ? TextureFilter::TF_Trilinear : TextureFilter::TF_Nearest;
+    texture->NeverStream = true;
+
+    // CreateTransient only makes the top level, the rest are added by hand. a level smaller than a block still takes a
+    // whole block
+    const FPixelFormatInfo& format = GPixelFormats[Format];
+    FTexturePlatformData* platformData = texture->GetPlatformData();
+    for (int32 level = 1; level < MipCount; level++)
+    {
+        int32 mipWidth = FMath::Max(Width >> level, 1);
+        int32 mipHeight = FMath::Max(Height >> level, 1);
+        int64 mipBytes = (int64)FMath::DivideAndRoundUp(mipWidth, format.BlockSizeX) * FMath::DivideAndRoundUp(mipHeight, format.BlockSizeY) * format.BlockBytes;
+
+        FTexture2DMipMap* mip = new FTexture2DMipMap();
+        mip->SizeX = mipWidth;
+        mip->SizeY = mipHeight;
+        mip->BulkData.Lock(LOCK_READ_WRITE);
+        FMemory::Memzero(mip->BulkData.Realloc(mipBytes), mipBytes);
+        mip->BulkData.Unlock();
+        platformData->Mips.Add(mip);
+    }
+
+    texture->UpdateResource();
+    return texture;
+}
+
+void UEbookSubsystem::ReleasePageTexture(UTexture2D* Texture)
+{
+    if (!Texture || mFreeTextures.Contains(Texture))
+        return;
+
+    // the one handed back the longest ago goes first
+    if (mFreeTextures.Num() >= MAX_FREE_TEXTURES)
+        mFreeTextures.RemoveAt(0);
+    mFreeTextures.Add(Texture);
+}
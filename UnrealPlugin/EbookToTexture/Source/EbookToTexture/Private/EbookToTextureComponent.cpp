@@ -7,80 +7,51 @@
  2. You should create a texture the size of what you're going to use, 1024x1024 by default
  3. Import it
  4. Change
-       Mip Gen Settings -> NoMipmaps
+       Mip Gen Settings -> NoMipmaps (the component makes its own texture, and its own mips if GenerateMips is on)
        sRGB -> false
        Compression Settings -> TC Vector Displacementmap (aka B8G8R8A8)
+       (even with TextureFormat set to BC1 or BC7, the component compresses its own texture)
  5. Create a material, open it
  6. Create a TextureSampleParameter2D node, name it "DynamicTextureParam"
  7. Change the texture to be the one you imported earlier
  8. Change "Sampler Type" to "Linear Color"
  9. Add 2 scalar parameters named "ScaleX" and "ScaleY"
  10. Add component to an actor with a StaticMeshComponent on it, assign this material to it
+ 11. For PageColor Gray or Auto, add a scalar parameter named "IsGray": a gray texture only has the red channel, so
+     lerp from the texture's RGB to its R (through a ComponentMask, then an AppendVector or three) by IsGray
 */
 
 
 #include "EbookToTextureComponent.h"
 #include "Kismet/GameplayStatics.h"
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
 
 #define RED 2
 #define GREEN 1
 #define BLUE 0
 #define ALPHA 3
 
-void UpdateTextureRegions(UTexture2D* Texture, int32 MipIndex, uint32 NumRegions, FUpdateTextureRegion2D* Regions, uint32 SrcPitch, uint32 SrcBpp, uint8* SrcData, bool bFreeData)
-{
-    if (Texture && Texture->GetResource())
-    {
-        typedef struct FUpdateTextureRegionsData
-        {
-            FTexture2DResource* Texture2DResource;
-            int32 MipIndex;
-            uint32 NumRegions;
-            FUpdateTextureRegion2D* Regions;
-            uint32 SrcPitch;
-            uint32 SrcBpp;
-            uint8* SrcData;
-        }FUpdateTextureRegionsData;
-
-        FUpdateTextureRegionsData* RegionData = new FUpdateTextureRegionsData;
-
-        RegionData->Texture2DResource = (FTexture2DResource*)Texture->GetResource();
-        RegionData->MipIndex = MipIndex;
-        RegionData->NumRegions = NumRegions;
-        RegionData->Regions = Regions;
-        RegionData->SrcPitch = SrcPitch;
-        RegionData->SrcBpp = SrcBpp;
-        RegionData->SrcData = SrcData;
-
-        ENQUEUE_RENDER_COMMAND(UpdateTextureRegionsData)(
-            [RegionData, bFreeData](FRHICommandListImmediate& RHICmdList)
-            {
-                for (uint32 RegionIndex = 0; RegionIndex < RegionData->NumRegions; ++RegionIndex)
-                {
-                    int32 CurrentFirstMip = RegionData->Texture2DResource->GetCurrentFirstMip();
-                    if (RegionData->MipIndex >= CurrentFirstMip)
-                    {
-                        RHIUpdateTexture2D(
-                            RegionData->Texture2DResource->GetTexture2DRHI(),
-                            RegionData->MipIndex - CurrentFirstMip,
-                            RegionData->Regions[RegionIndex],
-                            RegionData->SrcPitch,
-                            RegionData->SrcData
-                            + RegionData->Regions[RegionIndex].SrcY * RegionData->SrcPitch
-                            + RegionData->Regions[RegionIndex].SrcX * RegionData->SrcBpp
-                        );
-                    }
-                }
-                if (bFreeData)
-                {
-                    FMemory::Free(RegionData->Regions);
-                    FMemory::Free(RegionData->SrcData);
-                }
-                delete RegionData;
-            });
-    }
-}
+// "stat EBook" in the console (the group and the upload timing are in EbookSubsystem.h), the DLL side only fills in
+// while CollectStats is on
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Load page (ms)"), STAT_EBookLoadPage, STATGROUP_EBook);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Run page (ms)"), STAT_EBookRunPage, STATGROUP_EBook);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Draw (ms)"), STAT_EBookDraw, STATGROUP_EBook);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Convert (ms)"), STAT_EBookConvert, STATGROUP_EBook);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Copy (ms)"), STAT_EBookCopy, STATGROUP_EBook);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Page cache hits"), STAT_EBookPageCacheHits, STATGROUP_EBook);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Page cache misses"), STAT_EBookPageCacheMisses, STATGROUP_EBook);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Display list cache hits"), STAT_EBookListCacheHits, STATGROUP_EBook);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Display list cache misses"), STAT_EBookListCacheMisses, STATGROUP_EBook);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Disk cache hits"), STAT_EBookDiskCacheHits, STATGROUP_EBook);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Disk cache misses"), STAT_EBookDiskCacheMisses, STATGROUP_EBook);
+DECLARE_DWORD_COUNTER_STAT(TEXT("MuPDF allocations"), STAT_EBookAllocations, STATGROUP_EBook);
+DECLARE_MEMORY_STAT(TEXT("MuPDF memory"), STAT_EBookMemory, STATGROUP_EBook);
 
+CSV_DEFINE_CATEGORY(EBook, true);
 
 // Sets default values for this component's properties
 UEbookToTextureComponent::UEbookToTextureComponent()
@@ -90,7 +61,6 @@ UEbookToTextureComponent::UEbookToTextureComponent()
 	PrimaryComponentTick.bCanEverTick = true;
 
     mDynamicColors = nullptr;
-    mUpdateTextureRegion = nullptr;
 }
 
 
@@ -100,9 +70,9 @@ void UEbookToTextureComponent::BeginPlay()
 	Super::BeginPlay();
 
 	// ...
-    // !!! don't forget to put this DLL (and libmudpdf.dll) into one of the folders that Unreal looks in, if in doubt, try run it as is
-    // and check the output log, it'll have listed all the locations it tried to find it in
-    dllHandle = FPlatformProcess::GetDllHandle(_T("H:\\programming\\mupdf2rgb\\x64\\Release\\mupdf2rgb.dll"));
+    // the DLL is loaded once, by the subsystem, see there for where it looks
+    UEbookSubsystem* books = getBooks();
+    dllHandle = books ? books->GetDllHandle() : nullptr;
     if (dllHandle == nullptr)
     {
         GEngine->AddOnScreenDebugMessage(0, 10, FColor::Red, "Could not load ebook DLL");
@@ -110,31 +80,78 @@ void UEbookToTextureComponent::BeginPlay()
     }
     else
     {
-        pdfCreate = (Pdf_create)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_create"));
-        pdfDestroy = (Pdf_destroy)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_destroy"));
-        pdfGetPageFittedBGRA = (Pdf_getPageFittedBGRA)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getPageFittedBGRA"));
-        pdfGet2PagesFittedBGRA = (Pdf_get2PagesFittedBGRA)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_get2PagesFittedBGRA"));
+        pdfGetPageFittedPixels = (Pdf_getPageFittedPixels)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getPageFittedPixels"));
+        pdfGetSpreadPixels = (Pdf_getSpreadPixels)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getSpreadPixels"));
+        pdfPrefetch = (Pdf_prefetch)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_prefetch"));
+        pdfCreatePrefetcher = (Pdf_createPrefetcher)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_createPrefetcher"));
+        pdfPrefetchLayout = (Pdf_prefetchLayout)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_prefetchLayout"));
+        pdfDestroyPrefetcher = (Pdf_destroyPrefetcher)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_destroyPrefetcher"));
+        pdfSetCacheBudget = (Pdf_setCacheBudget)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_setCacheBudget"));
+        pdfGetPreviewPixels = (Pdf_getPreviewPixels)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getPreviewPixels"));
+        pdfGetSpreadPreviewPixels = (Pdf_getSpreadPreviewPixels)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getSpreadPreviewPixels"));
+        pdfIsPageGray = (Pdf_isPageGray)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_isPageGray"));
+        pdfSetDisplayListCacheSize = (Pdf_setDisplayListCacheSize)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_setDisplayListCacheSize"));
+        pdfGetPageSize = (Pdf_getPageSize)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getPageSize"));
+        pdfRenderTile = (Pdf_renderTile)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_renderTile"));
+        pdfHalveBGRA = (Pdf_halveBGRA)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_halveBGRA"));
+        pdfHalveGray = (Pdf_halveGray)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_halveGray"));
+        pdfEnableStats = (Pdf_enableStats)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_enableStats"));
+        pdfSetStoreBudget = (Pdf_setStoreBudget)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_setStoreBudget"));
+        pdfSetMemoryLimit = (Pdf_setMemoryLimit)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_setMemoryLimit"));
+        pdfSetDiskCache = (Pdf_setDiskCache)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_setDiskCache"));
+        pdfGetStats = (Pdf_getStats)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getStats"));
+        pdfGetPageCount = (Pdf_getPageCount)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getPageCount"));
+        pdfGetOutlineEntry = (Pdf_getOutlineEntry)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_getOutlineEntry"));
+        pdfEncodeBlocks = (Pdf_encodeBlocks)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_encodeBlocks"));
+        pdfRenderAtlasBGRA = (Pdf_renderAtlasBGRA)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_renderAtlasBGRA"));
+        pdfBeginRender = (Pdf_beginRender)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_beginRender"));
+        pdfContinueRender = (Pdf_continueRender)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_continueRender"));
+        pdfEndRender = (Pdf_endRender)FPlatformProcess::GetDllExport(dllHandle, TEXT("Pdf_endRender"));
     }
 
     mStaticMeshComponent = Cast<UStaticMeshComponent>(GetOwner()->GetComponentByClass(UStaticMeshComponent::StaticClass()));
 
     SetupTexture();
     UpdateTexture();
+
+    if (UseRenderScheduler)
+    {
+        if (UEbookRenderScheduler* scheduler = GetWorld() ? GetWorld()->GetSubsystem<UEbookRenderScheduler>() : nullptr)
+        {
+            scheduler->Register(this);
+            mScheduler = scheduler;
+        }
+    }
 }
 
 void UEbookToTextureComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
-    if (dllHandle)
-    {
-        if (pdfDestroy)
-            pdfDestroy(currentBook);
-        FPlatformProcess::FreeDllHandle(dllHandle);
-        currentBook = nullptr;
-        dllHandle = nullptr;
-    }
+    if (UEbookRenderScheduler* scheduler = mScheduler.Get())
+        scheduler->Unregister(this);
+    mScheduler = nullptr;
+
+    cancelAsyncPages();
+
+    closeBook();
+    dllHandle = nullptr;
 
     delete[] mDynamicColors; mDynamicColors = nullptr;
-    delete mUpdateTextureRegion; mUpdateTextureRegion = nullptr;
+    delete[] mPendingColors; mPendingColors = nullptr;
+    delete[] mPreviewColors; mPreviewColors = nullptr;
+    delete[] mMipColors; mMipColors = nullptr;
+    delete[] mPendingMipColors; mPendingMipColors = nullptr;
+    delete[] mPreviewMipColors; mPreviewMipColors = nullptr;
+    delete[] mBlockColors; mBlockColors = nullptr;
+    delete[] mPendingBlockColors; mPendingBlockColors = nullptr;
+    delete[] mPreviewBlockColors; mPreviewBlockColors = nullptr;
+    mColorCapacity = 0;
+    mMipCapacity = 0;
+    mBlockCapacity = 0;
+
+    // the texture goes back to be used by whoever needs one like it next
+    if (UEbookSubsystem* books = getBooks())
+        books->ReleasePageTexture(mDynamicTexture);
+    mDynamicTexture = nullptr;
 
     Super::EndPlay(EndPlayReason);
 }
@@ -144,15 +161,66 @@ void UEbookToTextureComponent::TickComponent(float DeltaTime, ELevelTick TickTyp
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-	// ...
+    // a scheduled book gets its turn from the scheduler
+    if (!mScheduler.IsValid())
+        continueBandRender(FMath::Max(0, FMath::RoundToInt(FrameBudgetMs * 1000)));
+    reportStats();
+}
+
+// hands whatever the DLL did since the last frame over to the stats system and the CSV profiler
+void UEbookToTextureComponent::reportStats()
+{
+    if (!currentBook || !pdfEnableStats || !pdfGetStats)
+        return;
+
+    if (CollectStats != mStatsEnabled)
+    {
+        mStatsEnabled = CollectStats;
+        pdfEnableStats(currentBook, mStatsEnabled ? 1 : 0);
+    }
+    if (!mStatsEnabled)
+        return;
+
+    FPdfStats stats;
+    if (!pdfGetStats(currentBook, &stats, 1))
+        return;
+
+    float loadPage = stats.Phases[0].Microseconds / 1000.0f;
+    float runPage = stats.Phases[1].Microseconds / 1000.0f;
+    float draw = stats.Phases[2].Microseconds / 1000.0f;
+    float convert = stats.Phases[3].Microseconds / 1000.0f;
+    float copy = stats.Phases[4].Microseconds / 1000.0f;
+
+    INC_FLOAT_STAT_BY(STAT_EBookLoadPage, loadPage);
+    INC_FLOAT_STAT_BY(STAT_EBookRunPage, runPage);
+    INC_FLOAT_STAT_BY(STAT_EBookDraw, draw);
+    INC_FLOAT_STAT_BY(STAT_EBookConvert, convert);
+    INC_FLOAT_STAT_BY(STAT_EBookCopy, copy);
+    INC_DWORD_STAT_BY(STAT_EBookPageCacheHits, stats.Counters[0]);
+    INC_DWORD_STAT_BY(STAT_EBookPageCacheMisses, stats.Counters[1]);
+    INC_DWORD_STAT_BY(STAT_EBookListCacheHits, stats.Counters[2]);
+    INC_DWORD_STAT_BY(STAT_EBookListCacheMisses, stats.Counters[3]);
+    INC_DWORD_STAT_BY(STAT_EBookDiskCacheHits, stats.Counters[4]);
+    INC_DWORD_STAT_BY(STAT_EBookDiskCacheMisses, stats.Counters[5]);
+    INC_DWORD_STAT_BY(STAT_EBookAllocations, stats.Allocations);
+
+    // the book might be shared with other components, the subsystem makes sure it's only counted once
+    if (UEbookSubsystem* books = getBooks())
+        INC_MEMORY_STAT_BY(STAT_EBookMemory, books->ReportBookMemory(currentBook, stats.BytesAllocated));
+
+    CSV_CUSTOM_STAT(EBook, LoadPageMs, loadPage, ECsvCustomStatOp::Accumulate);
+    CSV_CUSTOM_STAT(EBook, RunPageMs, runPage, ECsvCustomStatOp::Accumulate);
+    CSV_CUSTOM_STAT(EBook, DrawMs, draw, ECsvCustomStatOp::Accumulate);
+    CSV_CUSTOM_STAT(EBook, ConvertMs, convert, ECsvCustomStatOp::Accumulate);
+    CSV_CUSTOM_STAT(EBook, CopyMs, copy, ECsvCustomStatOp::Accumulate);
+    CSV_CUSTOM_STAT(EBook, PageCacheHits, (int32)stats.Counters[0], ECsvCustomStatOp::Accumulate);
+    CSV_CUSTOM_STAT(EBook, PageCacheMisses, (int32)stats.Counters[1], ECsvCustomStatOp::Accumulate);
+    CSV_CUSTOM_STAT(EBook, MuPDFMegabytes, stats.BytesAllocated / (1024.0f * 1024.0f), ECsvCustomStatOp::Accumulate);
 }
 
 
 void UEbookToTextureComponent::SetupTexture()
 {
-    if (mDynamicColors) delete[] mDynamicColors;
-    if (mUpdateTextureRegion) delete mUpdateTextureRegion;
-
     if (!mStaticMeshComponent)
     {
         GEngine->AddOnScreenDebugMessage(1, 1, FColor::Red, "Could not get static mesh component");
@@ -162,27 +230,108 @@ void UEbookToTextureComponent::SetupTexture()
     w = mTextureWidth;
     h = mTextureHeight;
 
+    // the DLL numbers its block formats 0 for BC1 and 1 for BC7. gray is only ever on when the texture isn't compressed
+    EPixelFormat pixelFormat = mGray ? PF_G8 : PF_B8G8R8A8;
+    mPixelBytes = mGray ? 1 : 4;
+    mBlockBytes = 0;
+    if (!mGray && pdfEncodeBlocks && TextureFormat == EEbookTextureFormat::BC1)
+    {
+        pixelFormat = PF_DXT1;
+        mBlockBytes = 8;
+    }
+    else if (!mGray && pdfEncodeBlocks && TextureFormat == EEbookTextureFormat::BC7)
+    {
+        pixelFormat = PF_BC7;
+        mBlockBytes = 16;
+    }
+    // how much one level takes up on the GPU, a level smaller than a block still takes a whole block
+    auto levelBytes = [this](int levelWidth, int levelHeight)
+    {
+        if (mBlockBytes)
+            return (uint32)(((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * mBlockBytes);
+        return (uint32)(levelWidth * levelHeight * mPixelBytes);
+    };
+    // switching between gray and colour keeps whatever buffers are big enough already. the shown, pending and preview
+    // ones are swapped around, so they're always the same size
+    auto reuse = [](std::initializer_list<uint8**> buffers, uint32& capacity, uint32 bytes)
+    {
+        for (uint8** buffer : buffers)
+        {
+            if (bytes > capacity)
+            {
+                delete[] *buffer;
+                *buffer = new uint8[bytes];
+            }
+            memset(*buffer, 0, bytes);
+        }
+        capacity = FMath::Max(capacity, bytes);
+    };
+
+    UEbookSubsystem* books = getBooks();
+    if (!books)
+        return;
+
+    // the mips are made on the CPU, by UpdateMips
+    mMipCount = (GenerateMips && (mGray ? pdfHalveGray : pdfHalveBGRA)) ? FMath::FloorLog2(FMath::Max(w, h)) + 1 : 1;
+
     mDynamicMaterials.Empty();
     mDynamicMaterials.Add(mStaticMeshComponent->CreateAndSetMaterialInstanceDynamic(0));
-    mDynamicTexture = UTexture2D::CreateTransient(w, h);
-    mDynamicTexture->CompressionSettings = TextureCompressionSettings::TC_VectorDisplacementmap;
-    mDynamicTexture->SRGB = 0;
-    mDynamicTexture->Filter = TextureFilter::TF_Nearest;
-    mDynamicTexture->AddToRoot();
-    mDynamicTexture->UpdateResource();
+    // switching between gray and colour needs another texture, the old one goes back to be used again
+    books->ReleasePageTexture(mDynamicTexture);
+    mDynamicTexture = books->AcquirePageTexture(w, h, pixelFormat, mMipCount);
+    if (!mDynamicTexture)
+        return;
 
-    mUpdateTextureRegion = new FUpdateTextureRegion2D(0, 0, 0, 0, w, h);
+    mMipOffsets.Empty();
+    mBlockOffsets.Empty();
+    if (mMipCount > 1)
+    {
+        uint32 mipBytes = 0;
+        for (int level = 1; level < mMipCount; level++)
+        {
+            mMipOffsets.Add(mipBytes);
+            mipBytes += FMath::Max(w >> level, 1) * FMath::Max(h >> level, 1) * mPixelBytes;
+        }
+        reuse({ &mMipColors, &mPendingMipColors, &mPreviewMipColors }, mMipCapacity, mipBytes);
+    }
+
+    if (mBlockBytes)
+    {
+        uint32 blockBytes = 0;
+        for (int level = 0; level < mMipCount; level++)
+        {
+            mBlockOffsets.Add(blockBytes);
+            blockBytes += levelBytes(FMath::Max(w >> level, 1), FMath::Max(h >> level, 1));
+        }
+        reuse({ &mBlockColors, &mPendingBlockColors, &mPreviewBlockColors }, mBlockCapacity, blockBytes);
+    }
 
     mDynamicMaterials[0]->SetTextureParameterValue("DynamicTextureParam", mDynamicTexture);
+    mDynamicMaterials[0]->SetScalarParameterValue("IsGray", mGray ? 1.0f : 0.0f);
 
-    mDataSize = w * h * 4;
-    mDataSqrtSize = w * 4;
+    mDataSize = w * h * mPixelBytes;
+    mDataSqrtSize = w * mPixelBytes;
     mArraySize = w * h;
     mArrayRowSize = w;
 
-    mDynamicColors = new uint8[mDataSize];
-
+    // these three are swapped around, so they're always the same size
+    if (mDataSize > mColorCapacity)
+    {
+        delete[] mDynamicColors;
+        delete[] mPendingColors;
+        delete[] mPreviewColors;
+        mDynamicColors = new uint8[mDataSize];
+        mPendingColors = new uint8[mDataSize];
+        mPreviewColors = new uint8[mDataSize];
+        mColorCapacity = mDataSize;
+    }
     memset(mDynamicColors, 0, mDataSize);
+    memset(mPendingColors, 0, mDataSize);
+    memset(mPreviewColors, 0, mDataSize);
+    mShownWidth = 0;
+    mShownHeight = 0;
+    mPendingExtent = FIntPoint::ZeroValue;
+    mPreviewExtent = FIntPoint::ZeroValue;
 }
 
 void UEbookToTextureComponent::UpdateTexture()
@@ -190,19 +339,407 @@ void UEbookToTextureComponent::UpdateTexture()
     if (!mDynamicTexture)
         return;
 
-    UpdateTextureRegions(mDynamicTexture, 0, 1, mUpdateTextureRegion, mDataSqrtSize, (uint32)4, mDynamicColors, false);
+    preparePage(textureLayout(), mDynamicColors, mMipColors, mBlockColors, mTextureWidth, mTextureHeight, 0, 0);
+    if (mBlockBytes)
+    {
+        uploadBlocks(0, mTextureWidth, mTextureHeight);
+    }
+    else
+    {
+        FUpdateTextureRegion2D region(0, 0, 0, 0, mTextureWidth, mTextureHeight);
+        uploadRegions(0, 1, &region, mDataSqrtSize, mDynamicColors);
+    }
+    UpdateMips(mTextureWidth, mTextureHeight);
+    mDynamicMaterials[0]->SetTextureParameterValue("DynamicTextureParam", mDynamicTexture);
+}
+
+// how much of mip `level` covers the top left `size` pixels of the top level, rounded up so it covers all of them.
+// halving that again and again rounding up each time comes out the same
+static int levelSize(int size, int textureSize, int level)
+{
+    return FMath::Min(FMath::Max((size + (1 << level) - 1) >> level, 1), FMath::Max(textureSize >> level, 1));
+}
+
+UEbookToTextureComponent::FEbookTextureLayout UEbookToTextureComponent::textureLayout() const
+{
+    FEbookTextureLayout layout;
+    layout.Width = mTextureWidth;
+    layout.Height = mTextureHeight;
+    layout.Pitch = mDataSqrtSize;
+    layout.PixelBytes = mPixelBytes;
+    layout.MipCount = mMipCount;
+    layout.BlockBytes = mBlockBytes;
+    layout.MipOffsets = mMipOffsets;
+    layout.BlockOffsets = mBlockOffsets;
+    layout.Halve = mGray ? pdfHalveGray : pdfHalveBGRA;
+    layout.Encode = pdfEncodeBlocks;
+    return layout;
+}
+
+void UEbookToTextureComponent::preparePage(const FEbookTextureLayout& layout, uint8* pixels, uint8* mips, uint8* blocks, int width, int height, int oldWidth, int oldHeight)
+{
+    if (!pixels)
+        return;
+
+    width = FMath::Clamp(width, 0, layout.Width);
+    height = FMath::Clamp(height, 0, layout.Height);
+    // the mips and blocks have to cover the old page too, so it gets cleared out of them as well
+    int coverWidth = FMath::Max(width, oldWidth);
+    int coverHeight = FMath::Max(height, oldHeight);
+    if (coverWidth <= 0 || coverHeight <= 0)
+        return;
+
+    // out to the next whole block, which the edge blocks and the mips' odd last column read too
+    int clearWidth = FMath::Min(Align(coverWidth, 4), layout.Width);
+    int clearHeight = FMath::Min(Align(coverHeight, 4), layout.Height);
+    for (int row = 0; row < clearHeight; row++)
+    {
+        int from = (row < height) ? width : 0;
+        if (clearWidth > from)
+            memset(pixels + row * layout.Pitch + from * layout.PixelBytes, 0, (clearWidth - from) * layout.PixelBytes);
+    }
+
+    // compresses the top left of a level, only whole blocks, so the blocks along the edge take in a few more pixels
+    auto encode = [&](int level, const uint8* levelPixels, int pitch, int levelWidth, int levelHeight)
+    {
+        int fullWidth = FMath::Max(layout.Width >> level, 1);
+        int fullHeight = FMath::Max(layout.Height >> level, 1);
+        int blockPitch = ((fullWidth + 3) / 4) * layout.BlockBytes;
+        layout.Encode(layout.BlockBytes == 8 ? 0 : 1, levelPixels, FMath::Min(Align(levelWidth, 4), fullWidth),
+            FMath::Min(Align(levelHeight, 4), fullHeight), pitch, blocks + layout.BlockOffsets[level], blockPitch);
+    };
+
+    bool compressed = layout.BlockBytes && blocks && layout.Encode;
+    if (compressed)
+        encode(0, pixels, layout.Pitch, coverWidth, coverHeight);
+
+    if (layout.MipCount <= 1 || !mips || !layout.Halve)
+        return;
+
+    // each level is made from the one above it, so together they cost about a third of what the top level does
+    const uint8* source = pixels;
+    int sourcePitch = layout.Pitch;
+    for (int level = 1; level < layout.MipCount; level++)
+    {
+        int levelPitch = FMath::Max(layout.Width >> level, 1) * layout.PixelBytes;
+        uint8* levelData = mips + layout.MipOffsets[level - 1];
+        int levelWidth = levelSize(coverWidth, layout.Width, level);
+        int levelHeight = levelSize(coverHeight, layout.Height, level);
+
+        // an odd width would lose its last column when halved, so take one more source pixel where there is one
+        int sourceWidth = FMath::Min(levelWidth * 2, FMath::Max(layout.Width >> (level - 1), 1));
+        int sourceHeight = FMath::Min(levelHeight * 2, FMath::Max(layout.Height >> (level - 1), 1));
+        layout.Halve(source, sourceWidth, sourceHeight, sourcePitch, levelData, levelPitch);
+        if (compressed)
+            encode(level, levelData, levelPitch, levelWidth, levelHeight);
+
+        source = levelData;
+        sourcePitch = levelPitch;
+    }
+}
+
+// uploads the top left `width x height` (in top level pixels) of every mip level after the first, which preparePage
+// already made
+void UEbookToTextureComponent::UpdateMips(int width, int height)
+{
+    if (mMipCount <= 1 || !mMipColors || width <= 0 || height <= 0)
+        return;
+
+    for (int level = 1; level < mMipCount; level++)
+    {
+        int levelWidth = levelSize(width, mTextureWidth, level);
+        int levelHeight = levelSize(height, mTextureHeight, level);
+        if (mBlockBytes)
+        {
+            uploadBlocks(level, levelWidth, levelHeight);
+        }
+        else
+        {
+            FUpdateTextureRegion2D region(0, 0, 0, 0, levelWidth, levelHeight);
+            uploadRegions(level, 1, &region, FMath::Max(mTextureWidth >> level, 1) * mPixelBytes, mMipColors + mMipOffsets[level - 1]);
+        }
+    }
+}
+
+// uploads the blocks covering the top left `width x height` of a level, which preparePage already compressed
+void UEbookToTextureComponent::uploadBlocks(int level, int width, int height)
+{
+    int levelWidth = FMath::Max(mTextureWidth >> level, 1);
+    int levelHeight = FMath::Max(mTextureHeight >> level, 1);
+    width = FMath::Min(Align(width, 4), levelWidth);
+    height = FMath::Min(Align(height, 4), levelHeight);
+    if (!mBlockColors || width <= 0 || height <= 0)
+        return;
+
+    int blockPitch = ((levelWidth + 3) / 4) * mBlockBytes;
+    FUpdateTextureRegion2D region(0, 0, 0, 0, width, height);
+    uploadRegions(level, 1, &region, blockPitch, mBlockColors + mBlockOffsets[level]);
+}
+
+// the pixels are copied on their way, so they can be drawn over right after
+void UEbookToTextureComponent::uploadRegions(int level, uint32 regionCount, const FUpdateTextureRegion2D* regions, uint32 pitch, const uint8* pixels)
+{
+    if (UEbookSubsystem* books = getBooks())
+        books->UploadTextureRegions(mDynamicTexture, level, regionCount, regions, pitch, pixels);
+}
+
+// only uploads the part of the texture the new page covers, plus whatever the previous page covered that it doesn't
+// (which gets cleared first), rather than the whole thing
+void UEbookToTextureComponent::UpdateTextureRect(int width, int height, bool pageUploaded, bool prepared)
+{
+    if (!mDynamicTexture)
+        return;
+
+    width = FMath::Clamp(width, 0, mTextureWidth);
+    height = FMath::Clamp(height, 0, mTextureHeight);
+
+    // the mips have to cover the old page too, so it gets cleared out of them as well
+    int mipWidth = FMath::Max(width, mShownWidth);
+    int mipHeight = FMath::Max(height, mShownHeight);
+
+    // unless a background render did it already, what's around the new page is cleared, and the mips and blocks made,
+    // here. the regions to upload are what preparePage clears, out to the next whole block
+    if (!prepared)
+        preparePage(textureLayout(), mDynamicColors, mMipColors, mBlockColors, width, height, mShownWidth, mShownHeight);
+    int clearWidth = FMath::Min(Align(mipWidth, 4), mTextureWidth);
+    int clearHeight = FMath::Min(Align(mipHeight, 4), mTextureHeight);
+
+    FUpdateTextureRegion2D regions[3];
+    uint32 regionCount = 0;
+
+    if (width > 0 && height > 0 && !pageUploaded)
+        regions[regionCount++] = FUpdateTextureRegion2D(0, 0, 0, 0, width, height);
+
+    // to the right of the new page, all the way down
+    if (clearWidth > width && clearHeight > 0)
+        regions[regionCount++] = FUpdateTextureRegion2D(width, 0, width, 0, clearWidth - width, clearHeight);
+
+    // below the new page, the bit to the right of that was already done above
+    if (clearHeight > height && width > 0)
+        regions[regionCount++] = FUpdateTextureRegion2D(0, height, 0, height, width, clearHeight - height);
+
+    mShownWidth = width;
+    mShownHeight = height;
+
+    // compressed, it's one region covering both pages
+    if (mBlockBytes)
+        uploadBlocks(0, mipWidth, mipHeight);
+    else if (regionCount > 0)
+        uploadRegions(0, regionCount, regions, mDataSqrtSize, mDynamicColors);
+    UpdateMips(mipWidth, mipHeight);
     mDynamicMaterials[0]->SetTextureParameterValue("DynamicTextureParam", mDynamicTexture);
 }
 
+UEbookSubsystem* UEbookToTextureComponent::getBooks() const
+{
+    return GEngine ? GEngine->GetEngineSubsystem<UEbookSubsystem>() : nullptr;
+}
+
+void UEbookToTextureComponent::closeBook()
+{
+    // the job and the prefetcher are the book's, so they have to go first
+    endBandRender();
+    if (mPrefetcher)
+        pdfDestroyPrefetcher(mPrefetcher);
+    mPrefetcher = nullptr;
+
+    UEbookSubsystem* books = getBooks();
+    if (currentBook && books)
+    {
+        // whatever the book was using is only gone if nobody else has it open, the subsystem knows
+        DEC_MEMORY_STAT_BY(STAT_EBookMemory, books->CloseBook(currentBook));
+    }
+    currentBook = nullptr;
+    mStatsEnabled = false;
+    mShownPages = 0;
+}
+
 bool UEbookToTextureComponent::Open(FString FilePath)
 {
-    if (!pdfCreate)
+    return openBook(FilePath, false);
+}
+
+bool UEbookToTextureComponent::OpenAsync(FString FilePath)
+{
+    return openBook(FilePath, true);
+}
+
+// a handful of pages spread through the book (the first one included) all without any colour on them
+static bool isBookGray(Pdf_isPageGray isPageGray, Pdf* book, int pageCount)
+{
+    const int samples = FMath::Min(pageCount, 5);
+    if (!isPageGray || !book || samples <= 0)
         return false;
 
-    pdfDestroy(currentBook);
-    currentBook = nullptr;
+    for (int index = 0; index < samples; index++)
+    {
+        int isGray = 0;
+        if (!isPageGray(book, (int)((int64)index * pageCount / samples), &isGray) || !isGray)
+            return false;
+    }
+    return true;
+}
 
-    return !!pdfCreate(&currentBook, TCHAR_TO_ANSI(*FilePath));
+bool UEbookToTextureComponent::openBook(const FString& FilePath, bool lazily)
+{
+    UEbookSubsystem* books = getBooks();
+    if (!books || !dllHandle)
+        return false;
+
+    cancelAsyncPages();
+    closeBook();
+    mTiles.Empty();
+    mLastPage = INDEX_NONE;
+
+    // these only apply to books opened from here on
+    if (pdfSetStoreBudget)
+        pdfSetStoreBudget((size_t)FMath::Max(MuPDFCacheMegabytes, 0) * 1024 * 1024);
+    if (pdfSetMemoryLimit)
+        pdfSetMemoryLimit((size_t)FMath::Max(MuPDFMemoryLimitMegabytes, 0) * 1024 * 1024);
+    // reopening the same file at the same size is a no-op in the DLL, so this only costs something when it changes
+    if (pdfSetDiskCache)
+    {
+        if (DiskCacheMegabytes > 0)
+        {
+            FString path = DiskCachePath.IsEmpty() ? FPaths::ProjectSavedDir() / TEXT("EbookCache/pages.pack") : DiskCachePath;
+            path = FPaths::ConvertRelativePathToFull(path);
+            IFileManager::Get().MakeDirectory(*FPaths::GetPath(path), true);
+            pdfSetDiskCache(TCHAR_TO_ANSI(*path), (size_t)DiskCacheMegabytes * 1024 * 1024);
+        }
+        else
+        {
+            pdfSetDiskCache(nullptr, 0);
+        }
+    }
+
+    // opening a book some other component already has open is almost free, it's the same one
+    uint32 serial = ++mOpenSerial;
+    if (lazily)
+    {
+        TWeakObjectPtr<UEbookToTextureComponent> weakThis(this);
+        currentBook = books->OpenBook(FilePath, [weakThis, serial](int32 pageCount)
+        {
+            // comes from one of the DLL's threads
+            AsyncTask(ENamedThreads::GameThread, [weakThis, serial, pageCount]()
+            {
+                if (UEbookToTextureComponent* component = weakThis.Get())
+                    component->finishOpen(serial, pageCount);
+            });
+        });
+    }
+    else
+    {
+        currentBook = books->OpenBook(FilePath);
+    }
+    if (!currentBook)
+        return false;
+
+    // the book might be shared, so prefetching goes by this component's own layout, and only cancels its own
+    if (pdfCreatePrefetcher && pdfPrefetchLayout && pdfDestroyPrefetcher)
+        pdfCreatePrefetcher(currentBook, &mPrefetcher);
+
+    if (pdfSetCacheBudget)
+        pdfSetCacheBudget(currentBook, (size_t)FMath::Max(PageCacheMegabytes, 0) * 1024 * 1024);
+    if (pdfSetDisplayListCacheSize)
+        pdfSetDisplayListCacheSize(currentBook, FMath::Max(DisplayListCachePages, 0));
+
+    // Auto has to look at the pages, which for a lazily opened book waits until they're counted. till then it's colour,
+    // which is always right, just bigger
+    if (PageColor != EEbookPageColor::Auto)
+        setGray(PageColor == EEbookPageColor::Gray);
+    else if (lazily)
+        setGray(false);
+    else
+        setGray(isBookGray(pdfIsPageGray, currentBook, GetPageCount()));
+
+    return true;
+}
+
+void UEbookToTextureComponent::finishOpen(uint32 serial, int pageCount)
+{
+    // another book was opened (or this one closed) since
+    if (serial != mOpenSerial || !currentBook)
+        return;
+
+    if (PageColor == EEbookPageColor::Auto && pageCount > 0)
+        checkPageColorAsync(pageCount);
+
+    OnBookOpened.Broadcast(pageCount >= 0, pageCount);
+}
+
+bool UEbookToTextureComponent::canShowGray() const
+{
+    return TextureFormat == EEbookTextureFormat::Uncompressed && pdfGetPageFittedPixels && (!GenerateMips || pdfHalveGray);
+}
+
+void UEbookToTextureComponent::setGray(bool gray)
+{
+    gray = gray && canShowGray();
+    if (gray == mGray)
+        return;
+
+    // the buffers a background render writes into are about to be replaced
+    cancelAsyncPages();
+    mGray = gray;
+    SetupTexture();
+    UpdateTexture();
+
+    if (currentBook && mLastPage != INDEX_NONE)
+        requestPageAsync(mLastPage, mLastPageCount);
+}
+
+void UEbookToTextureComponent::checkPageColorAsync(int pageCount)
+{
+    Pdf* book = currentBook;
+    Pdf_isPageGray isPageGray = pdfIsPageGray;
+    uint32 serial = mOpenSerial;
+    TWeakObjectPtr<UEbookToTextureComponent> weakThis(this);
+
+    // the pages it looks at are loaded the same way showing them does, and kept, so the first page shown gets them for free
+    mColorCheck = Async(EAsyncExecution::ThreadPool, [=]()
+    {
+        bool gray = isBookGray(isPageGray, book, pageCount);
+        AsyncTask(ENamedThreads::GameThread, [=]()
+        {
+            if (UEbookToTextureComponent* component = weakThis.Get())
+                component->finishPageColor(serial, gray);
+        });
+    });
+}
+
+void UEbookToTextureComponent::finishPageColor(uint32 serial, bool gray)
+{
+    if (serial != mOpenSerial || !currentBook || PageColor != EEbookPageColor::Auto)
+        return;
+
+    setGray(gray);
+}
+
+int32 UEbookToTextureComponent::GetPageCount() const
+{
+    int pageCount = -1;
+    if (!currentBook || !pdfGetPageCount || !pdfGetPageCount(currentBook, &pageCount))
+        return -1;
+    return pageCount;
+}
+
+TArray<FEbookOutlineEntry> UEbookToTextureComponent::GetOutline() const
+{
+    TArray<FEbookOutlineEntry> outline;
+    if (!currentBook || !pdfGetOutlineEntry)
+        return outline;
+
+    char title[512];
+    int depth;
+    int page;
+    for (int index = 0; pdfGetOutlineEntry(currentBook, index, &depth, &page, title, sizeof(title)); index++)
+    {
+        FEbookOutlineEntry& entry = outline.AddDefaulted_GetRef();
+        entry.Title = UTF8_TO_TCHAR(title);
+        entry.Depth = depth;
+        entry.Page = page;
+    }
+    return outline;
 }
 
 bool UEbookToTextureComponent::updatePage(int pageNumber, int pageCount)
@@ -210,36 +747,706 @@ bool UEbookToTextureComponent::updatePage(int pageNumber, int pageCount)
     if (!currentBook)
         return false;
 
+    // anything still rendering in the background is now out of date
+    newRequestSerial();
+    mHasQueuedRequest = false;
+
+    mLastPage = pageNumber;
+    mLastPageCount = pageCount;
+
     int resultingWidth;
     int resultingHeight;
+    int shownPages = pageCount;
+    int format = mGray ? PDF_FORMAT_GRAY : PDF_FORMAT_BGRA;
 
-    if (pageCount == 1)
+    if (pageCount == 1 || !pdfGetSpreadPixels)
     {
-        if (!pdfGetPageFittedBGRA(currentBook, pageNumber, mTextureWidth, mTextureHeight, &resultingWidth, &resultingHeight, mDynamicColors))
+        if (!pdfGetPageFittedPixels(currentBook, pageNumber, pageCount, format, renderWidth(), renderHeight(), &resultingWidth, &resultingHeight, mDynamicColors, mDataSqrtSize))
             return false;
     }
-    else 
+    else
     {
-        if (!pdfGet2PagesFittedBGRA(currentBook, pageNumber, mTextureWidth, mTextureHeight, &resultingWidth, &resultingHeight, mDynamicColors))
+        if (!pdfGetSpreadPixels(currentBook, pageNumber, format, renderWidth(), renderHeight(), &resultingWidth, &resultingHeight, mDynamicColors, mDataSqrtSize, &shownPages))
             return false;
     }
 
+    mShownPages = shownPages;
+    mShownDivisor = mRenderDivisor;
+    showRenderedPage(pageNumber, resultingWidth, resultingHeight);
+    return true;
+}
+
+void UEbookToTextureComponent::showRenderedPage(int pageNumber, int resultingWidth, int resultingHeight, bool pageUploaded, bool prepared)
+{
+    showRenderedArea(resultingWidth, resultingHeight, pageUploaded, prepared);
+
+    // get the neighbouring pages ready while the user is looking at this one
+    if (PrefetchRadius <= 0 || !mPrefetchAllowed)
+        return;
+    if (mPrefetcher)
+    {
+        int format = mGray ? PDF_FORMAT_GRAY : PDF_FORMAT_BGRA;
+        int width = FMath::Max(mTextureWidth / mShownDivisor, 1);
+        int height = FMath::Max(mTextureHeight / mShownDivisor, 1);
+        pdfPrefetchLayout(mPrefetcher, pageNumber, mLastPageCount, pdfGetSpreadPixels != nullptr, format, width, height, PrefetchRadius);
+    }
+    else if (pdfPrefetch)
+    {
+        pdfPrefetch(currentBook, pageNumber, PrefetchRadius);
+    }
+}
+
+void UEbookToTextureComponent::showRenderedArea(int resultingWidth, int resultingHeight, bool pageUploaded, bool prepared)
+{
     // adjust uv to fit resultingWidth and Height
     float u = resultingWidth / (float)mTextureWidth;
     float v = resultingHeight / (float)mTextureHeight;
     mDynamicMaterials[0]->SetScalarParameterValue("ScaleX", u);
     mDynamicMaterials[0]->SetScalarParameterValue("ScaleY", v);
 
-    UpdateTexture();
+    UpdateTextureRect(resultingWidth, resultingHeight, pageUploaded, prepared);
+}
+
+bool UEbookToTextureComponent::requestPageAsync(int pageNumber, int pageCount)
+{
+    if (!currentBook || !mPendingColors)
+        return false;
+
+    // only the latest request matters, anything queued before it is simply replaced
+    newRequestSerial();
+    mLastPage = pageNumber;
+    mLastPageCount = pageCount;
+    mQueuedPage = pageNumber;
+    mQueuedPageCount = pageCount;
+    mHasQueuedRequest = true;
+
+    if (usesBands())
+        return startBandRender(pageNumber, pageCount);
+
+    if (!mAsyncBusy)
+        startAsyncPage();
+
     return true;
 }
 
+void UEbookToTextureComponent::startAsyncPage()
+{
+    mHasQueuedRequest = false;
+    mAsyncBusy = true;
+    mInFlightSerial = mRequestSerial;
+    mInFlightDivisor = mRenderDivisor;
+
+    Pdf* book = currentBook;
+    uint8* buffer = mPendingColors;
+    uint8* bufferMips = mPendingMipColors;
+    uint8* bufferBlocks = mPendingBlockColors;
+    uint8* previewBuffer = mPreviewColors;
+    uint8* previewMips = mPreviewMipColors;
+    uint8* previewBlocks = mPreviewBlockColors;
+    FEbookTextureLayout layout = textureLayout();
+    FIntPoint pendingExtent = mPendingExtent;
+    FIntPoint previewExtent = mPreviewExtent;
+    uint32 serial = mRequestSerial;
+    int pageNumber = mQueuedPage;
+    int pageCount = mQueuedPageCount;
+    int width = renderWidth();
+    int height = renderHeight();
+    int format = mGray ? PDF_FORMAT_GRAY : PDF_FORMAT_BGRA;
+    int stride = mDataSqrtSize;
+    Pdf_getPageFittedPixels render = pdfGetPageFittedPixels;
+    Pdf_getSpreadPixels renderSpread = (mQueuedPageCount == 1) ? nullptr : pdfGetSpreadPixels;
+    // a spread is previewed as whatever it really is, a double page spread on its own
+    Pdf_getPreviewPixels preview = (ProgressiveRendering && previewBuffer && !renderSpread) ? pdfGetPreviewPixels : nullptr;
+    Pdf_getSpreadPreviewPixels previewSpread = (ProgressiveRendering && previewBuffer && renderSpread) ? pdfGetSpreadPreviewPixels : nullptr;
+    TSharedRef<FThreadSafeCounter, ESPMode::ThreadSafe> latestSerial = mLatestSerial;
+    TWeakObjectPtr<UEbookToTextureComponent> weakThis(this);
+
+    // whatever gets drawn, even if it's thrown away, might be left in them
+    mPendingExtent = mPendingExtent.ComponentMax(FIntPoint(width, height));
+    if (preview || previewSpread)
+        mPreviewExtent = mPreviewExtent.ComponentMax(FIntPoint(width, height));
+
+    // the mips and blocks are made here too, so the game thread only has to upload them
+    mAsyncRender = Async(EAsyncExecution::ThreadPool, [=]()
+    {
+        auto finish = [=](bool success, int resultingWidth, int resultingHeight, bool fromPreview, int shownPages)
+        {
+            AsyncTask(ENamedThreads::GameThread, [=]()
+            {
+                if (UEbookToTextureComponent* component = weakThis.Get())
+                    component->finishAsyncPage(serial, pageNumber, success, resultingWidth, resultingHeight, fromPreview, shownPages);
+            });
+        };
+
+        int resultingWidth = 0;
+        int resultingHeight = 0;
+
+        // a quarter size render is a sixteenth of the work, so it's up almost right away
+        if (preview || previewSpread)
+        {
+            int isFinal = 0;
+            int previewPages = pageCount;
+            bool previewed = previewSpread
+                ? !!previewSpread(book, pageNumber, format, width, height, &resultingWidth, &resultingHeight, previewBuffer, stride, &isFinal, &previewPages)
+                : !!preview(book, pageNumber, pageCount, format, width, height, &resultingWidth, &resultingHeight, previewBuffer, stride, &isFinal);
+            if (previewed)
+            {
+                preparePage(layout, previewBuffer, previewMips, previewBlocks, resultingWidth, resultingHeight, previewExtent.X, previewExtent.Y);
+
+                // it was in the cache, nothing more to do
+                if (isFinal)
+                {
+                    finish(true, resultingWidth, resultingHeight, true, previewPages);
+                    return;
+                }
+
+                AsyncTask(ENamedThreads::GameThread, [=]()
+                {
+                    if (UEbookToTextureComponent* component = weakThis.Get())
+                        component->showAsyncPreview(serial, resultingWidth, resultingHeight);
+                });
+            }
+
+            // the user already flipped on, don't bother with the full thing
+            if ((uint32)latestSerial->GetValue() != serial)
+            {
+                finish(false, 0, 0, false, 0);
+                return;
+            }
+        }
+
+        int shownPages = pageCount;
+        bool success = renderSpread
+            ? !!renderSpread(book, pageNumber, format, width, height, &resultingWidth, &resultingHeight, buffer, stride, &shownPages)
+            : !!render(book, pageNumber, pageCount, format, width, height, &resultingWidth, &resultingHeight, buffer, stride);
+        if (success)
+            preparePage(layout, buffer, bufferMips, bufferBlocks, resultingWidth, resultingHeight, pendingExtent.X, pendingExtent.Y);
+        finish(success, resultingWidth, resultingHeight, false, shownPages);
+    });
+}
+
+void UEbookToTextureComponent::showAsyncPreview(uint32 serial, int resultingWidth, int resultingHeight)
+{
+    if (!mAsyncBusy || serial != mInFlightSerial || serial != mRequestSerial)
+        return;
+
+    // no prefetching yet, that'd only slow down the full resolution render
+    swapInPage(true);
+    showRenderedArea(resultingWidth, resultingHeight, false, true);
+}
+
+void UEbookToTextureComponent::swapInPage(bool fromPreview)
+{
+    Swap(mDynamicColors, fromPreview ? mPreviewColors : mPendingColors);
+    Swap(mMipColors, fromPreview ? mPreviewMipColors : mPendingMipColors);
+    Swap(mBlockColors, fromPreview ? mPreviewBlockColors : mPendingBlockColors);
+    // what was shown goes back to be drawn over, it's blank outside of its page
+    (fromPreview ? mPreviewExtent : mPendingExtent) = FIntPoint(mShownWidth, mShownHeight);
+}
+
+void UEbookToTextureComponent::finishAsyncPage(uint32 serial, int pageNumber, bool success, int resultingWidth, int resultingHeight, bool fromPreview, int shownPages, bool pageUploaded)
+{
+    // left over from before a cancel
+    if (!mAsyncBusy || serial != mInFlightSerial)
+        return;
+
+    mAsyncBusy = false;
+
+    // something newer was asked for in the meantime, so this one is thrown away
+    if (serial != mRequestSerial)
+    {
+        if (mHasQueuedRequest)
+            startAsyncPage();
+        return;
+    }
+
+    if (success)
+    {
+        // a band render's bands are the new page now, there's nothing to put back
+        mBandRows = 0;
+        mBandWidth = 0;
+        swapInPage(fromPreview);
+        mShownPages = shownPages;
+        mShownDivisor = mInFlightDivisor;
+        showRenderedPage(pageNumber, resultingWidth, resultingHeight, pageUploaded, true);
+    }
+
+    OnPageReady.Broadcast(pageNumber, success);
+}
+
+void UEbookToTextureComponent::cancelAsyncPages()
+{
+    // the DLL call can't be interrupted, so wait it out, its result is ignored thanks to the serial
+    newRequestSerial();
+    mHasQueuedRequest = false;
+    if (mAsyncRender.IsValid())
+        mAsyncRender.Wait();
+    mAsyncBusy = false;
+
+    // same for an atlas
+    mAtlasSerial++;
+    if (mAtlasRender.IsValid())
+        mAtlasRender.Wait();
+
+    // and for Auto's look at the pages, which the serial of the open takes care of
+    if (mColorCheck.IsValid())
+        mColorCheck.Wait();
+}
+
+void UEbookToTextureComponent::newRequestSerial()
+{
+    mRequestSerial++;
+    mLatestSerial->Set((int32)mRequestSerial);
+    // a page that's being drawn a band at a time is simply dropped, that doesn't wait for anything
+    endBandRender();
+}
+
+bool UEbookToTextureComponent::usesBands() const
+{
+    return pdfBeginRender && pdfContinueRender && pdfEndRender && (mScheduler.IsValid() || FrameBudgetMs > 0);
+}
+
+bool UEbookToTextureComponent::startBandRender(int pageNumber, int pageCount)
+{
+    mHasQueuedRequest = false;
+
+    // a background render from before FrameBudgetMs was turned on is still writing into mPendingColors, it's
+    // ignored anyway thanks to the serial
+    if (mAsyncBusy && mAsyncRender.IsValid())
+        mAsyncRender.Wait();
+    mAsyncBusy = false;
+
+    int format = mGray ? PDF_FORMAT_GRAY : PDF_FORMAT_BGRA;
+    if (!pdfBeginRender(currentBook, pageNumber, pageCount, format, renderWidth(), renderHeight(), mPendingColors, mDataSqrtSize, &mBandJob))
+        return false;
+    mBandOldExtent = mPendingExtent;
+    mPendingExtent = mPendingExtent.ComponentMax(FIntPoint(renderWidth(), renderHeight()));
+    // TickComponent (or the scheduler) takes it from here
+    mBandPage = pageNumber;
+    mBandDivisor = mRenderDivisor;
+    mBandRows = 0;
+    mBandWidth = 0;
+    return true;
+}
+
+// draws the next few rows of the page for up to `budgetMicroseconds`, and shows them. once it's all there its mips and
+// blocks are made in the background, and it's swapped in like a background render is. returns about how many bytes
+// that sent to the GPU
+int64 UEbookToTextureComponent::continueBandRender(int budgetMicroseconds)
+{
+    if (!mBandJob)
+        return 0;
+
+    int64 uploaded = 0;
+    FPdfRenderProgress progress;
+    bool success = !!pdfContinueRender(mBandJob, budgetMicroseconds, &progress);
+    if (success && progress.RowsDone > progress.FirstRow)
+    {
+        // the first rows are where the page's size is known. a compressed texture keeps the old page up (at its own
+        // size) until the new one is all there
+        if (progress.FirstRow == 0 && !mBlockBytes)
+        {
+            mDynamicMaterials[0]->SetScalarParameterValue("ScaleX", progress.ResultingWidth / (float)mTextureWidth);
+            mDynamicMaterials[0]->SetScalarParameterValue("ScaleY", progress.ResultingHeight / (float)mTextureHeight);
+        }
+        uploaded += uploadBand(progress.FirstRow, progress.RowsDone, progress.ResultingWidth);
+    }
+    if (success && !progress.Done)
+        return uploaded;
+
+    int pageNumber = mBandPage;
+    // failed, endBandRender puts the old page back
+    if (!success)
+    {
+        endBandRender();
+        OnPageReady.Broadcast(pageNumber, false);
+        return uploaded;
+    }
+
+    // done, the bands stay, and the mips and blocks are made in the background like they are for a background render.
+    // if something else is asked for before they're ready, endBandRender still puts the old page back
+    pdfEndRender(mBandJob);
+    mBandJob = nullptr;
+    mAsyncBusy = true;
+    mInFlightSerial = mRequestSerial;
+    mInFlightDivisor = mBandDivisor;
+
+    uint8* buffer = mPendingColors;
+    uint8* bufferMips = mPendingMipColors;
+    uint8* bufferBlocks = mPendingBlockColors;
+    FEbookTextureLayout layout = textureLayout();
+    FIntPoint oldExtent = mBandOldExtent;
+    uint32 serial = mRequestSerial;
+    bool pageUploaded = mBlockBytes == 0;
+    TWeakObjectPtr<UEbookToTextureComponent> weakThis(this);
+    mAsyncRender = Async(EAsyncExecution::ThreadPool, [=]()
+    {
+        preparePage(layout, buffer, bufferMips, bufferBlocks, progress.ResultingWidth, progress.ResultingHeight, oldExtent.X, oldExtent.Y);
+        AsyncTask(ENamedThreads::GameThread, [=]()
+        {
+            if (UEbookToTextureComponent* component = weakThis.Get())
+                component->finishAsyncPage(serial, pageNumber, true, progress.ResultingWidth, progress.ResultingHeight, false, progress.ShownPages, pageUploaded);
+        });
+    });
+
+    // what's left to send, once they're made, is the mips (about a third of the page), or all of it when it's compressed
+    int64 pageBytes = (int64)progress.ResultingWidth * progress.ResultingHeight;
+    uploaded += mBlockBytes ? pageBytes * mBlockBytes / 16 * 4 / 3 : pageBytes * mPixelBytes / 3;
+    return uploaded;
+}
+
+void UEbookToTextureComponent::endBandRender()
+{
+    if (mBandJob)
+        pdfEndRender(mBandJob);
+    mBandJob = nullptr;
+
+    // a page that was dropped (or failed) part way leaves its bands in the texture, over the old page, which is still
+    // what mDynamicColors and the mips have, so that's put back
+    if (mBandRows > 0 && mDynamicTexture && mDynamicColors)
+    {
+        // whatever mDynamicColors has outside of the old page is left over from some page before it, the texture is
+        // blank there
+        for (int row = 0; row < mBandRows; row++)
+        {
+            int from = (row < mShownHeight) ? mShownWidth : 0;
+            if (mBandWidth > from)
+                memset(mDynamicColors + row * mDataSqrtSize + from * mPixelBytes, 0, (mBandWidth - from) * mPixelBytes);
+        }
+        FUpdateTextureRegion2D region(0, 0, 0, 0, mBandWidth, mBandRows);
+        uploadRegions(0, 1, &region, mDataSqrtSize, mDynamicColors);
+        showRenderedArea(mShownWidth, mShownHeight, true);
+    }
+    mBandRows = 0;
+    mBandWidth = 0;
+}
+
+// uploads rows `firstRow` up to `lastRow` of the page being drawn, as wide as the previous page was too, so they cover
+// it completely. compressed textures can only take whole blocks, so they get the whole page once it's done instead
+int64 UEbookToTextureComponent::uploadBand(int firstRow, int lastRow, int width)
+{
+    if (!mDynamicTexture || mBlockBytes)
+        return 0;
+
+    width = FMath::Clamp(width, 0, mTextureWidth);
+    lastRow = FMath::Min(lastRow, mTextureHeight);
+    int bandWidth = FMath::Max(width, mShownWidth);
+    if (bandWidth <= 0 || lastRow <= firstRow)
+        return 0;
+
+    for (int row = firstRow; row < lastRow; row++)
+        memset(mPendingColors + row * mDataSqrtSize + width * mPixelBytes, 0, (bandWidth - width) * mPixelBytes);
+
+    FUpdateTextureRegion2D region(0, firstRow, 0, firstRow, bandWidth, lastRow - firstRow);
+    uploadRegions(0, 1, &region, mDataSqrtSize, mPendingColors);
+    mBandRows = FMath::Max(mBandRows, lastRow);
+    mBandWidth = FMath::Max(mBandWidth, bandWidth);
+    return (int64)bandWidth * (lastRow - firstRow) * mPixelBytes;
+}
+
+void UEbookToTextureComponent::SetRenderDivisor(int divisor)
+{
+    mRenderDivisor = FMath::Max(divisor, 1);
+
+    // only redrawn to make it sharper, a book that moved away keeps what it has until its next page. nor while a page is
+    // still on its way, the scheduler comes back to it next frame anyway
+    if (mRenderDivisor < mShownDivisor && currentBook && mLastPage != INDEX_NONE && !mBandJob && !mAsyncBusy)
+        requestPageAsync(mLastPage, mLastPageCount);
+}
+
 bool UEbookToTextureComponent::ShowPage(int Page)
 {
+    mLastInteraction = FPlatformTime::Seconds();
     return updatePage(Page, 1);
 }
 
+int32 UEbookToTextureComponent::GetShownPageCount() const
+{
+    return mShownPages;
+}
+
 bool UEbookToTextureComponent::Show2Pages(int StartPage)
 {
+    mLastInteraction = FPlatformTime::Seconds();
     return updatePage(StartPage, 2);
 }
+
+bool UEbookToTextureComponent::ShowPageAsync(int Page)
+{
+    mLastInteraction = FPlatformTime::Seconds();
+    return requestPageAsync(Page, 1);
+}
+
+bool UEbookToTextureComponent::Show2PagesAsync(int StartPage)
+{
+    mLastInteraction = FPlatformTime::Seconds();
+    return requestPageAsync(StartPage, 2);
+}
+
+
+int32 UEbookToTextureComponent::findTile(int pageNumber, float zoom, int x, int y) const
+{
+    for (int32 index = 0; index < mTiles.Num(); index++)
+    {
+        const FEbookTile& tile = mTiles[index];
+        if (tile.Page == pageNumber && tile.Zoom == zoom && tile.Size == TileSize && tile.X == x && tile.Y == y)
+            return index;
+    }
+    return INDEX_NONE;
+}
+
+// reuses the least recently used tile once there are MaxCachedTiles of them, but never one that's in use right now
+int32 UEbookToTextureComponent::newTile(int pageNumber, float zoom, int x, int y)
+{
+    int32 index = INDEX_NONE;
+
+    if (mTiles.Num() >= FMath::Max(MaxCachedTiles, 1))
+    {
+        for (int32 candidate = 0; candidate < mTiles.Num(); candidate++)
+        {
+            if (mTiles[candidate].LastUsed < mTileClock && (index == INDEX_NONE || mTiles[candidate].LastUsed < mTiles[index].LastUsed))
+                index = candidate;
+        }
+    }
+    if (index == INDEX_NONE)
+        index = mTiles.AddDefaulted();
+
+    FEbookTile& tile = mTiles[index];
+    tile.Page = pageNumber;
+    tile.Zoom = zoom;
+    tile.Size = TileSize;
+    tile.X = x;
+    tile.Y = y;
+    tile.LastUsed = mTileClock;
+    tile.Pixels.SetNumUninitialized(TileSize * TileSize * 4);
+    return index;
+}
+
+bool UEbookToTextureComponent::ShowPageRegion(int Page, float Zoom, float CenterX, float CenterY)
+{
+    if (!currentBook || !pdfGetPageSize || !pdfRenderTile || !mDynamicColors || Zoom <= 0 || TileSize <= 0)
+        return false;
+
+    float pageWidth;
+    float pageHeight;
+    if (!pdfGetPageSize(currentBook, Page, &pageWidth, &pageHeight))
+        return false;
+
+    // anything still rendering in the background is now out of date
+    newRequestSerial();
+    mHasQueuedRequest = false;
+    mLastInteraction = FPlatformTime::Seconds();
+    // the tiles are always drawn at the full zoom, so there's nothing for the scheduler to make sharper
+    mShownDivisor = 1;
+
+    // the part of the zoomed page the texture shows
+    int zoomedWidth = FMath::CeilToInt(pageWidth * Zoom);
+    int zoomedHeight = FMath::CeilToInt(pageHeight * Zoom);
+    int shownWidth = FMath::Min(zoomedWidth, mTextureWidth);
+    int shownHeight = FMath::Min(zoomedHeight, mTextureHeight);
+    int originX = FMath::Clamp(FMath::RoundToInt(CenterX * zoomedWidth - shownWidth * 0.5f), 0, zoomedWidth - shownWidth);
+    int originY = FMath::Clamp(FMath::RoundToInt(CenterY * zoomedHeight - shownHeight * 0.5f), 0, zoomedHeight - shownHeight);
+    if (shownWidth <= 0 || shownHeight <= 0)
+        return false;
+
+    // mark everything under the window as in use first, so making room for the missing ones can't throw them out
+    mTileClock++;
+    TArray<int32> visible;
+    TArray<int32> missing;
+    for (int tileY = originY / TileSize; tileY <= (originY + shownHeight - 1) / TileSize; tileY++)
+    {
+        for (int tileX = originX / TileSize; tileX <= (originX + shownWidth - 1) / TileSize; tileX++)
+        {
+            int32 index = findTile(Page, Zoom, tileX * TileSize, tileY * TileSize);
+            if (index != INDEX_NONE)
+                mTiles[index].LastUsed = mTileClock;
+            visible.Add(index);
+        }
+    }
+    int32 visibleIndex = 0;
+    for (int tileY = originY / TileSize; tileY <= (originY + shownHeight - 1) / TileSize; tileY++)
+    {
+        for (int tileX = originX / TileSize; tileX <= (originX + shownWidth - 1) / TileSize; tileX++, visibleIndex++)
+        {
+            if (visible[visibleIndex] == INDEX_NONE)
+            {
+                visible[visibleIndex] = newTile(Page, Zoom, tileX * TileSize, tileY * TileSize);
+                missing.Add(visible[visibleIndex]);
+            }
+        }
+    }
+
+    // the DLL is happy to render several tiles of the same page at once
+    Pdf* book = currentBook;
+    Pdf_renderTile render = pdfRenderTile;
+    TArray<bool> rendered;
+    rendered.Init(false, missing.Num());
+    ParallelFor(missing.Num(), [&](int32 index)
+    {
+        FEbookTile& tile = mTiles[missing[index]];
+        rendered[index] = !!render(book, tile.Page, tile.Zoom, tile.X, tile.Y, tile.Size, tile.Size, tile.Pixels.GetData(), tile.Size * 4);
+    });
+
+    bool success = true;
+    for (int32 index = 0; index < missing.Num(); index++)
+    {
+        if (!rendered[index])
+        {
+            mTiles[missing[index]].Page = INDEX_NONE;
+            success = false;
+        }
+    }
+    if (!success)
+        return false;
+
+    // copy the visible bit of each tile into place
+    for (int32 index : visible)
+    {
+        const FEbookTile& tile = mTiles[index];
+        int left = FMath::Max(tile.X, originX);
+        int top = FMath::Max(tile.Y, originY);
+        int right = FMath::Min(tile.X + tile.Size, originX + shownWidth);
+        int bottom = FMath::Min(tile.Y + tile.Size, originY + shownHeight);
+
+        for (int y = top; y < bottom; y++)
+        {
+            uint8* to = mDynamicColors + (y - originY) * mDataSqrtSize + (left - originX) * mPixelBytes;
+            const uint8* from = tile.Pixels.GetData() + ((y - tile.Y) * tile.Size + (left - tile.X)) * 4;
+            if (!mGray)
+            {
+                memcpy(to, from, (right - left) * 4);
+                continue;
+            }
+            // tiles are always BGRA, a gray book's pixels are the same in all three, so green will do
+            for (int x = 0; x < right - left; x++)
+                to[x] = from[x * 4 + 1];
+        }
+    }
+
+    showRenderedArea(shownWidth, shownHeight);
+    return true;
+}
+
+bool UEbookToTextureComponent::layoutAtlas(int firstPage, int pageCount, int columns, int thumbnailWidth, int thumbnailHeight, TArray<FPdfAtlasPage>& pages, int& atlasWidth, int& atlasHeight) const
+{
+    if (!currentBook || !pdfRenderAtlasBGRA || firstPage < 0 || columns <= 0 || thumbnailWidth <= 0 || thumbnailHeight <= 0)
+        return false;
+
+    // don't go past the end of the book, if it's been counted yet
+    int bookPages = GetPageCount();
+    if (bookPages >= 0)
+        pageCount = FMath::Min(pageCount, bookPages - firstPage);
+    if (pageCount <= 0)
+        return false;
+
+    columns = FMath::Min(columns, pageCount);
+    int rows = (pageCount + columns - 1) / columns;
+    atlasWidth = columns * thumbnailWidth;
+    atlasHeight = rows * thumbnailHeight;
+    if (atlasWidth > (int)GetMax2DTextureDimension() || atlasHeight > (int)GetMax2DTextureDimension())
+        return false;
+
+    pages.SetNumZeroed(pageCount);
+    for (int index = 0; index < pageCount; index++)
+    {
+        pages[index].PageNumber = firstPage + index;
+        pages[index].X = (index % columns) * thumbnailWidth;
+        pages[index].Y = (index / columns) * thumbnailHeight;
+        pages[index].Width = thumbnailWidth;
+        pages[index].Height = thumbnailHeight;
+    }
+    return true;
+}
+
+UTexture2D* UEbookToTextureComponent::makeAtlasTexture(const TArray<uint8>& pixels, const TArray<FPdfAtlasPage>& pages, int atlasWidth, int atlasHeight)
+{
+    UTexture2D* atlas = UTexture2D::CreateTransient(atlasWidth, atlasHeight, PF_B8G8R8A8);
+    if (!atlas)
+        return nullptr;
+    atlas->CompressionSettings = TextureCompressionSettings::TC_VectorDisplacementmap;
+    atlas->SRGB = 0;
+    atlas->Filter = TextureFilter::TF_Bilinear;
+
+    FTexture2DMipMap& mip = atlas->GetPlatformData()->Mips[0];
+    void* data = mip.BulkData.Lock(LOCK_READ_WRITE);
+    FMemory::Memcpy(data, pixels.GetData(), pixels.Num());
+    mip.BulkData.Unlock();
+    atlas->UpdateResource();
+
+    mAtlasTexture = atlas;
+    mAtlasPages = pages;
+    mAtlasWidth = atlasWidth;
+    mAtlasHeight = atlasHeight;
+    return atlas;
+}
+
+UTexture2D* UEbookToTextureComponent::BuildPageAtlas(int32 FirstPage, int32 PageCount, int32 Columns, int32 ThumbnailWidth, int32 ThumbnailHeight)
+{
+    TArray<FPdfAtlasPage> pages;
+    int atlasWidth, atlasHeight;
+    if (!layoutAtlas(FirstPage, PageCount, Columns, ThumbnailWidth, ThumbnailHeight, pages, atlasWidth, atlasHeight))
+        return nullptr;
+
+    // whatever is still being built in the background is out of date now
+    mAtlasSerial++;
+
+    // anything a page doesn't cover stays transparent
+    TArray<uint8> pixels;
+    pixels.SetNumZeroed(atlasWidth * atlasHeight * 4);
+    pdfRenderAtlasBGRA(currentBook, pages.GetData(), pages.Num(), pixels.GetData(), atlasWidth * 4, atlasHeight);
+
+    // an atlas with a page or two missing is still better than none
+    return makeAtlasTexture(pixels, pages, atlasWidth, atlasHeight);
+}
+
+bool UEbookToTextureComponent::BuildPageAtlasAsync(int32 FirstPage, int32 PageCount, int32 Columns, int32 ThumbnailWidth, int32 ThumbnailHeight)
+{
+    TArray<FPdfAtlasPage> pages;
+    int atlasWidth, atlasHeight;
+    if (!layoutAtlas(FirstPage, PageCount, Columns, ThumbnailWidth, ThumbnailHeight, pages, atlasWidth, atlasHeight))
+        return false;
+
+    // only one at a time, the one before it has the workers busy anyway
+    uint32 serial = ++mAtlasSerial;
+    if (mAtlasRender.IsValid())
+        mAtlasRender.Wait();
+
+    Pdf* book = currentBook;
+    Pdf_renderAtlasBGRA render = pdfRenderAtlasBGRA;
+    TWeakObjectPtr<UEbookToTextureComponent> weakThis(this);
+
+    mAtlasRender = Async(EAsyncExecution::ThreadPool, [=]() mutable
+    {
+        TArray<uint8> pixels;
+        pixels.SetNumZeroed(atlasWidth * atlasHeight * 4);
+        bool success = !!render(book, pages.GetData(), pages.Num(), pixels.GetData(), atlasWidth * 4, atlasHeight);
+
+        AsyncTask(ENamedThreads::GameThread, [=, pixels = MoveTemp(pixels)]()
+        {
+            if (UEbookToTextureComponent* component = weakThis.Get())
+                component->finishAsyncAtlas(serial, pixels, pages, atlasWidth, atlasHeight, success);
+        });
+    });
+    return true;
+}
+
+void UEbookToTextureComponent::finishAsyncAtlas(uint32 serial, const TArray<uint8>& pixels, const TArray<FPdfAtlasPage>& pages, int atlasWidth, int atlasHeight, bool success)
+{
+    // something newer was asked for, or the book was closed
+    if (serial != mAtlasSerial)
+        return;
+
+    UTexture2D* atlas = makeAtlasTexture(pixels, pages, atlasWidth, atlasHeight);
+    OnPageAtlasReady.Broadcast(atlas, success && atlas != nullptr);
+}
+
+bool UEbookToTextureComponent::GetAtlasPageUV(int32 Index, FVector2D& UVMin, FVector2D& UVMax) const
+{
+    if (!mAtlasTexture || !mAtlasPages.IsValidIndex(Index) || !mAtlasPages[Index].Success)
+        return false;
+
+    const FPdfAtlasPage& page = mAtlasPages[Index];
+    UVMin = FVector2D(page.X / (float)mAtlasWidth, page.Y / (float)mAtlasHeight);
+    UVMax = FVector2D((page.X + page.ResultingWidth) / (float)mAtlasWidth, (page.Y + page.ResultingHeight) / (float)mAtlasHeight);
+    return true;
+}
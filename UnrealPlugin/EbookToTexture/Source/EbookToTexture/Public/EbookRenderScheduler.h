@@ -0,0 +1,57 @@
+// Copyright 2023 Dirk de la Hunt
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "EbookRenderScheduler.generated.h"
+
+class UEbookToTextureComponent;
+
+// decides for all the books in a world how sharp their pages are drawn, and when. every frame the books are ranked by
+// whether they're on screen, how big they are on it, and how recently somebody turned one of their pages. each one gets
+// its pages drawn about as big as it shows up on screen (in halvings of its texture), and the pages they're waiting for
+// are drawn a band at a time on the game thread, best ranked first, until the frame's CPU or upload budget runs out.
+// components join in BeginPlay, unless UseRenderScheduler is off. the budgets can go in the [/Script/EbookToTexture.EbookRenderScheduler]
+// section of DefaultGame.ini
+UCLASS(config = Game)
+class EBOOKTOTEXTURE_API UEbookRenderScheduler : public UTickableWorldSubsystem
+{
+    GENERATED_BODY()
+
+public:
+    virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+    virtual void Tick(float DeltaTime) override;
+    virtual TStatId GetStatId() const override;
+
+    void Register(UEbookToTextureComponent* Book);
+    void Unregister(UEbookToTextureComponent* Book);
+
+    // how long all books together may spend drawing pages on the game thread each frame
+    UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        float FrameBudgetMs = 4;
+    // and how much of them they may send to the GPU each frame. the last book to go over it still gets its band uploaded
+    UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 UploadBudgetKilobytes = 4096;
+    // a book somebody turned a page of this recently counts as being read, and goes before ones that are merely in view
+    UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        float InteractionSeconds = 5;
+    // pages are never drawn smaller than their texture divided by this, which is also what books out of view get
+    UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 MaxResolutionDivisor = 8;
+    // only this many of the best ranked books get their neighbouring pages rendered ahead of time
+    UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 PrefetchingBooks = 2;
+
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        int32 GetScheduledBookCount() const { return mBooks.Num(); }
+
+protected:
+    struct FScheduledBook
+    {
+        TWeakObjectPtr<UEbookToTextureComponent> Book;
+        float Priority = 0;
+    };
+
+    TArray<FScheduledBook> mBooks;
+};
@@ -0,0 +1,103 @@
+// Copyright 2023 Dirk de la Hunt
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/EngineSubsystem.h"
+#include "Engine/Texture2D.h"
+#include "EbookSubsystem.generated.h"
+
+// "stat EBook" in the console, the components fill in most of it, the uploads are timed in here
+DECLARE_STATS_GROUP(TEXT("EBook"), STATGROUP_EBook, STATCAT_Advanced);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Texture upload"), STAT_EBookUpload, STATGROUP_EBook, );
+
+typedef struct Pdf Pdf;
+
+typedef int(__cdecl* Pdf_create)(Pdf **newPdf, const char *filePath);
+typedef int(__cdecl* Pdf_destroy)(Pdf *pdf);
+typedef long long(__cdecl* Pdf_streamRead)(void *user, unsigned char *buffer, size_t size);
+typedef long long(__cdecl* Pdf_streamSeek)(void *user, long long offset, int whence);
+typedef void(__cdecl* Pdf_streamClose)(void *user);
+typedef int(__cdecl* Pdf_getPageCount)(Pdf *pdf, int *pageCount);
+typedef void(__cdecl* Pdf_opened)(void *user, Pdf *pdf, int pageCount);
+typedef int(__cdecl* Pdf_createLazy)(Pdf **newPdf, const char *filePath, Pdf_opened callback, void *user);
+typedef int(__cdecl* Pdf_createFromStream)(Pdf **newPdf, const char *name, Pdf_streamRead read, Pdf_streamSeek seek, Pdf_streamClose close, void *user);
+
+// loads the helper DLL once for the whole process, and keeps track of the books that are open, so every component showing
+// the same file shares one parsed document (and its caches) rather than opening it again. the sharing itself happens in the
+// DLL, Pdf_create hands out the same Pdf for the same file, this just keeps the books that are shared counted once.
+UCLASS()
+class EBOOKTOTEXTURE_API UEbookSubsystem : public UEngineSubsystem
+{
+    GENERATED_BODY()
+
+public:
+    virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+    virtual void Deinitialize() override;
+
+    // nullptr if the DLL couldn't be loaded
+    void* GetDllHandle() const { return dllHandle; }
+
+    // files on disk are opened (and memory mapped) by the DLL itself, anything only Unreal can see, like files in a pak,
+    // is read through Unreal's file system as MuPDF asks for it. every book that's returned needs a CloseBook, which
+    // returns how much memory (as last reported) went away with it.
+    // with OnCounted the book is opened lazily: this returns right away, the first page drawn opens it, and OnCounted gets
+    // the page count (or -1 if it couldn't be opened) from a background thread once it's been counted. only files on disk
+    // can be opened lazily, one that has to be read through Unreal is opened and counted before this returns, and
+    // OnCounted is called right away, on the calling thread
+    Pdf* OpenBook(const FString& FilePath, TFunction<void(int32)> OnCounted = nullptr);
+    int64 CloseBook(Pdf* Book);
+    // takes what the DLL says the book is using, and returns how much that changed since it was last told, so the memory
+    // stat goes up by what the book uses once, no matter how many components report it
+    int64 ReportBookMemory(Pdf* Book, int64 Bytes);
+
+    // how many different books are open, and how many components have them open
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        int32 GetOpenBookCount() const { return mBooks.Num(); }
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        int32 GetBookUserCount() const;
+
+    // sends `Regions` of `SrcData` to one mip level of the texture. they're copied into a staging buffer first, which the
+    // render thread uploads from, so `SrcData` can be drawn over as soon as this returns. a staging buffer is only used
+    // again once the upload from it is done, and they're shared by all components, so once there are enough of them
+    // to go round, uploading doesn't allocate anything. compressed textures take their regions in whole blocks
+    void UploadTextureRegions(UTexture2D* Texture, int32 MipIndex, uint32 NumRegions, const FUpdateTextureRegion2D* Regions, uint32 SrcPitch, const uint8* SrcData);
+
+    // a transient page texture with `MipCount` levels, all there and on the GPU. one that was handed back with the same
+    // size, format and levels is given out again rather than making a new one, so whatever was on it is still there.
+    // nothing else holds on to it, so the caller has to keep it referenced until it's handed back
+    UTexture2D* AcquirePageTexture(int32 Width, int32 Height, EPixelFormat Format, int32 MipCount);
+    void ReleasePageTexture(UTexture2D* Texture);
+
+    // how many staging buffers there are, and how many textures are waiting to be used again
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        int32 GetStagingBufferCount() const { return mStaging.Num(); }
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        int32 GetPooledTextureCount() const { return mFreeTextures.Num(); }
+
+protected:
+    struct FOpenBook
+    {
+        int32 Users = 0;
+        int64 ReportedBytes = 0;
+    };
+
+    void* dllHandle = nullptr;
+    Pdf_create pdfCreate = nullptr;
+    Pdf_destroy pdfDestroy = nullptr;
+    Pdf_createFromStream pdfCreateFromStream = nullptr;
+    Pdf_createLazy pdfCreateLazy = nullptr;
+    Pdf_getPageCount pdfGetPageCount = nullptr;
+
+    TMap<Pdf*, FOpenBook> mBooks;
+
+    // see EbookSubsystem.cpp
+    struct FStagingBuffer;
+    FStagingBuffer* acquireStaging(int64 bytes);
+    void freeStaging();
+
+    TArray<FStagingBuffer*> mStaging;
+    int32 mStagingCursor = 0;
+    UPROPERTY(Transient)
+        TArray<UTexture2D*> mFreeTextures;
+};
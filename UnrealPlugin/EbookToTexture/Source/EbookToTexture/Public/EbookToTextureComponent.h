@@ -6,14 +6,131 @@
 #include "Components/ActorComponent.h"
 #include "Engine/Texture2D.h"
 #include "Rendering/Texture2DResource.h"
+#include "Async/Future.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "EbookSubsystem.h"
+#include "EbookRenderScheduler.h"
 #include "EbookToTextureComponent.generated.h"
 
-typedef struct Pdf Pdf;
+// has to match PdfStats in the helper DLL's mupdf2rgb.h
+struct FPdfStats
+{
+    struct
+    {
+        int64 Count;
+        int64 Microseconds;
+    } Phases[5];            // load page, run page, draw, convert, copy
+    int64 Counters[6];      // page cache hits, misses, display list cache hits, misses, disk cache hits, misses
+    int64 BytesAllocated;
+    int64 PeakBytesAllocated;
+    int64 Allocations;
+};
+
+// has to match PdfAtlasPage in the helper DLL's mupdf2rgb.h
+struct FPdfAtlasPage
+{
+    int32 PageNumber;
+    int32 X;
+    int32 Y;
+    int32 Width;
+    int32 Height;
+    int32 ResultingWidth;
+    int32 ResultingHeight;
+    int32 Success;
+};
+
+// has to match PdfRenderProgress in the helper DLL's mupdf2rgb.h
+struct FPdfRenderProgress
+{
+    int32 ResultingWidth;
+    int32 ResultingHeight;
+    int32 ShownPages;
+    int32 FirstRow;
+    int32 RowsDone;
+    int32 Errors;
+    int32 Done;
+};
+
+// a page the DLL is drawing a band at a time, only ever handed back to it
+struct PdfRenderJob;
+// this component's prefetching of a book that might be shared, same
+struct PdfPrefetcher;
 
-typedef int(__cdecl* Pdf_create)(Pdf **newPdf, const char *filePath);
-typedef int(__cdecl* Pdf_destroy)(Pdf *pdf);
-typedef int(__cdecl* Pdf_getPageFittedBGRA)(Pdf *pdf, int pageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer);
-typedef int(__cdecl* Pdf_get2PagesFittedBGRA)(Pdf *pdf, int startPageNumber, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer);
+// the DLL's pixel formats, only the ones pages are shown as
+#define PDF_FORMAT_BGRA 0
+#define PDF_FORMAT_GRAY 3
+
+typedef int(__cdecl* Pdf_getPageFittedPixels)(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride);
+typedef int(__cdecl* Pdf_getSpreadPixels)(Pdf *pdf, int startPageNumber, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *shownPages);
+typedef int(__cdecl* Pdf_prefetch)(Pdf *pdf, int pageNumber, int radius);
+typedef int(__cdecl* Pdf_createPrefetcher)(Pdf *pdf, PdfPrefetcher **newPrefetcher);
+typedef int(__cdecl* Pdf_prefetchLayout)(PdfPrefetcher *prefetcher, int pageNumber, int pageCount, int spreads, int format, int availableWidth, int availableHeight, int radius);
+typedef int(__cdecl* Pdf_destroyPrefetcher)(PdfPrefetcher *prefetcher);
+typedef int(__cdecl* Pdf_setCacheBudget)(Pdf *pdf, size_t budgetBytes);
+typedef int(__cdecl* Pdf_setDisplayListCacheSize)(Pdf *pdf, int pages);
+typedef int(__cdecl* Pdf_getPreviewPixels)(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *isFinal);
+typedef int(__cdecl* Pdf_getSpreadPreviewPixels)(Pdf *pdf, int startPageNumber, int format, int availableWidth, int availableHeight, int *resultingWidth, int *resultingHeight, unsigned char *outBuffer, int outStride, int *isFinal, int *shownPages);
+typedef int(__cdecl* Pdf_isPageGray)(Pdf *pdf, int pageNumber, int *isGray);
+typedef int(__cdecl* Pdf_getPageSize)(Pdf *pdf, int pageNumber, float *width, float *height);
+typedef int(__cdecl* Pdf_setStoreBudget)(size_t bytes);
+typedef int(__cdecl* Pdf_setMemoryLimit)(size_t bytes);
+typedef int(__cdecl* Pdf_setDiskCache)(const char *path, size_t bytes);
+typedef int(__cdecl* Pdf_enableStats)(Pdf *pdf, int enabled);
+typedef int(__cdecl* Pdf_getStats)(Pdf *pdf, FPdfStats *outStats, int reset);
+typedef int(__cdecl* Pdf_halveBGRA)(const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride);
+typedef int(__cdecl* Pdf_halveGray)(const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride);
+typedef int(__cdecl* Pdf_renderTile)(Pdf *pdf, int pageNumber, float zoom, int tileX, int tileY, int tileWidth, int tileHeight, unsigned char *outBuffer, int outStride);
+typedef int(__cdecl* Pdf_renderAtlasBGRA)(Pdf *pdf, FPdfAtlasPage *pages, int pageCount, unsigned char *atlas, int atlasStride, int atlasHeight);
+typedef int(__cdecl* Pdf_beginRender)(Pdf *pdf, int pageNumber, int pageCount, int format, int availableWidth, int availableHeight, unsigned char *outBuffer, int outStride, PdfRenderJob **newJob);
+typedef int(__cdecl* Pdf_continueRender)(PdfRenderJob *job, int budgetMicroseconds, FPdfRenderProgress *progress);
+typedef int(__cdecl* Pdf_endRender)(PdfRenderJob *job);
+typedef int(__cdecl* Pdf_encodeBlocks)(int format, const unsigned char *src, int width, int height, int srcStride, unsigned char *dst, int dstStride);
+
+typedef int(__cdecl* Pdf_getOutlineEntry)(Pdf *pdf, int index, int *depth, int *pageNumber, char *title, int titleSize);
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FEbookPageReadySignature, int32, Page, bool, bSuccess);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FEbookOpenedSignature, bool, bSuccess, int32, PageCount);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FEbookAtlasReadySignature, UTexture2D*, Atlas, bool, bSuccess);
+
+// what the page texture is stored as on the GPU
+UENUM(BlueprintType)
+enum class EEbookTextureFormat : uint8
+{
+    // 4 bytes per pixel, exactly what was rendered
+    Uncompressed,
+    // half a byte per pixel, 8 times smaller, fine for black and white text, colours get a bit blocky
+    BC1,
+    // a byte per pixel, 4 times smaller, looks close to uncompressed, but takes about twice as long as BC1 to make
+    BC7,
+};
+
+// whether pages are drawn in colour, or in gray (a quarter of the memory, and of the time it takes to get them to the GPU)
+UENUM(BlueprintType)
+enum class EEbookPageColor : uint8
+{
+    Color,
+    // for books that are black and white anyway, anything coloured comes out gray
+    Gray,
+    // gray if a few pages spread through the book have no colour on them, colour otherwise. a colour cover counts, so
+    // pick Gray for books that are black and white apart from their cover
+    Auto,
+};
+
+// one entry of a book's table of contents, see GetOutline
+USTRUCT(BlueprintType)
+struct FEbookOutlineEntry
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "EBook")
+        FString Title;
+    // 0 for the top level, entries inside it come right after it with a bigger depth
+    UPROPERTY(BlueprintReadOnly, Category = "EBook")
+        int32 Depth = 0;
+    // -1 if it points somewhere outside of the book
+    UPROPERTY(BlueprintReadOnly, Category = "EBook")
+        int32 Page = -1;
+};
 
 
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
@@ -27,37 +144,262 @@ public:
 
 // dll stuff
 protected:
+    // both belong to the UEbookSubsystem, books are opened and closed through it so they can be shared
     void* dllHandle = nullptr;
     Pdf* currentBook = nullptr;
+    // belongs to this component, see Pdf_createPrefetcher, nullptr with a DLL that doesn't have them
+    PdfPrefetcher* mPrefetcher = nullptr;
+    UEbookSubsystem* getBooks() const;
+    void closeBook();
 
-    Pdf_create pdfCreate = nullptr;
-    Pdf_destroy pdfDestroy = nullptr;
-    Pdf_getPageFittedBGRA pdfGetPageFittedBGRA = nullptr;
-    Pdf_get2PagesFittedBGRA pdfGet2PagesFittedBGRA = nullptr;
+    Pdf_getPageFittedPixels pdfGetPageFittedPixels = nullptr;
+    Pdf_getSpreadPixels pdfGetSpreadPixels = nullptr;
+    Pdf_prefetch pdfPrefetch = nullptr;
+    Pdf_createPrefetcher pdfCreatePrefetcher = nullptr;
+    Pdf_prefetchLayout pdfPrefetchLayout = nullptr;
+    Pdf_destroyPrefetcher pdfDestroyPrefetcher = nullptr;
+    Pdf_setCacheBudget pdfSetCacheBudget = nullptr;
+    Pdf_getPreviewPixels pdfGetPreviewPixels = nullptr;
+    Pdf_getSpreadPreviewPixels pdfGetSpreadPreviewPixels = nullptr;
+    Pdf_isPageGray pdfIsPageGray = nullptr;
+    Pdf_setDisplayListCacheSize pdfSetDisplayListCacheSize = nullptr;
+    Pdf_getPageSize pdfGetPageSize = nullptr;
+    Pdf_renderTile pdfRenderTile = nullptr;
+    Pdf_halveBGRA pdfHalveBGRA = nullptr;
+    Pdf_halveGray pdfHalveGray = nullptr;
+    Pdf_enableStats pdfEnableStats = nullptr;
+    Pdf_setStoreBudget pdfSetStoreBudget = nullptr;
+    Pdf_setMemoryLimit pdfSetMemoryLimit = nullptr;
+    Pdf_setDiskCache pdfSetDiskCache = nullptr;
+    Pdf_getStats pdfGetStats = nullptr;
+    Pdf_getPageCount pdfGetPageCount = nullptr;
+    Pdf_getOutlineEntry pdfGetOutlineEntry = nullptr;
+    Pdf_encodeBlocks pdfEncodeBlocks = nullptr;
+    Pdf_renderAtlasBGRA pdfRenderAtlasBGRA = nullptr;
+    Pdf_beginRender pdfBeginRender = nullptr;
+    Pdf_continueRender pdfContinueRender = nullptr;
+    Pdf_endRender pdfEndRender = nullptr;
 
 // texture stuff
 protected:
     void SetupTexture();
     void UpdateTexture();
+    // with `pageUploaded`, the page itself is already on the GPU (see uploadBand), only the rest needs doing. with
+    // `prepared`, preparePage was already run on mDynamicColors (off the game thread), so it's only uploaded
+    void UpdateTextureRect(int width, int height, bool pageUploaded = false, bool prepared = false);
+    void UpdateMips(int width, int height);
+    void uploadBlocks(int level, int width, int height);
+    void uploadRegions(int level, uint32 regionCount, const FUpdateTextureRegion2D* regions, uint32 pitch, const uint8* pixels);
+
+    // everything preparePage needs to know about the texture, copied so a background render can use it
+    struct FEbookTextureLayout
+    {
+        int Width = 0;
+        int Height = 0;
+        int Pitch = 0;
+        int PixelBytes = 4;
+        int MipCount = 1;
+        int BlockBytes = 0;
+        TArray<uint32> MipOffsets;
+        TArray<uint32> BlockOffsets;
+        Pdf_halveBGRA Halve = nullptr;
+        Pdf_encodeBlocks Encode = nullptr;
+    };
+    FEbookTextureLayout textureLayout() const;
+    // clears `pixels` around a `width x height` page drawn into it, and makes its mips and blocks, over the area both the
+    // page and the `oldWidth x oldHeight` one that was there before cover. touches nothing but what it's handed, so it
+    // can run on any thread
+    static void preparePage(const FEbookTextureLayout& layout, uint8* pixels, uint8* mips, uint8* blocks, int width, int height, int oldWidth, int oldHeight);
 
     TArray<class UMaterialInstanceDynamic*> mDynamicMaterials;
-    UTexture2D* mDynamicTexture = nullptr;
-    FUpdateTextureRegion2D* mUpdateTextureRegion;
+    // comes from (and goes back to) the UEbookSubsystem's pool
+    UPROPERTY(Transient)
+        UTexture2D* mDynamicTexture = nullptr;
 
+    // the buffers below only ever grow, so switching between gray and colour doesn't reallocate them
     uint8* mDynamicColors = nullptr;
+    uint32 mColorCapacity = 0;
+    uint32 mMipCapacity = 0;
+    uint32 mBlockCapacity = 0;
+    // every mip level after the first, one after the other, each as wide as that level of the texture
+    uint8* mMipColors = nullptr;
+    TArray<uint32> mMipOffsets;
+    int mMipCount = 1;
     int mTextureWidth = 1024;
     int mTextureHeight = 1024;
 
+    // when the texture is compressed, everything is still drawn (and the mips made) as BGRA, and every level is
+    // compressed into here on its way to the GPU, one level after the other. 0 bytes per block means it isn't compressed
+    uint8* mBlockColors = nullptr;
+    TArray<uint32> mBlockOffsets;
+    int mBlockBytes = 0;
+
+    // a gray texture (G8) has everything, the pages, the mips, and the buffers behind them, a byte per pixel instead of 4
+    bool mGray = false;
+    int mPixelBytes = 4;
+
     uint32 mDataSize;
     uint32 mDataSqrtSize;
     uint32 mArraySize;
     uint32 mArrayRowSize;
 
+    // the area of the texture the currently shown page covers, anything outside of it is blank, in mDynamicColors and
+    // the mips and blocks made from it too
+    int mShownWidth = 0;
+    int mShownHeight = 0;
+
     UStaticMeshComponent* mStaticMeshComponent;
 
 // book stuff
 protected:
+    bool openBook(const FString& FilePath, bool lazily);
+    void finishOpen(uint32 serial, int pageCount);
+
+    // bumped on every open, so a lazy open that finishes after the next one started gets ignored
+    uint32 mOpenSerial = 0;
+
+    // PageColor, and whether it can be had at all
+    bool canShowGray() const;
+    // switches the texture between gray and colour, showing the last page asked for again in the new one
+    void setGray(bool gray);
+    void checkPageColorAsync(int pageCount);
+    void finishPageColor(uint32 serial, bool gray);
+    // for Auto, done once the book's pages are counted
+    TFuture<void> mColorCheck;
+    // what was asked for last, so it can be shown again when the texture changes
+    int mLastPage = INDEX_NONE;
+    int mLastPageCount = 1;
+    // pages are drawn this much smaller than the texture, see UEbookRenderScheduler, and the shown one was drawn at
+    // mShownDivisor. a book that isn't scheduled always draws them as big as the texture
+    int mRenderDivisor = 1;
+    int mShownDivisor = 1;
+    int renderWidth() const { return FMath::Max(mTextureWidth / mRenderDivisor, 1); }
+    int renderHeight() const { return FMath::Max(mTextureHeight / mRenderDivisor, 1); }
     bool updatePage(int pageNumber, int pageCount);
+    void showRenderedPage(int pageNumber, int resultingWidth, int resultingHeight, bool pageUploaded = false, bool prepared = false);
+    // how many pages the last Show2Pages(Async) actually showed, double page spreads are shown on their own
+    int mShownPages = 0;
+    void showRenderedArea(int resultingWidth, int resultingHeight, bool pageUploaded = false, bool prepared = false);
+
+// async stuff
+protected:
+    bool requestPageAsync(int pageNumber, int pageCount);
+    void startAsyncPage();
+    void showAsyncPreview(uint32 serial, int resultingWidth, int resultingHeight);
+    void finishAsyncPage(uint32 serial, int pageNumber, bool success, int resultingWidth, int resultingHeight, bool fromPreview, int shownPages, bool pageUploaded = false);
+    void cancelAsyncPages();
+    void newRequestSerial();
+
+    // the background render goes in here, and it's swapped with mDynamicColors once done. its mips and blocks are
+    // made alongside it, and swapped with mMipColors and mBlockColors, so all the game thread does is upload them
+    uint8* mPendingColors = nullptr;
+    uint8* mPendingMipColors = nullptr;
+    uint8* mPendingBlockColors = nullptr;
+    // same for the blurry preview that's shown while the background render is still busy
+    uint8* mPreviewColors = nullptr;
+    uint8* mPreviewMipColors = nullptr;
+    uint8* mPreviewBlockColors = nullptr;
+    // how much of mPendingColors and mPreviewColors (and their mips and blocks) might not be blank, like mShownWidth
+    // and mShownHeight are for mDynamicColors
+    FIntPoint mPendingExtent = FIntPoint::ZeroValue;
+    FIntPoint mPreviewExtent = FIntPoint::ZeroValue;
+    // puts the pending (or preview) buffers up in place of the shown ones
+    void swapInPage(bool fromPreview);
+    TFuture<void> mAsyncRender;
+    // bumped on every request, so a render that finishes after something newer was asked for gets ignored
+    uint32 mRequestSerial = 0;
+    // a copy of mRequestSerial the background render can look at, so it can skip the full render if it's no longer wanted
+    TSharedRef<FThreadSafeCounter, ESPMode::ThreadSafe> mLatestSerial = MakeShared<FThreadSafeCounter, ESPMode::ThreadSafe>();
+    uint32 mInFlightSerial = 0;
+    int mInFlightDivisor = 1;
+    bool mAsyncBusy = false;
+    bool mHasQueuedRequest = false;
+    int mQueuedPage = 0;
+    int mQueuedPageCount = 1;
+
+// band stuff
+protected:
+    // whether the async functions draw pages a band at a time (see FrameBudgetMs and UEbookRenderScheduler)
+    bool usesBands() const;
+    bool startBandRender(int pageNumber, int pageCount);
+    // returns roughly how many bytes that sent to the GPU
+    int64 continueBandRender(int budgetMicroseconds);
+    void endBandRender();
+    int64 uploadBand(int firstRow, int lastRow, int width);
+
+    // the page being drawn into mPendingColors a few rows a frame (see FrameBudgetMs), and which page that is
+    PdfRenderJob* mBandJob = nullptr;
+    int mBandPage = 0;
+    int mBandDivisor = 1;
+    // how much of the texture its bands have covered so far, which endBandRender puts back if it doesn't finish, or if
+    // something else is asked for before its mips and blocks are made
+    int mBandRows = 0;
+    int mBandWidth = 0;
+    // mPendingExtent from before the bands started drawing over it
+    FIntPoint mBandOldExtent = FIntPoint::ZeroValue;
+
+// scheduler stuff
+protected:
+    TWeakObjectPtr<UEbookRenderScheduler> mScheduler;
+    // when a page was last asked for from outside, in FPlatformTime::Seconds
+    double mLastInteraction = -1.0e9;
+    bool mPrefetchAllowed = true;
+
+public:
+    // for UEbookRenderScheduler
+    UStaticMeshComponent* GetPageMesh() const { return mStaticMeshComponent; }
+    int32 GetTextureWidth() const { return mTextureWidth; }
+    double GetLastInteractionTime() const { return mLastInteraction; }
+    bool HasPendingBands() const { return mBandJob != nullptr; }
+    // draws the page that's on its way for about `budgetMicroseconds`, returns roughly how many bytes that sent to the GPU
+    int64 RunBands(int budgetMicroseconds) { return continueBandRender(budgetMicroseconds); }
+    // pages are drawn at the texture's size divided by `divisor` from here on, and if that's sharper than the page that's
+    // shown, it's drawn again
+    void SetRenderDivisor(int divisor);
+    void SetPrefetchAllowed(bool allowed) { mPrefetchAllowed = allowed; }
+
+// tile stuff
+protected:
+    // one TileSize x TileSize square of a page drawn at some zoom, X and Y are its top left in pixels at that zoom
+    struct FEbookTile
+    {
+        int32 Page = INDEX_NONE;
+        float Zoom = 0;
+        int32 Size = 0;
+        int32 X = 0;
+        int32 Y = 0;
+        uint64 LastUsed = 0;
+        TArray<uint8> Pixels;
+    };
+
+    int32 findTile(int pageNumber, float zoom, int x, int y) const;
+    int32 newTile(int pageNumber, float zoom, int x, int y);
+
+    // rendered tiles are kept around (up to MaxCachedTiles of them) so panning only renders the newly uncovered ones
+    TArray<FEbookTile> mTiles;
+    uint64 mTileClock = 0;
+
+// atlas stuff
+protected:
+    bool layoutAtlas(int firstPage, int pageCount, int columns, int thumbnailWidth, int thumbnailHeight, TArray<FPdfAtlasPage>& pages, int& atlasWidth, int& atlasHeight) const;
+    UTexture2D* makeAtlasTexture(const TArray<uint8>& pixels, const TArray<FPdfAtlasPage>& pages, int atlasWidth, int atlasHeight);
+    void finishAsyncAtlas(uint32 serial, const TArray<uint8>& pixels, const TArray<FPdfAtlasPage>& pages, int atlasWidth, int atlasHeight, bool success);
+
+    // the last atlas built, and where each page ended up in it
+    UPROPERTY(Transient)
+        UTexture2D* mAtlasTexture = nullptr;
+    TArray<FPdfAtlasPage> mAtlasPages;
+    int mAtlasWidth = 0;
+    int mAtlasHeight = 0;
+    // bumped on every atlas request, so only the latest one asked for is kept
+    uint32 mAtlasSerial = 0;
+    TFuture<void> mAtlasRender;
+
+// stats stuff
+protected:
+    void reportStats();
+
+    bool mStatsEnabled = false;
 
 protected:
 	// Called when the game starts
@@ -68,11 +410,126 @@ public:
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
+public:
+    // how many pages (or pairs of pages) either side of the current one to render in the background
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 PrefetchRadius = 2;
+    // how much memory each open book may use to keep already rendered pages around, 0 disables it (and prefetching).
+    // components showing the same book share it, along with its caches, so this and the other per book settings are
+    // whatever the last of them to open it asked for
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 PageCacheMegabytes = 64;
+    // how much MuPDF may keep cached (decoded images, fonts) for the book, 0 for no limit. only read when a book is opened
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 MuPDFCacheMegabytes = 64;
+    // a limit on what MuPDF may use for all open books together (of all components, the last one to open a book wins), 0 for none
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 MuPDFMemoryLimitMegabytes = 0;
+    // keeps rendered pages on disk, so books opened again in a later session show up without being rendered again.
+    // 0 turns it off. it's one file for all components (the last one to open a book wins), and only one running game
+    // can use it at a time
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 DiskCacheMegabytes = 0;
+    // where the disk cache goes, empty means Saved/EbookCache/pages.pack
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        FString DiskCachePath;
+    // how many pages each open book keeps parsed, so showing them again at another size or layout skips the parsing
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 DisplayListCachePages = 32;
+    // ShowPageRegion renders the page in squares this big, and keeps up to MaxCachedTiles of them around
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 TileSize = 256;
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        int32 MaxCachedTiles = 64;
+    // gives the texture a full mip chain (made on the CPU whenever the page changes), so pages seen from far away don't shimmer.
+    // only read when the texture is set up, i.e., in BeginPlay
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        bool GenerateMips = true;
+    // compressing the texture saves a lot of video memory (and upload time) for a bit of CPU time, every time the page
+    // changes. only read when the texture is set up, i.e., in BeginPlay
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        EEbookTextureFormat TextureFormat = EEbookTextureFormat::Uncompressed;
+    // gray only works with an Uncompressed TextureFormat, the material has to take the gray from the texture's red
+    // channel (see the top of EbookToTextureComponent.cpp)
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        EEbookPageColor PageColor = EEbookPageColor::Color;
+    // times each step of rendering a page (in the DLL) and uploading it, for "stat EBook" and the CSV profiler
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        bool CollectStats = false;
+    // the async functions first show a quick low resolution version of the page, and then the real thing once it's done
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        bool ProgressiveRendering = true;
+    // above 0, the async functions draw the page on the game thread instead, a band of rows at a time, taking about this
+    // long each frame, and each band is shown as soon as it's done (the mips follow once the whole page is). for
+    // platforms that can't spare a thread for a whole page. the page is still parsed on one of the DLL's threads, as
+    // that can't be split up. a compressed TextureFormat only shows the page once it's all there. ignored for books
+    // that are scheduled (see UseRenderScheduler), the scheduler's budget goes for those
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        float FrameBudgetMs = 0;
+    // leaves when (and how sharp) pages are drawn to the world's UEbookRenderScheduler, along with every other book in it,
+    // which draws them a band at a time like FrameBudgetMs does, within its own budget. ShowPage and Show2Pages still
+    // draw right away, but at the size it picked. only read in BeginPlay
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "EBook")
+        bool UseRenderScheduler = true;
+
 public:
     UFUNCTION(BlueprintCallable, Category = "EBook")
         bool Open(FString FilePath);
+    // returns right away without even reading the file, the first page shown opens it, so use the async functions to
+    // keep that off the game thread. the pages are counted (and the outline loaded) in the background after that, and
+    // then OnBookOpened fires. only fails if the file doesn't exist.
+    // except for files only Unreal can see, e.g., ones in a pak: the DLL can't open those lazily, so they're opened (and
+    // counted) right here, on the game thread, like Open does, and OnBookOpened fires next frame
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        bool OpenAsync(FString FilePath);
+    UPROPERTY(BlueprintAssignable, Category = "EBook")
+        FEbookOpenedSignature OnBookOpened;
+
+    // -1 while OpenAsync is still counting
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        int32 GetPageCount() const;
+    // the book's table of contents, flattened, empty while OpenAsync is still counting
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        TArray<FEbookOutlineEntry> GetOutline() const;
     UFUNCTION(BlueprintCallable, Category = "EBook")
         bool ShowPage(int Page);
     UFUNCTION(BlueprintCallable, Category = "EBook")
         bool Show2Pages(int StartPage);
+
+    // renders in the background, the current page stays up until the new one is ready, and then OnPageReady fires.
+    // asking for another page before that replaces this request, only the last one asked for is shown.
+    // with ProgressiveRendering on, a blurry preview replaces the current page almost immediately, OnPageReady still
+    // only fires for the full resolution one.
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        bool ShowPageAsync(int Page);
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        bool Show2PagesAsync(int StartPage);
+    // 1 or 2 after Show2Pages, as a page that's a double page spread already is shown on its own (as is the last page),
+    // so the next spread starts at StartPage + GetShownPageCount(). 0 if nothing is shown yet
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        int32 GetShownPageCount() const;
+
+    UPROPERTY(BlueprintAssignable, Category = "EBook")
+        FEbookPageReadySignature OnPageReady;
+
+    // renders PageCount pages starting at FirstPage as thumbnails into a texture of their own, Columns of them across, for
+    // an overview or a carousel. each page is fitted into a ThumbnailWidth x ThumbnailHeight cell, at its top left, see
+    // GetAtlasPageUV for exactly where. the pages are rendered in parallel, but this still blocks until they're all done
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        UTexture2D* BuildPageAtlas(int32 FirstPage, int32 PageCount, int32 Columns, int32 ThumbnailWidth, int32 ThumbnailHeight);
+    // same, but in the background, OnPageAtlasReady fires once it's done. asking again before that replaces the request
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        bool BuildPageAtlasAsync(int32 FirstPage, int32 PageCount, int32 Columns, int32 ThumbnailWidth, int32 ThumbnailHeight);
+    UPROPERTY(BlueprintAssignable, Category = "EBook")
+        FEbookAtlasReadySignature OnPageAtlasReady;
+    // the part of the last atlas covered by its Index-th page (0 is FirstPage), false if it isn't there
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        bool GetAtlasPageUV(int32 Index, FVector2D& UVMin, FVector2D& UVMax) const;
+
+    // shows a texture sized window into the page drawn at Zoom (1 is 72dpi), for zooming in further than the texture
+    // could hold the whole page. CenterX and CenterY are where on the page (0 to 1) the middle of the window should be,
+    // the window is kept inside the page. only the tiles under the window are rendered, and only once, so panning
+    // around at the same zoom is cheap.
+    UFUNCTION(BlueprintCallable, Category = "EBook")
+        bool ShowPageRegion(int Page, float Zoom, float CenterX, float CenterY);
 };